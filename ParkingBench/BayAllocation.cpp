@@ -0,0 +1,118 @@
+/*
+Description:    Bay allocation benchmark. Cars enter and leave a car park kept at a fill level, each entering car taking
+                the free position with the smallest number. Positions are allocated with the bay allocator, and by
+                scanning a flag per position as the gate did before. The occupied positions are scattered, as they
+                are after cars left in any order
+Author:         Hanson
+File:           BayAllocation.cpp
+*/
+
+#include "Bench.h"
+
+const UINT			BAY_BATCH = 1000;				//Enters and leaves timed together, a single one is too short for the timer
+const UINT			BAY_BATCHES = 200;				//Batches of the allocator at each fill level
+const UINT			BAY_SCAN_BATCHES = 5;			//Batches of scans at each fill level. The positions with small numbers fill up,
+													//so a scan visits most of them
+const double		BAY_FILLS[] = { 0, 50, 90, 99, 99.9 };	//Fill levels in percent
+
+/*
+Description:    Find the free position with the smallest number by scanning the flags of the positions
+Args:			Used: Flag of each position, true if it's occupied
+Return:			The position, -1 if all positions are occupied
+*/
+static int IceScanBays(const vector<bool> &Used) {
+	for (UINT i = 0; i < Used.size(); i++) {
+		if (!Used[i])
+			return (int)i;
+	}
+	return -1;
+}
+
+/*
+Description:    Time the enters and leaves of a car park at a fill level. A car enters and takes a position, then a car
+				parking at a random position leaves, so the fill level stays the same
+Args:			Capacity: No. of positions
+				Fill: The fill level in percent
+				Scan: If the positions are allocated by scanning the flags, otherwise with the bay allocator
+				Random: Random number generator choosing the positions
+				Times: Vector to add the time taken by each batch to, in microseconds
+Return:			No. of allocations which didn't take the free position with the smallest number
+*/
+static UINT IceTimeBays(UINT Capacity, double Fill, bool Scan, mt19937 &Random, vector<double> &Times) {
+	IceBayAllocator	Bays;
+	vector<bool>	Used(Capacity);
+	vector<UINT>	Occupied(Capacity);
+	UINT			Target = (UINT)(Capacity * Fill / 100), Wrong = 0;
+
+	for (UINT i = 0; i < Capacity; i++)
+		Occupied[i] = i;
+	shuffle(Occupied.begin(), Occupied.end(), Random);
+	Occupied.resize(Target);
+	Bays.Reset(Capacity);
+	for (UINT i = 0; i < Target; i++) {
+		Bays.Claim(Occupied[i]);
+		Used[Occupied[i]] = true;
+	}
+
+	for (UINT b = 0; b < (Scan ? BAY_SCAN_BATCHES : BAY_BATCHES); b++) {
+		double	Start = IceBenchMicroseconds();
+		for (UINT i = 0; i < BAY_BATCH; i++) {
+			int		Bay = Scan ? IceScanBays(Used) : Bays.Allocate();
+			if (Bay < 0 || Used[Bay]) {																	//Full, or an occupied position
+				Wrong++;
+				break;
+			}
+			Used[Bay] = true;
+			Occupied.push_back((UINT)Bay);
+
+			UINT	Leaving = uniform_int_distribution<UINT>(0, (UINT)Occupied.size() - 1)(Random);
+			Bay = (int)Occupied[Leaving];
+			Used[Bay] = false;
+			if (!Scan)
+				Bays.Release((UINT)Bay);
+			Occupied[Leaving] = Occupied.back();
+			Occupied.pop_back();
+		}
+		Times.push_back(IceBenchMicroseconds() - Start);
+
+		if (!Scan) {																				//Check the allocator against the flags
+			int	First = IceScanBays(Used), Bay = Bays.Allocate();
+			if (Bay != First || Bays.GetFreeCount() != Capacity - Occupied.size() - (Bay >= 0))
+				Wrong++;
+			if (Bay >= 0)
+				Bays.Release((UINT)Bay);
+		}
+	}
+	return Wrong;
+}
+
+/*
+Description:    Time the allocation of positions at several fill levels, with the bay allocator and with a scan
+Args:			Capacity: No. of positions, PARKING_MIN_CAPACITY ~ PARKING_MAX_CAPACITY
+				Seed: Seed of the positions
+Return:			0 if every car takes the free position with the smallest number, 1 otherwise
+*/
+int IceRunBayAllocation(UINT Capacity, UINT Seed) {
+	mt19937	Random(Seed);
+	UINT	Wrong = 0;
+	char	Name[64];
+
+	if (Capacity < PARKING_MIN_CAPACITY || Capacity > PARKING_MAX_CAPACITY) {
+		printf("The capacity must be %u ~ %u\n", PARKING_MIN_CAPACITY, PARKING_MAX_CAPACITY);
+		return 1;
+	}
+	printf("%u positions\n", Capacity);
+	for (UINT i = 0; i < sizeof(BAY_FILLS) / sizeof(BAY_FILLS[0]); i++) {
+		vector<double>	Allocator, Scan;
+
+		Wrong += IceTimeBays(Capacity, BAY_FILLS[i], false, Random, Allocator);
+		Wrong += IceTimeBays(Capacity, BAY_FILLS[i], true, Random, Scan);
+		sprintf_s(Name, "%g%% full, allocator, 1000 per sample", BAY_FILLS[i]);
+		IcePrintPercentiles(Name, Allocator);
+		sprintf_s(Name, "%g%% full, scan, 1000 per sample", BAY_FILLS[i]);
+		IcePrintPercentiles(Name, Scan);
+	}
+	if (Wrong)
+		printf("%u allocations took a wrong position\n", Wrong);
+	return Wrong ? 1 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,243 @@
+/*
+Description:    Entry of the benchmarks and tests, and the helpers shared by them
+Author:         Hanson
+File:           Bench.cpp
+*/
+
+#include "Bench.h"
+
+/*
+Description:    The log files are used without the main window, so their prompts have no owner
+Return:			NULL
+*/
+HWND GetMainWindowHandle() {
+	return NULL;
+}
+
+/*
+Description:    Get the current time
+Return:			The time, see IceToEpoch()
+*/
+LONGLONG IceBenchNow() {
+	SYSTEMTIME	Time;
+
+	GetLocalTime(&Time);
+	return IceToEpoch(Time);
+}
+
+/*
+Description:    Delete a log file, and the journal, manifest, checkpoint, key, summary and damaged copy files named after it
+Args:			LogPath: Path of the log file
+*/
+void IceDeleteBenchFiles(const wstring &LogPath) {
+	const wchar_t	*Extensions[] = { L".jnl", L".mft", L".ckp", L".key", L".sum", L".bad" };
+	wstring			BasePath = LogPath.substr(0, LogPath.find_last_of(L'.'));
+
+	DeleteFileW(LogPath.c_str());
+	DeleteFileW((LogPath + L".tmp").c_str());
+	for (UINT i = 0; i < sizeof(Extensions) / sizeof(Extensions[0]); i++)
+		DeleteFileW((BasePath + Extensions[i]).c_str());
+}
+
+/*
+Description:    Create a log file with the default password and some records. A car enters every second,
+				and every other car has left an hour later
+Args:			LogPath: Path of the log file, replaced if it exists
+				Count: No. of records
+				From: Enter time of the first car, see IceToEpoch()
+Return:			true if succeed, false otherwise
+*/
+bool IceCreateBenchLog(const wstring &LogPath, UINT Count, LONGLONG From) {
+	wchar_t		Password[CIPHER_MAX_KEY], CarNumber[CAR_NUMBER_MAX + 1];
+
+	IceDeleteBenchFiles(LogPath);
+
+	IceEncryptedFile	File(LogPath.c_str());
+	lstrcpyW(Password, BENCH_PASSWORD);
+	if (File.WithoutFile || !File.ReadFile(Password))
+		return false;
+	File.FileContent.Capacity = max(Count, PARKING_MIN_CAPACITY);								//Every car has its own position
+	for (UINT i = 0; i < Count; i++) {
+		swprintf_s(CarNumber, L"B%07u", i);
+		if (!File.AddLog(CarNumber, From + i, i % 2 ? From + i + 3600 : 0, i, i % 2 ? 1000 : 0))
+			return false;
+	}
+	return File.SaveFile();
+}
+
+/*
+Description:    Get a record of a large log file, see IceCreateLargeBenchLog(). A car enters every second and leaves
+				an hour later, except every thousandth car, which is still parking at its own position
+Args:			Index: Index of the record
+				From: Enter time of the first car, see IceToEpoch()
+Return:			The record
+*/
+LogInfo IceBenchRecord(ULONGLONG Index, LONGLONG From) {
+	wchar_t		CarNumber[CAR_NUMBER_MAX + 1];
+	LogInfo		Info;
+
+	swprintf_s(CarNumber, L"B%07u", (UINT)(Index % 10000000));
+	Info.EnterTime = From + (LONGLONG)Index;
+	Info.LeaveTime = Index % 1000 ? Info.EnterTime + 3600 : 0;
+	Info.CarNumber = IcePackCarNumber(CarNumber);
+	Info.Fee = Index % 1000 ? 1000 : 0;
+	Info.CarPos = (UINT)(Index % 1000 ? Index % PARKING_MAX_CAPACITY : Index / 1000 % PARKING_MAX_CAPACITY);
+	return Info;
+}
+
+/*
+Description:    Create a log file of any size with the default password. The blocks are encoded and written
+				FILE_IO_CHUNK bytes at a time, so the records are never all in memory
+Args:			LogPath: Path of the log file, replaced if it exists
+				Count: No. of records, see IceBenchRecord()
+				From: Enter time of the first car, see IceToEpoch()
+Return:			true if succeed, false otherwise
+*/
+bool IceCreateLargeBenchLog(const wstring &LogPath, ULONGLONG Count, LONGLONG From) {
+	IceKeySchedule	Schedule;
+	HANDLE			hFile;
+	BYTE			Header[CHECK_BLOCK_SIZE];
+	LogInfo			Records[CHECK_BLOCK_RECORDS];
+	vector<BYTE>	Buffer(FILE_IO_CHUNK);
+	ULONGLONG		BlockCount = (Count + CHECK_BLOCK_RECORDS - 1) / CHECK_BLOCK_RECORDS;
+	const UINT		ChunkBlocks = FILE_IO_CHUNK / CHECK_BLOCK_SIZE;
+	DWORD			Written;
+	bool			Result;
+
+	IceDeleteBenchFiles(LogPath);
+	if (!IceExpandKey(BENCH_PASSWORD, Schedule))
+		return false;
+	hFile = CreateFileW(LogPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+	IceBuildRecordHeader(Header, BENCH_PASSWORD, Count, 10, PARKING_MAX_CAPACITY, 0, Schedule);
+	Result = WriteFile(hFile, Header, CHECK_BLOCK_SIZE, &Written, NULL) && Written == CHECK_BLOCK_SIZE;
+	for (ULONGLONG Block = 0; Result && Block < BlockCount; ) {
+		UINT	Blocks = (UINT)min(BlockCount - Block, (ULONGLONG)ChunkBlocks);
+		for (UINT i = 0; i < Blocks; i++) {
+			ULONGLONG	First = (Block + i) * CHECK_BLOCK_RECORDS;
+			UINT		InBlock = (UINT)min(Count - First, (ULONGLONG)CHECK_BLOCK_RECORDS);
+			for (UINT j = 0; j < InBlock; j++)
+				Records[j] = IceBenchRecord(First + j, From);
+			IceEncodeBlock(Buffer.data() + CHECK_BLOCK_SIZE * i, Records, InBlock, Schedule, IceRecordOffset(LOG_VERSION, First));
+		}
+		Result = WriteFile(hFile, Buffer.data(), CHECK_BLOCK_SIZE * Blocks, &Written, NULL) && Written == CHECK_BLOCK_SIZE * Blocks;
+		Block += Blocks;
+	}
+	CloseHandle(hFile);
+	return Result;
+}
+
+/*
+Description:    Get the peak memory used by the process so far
+Return:			The peak working set in bytes
+*/
+size_t IceBenchPeakMemory() {
+	PROCESS_MEMORY_COUNTERS	Counters = { sizeof(Counters) };
+
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &Counters, sizeof(Counters)))
+		return 0;
+	return Counters.PeakWorkingSetSize;
+}
+
+/*
+Description:    Get the time from a fixed point, for timing short operations
+Return:			The time in microseconds
+*/
+double IceBenchMicroseconds() {
+	LARGE_INTEGER	Counter, Frequency;
+
+	QueryPerformanceCounter(&Counter);
+	QueryPerformanceFrequency(&Frequency);
+	return (double)Counter.QuadPart * 1000000.0 / (double)Frequency.QuadPart;
+}
+
+/*
+Description:    Print the median, the tail percentiles and the max of some latencies
+Args:			Name: Name of the latencies
+				Samples: The latencies in microseconds, sorted by this function
+*/
+void IcePrintPercentiles(const char *Name, vector<double> &Samples) {
+	const double	Ranks[] = { 50, 90, 99, 99.9 };
+
+	if (Samples.empty()) {
+		printf("%s: no samples\n", Name);
+		return;
+	}
+	sort(Samples.begin(), Samples.end());
+	printf("%s: %u samples", Name, (UINT)Samples.size());
+	for (UINT i = 0; i < sizeof(Ranks) / sizeof(Ranks[0]); i++)
+		printf(", p%g %.2f", Ranks[i], Samples[min((size_t)(Samples.size() * Ranks[i] / 100), Samples.size() - 1)]);
+	printf(", max %.2f us\n", Samples.back());
+}
+
+/*
+Description:    Run a benchmark or test chosen by the first argument
+Args:			argc: No. of arguments
+				argv: The arguments: name of the benchmark or test, then its arguments
+Return:			0 if succeed, otherwise the benchmark or test failed
+*/
+int wmain(int argc, wchar_t *argv[]) {
+	UINT	Seed = argc > 2 ? (UINT)_wtoi(argv[2]) : BENCH_SEED;
+
+	if (argc > 1 && lstrcmpW(argv[1], L"faults") == 0)
+		return IceRunFaultInjection(Seed, argc > 3 ? (UINT)_wtoi(argv[3]) : 200);
+	if (argc > 1 && lstrcmpW(argv[1], L"gate") == 0)
+		return IceRunGateLatency(argc > 2 ? (UINT)_wtoi(argv[2]) : 1000000);
+	if (argc > 1 && lstrcmpW(argv[1], L"plates") == 0)
+		return IceRunPlateLookup(argc > 2 ? (UINT)_wtoi(argv[2]) : 100000, argc > 3 ? (UINT)_wtoi(argv[3]) : BENCH_SEED);
+	if (argc > 1 && lstrcmpW(argv[1], L"bays") == 0)
+		return IceRunBayAllocation(argc > 2 ? (UINT)_wtoi(argv[2]) : PARKING_MAX_CAPACITY, argc > 3 ? (UINT)_wtoi(argv[3]) : BENCH_SEED);
+	if (argc > 1 && lstrcmpW(argv[1], L"append") == 0)
+		return IceRunRecordAppend(argc > 2 ? (UINT)_wtoi(argv[2]) : 10000000);
+	if (argc > 1 && lstrcmpW(argv[1], L"seal") == 0)
+		return IceRunSealThroughput(argc > 2 ? (UINT)_wtoi(argv[2]) : 256);
+	if (argc > 1 && lstrcmpW(argv[1], L"stream") == 0)
+		return IceRunStreamReader(argc > 2 ? (UINT)_wtoi(argv[2]) : 5);
+	if (argc > 1 && lstrcmpW(argv[1], L"import") == 0)
+		return IceRunImportMemory(argc > 2 ? (UINT)_wtoi(argv[2]) : 5000000);
+	if (argc > 1 && lstrcmpW(argv[1], L"load") == 0)
+		return IceRunLoadTime(argc > 2 ? (UINT)_wtoi(argv[2]) : 2048, argc > 3 && lstrcmpW(argv[3], L"buffered") == 0);
+	if (argc > 1 && lstrcmpW(argv[1], L"exit") == 0)
+		return IceRunExitLatency(argc > 2 ? (UINT)_wtoi(argv[2]) : 10000000);
+	if (argc > 1 && lstrcmpW(argv[1], L"cipher") == 0)
+		return IceRunCipherThroughput(argc > 2 ? (UINT)_wtoi(argv[2]) : 256);
+	if (argc > 1 && lstrcmpW(argv[1], L"threads") == 0)
+		return IceRunLoadThreads(argc > 2 ? (UINT)_wtoi(argv[2]) : 1024);
+	if (argc > 1 && lstrcmpW(argv[1], L"commit") == 0)
+		return IceRunGroupCommit(argc > 2 ? (UINT)_wtoi(argv[2]) : 2000);
+	if (argc > 1 && lstrcmpW(argv[1], L"events") == 0)
+		return IceRunEventRate(argc > 2 ? (UINT)_wtoi(argv[2]) : 10000000);
+	if (argc > 1 && lstrcmpW(argv[1], L"large") == 0)
+		return IceRunLargeFile(argc > 2 ? (UINT)_wtoi(argv[2]) : 5);
+	if (argc > 1 && lstrcmpW(argv[1], L"export") == 0)
+		return IceRunExportThroughput(argc > 2 ? (UINT)_wtoi(argv[2]) : 5000000);
+	if (argc > 1 && lstrcmpW(argv[1], L"range") == 0)
+		return IceRunRangeScan(argc > 2 ? (UINT)_wtoi(argv[2]) : 10000000);
+	if (argc > 1 && lstrcmpW(argv[1], L"scrub") == 0)
+		return IceRunHistoryScrub(argc > 2 ? (UINT)_wtoi(argv[2]) : 10000000);
+	if (argc > 1 && lstrcmpW(argv[1], L"occupancy") == 0)
+		return IceRunOccupancyReplay(Seed, argc > 3 ? (UINT)_wtoi(argv[3]) : 200);
+
+	printf("Usage: ParkingBench <name> [args]\n"
+		"  faults [seed] [trials]    Truncate or corrupt a log file at random offsets and check the recovered records\n"
+		"  gate [records]            Time the gate events with and without a compaction job running\n"
+		"  plates [parked] [seed]    Time the lookups of car numbers among the parking cars, with the index and with a scan\n"
+		"  bays [capacity] [seed]    Time the allocation of positions at several fill levels, with the allocator and with a scan\n"
+		"  append [records]          Time the appends of records to the record store and to a vector\n"
+		"  seal [megabytes]          Time sealing, opening and hashing the blocks of a buffer with a derived key\n"
+		"  stream [gigabytes]        Stream a large log file with the record reader and check the memory stays bounded\n"
+		"  import [records]          Time the import of a CSV file into a log file, and report the peak memory\n"
+		"  load [megabytes] [mode]   Time the load of a log file and report the peak memory. Mode: mapped (default) or buffered\n"
+		"  exit [max records]        Time the exits of log files of 10,000 records up to max records, and the saves of the whole file\n"
+		"  cipher [megabytes]        Time the scalar, SSE2 and AVX2 kernels of the password cipher, and check them with the byte loop\n"
+		"  threads [megabytes]       Time the load of a log file with 1 up to 16 loader threads\n"
+		"  commit [events]           Time cars entering at 1 up to 16 gates at once, with and without group commit\n"
+		"  events [max records]      Time the gate events of log files of 1,000 records up to max records, with the journal and rewriting the file\n"
+		"  large [gigabytes]         Read back a log file past 4 GB, and check a sparse log file of more than 4G records\n"
+		"  export [records]          Time the exports of a log file as CSV and NDJSON with 1 up to 16 threads\n"
+		"  range [records]           Time the counts of the cars of some days with full scans and with ReadRange()\n"
+		"  scrub [records]           Time the history slider dragged across a day, with the interval index, the snapshots and scans\n"
+		"  occupancy [seed] [trials] Check the occupancy snapshots with scans, as random cars enter and leave\n");
+	return 2;
+}
\ No newline at end of file
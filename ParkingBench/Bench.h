@@ -0,0 +1,48 @@
+/*
+Description:    Benchmarks and fault injection tests of the log files, run from the console
+                without the windows of the system
+Author:         Hanson
+File:           Bench.h
+*/
+
+#include "FileManager.h"
+#include <cstdio>
+#include <random>
+#include <psapi.h>
+
+/* Bench constants */
+const wchar_t		BENCH_LOG_PATH[] = L"BenchLog.dat";	//Log file created by the benchmarks in the working directory
+const wchar_t		BENCH_PASSWORD[] = L"123";		//Password of the log files created by the benchmarks
+const UINT			BENCH_HOT_DAYS = 36500;			//Closed sessions stay in the log files of the benchmarks, unless a benchmark archives them
+const UINT			BENCH_SEED = 2019;				//Default seed of the random numbers, so every run tests the same cases
+
+/* Procedure declarations */
+LONGLONG IceBenchNow();																						//This retrieves the current time, see IceToEpoch()
+void IceDeleteBenchFiles(const wstring &LogPath);															//This deletes a log file and the files named after it
+bool IceCreateBenchLog(const wstring &LogPath, UINT Count, LONGLONG From);								//This creates a log file with some records
+LogInfo IceBenchRecord(ULONGLONG Index, LONGLONG From);														//This retrieves a record of a large log file
+bool IceCreateLargeBenchLog(const wstring &LogPath, ULONGLONG Count, LONGLONG From);						//This creates a log file of any size
+size_t IceBenchPeakMemory();																				//This retrieves the peak memory used by the process
+double IceBenchMicroseconds();																				//This retrieves the time from a fixed point in microseconds
+void IcePrintPercentiles(const char *Name, vector<double> &Samples);										//This prints the percentiles of some latencies
+
+/* Benchmarks and tests, return the exit code */
+int IceRunFaultInjection(UINT Seed, UINT Trials);
+int IceRunGateLatency(UINT Records);
+int IceRunPlateLookup(UINT Parked, UINT Seed);
+int IceRunBayAllocation(UINT Capacity, UINT Seed);
+int IceRunRecordAppend(UINT Records);
+int IceRunSealThroughput(UINT Megabytes);
+int IceRunStreamReader(UINT Gigabytes);
+int IceRunImportMemory(UINT Records);
+int IceRunLoadTime(UINT Megabytes, bool Buffered);
+int IceRunExitLatency(UINT MaxRecords);
+int IceRunCipherThroughput(UINT Megabytes);
+int IceRunLoadThreads(UINT Megabytes);
+int IceRunGroupCommit(UINT Events);
+int IceRunEventRate(UINT MaxRecords);
+int IceRunLargeFile(UINT Gigabytes);
+int IceRunExportThroughput(UINT Records);
+int IceRunRangeScan(UINT Records);
+int IceRunHistoryScrub(UINT Records);
+int IceRunOccupancyReplay(UINT Seed, UINT Trials);
\ No newline at end of file
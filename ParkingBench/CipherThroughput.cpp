@@ -0,0 +1,106 @@
+/*
+Description:    Cipher throughput benchmark. Encrypts a buffer with the password using the scalar, SSE2 and AVX2
+                kernels of IceCryptBlock(), and with the byte loop the files were encrypted with before the kernels.
+                Every kernel must give the same bytes as the byte loop, whatever the password and the offset
+Author:         Hanson
+File:           CipherThroughput.cpp
+*/
+
+#include "Bench.h"
+
+const UINT			CIPHER_ROUNDS = 3;				//Passes over the buffer, the fastest is reported
+const wchar_t		*CIPHER_PASSWORDS[] = { L"7", L"123", L"ParkingLot", L"TwentyCharsPassword!" };	//Passwords checked, 1 ~ CIPHER_MAX_KEY chars
+const char			*CIPHER_KERNELS[] = { "Scalar", "SSE2", "AVX2" };	//Names of the kernels, by level
+
+/*
+Description:    Encrypt or decrypt a piece of data as it was done before the kernels, one byte at a time
+Args:			Buffer: The data, processed in place
+				Length: Size of the data in bytes
+				Password: The password
+				Offset: Position of the first byte of Buffer in the file
+*/
+static void IceCryptLegacy(BYTE *Buffer, size_t Length, const wchar_t *Password, streamoff Offset) {
+	int		KeyLen = lstrlenW(Password);
+
+	for (size_t i = 0; i < Length; i++)
+		Buffer[i] ^= 487 ^ Password[(Offset + i) % KeyLen];
+}
+
+/*
+Description:    Check a kernel against the byte loop with every password, at odd offsets and lengths
+Args:			Level: Level of the kernel
+				Plain: Data to be encrypted
+Return:			No. of pieces encrypted differently
+*/
+static UINT IceCheckKernel(int Level, const vector<BYTE> &Plain) {
+	mt19937			Random(BENCH_SEED);
+	IceKeySchedule	Schedule;
+	vector<BYTE>	Expected(Plain.size()), Actual(Plain.size());
+	UINT			Failed = 0;
+
+	for (UINT i = 0; i < sizeof(CIPHER_PASSWORDS) / sizeof(CIPHER_PASSWORDS[0]); i++) {
+		IceExpandKey(CIPHER_PASSWORDS[i], Schedule);
+		for (UINT Piece = 0; Piece < 200; Piece++) {
+			size_t		Start = Random() % Plain.size();
+			size_t		Length = Random() % min(Plain.size() - Start, (size_t)4 * CIPHER_BLOCK * CIPHER_MAX_KEY) + 1;
+			streamoff	Offset = Random() % 1000000;
+
+			memcpy(Expected.data(), Plain.data() + Start, Length);
+			IceCryptLegacy(Expected.data(), Length, CIPHER_PASSWORDS[i], Offset);
+			IceCryptKernel(Actual.data(), Plain.data() + Start, Length, Schedule, Offset, Level);
+			if (memcmp(Actual.data(), Expected.data(), Length) != 0)
+				Failed++;
+		}
+	}
+	return Failed;
+}
+
+/*
+Description:    Time the kernels and the byte loop over a buffer
+Args:			Megabytes: Size of the buffer in MB
+Return:			0 if every kernel gives the bytes of the byte loop, 1 otherwise
+*/
+int IceRunCipherThroughput(UINT Megabytes) {
+	mt19937			Random(BENCH_SEED);
+	IceKeySchedule	Schedule;
+	size_t			Bytes = (size_t)Megabytes * 1048576;
+	UINT			Failed = 0;
+
+	if (Bytes == 0 || !IceExpandKey(BENCH_PASSWORD, Schedule)) {
+		printf("Failed to prepare the key\n");
+		return 1;
+	}
+
+	vector<BYTE>	Plain(Bytes), Expected(Bytes), Actual(Bytes);
+	for (size_t i = 0; i < Plain.size(); i++)
+		Plain[i] = (BYTE)Random();
+
+	double	LegacyTime = 0;
+	for (UINT Round = 0; Round < CIPHER_ROUNDS; Round++) {
+		memcpy(Expected.data(), Plain.data(), Bytes);
+		double	Start = IceBenchMicroseconds();
+		IceCryptLegacy(Expected.data(), Bytes, BENCH_PASSWORD, 0);
+		double	Time = IceBenchMicroseconds() - Start;
+		LegacyTime = Round ? min(LegacyTime, Time) : Time;
+	}
+	printf("%u MB, kernel in use: %s\n", Megabytes, CIPHER_KERNELS[CipherLevel]);
+	printf("Byte loop: %.2f GB/s\n", Bytes / LegacyTime / 1000.0);
+
+	for (int Level = CIPHER_SCALAR; Level <= CipherLevel; Level++) {
+		double	KernelTime = 0;
+		for (UINT Round = 0; Round < CIPHER_ROUNDS; Round++) {
+			double	Start = IceBenchMicroseconds();
+			IceCryptKernel(Actual.data(), Plain.data(), Bytes, Schedule, 0, Level);
+			double	Time = IceBenchMicroseconds() - Start;
+			KernelTime = Round ? min(KernelTime, Time) : Time;
+		}
+
+		UINT	Wrong = IceCheckKernel(Level, Plain) + (memcmp(Actual.data(), Expected.data(), Bytes) != 0 ? 1 : 0);
+		printf("%s: %.2f GB/s, %.1f times the byte loop%s\n", CIPHER_KERNELS[Level], Bytes / KernelTime / 1000.0,
+			LegacyTime / KernelTime, Wrong ? ", NOT the bytes of the byte loop" : "");
+		Failed += Wrong;
+	}
+	for (int Level = CipherLevel + 1; Level <= CIPHER_AVX2; Level++)
+		printf("%s: not supported by the CPU\n", CIPHER_KERNELS[Level]);
+	return Failed ? 1 : 0;
+}
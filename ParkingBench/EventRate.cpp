@@ -0,0 +1,96 @@
+/*
+Description:    Gate event benchmark. Cars enter and leave at the gate of log files from 1,000 records up to millions,
+                each event appending its record to the journal, and the same events are timed again rewriting the
+                whole log file as every event did before the journal. The journal should keep the events per second
+                the same whatever the size of the log file
+Author:         Hanson
+File:           EventRate.cpp
+*/
+
+#include "Bench.h"
+
+const UINT			EVENT_COUNT = 2000;				//Events appended to the journal per log file, less than JOURNAL_COMPACT_LIMIT
+const UINT			EVENT_REWRITES = 4;				//Events rewriting the whole log file per log file
+
+/*
+Description:    Let a car enter, or let the car entered by the last event leave
+Args:			File: The log file
+				Event: No. of the event. A car enters on even events, and leaves on the next one
+Return:			true if succeed, false otherwise
+*/
+static bool IceLogEvent(IceEncryptedFile &File, UINT Event) {
+	wchar_t		CarNumber[CAR_NUMBER_MAX + 1];
+
+	if (Event % 2 == 0) {
+		swprintf_s(CarNumber, L"E%07u", Event / 2);
+		return File.AddLog(CarNumber, IceBenchNow(), 0, (Event / 2) % File.FileContent.Capacity, 0);
+	}
+
+	UINT	Index = File.FileContent.ElementCount - 1;
+	LogInfo	&Info = File.FileContent.LogData[Index];
+	Info.LeaveTime = max(IceBenchNow(), Info.EnterTime);
+	Info.Fee = 500;
+	return File.UpdateLog(Index);
+}
+
+/*
+Description:    Time the events of a log file
+Args:			Records: No. of records of the log file
+Return:			true if succeed, false otherwise
+*/
+static bool IceTimeEvents(UINT Records) {
+	wchar_t		Password[CIPHER_MAX_KEY];
+	double		Start, Journal, Rewrite;
+	UINT		Event = 0;
+
+	if (!IceCreateLargeBenchLog(BENCH_LOG_PATH, Records, IceBenchNow() - Records)) {
+		printf("Failed to create the log file\n");
+		return false;
+	}
+
+	IceEncryptedFile	File(BENCH_LOG_PATH, false);												//Every record is written when it is added, not after the commit window
+	lstrcpyW(Password, BENCH_PASSWORD);
+	File.ArchiveHotDays = BENCH_HOT_DAYS;
+	if (!File.ReadFile(Password)) {
+		printf("Failed to read the log file\n");
+		return false;
+	}
+	Start = IceBenchMicroseconds();
+	for (UINT i = 0; i < EVENT_COUNT; i++) {
+		if (!IceLogEvent(File, Event++)) {
+			printf("Failed to log an event\n");
+			return false;
+		}
+	}
+	Journal = IceBenchMicroseconds() - Start;
+
+	Start = IceBenchMicroseconds();
+	for (UINT i = 0; i < EVENT_REWRITES; i++) {
+		File.FileContent.LogData.Append(IceBenchRecord(Records + i, IceBenchNow() - Records));	//As AddLog() did before the journal
+		File.FileContent.ElementCount++;
+		if (!File.SaveFile()) {
+			printf("Failed to save the log file\n");
+			return false;
+		}
+	}
+	Rewrite = IceBenchMicroseconds() - Start;
+
+	printf("%8u records: %.0f events/s appended to the journal, %.1f events/s rewriting the log file (%.0f times slower)\n",
+		Records, EVENT_COUNT / (Journal / 1000000), EVENT_REWRITES / (Rewrite / 1000000),
+		(Rewrite / EVENT_REWRITES) / (Journal / EVENT_COUNT));
+	return true;
+}
+
+/*
+Description:    Time the events of log files from 1,000 records up to some records, 10 times larger each
+Args:			MaxRecords: No. of records of the largest log file
+Return:			0 if succeed, 1 otherwise
+*/
+int IceRunEventRate(UINT MaxRecords) {
+	bool	Result = true;
+
+	for (ULONGLONG Records = 1000; Result && Records <= MaxRecords; Records *= 10)
+		Result = IceTimeEvents((UINT)Records);
+	IceDeleteBenchFiles(BENCH_LOG_PATH);
+	return Result ? 0 : 1;
+}
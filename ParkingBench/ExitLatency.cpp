@@ -0,0 +1,85 @@
+/*
+Description:    Exit latency benchmark. Cars leave log files of several sizes, each exit overwriting the block of its
+                record in place, and the whole log file is saved as every exit did before. The exits should take the
+                same time whatever the size of the log file
+Author:         Hanson
+File:           ExitLatency.cpp
+*/
+
+#include "Bench.h"
+
+const UINT			EXIT_EVENTS = 1000;				//Exits timed per log file
+const UINT			EXIT_SAVES = 3;					//Saves of the whole log file timed per log file
+
+/*
+Description:    Time the exits of a log file
+Args:			Records: No. of records of the log file
+Return:			true if succeed, false otherwise
+*/
+static bool IceTimeExits(UINT Records) {
+	wchar_t			Password[CIPHER_MAX_KEY];
+	char			Name[64];
+	vector<double>	Exits, Saves;
+	LONGLONG		From = IceBenchNow() - Records;
+
+	if (!IceCreateLargeBenchLog(BENCH_LOG_PATH, Records, From)) {
+		printf("Failed to create the log file\n");
+		return false;
+	}
+
+	IceEncryptedFile	File(BENCH_LOG_PATH, false);													//Every record is written at once, not after the commit window
+	lstrcpyW(Password, BENCH_PASSWORD);
+	File.ArchiveHotDays = BENCH_HOT_DAYS;
+	if (!File.ReadFile(Password) || File.OpenSessions.empty()) {
+		printf("Failed to read the log file\n");
+		return false;
+	}
+	vector<UINT>	Parked = File.OpenSessions;
+	for (UINT i = 0; i < EXIT_EVENTS; i++) {
+		UINT	Index = Parked[i % Parked.size()];
+		LogInfo	&Info = File.FileContent.LogData[Index];
+		double	Start = IceBenchMicroseconds();
+
+		Info.LeaveTime = Info.EnterTime + 3600;													//The car leaves
+		Info.Fee = 1000;
+		if (!File.UpdateLog(Index)) {
+			printf("Failed to log an exit\n");
+			return false;
+		}
+		Exits.push_back(IceBenchMicroseconds() - Start);
+		Info.LeaveTime = 0;																		//Park the car again for the next round
+		Info.Fee = 0;
+		if (!File.UpdateLog(Index)) {
+			printf("Failed to log an exit\n");
+			return false;
+		}
+	}
+	for (UINT i = 0; i < EXIT_SAVES; i++) {
+		double	Start = IceBenchMicroseconds();
+		if (!File.SaveFile()) {
+			printf("Failed to save the log file\n");
+			return false;
+		}
+		Saves.push_back(IceBenchMicroseconds() - Start);
+	}
+
+	sprintf_s(Name, "%u records, exits in place", Records);
+	IcePrintPercentiles(Name, Exits);
+	sprintf_s(Name, "%u records, whole file saved", Records);
+	IcePrintPercentiles(Name, Saves);
+	return true;
+}
+
+/*
+Description:    Time the exits of log files from 10,000 records up to some records, 10 times larger each
+Args:			MaxRecords: No. of records of the largest log file
+Return:			0 if succeed, 1 otherwise
+*/
+int IceRunExitLatency(UINT MaxRecords) {
+	bool	Result = true;
+
+	for (ULONGLONG Records = 10000; Result && Records <= MaxRecords; Records *= 10)
+		Result = IceTimeExits((UINT)Records);
+	IceDeleteBenchFiles(BENCH_LOG_PATH);
+	return Result ? 0 : 1;
+}
\ No newline at end of file
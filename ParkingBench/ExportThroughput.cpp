@@ -0,0 +1,105 @@
+/*
+Description:    Export benchmark. Exports a large log file as CSV and as NDJSON with 1 thread up to EXPORT_MAX_THREADS
+                threads, and reports the records and the megabytes written per second. Every export must give the
+                output of the export with 1 thread, and more threads than EXPORT_MAX_THREADS must be clamped
+Author:         Hanson
+File:           ExportThroughput.cpp
+*/
+
+#include "Bench.h"
+
+const wchar_t		EXPORT_OUT_PATH[] = L"BenchExport.txt";	//Output file of the exports
+const UINT			EXPORT_TOO_MANY_THREADS = 1000;	//Threads asked for by the last export of each format, clamped to EXPORT_MAX_THREADS
+
+/*
+Description:    Hash the content of a file
+Args:			Path: Path of the file
+				Hash: Variable to receive the hash
+				Size: Variable to receive the size of the file in bytes
+Return:			true if succeed, false otherwise
+*/
+static bool IceHashFile(const wstring &Path, DWORD &Hash, ULONGLONG &Size) {
+	vector<BYTE>	Buffer(FILE_IO_CHUNK);
+	HANDLE			hFile;
+	DWORD			Read;
+	bool			Result = true;
+
+	hFile = CreateFileW(Path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+	Hash = 0;
+	Size = 0;
+	while ((Result = ::ReadFile(hFile, Buffer.data(), (DWORD)Buffer.size(), &Read, NULL) != FALSE) && Read > 0) {
+		Hash = Hash * 31 + IceCrc32c(Buffer.data(), Read);
+		Size += Read;
+	}
+	CloseHandle(hFile);
+	return Result;
+}
+
+/*
+Description:    Time the exports of the log file in a format
+Args:			File: The log file
+				Format: EXPORT_CSV or EXPORT_NDJSON
+Return:			No. of failures
+*/
+static UINT IceTimeExports(IceEncryptedFile &File, int Format) {
+	ExportOptions	Options = { Format, 0, MAXLONGLONG, EXPORT_ALL, 1 };
+	DWORD			SingleHash = 0, Hash;
+	ULONGLONG		Exported, Size;
+	UINT			Failed = 0;
+
+	for (UINT i = 1; i <= EXPORT_MAX_THREADS * 2; i *= 2) {
+		UINT	Threads = i > EXPORT_MAX_THREADS ? EXPORT_TOO_MANY_THREADS : i;
+		double	Start = IceBenchMicroseconds();
+		Options.Threads = Threads;
+		bool	Result = File.ExportRecords(EXPORT_OUT_PATH, Options, &Exported);
+		double	Time = IceBenchMicroseconds() - Start;
+
+		if (!Result || Exported != File.FileContent.ElementCount || !IceHashFile(EXPORT_OUT_PATH, Hash, Size)) {
+			printf("%u threads: failed to export the records\n", Threads);
+			Failed++;
+			continue;
+		}
+		if (Threads == 1)
+			SingleHash = Hash;
+		printf("%s, %4u threads: %.2f s, %.0f records/s, %.0f MB/s%s\n", Format == EXPORT_CSV ? "CSV" : "NDJSON", Threads,
+			Time / 1000000, Exported / (Time / 1000000), Size / 1048576.0 / (Time / 1000000),
+			Hash == SingleHash ? "" : ", NOT the output of 1 thread");
+		if (Hash != SingleHash)
+			Failed++;
+	}
+	return Failed;
+}
+
+/*
+Description:    Time the exports of a log file of some records
+Args:			Records: No. of records of the log file
+Return:			0 if every export gives the output of the export with 1 thread, 1 otherwise
+*/
+int IceRunExportThroughput(UINT Records) {
+	wchar_t		Password[CIPHER_MAX_KEY];
+	UINT		Failed = 0;
+
+	if (!IceCreateLargeBenchLog(BENCH_LOG_PATH, Records, IceBenchNow() - Records)) {
+		printf("Failed to create the log file\n");
+		IceDeleteBenchFiles(BENCH_LOG_PATH);
+		return 1;
+	}
+	{
+		IceEncryptedFile	File(BENCH_LOG_PATH);
+		lstrcpyW(Password, BENCH_PASSWORD);
+		File.ArchiveHotDays = BENCH_HOT_DAYS;
+		if (!File.ReadFile(Password)) {
+			printf("Failed to read the log file\n");
+			Failed++;
+		}
+		else {
+			printf("%u records, %u cores\n", Records, thread::hardware_concurrency());
+			Failed += IceTimeExports(File, EXPORT_CSV) + IceTimeExports(File, EXPORT_NDJSON);
+		}
+	}
+	IceDeleteBenchFiles(BENCH_LOG_PATH);
+	DeleteFileW(EXPORT_OUT_PATH);
+	return Failed ? 1 : 0;
+}
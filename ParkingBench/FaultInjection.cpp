@@ -0,0 +1,272 @@
+/*
+Description:    Fault injection test of the log file. Copies of a log file are truncated or corrupted at random
+                offsets, as a power failure or a bad sector would leave them, then read back. A damaged tail must be
+                cut off, and a damaged block before a valid one must lose its own records only. All other records
+                must be recovered as they were
+Author:         Hanson
+File:           FaultInjection.cpp
+*/
+
+#include "Bench.h"
+
+const wchar_t		FAULT_LOG_PATH[] = L"BenchFault.dat";	//Damaged copies of the log file
+const wchar_t		FAULT_BAD_PATH[] = L"BenchFault.bad";	//Copy of a log file with damaged blocks, kept when it is saved
+const UINT			FAULT_RECORDS = CHECK_BLOCK_RECORDS * 40 + 50;	//Records of the log file, the last block is partly filled
+
+/*
+Description:    Read a whole file
+Args:			Path: Path of the file
+				Bytes: Vector to store the content
+Return:			true if succeed, false otherwise
+*/
+static bool IceLoadBytes(const wstring &Path, vector<char> &Bytes) {
+	ifstream	fsIn;
+
+	fsIn.open(Path.c_str(), ios::binary);
+	if (fsIn.fail())
+		return false;
+	fsIn.seekg(0, ios::end);
+	Bytes.resize((size_t)fsIn.tellg());
+	fsIn.seekg(0, ios::beg);
+	fsIn.read(Bytes.data(), Bytes.size());
+	return !fsIn.fail();
+}
+
+/*
+Description:    Write a whole file
+Args:			Path: Path of the file, replaced if it exists
+				Bytes: The content
+				Size: Size of the content in bytes
+Return:			true if succeed, false otherwise
+*/
+static bool IceStoreBytes(const wstring &Path, const char *Bytes, size_t Size) {
+	ofstream	fsOut;
+
+	fsOut.open(Path.c_str(), ios::binary | ios::trunc);
+	if (fsOut.fail())
+		return false;
+	fsOut.write(Bytes, Size);
+	fsOut.close();
+	return !fsOut.fail();
+}
+
+/*
+Description:    Calculate the records which should be recovered from a damaged log file. The blocks at the end which are
+				missing or fail the checksum are dropped, a block failing the checksum before a valid block is kept with
+				its records lost
+Args:			Count: No. of records of the log file
+				Size: Size of the damaged file
+				Damaged: Offset of the corrupted byte, or -1 if the file is truncated only
+				Lost: Variable to receive the index of the first record of the damaged block kept, Count if there is none
+Return:			The no. of records kept in the file
+*/
+static UINT IceExpectedRecords(UINT Count, streamoff Size, streamoff Damaged, UINT &Lost) {
+	UINT	Recovered = (UINT)min((ULONGLONG)Count, (ULONGLONG)(Size / CHECK_BLOCK_SIZE - 1) * CHECK_BLOCK_RECORDS);
+
+	Lost = Count;
+
+	if (Damaged >= CHECK_BLOCK_SIZE) {
+		UINT		First = (UINT)(Damaged / CHECK_BLOCK_SIZE - 1) * CHECK_BLOCK_RECORDS;
+		streamoff	InBlock = Damaged % CHECK_BLOCK_SIZE;
+		if (First < Count) {
+			UINT	Records = min(Count - First, CHECK_BLOCK_RECORDS);
+			if (InBlock < (streamoff)sizeof(LogInfo) * Records ||										//A record or the checksum, the padding isn't checked
+				(InBlock >= (streamoff)sizeof(LogInfo) * CHECK_BLOCK_RECORDS && InBlock < (streamoff)(sizeof(LogInfo) * CHECK_BLOCK_RECORDS + sizeof(DWORD)))) {
+				if (First + Records < Recovered)															//A valid block follows
+					Lost = First;
+				else
+					Recovered = min(Recovered, First);
+			}
+		}
+	}
+	return Recovered;
+}
+
+/*
+Description:    Read a damaged log file and compare the recovered records with the original ones
+Args:			Original: The records of the log file before it was damaged
+				Expected: No. of records which should be recovered
+				Lost: Index of the first record of the damaged block kept, which must be zeroed
+				Fault: Description of the damage, printed if the check fails
+Return:			true if the recovered records are correct, false otherwise
+*/
+static bool IceCheckRecovery(const IceRecordStore &Original, UINT Expected, UINT Lost, const char *Fault) {
+	wchar_t			Password[CIPHER_MAX_KEY];
+	UINT			LostCount = Lost < Expected ? min(Expected - Lost, CHECK_BLOCK_RECORDS) : 0;
+	const LogInfo	Zero = {};
+	vector<char>	Before, After;
+
+	lstrcpyW(Password, BENCH_PASSWORD);
+	if (!IceLoadBytes(FAULT_LOG_PATH, Before))
+		return false;
+	for (int Pass = 0; Pass < 2; Pass++) {														//The damaged tail is cut off when the file is read first,
+		IceEncryptedFile	File(FAULT_LOG_PATH);												//which must leave the same records
+		UINT				Parking = 0;
+
+		File.ArchiveHotDays = BENCH_HOT_DAYS;													//Nothing is moved to segments
+		if (!File.ReadFile(Password)) {
+			printf("%s: read failed (pass %d)\n", Fault, Pass + 1);
+			return false;
+		}
+		if (File.FileContent.ElementCount != Expected || File.TruncatedRecords != (Pass ? 0 : Original.Size() - Expected)) {
+			printf("%s: %u records recovered and %u dropped, expected %u and %u (pass %d)\n", Fault, File.FileContent.ElementCount,
+				File.TruncatedRecords, Expected, (UINT)(Pass ? 0 : Original.Size() - Expected), Pass + 1);
+			return false;
+		}
+		for (UINT i = 0; i < Expected; i++) {
+			bool	InLost = i >= Lost && i < Lost + LostCount;
+			if (memcmp(&File.FileContent.LogData[i], InLost ? &Zero : &Original[i], sizeof(LogInfo)) != 0) {
+				printf("%s: record %u differs (pass %d)\n", Fault, i, Pass + 1);
+				return false;
+			}
+			if (!InLost && Original[i].LeaveTime == 0)
+				Parking++;
+		}
+		if (File.OpenSessions.size() != Parking || File.InvalidRecords || File.DamagedRecords != LostCount) {
+			printf("%s: %u cars parking, %u damaged and %u lost records, expected %u, 0 and %u (pass %d)\n", Fault,
+				(UINT)File.OpenSessions.size(), File.InvalidRecords, File.DamagedRecords, Parking, LostCount, Pass + 1);
+			return false;
+		}
+		if (LostCount && (!IceLoadBytes(FAULT_LOG_PATH, After) || After != Before)) {				//Kept as it is until it is saved
+			printf("%s: the log file with a damaged block is rewritten (pass %d)\n", Fault, Pass + 1);
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+Description:    Check that saving a log file with a damaged block inside keeps a copy of it, and that the records
+				lost stay zeroed in the new snapshot
+Args:			Bytes: Content of the log file
+				Original: The records of the log file
+Return:			true if succeed, false otherwise
+*/
+static bool IceCheckDamagedSave(const vector<char> &Bytes, const IceRecordStore &Original) {
+	wchar_t			Password[CIPHER_MAX_KEY];
+	const LogInfo	Zero = {};
+	vector<char>	Damaged = Bytes, Kept;
+	UINT			Lost = CHECK_BLOCK_RECORDS * 2, Expected = (UINT)Original.Size();
+	bool			Result;
+
+	IceDeleteBenchFiles(FAULT_LOG_PATH);
+	Damaged[CHECK_BLOCK_SIZE * 3] ^= 1;																//First record of the third block of records
+	if (!IceStoreBytes(FAULT_LOG_PATH, Damaged.data(), Damaged.size()))
+		return false;
+	{
+		IceEncryptedFile	File(FAULT_LOG_PATH);
+		lstrcpyW(Password, BENCH_PASSWORD);
+		File.ArchiveHotDays = BENCH_HOT_DAYS;
+		Result = File.ReadFile(Password) && File.DamagedRecords == CHECK_BLOCK_RECORDS && File.SaveFile();
+	}
+	if (!Result || !IceLoadBytes(FAULT_BAD_PATH, Kept) || Kept != Damaged) {
+		printf("Damaged save: no copy of the damaged log file is kept\n");
+		return false;
+	}
+	{
+		IceEncryptedFile	File(FAULT_LOG_PATH);
+		File.ArchiveHotDays = BENCH_HOT_DAYS;
+		Result = File.ReadFile(Password) && File.FileContent.ElementCount == Expected && !File.DamagedRecords;
+		for (UINT i = 0; Result && i < Expected; i++) {
+			bool	InLost = i >= Lost && i < Lost + CHECK_BLOCK_RECORDS;
+			Result = memcmp(&File.FileContent.LogData[i], InLost ? &Zero : &Original[i], sizeof(LogInfo)) == 0;
+		}
+	}
+	if (!Result)
+		printf("Damaged save: the records are not saved as expected\n");
+	return Result;
+}
+
+/*
+Description:    Check that a temporary file left by an interrupted save doesn't affect the log file, and is
+				replaced by the next save
+Args:			Bytes: Content of the log file
+				Original: The records of the log file
+Return:			true if succeed, false otherwise
+*/
+static bool IceCheckInterruptedSave(const vector<char> &Bytes, const IceRecordStore &Original) {
+	wchar_t		Password[CIPHER_MAX_KEY];
+	bool		Result;
+
+	IceDeleteBenchFiles(FAULT_LOG_PATH);
+	if (!IceStoreBytes(FAULT_LOG_PATH, Bytes.data(), Bytes.size()) ||
+		!IceStoreBytes(wstring(FAULT_LOG_PATH) + L".tmp", Bytes.data(), Bytes.size() / 2))				//Half of a new snapshot
+		return false;
+	if (!IceCheckRecovery(Original, (UINT)Original.Size(), (UINT)Original.Size(), "Interrupted save"))
+		return false;
+	{
+		IceEncryptedFile	File(FAULT_LOG_PATH);
+		lstrcpyW(Password, BENCH_PASSWORD);
+		File.ArchiveHotDays = BENCH_HOT_DAYS;
+		Result = File.ReadFile(Password) && File.SaveFile();
+	}
+	if (!Result || GetFileAttributesW((wstring(FAULT_LOG_PATH) + L".tmp").c_str()) != INVALID_FILE_ATTRIBUTES) {
+		printf("Interrupted save: the temporary file is not replaced\n");
+		return false;
+	}
+	return IceCheckRecovery(Original, (UINT)Original.Size(), (UINT)Original.Size(), "Save after an interrupted save");
+}
+
+/*
+Description:    Truncate or corrupt copies of a log file at random offsets and check the recovered records. The header
+				block is left intact, as it is checked by the password only
+Args:			Seed: Seed of the random offsets
+				Trials: No. of damaged copies, half of them truncated and half corrupted
+Return:			0 if all records are recovered as expected, 1 otherwise
+*/
+int IceRunFaultInjection(UINT Seed, UINT Trials) {
+	wchar_t			Password[CIPHER_MAX_KEY];
+	IceRecordStore	Original;
+	vector<char>	Bytes, Damaged;
+	mt19937			Random(Seed);
+	UINT			Failed = 0;
+
+	if (!IceCreateBenchLog(FAULT_LOG_PATH, FAULT_RECORDS, IceBenchNow() - FAULT_RECORDS)) {
+		printf("Failed to create the log file\n");
+		return 1;
+	}
+	{
+		IceEncryptedFile	File(FAULT_LOG_PATH);
+		lstrcpyW(Password, BENCH_PASSWORD);
+		File.ArchiveHotDays = BENCH_HOT_DAYS;
+		if (!File.ReadFile(Password) || !File.SaveFile()) {										//Saved again, so every record is in the log file
+			printf("Failed to read the log file\n");
+			return 1;
+		}
+		Original.Swap(File.FileContent.LogData);
+	}
+	if (!IceLoadBytes(FAULT_LOG_PATH, Bytes)) {
+		printf("Failed to read the log file\n");
+		return 1;
+	}
+
+	uniform_int_distribution<size_t>	Offset(CHECK_BLOCK_SIZE, Bytes.size() - 1);
+	uniform_int_distribution<int>		Mask(1, 255);
+	for (UINT i = 0; i < Trials; i++) {
+		size_t	At = Offset(Random);
+		char	Fault[64];
+		UINT	Expected, Lost;
+
+		IceDeleteBenchFiles(FAULT_LOG_PATH);
+		Damaged = Bytes;
+		if (i % 2) {																				//Flip some bits of a byte
+			Damaged[At] ^= (char)Mask(Random);
+			sprintf_s(Fault, "Corrupted at %u", (UINT)At);
+		}
+		else {
+			Damaged.resize(At);
+			sprintf_s(Fault, "Truncated at %u", (UINT)At);
+		}
+		Expected = IceExpectedRecords((UINT)Original.Size(), Damaged.size(), i % 2 ? (streamoff)At : -1, Lost);
+		if (!IceStoreBytes(FAULT_LOG_PATH, Damaged.data(), Damaged.size()) || !IceCheckRecovery(Original, Expected, Lost, Fault))
+			Failed++;
+	}
+	if (!IceCheckInterruptedSave(Bytes, Original))
+		Failed++;
+	if (!IceCheckDamagedSave(Bytes, Original))
+		Failed++;
+	IceDeleteBenchFiles(FAULT_LOG_PATH);
+
+	printf("%u records, %u damaged copies, seed %u: %u failed\n", (UINT)Original.Size(), Trials, Seed, Failed);
+	return Failed ? 1 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,103 @@
+/*
+Description:    Gate latency benchmark. Cars enter and leave as at the gate, each event waiting until its record is
+                committed, first with no compaction job and then while a job archives the closed sessions of the log
+                file. The job runs on the compaction thread, so the latencies should stay the same
+Author:         Hanson
+File:           GateLatency.cpp
+*/
+
+#include "Bench.h"
+
+const UINT			GATE_EVENTS = 2000;				//Events timed without a job
+const LONGLONG		GATE_LOG_AGE = 30;				//Days since the first car of the log file entered, so its closed sessions are archived
+
+/*
+Description:    Let a car enter or leave and wait until the record is committed, as the gate does
+Args:			File: The log file
+				Event: No. of the event. A car enters on even events, and leaves on the next one
+				Index: Index of the record of the car, set when the car enters
+				Latencies: Vector to add the time taken to, in microseconds
+Return:			true if succeed, false otherwise
+*/
+static bool IceGateEvent(IceEncryptedFile &File, UINT Event, UINT &Index, vector<double> &Latencies) {
+	wchar_t		CarNumber[CAR_NUMBER_MAX + 1];
+	ULONGLONG	Ticket;
+	double		Start = IceBenchMicroseconds();
+	bool		Result;
+
+	if (Event % 2 == 0) {
+		swprintf_s(CarNumber, L"G%07u", Event / 2);
+		Result = File.AddLog(CarNumber, IceBenchNow(), 0, (Event / 2) % File.FileContent.Capacity, 0, &Ticket);
+		Index = File.FileContent.ElementCount - 1;
+	}
+	else {
+		LogInfo	&Info = File.FileContent.LogData[Index];
+		Info.LeaveTime = max(IceBenchNow(), Info.EnterTime);
+		Info.Fee = 500;
+		Result = File.UpdateLog(Index, &Ticket);
+	}
+	Result = Result && File.WaitForCommit(Ticket);
+	Latencies.push_back(IceBenchMicroseconds() - Start);
+	return Result;
+}
+
+/*
+Description:    Time the gate events of a log file with and without a compaction job running, and the time taken to shrink
+				the log file when the job is finished, which the main window does on its compaction timer
+Args:			Records: No. of records of the log file, every other car has left
+Return:			0 if succeed, 1 otherwise
+*/
+int IceRunGateLatency(UINT Records) {
+	wchar_t			Password[CIPHER_MAX_KEY];
+	vector<double>	Idle, Busy;
+	UINT			Event = 0, Index = 0, Before;
+	double			Start, Finish = 0;
+
+	if (!IceCreateBenchLog(BENCH_LOG_PATH, Records, IceBenchNow() - GATE_LOG_AGE * SECONDS_PER_DAY)) {
+		printf("Failed to create the log file\n");
+		return 1;
+	}
+
+	IceEncryptedFile	File(BENCH_LOG_PATH);
+	lstrcpyW(Password, BENCH_PASSWORD);
+	File.ArchiveHotDays = BENCH_HOT_DAYS;														//No job is started when the file is read
+	if (!File.ReadFile(Password)) {
+		printf("Failed to read the log file\n");
+		return 1;
+	}
+	while (Idle.size() < GATE_EVENTS) {
+		if (!IceGateEvent(File, Event++, Index, Idle)) {
+			printf("Failed to log a gate event\n");
+			return 1;
+		}
+	}
+
+	Before = File.FileContent.ElementCount;
+	File.ArchiveHotDays = ARCHIVE_HOT_DAYS;
+	File.CompactionFailed = false;
+	if (Event % 2 || !File.StartCompaction()) {
+		printf("Failed to start the compaction job\n");
+		return 1;
+	}
+	for (;;) {																					//Cars keep entering and leaving until the job is finished
+		if (!IceGateEvent(File, Event++, Index, Busy) || !IceGateEvent(File, Event++, Index, Busy)) {
+			printf("Failed to log a gate event\n");
+			return 1;
+		}
+		Start = IceBenchMicroseconds();
+		if (File.FinishCompaction(false)) {
+			Finish = IceBenchMicroseconds() - Start;
+			break;
+		}
+		if (File.CompactionFailed) {
+			printf("The compaction job failed\n");
+			return 1;
+		}
+	}
+
+	printf("%u records, %u archived\n", Before, Before - File.FileContent.ElementCount);
+	IcePrintPercentiles("Gate events without a job", Idle);
+	IcePrintPercentiles("Gate events during the job", Busy);
+	printf("Log file shrunk in %.1f ms\n", Finish / 1000);
+	return 0;
+}
\ No newline at end of file
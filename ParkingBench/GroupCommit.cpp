@@ -0,0 +1,111 @@
+/*
+Description:    Group commit benchmark. Several gates let cars enter at the same time, each waiting until its record
+                is committed, with the records written and synced by the writer thread in batches, and with every
+                record written on its own when it is added, without a sync, as before group commit. Reports the
+                events per second, the latency of the events, and the batch sizes and commit latencies counted by
+                the writer thread
+Author:         Hanson
+File:           GroupCommit.cpp
+*/
+
+#include "Bench.h"
+
+const UINT			COMMIT_MAX_PRODUCERS = 16;		//Max no. of gates, doubled from 1 on each run
+const UINT			COMMIT_LOG_RECORDS = 1000;		//No. of records of the log file before the gates are opened
+
+/*
+Description:    Let cars enter at a gate, as the gate thread of the system does
+Args:			File: The log file
+				FileLock: Lock serializing the changes of the records, the gates wait for the commits without it
+				Gate: No. of the gate
+				Events: No. of cars entering at the gate
+				Latencies: Vector to store the time taken by each event, in microseconds
+				Failed: Variable to receive the no. of failed events
+*/
+static void IceGateProc(IceEncryptedFile *File, mutex *FileLock, UINT Gate, UINT Events, vector<double> *Latencies, UINT *Failed) {
+	wchar_t		CarNumber[CAR_NUMBER_MAX + 1];
+
+	for (UINT i = 0; i < Events; i++) {
+		ULONGLONG	Ticket;
+		double		Start = IceBenchMicroseconds();
+		bool		Result;
+
+		swprintf_s(CarNumber, L"C%02u%05u", Gate, i);
+		{
+			lock_guard<mutex>	Lock(*FileLock);
+			Result = File->AddLog(CarNumber, IceBenchNow(), 0, (Gate * Events + i) % File->FileContent.Capacity, 0, &Ticket);
+		}
+		if (!Result || !File->WaitForCommit(Ticket))
+			(*Failed)++;
+		Latencies->push_back(IceBenchMicroseconds() - Start);
+	}
+}
+
+/*
+Description:    Time some cars entering at several gates at the same time
+Args:			Producers: No. of gates
+				Events: No. of cars entering at all gates
+				Group: If the records are committed in batches by the writer thread, see IceEncryptedFile()
+Return:			true if succeed, false otherwise
+*/
+static bool IceTimeCommits(UINT Producers, UINT Events, bool Group) {
+	wchar_t					Password[CIPHER_MAX_KEY];
+	mutex					FileLock;
+	vector<thread>			Gates;
+	vector<vector<double>>	Latencies(Producers);
+	vector<double>			All;
+	vector<UINT>			Failed(Producers);
+	CommitStats				Stats;
+	double					Start, Time;
+
+	if (!IceCreateBenchLog(BENCH_LOG_PATH, COMMIT_LOG_RECORDS, IceBenchNow() - COMMIT_LOG_RECORDS)) {
+		printf("Failed to create the log file\n");
+		return false;
+	}
+	{
+		IceEncryptedFile	File(BENCH_LOG_PATH, Group);
+		lstrcpyW(Password, BENCH_PASSWORD);
+		File.ArchiveHotDays = BENCH_HOT_DAYS;
+		if (!File.ReadFile(Password)) {
+			printf("Failed to read the log file\n");
+			return false;
+		}
+		Start = IceBenchMicroseconds();
+		for (UINT i = 0; i < Producers; i++)
+			Gates.push_back(thread(IceGateProc, &File, &FileLock, i, Events / Producers, &Latencies[i], &Failed[i]));
+		for (UINT i = 0; i < Gates.size(); i++)
+			Gates[i].join();
+		Time = IceBenchMicroseconds() - Start;
+		Stats = File.GetCommitStats();
+	}
+	for (UINT i = 0; i < Producers; i++) {
+		if (Failed[i]) {
+			printf("Failed to log an event\n");
+			return false;
+		}
+		All.insert(All.end(), Latencies[i].begin(), Latencies[i].end());
+	}
+	printf("%2u gates, %s: %.0f events/s\n", Producers, Group ? "group commit" : "written one by one", All.size() / (Time / 1000000));
+	IcePrintPercentiles("  Events", All);
+	if (Group && Stats.Batches)
+		printf("  Commits: %llu records in %llu batches, %.1f records per batch, max %u, latency %.0f us on average, max %llu us\n",
+			Stats.Records, Stats.Batches, (double)Stats.Records / Stats.Batches, Stats.MaxBatchSize,
+			(double)Stats.TotalLatency / Stats.Records, Stats.MaxLatency);
+	return true;
+}
+
+/*
+Description:    Time the commits of 1 gate up to COMMIT_MAX_PRODUCERS gates, with and without group commit
+Args:			Events: No. of cars entering on each run, less than JOURNAL_COMPACT_LIMIT so the journal is not compacted
+Return:			0 if succeed, 1 otherwise
+*/
+int IceRunGroupCommit(UINT Events) {
+	bool	Result = Events > 0 && Events < JOURNAL_COMPACT_LIMIT;
+
+	if (!Result)
+		printf("The no. of events must be between 1 and %u\n", JOURNAL_COMPACT_LIMIT - 1);
+	for (UINT Producers = 1; Result && Producers <= COMMIT_MAX_PRODUCERS; Producers *= 2)
+		Result = IceTimeCommits(Producers, Events, false) && IceTimeCommits(Producers, Events, true);
+	IceDeleteBenchFiles(BENCH_LOG_PATH);
+	return Result ? 0 : 1;
+}
@@ -0,0 +1,137 @@
+/*
+Description:    History scrub benchmark. Drags the slider of the history report across a day of a large log file and
+                back, one lookup per minute as the slider moves, finding the cars parking at each time with the
+                interval index, with the occupancy snapshots at several spacings, and with a scan of all records as
+                the report did before. Every lookup must find the cars of the scan
+Author:         Hanson
+File:           HistoryScrub.cpp
+*/
+
+#include "Bench.h"
+
+const SYSTEMTIME	SCRUB_FIRST_DAY = { 2018, 11, 0, 1 };	//Enter time of the first car
+const UINT			SCRUB_STEPS = 24 * 60;			//Positions of the slider, one per minute
+const UINT			SCRUB_SCAN_STEP = 10;			//Positions looked up with a scan too, one of every SCRUB_SCAN_STEP
+const LONGLONG		SCRUB_SPACINGS[] = { 5 * 60, OCCUPANCY_SNAPSHOT_SPACING, 60 * 60 };	//Snapshot spacings timed
+
+/*
+Description:    Find the cars parking at a time with a scan of all records, as the history report did before the index
+Args:			LogData: The records
+				Time: The time, see IceToEpoch()
+				Sessions: Vector to receive the indices of the records of the cars
+*/
+static void IceScanSessions(const IceRecordStore &LogData, LONGLONG Time, vector<UINT> &Sessions) {
+	size_t	Run;
+
+	Sessions.clear();
+	for (size_t i = 0; i < LogData.Size(); i += Run) {
+		const LogInfo	*First = LogData.GetRun(i, Run);
+		for (size_t j = 0; j < Run; j++) {
+			if (First[j].EnterTime > 0 && Time >= First[j].EnterTime && (First[j].LeaveTime >= Time || First[j].LeaveTime == 0))
+				Sessions.push_back((UINT)(i + j));
+		}
+	}
+}
+
+/*
+Description:    Drag the slider across the day and back, and print the latencies of the lookups
+Args:			Name: Name of the way of lookup
+				Day: Beginning of the day
+				Find: Function finding the cars parking at a time
+				Scanned: Cars found by the scans at every SCRUB_SCAN_STEP positions, sorted
+Return:			No. of lookups not finding the cars of the scan
+*/
+template <class Finder>
+static UINT IceDragSlider(const char *Name, LONGLONG Day, Finder Find, const vector<vector<UINT>> &Scanned) {
+	vector<double>	Lookups;
+	vector<UINT>	Found;
+	double			Total = 0;
+	UINT			Failed = 0;
+
+	for (UINT i = 0; i < SCRUB_STEPS * 2; i++) {
+		UINT	Step = i < SCRUB_STEPS ? i : SCRUB_STEPS * 2 - 1 - i;								//Forward, then backward
+		double	Start = IceBenchMicroseconds();
+
+		Find(Day + Step * 60, Found);
+		Lookups.push_back(IceBenchMicroseconds() - Start);
+		Total += Lookups.back();
+		if (Step % SCRUB_SCAN_STEP)
+			continue;
+		sort(Found.begin(), Found.end());
+		if (Found != Scanned[Step / SCRUB_SCAN_STEP]) {
+			printf("%s, %02u:%02u: %u cars found, %u by the scan\n", Name, Step / 60, Step % 60, (UINT)Found.size(),
+				(UINT)Scanned[Step / SCRUB_SCAN_STEP].size());
+			Failed++;
+		}
+	}
+	IcePrintPercentiles(Name, Lookups);
+	printf("  Slider dragged across the day and back (%u positions): %.1f ms\n", SCRUB_STEPS * 2, Total / 1000);
+	return Failed;
+}
+
+/*
+Description:    Time the slider dragged across the middle day of a log file of some records
+Args:			Records: No. of records of the log file, a car enters every second
+Return:			0 if every lookup finds the cars of the scan, 1 otherwise
+*/
+int IceRunHistoryScrub(UINT Records) {
+	LONGLONG				From = IceToEpoch(SCRUB_FIRST_DAY);
+	LONGLONG				Day = From + (LONGLONG)Records / 2 / SECONDS_PER_DAY * SECONDS_PER_DAY;	//Beginning of the middle day
+	wchar_t					Password[CIPHER_MAX_KEY];
+	vector<vector<UINT>>	Scanned(SCRUB_STEPS / SCRUB_SCAN_STEP);
+	vector<double>			Scans;
+	UINT					Failed = 0;
+	double					Start;
+
+	if (!IceCreateLargeBenchLog(BENCH_LOG_PATH, Records, From)) {
+		printf("Failed to create the log file\n");
+		IceDeleteBenchFiles(BENCH_LOG_PATH);
+		return 1;
+	}
+
+	IceEncryptedFile	File(BENCH_LOG_PATH);
+	lstrcpyW(Password, BENCH_PASSWORD);
+	File.ArchiveHotDays = BENCH_HOT_DAYS;
+	if (!File.ReadFile(Password)) {
+		printf("Failed to read the log file\n");
+		IceDeleteBenchFiles(BENCH_LOG_PATH);
+		return 1;
+	}
+	IceDeleteBenchFiles(BENCH_LOG_PATH);
+
+	const IceRecordStore	&LogData = File.FileContent.LogData;
+	for (UINT i = 0; i < Scanned.size(); i++) {
+		Start = IceBenchMicroseconds();
+		IceScanSessions(LogData, Day + i * SCRUB_SCAN_STEP * 60, Scanned[i]);
+		Scans.push_back(IceBenchMicroseconds() - Start);
+	}
+	printf("%u records, %u cars parking at noon\n", Records, (UINT)Scanned[Scanned.size() / 2].size());
+	IcePrintPercentiles("Scans", Scans);
+	printf("  Slider dragged across the day and back (%u positions): %.1f ms\n", SCRUB_STEPS * 2,
+		Scans[Scans.size() / 2] * SCRUB_STEPS * 2 / 1000);
+
+	IceIntervalIndex	Index;
+	Start = IceBenchMicroseconds();
+	Index.Build(LogData);																		//As after logging in
+	printf("Interval index built in %.1f ms\n", (IceBenchMicroseconds() - Start) / 1000);
+	Failed += IceDragSlider("Index lookups", Day, [&](LONGLONG Time, vector<UINT> &Found) {
+		Index.Find(LogData, Time, Found);
+	}, Scanned);
+	Index.Clear();
+
+	for (UINT i = 0; i < sizeof(SCRUB_SPACINGS) / sizeof(SCRUB_SPACINGS[0]); i++) {
+		IceOccupancyHistory	Occupancy;
+		char				Name[64];
+
+		Occupancy.SnapshotSpacing = SCRUB_SPACINGS[i];
+		Start = IceBenchMicroseconds();
+		Occupancy.Build(LogData);
+		printf("Snapshots every %lld minutes built in %.1f ms, %.1f MB\n", SCRUB_SPACINGS[i] / 60,
+			(IceBenchMicroseconds() - Start) / 1000, Occupancy.GetMemorySize() / 1048576.0);
+		sprintf_s(Name, "Snapshot lookups, every %lld minutes", SCRUB_SPACINGS[i] / 60);
+		Failed += IceDragSlider(Name, Day, [&](LONGLONG Time, vector<UINT> &Found) {
+			Occupancy.Find(Time, Found);
+		}, Scanned);
+	}
+	return Failed ? 1 : 0;
+}
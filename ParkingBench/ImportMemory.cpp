@@ -0,0 +1,102 @@
+/*
+Description:    Import benchmark. Imports a CSV file into a large log file, and reports the time and the peak memory
+                against the size of the records of the log file and of the imported file
+Author:         Hanson
+File:           ImportMemory.cpp
+*/
+
+#include "Bench.h"
+
+const wchar_t		IMPORT_CSV_PATH[] = L"BenchImport.csv";	//CSV file created by the benchmark in the working directory
+
+/*
+Description:    Write a CSV file of closed sessions. A car enters every second, so the records are merged one by one
+				with the records of the log file, and leaves half an hour later
+Args:			Path: Path of the CSV file, replaced if it exists
+				Count: No. of records
+				From: Enter time of the first car, see IceToEpoch()
+Return:			true if succeed, false otherwise
+*/
+static bool IceWriteImportFile(const wstring &Path, UINT Count, LONGLONG From) {
+	HANDLE		hFile;
+	string		Text;
+	char		Line[128];
+	DWORD		Written;
+	bool		Result = true;
+
+	hFile = CreateFileW(Path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+	Text = "car_number,enter_time,leave_time,position,fee\n";
+	for (UINT i = 0; Result && i <= Count; i++) {
+		if (Text.size() >= FILE_IO_CHUNK || i == Count) {											//Write a piece
+			Result = WriteFile(hFile, Text.data(), (DWORD)Text.size(), &Written, NULL) && Written == Text.size();
+			Text.clear();
+		}
+		if (i == Count)
+			break;
+
+		SYSTEMTIME	Enter = IceFromEpoch(From + i), Leave = IceFromEpoch(From + i + 1800);
+		sprintf_s(Line, "I%07u,%04u-%02u-%02u %02u:%02u:%02u,%04u-%02u-%02u %02u:%02u:%02u,%u,5.00\n", i % 10000000,
+			Enter.wYear, Enter.wMonth, Enter.wDay, Enter.wHour, Enter.wMinute, Enter.wSecond,
+			Leave.wYear, Leave.wMonth, Leave.wDay, Leave.wHour, Leave.wMinute, Leave.wSecond, i % PARKING_MAX_CAPACITY + 1);
+		Text += Line;
+	}
+	CloseHandle(hFile);
+	return Result;
+}
+
+/*
+Description:    Time the import of some records into a log file of the same number of records
+Args:			Records: No. of records of the log file and of the CSV file
+Return:			0 if every record is imported, 1 otherwise
+*/
+int IceRunImportMemory(UINT Records) {
+	wchar_t			Password[CIPHER_MAX_KEY];
+	LONGLONG		From = IceBenchNow() - 2 * (LONGLONG)Records;
+	ImportResult	Counters = {};
+	LARGE_INTEGER	szFile = {};
+	HANDLE			hFile;
+	double			Start, Time;
+	size_t			Loaded, Peak;
+	bool			Result;
+
+	if (!IceCreateLargeBenchLog(BENCH_LOG_PATH, Records, From) || !IceWriteImportFile(IMPORT_CSV_PATH, Records, From + 1)) {
+		printf("Failed to create the files\n");
+		IceDeleteBenchFiles(BENCH_LOG_PATH);
+		DeleteFileW(IMPORT_CSV_PATH);
+		return 1;
+	}
+	hFile = CreateFileW(IMPORT_CSV_PATH, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+	if (hFile != INVALID_HANDLE_VALUE) {
+		GetFileSizeEx(hFile, &szFile);
+		CloseHandle(hFile);
+	}
+
+	{
+		IceEncryptedFile	File(BENCH_LOG_PATH);
+		lstrcpyW(Password, BENCH_PASSWORD);
+		File.ArchiveHotDays = BENCH_HOT_DAYS;													//Nothing is archived while importing
+		Result = File.ReadFile(Password);
+		Loaded = IceBenchPeakMemory();
+		Start = IceBenchMicroseconds();
+		Result = Result && File.ImportRecords(IMPORT_CSV_PATH, 0, &Counters) && Counters.Imported == Records &&
+			File.FileContent.ElementCount == 2 * (ULONGLONG)Records;
+		Time = IceBenchMicroseconds() - Start;
+		Peak = IceBenchPeakMemory();
+	}
+	IceDeleteBenchFiles(BENCH_LOG_PATH);
+	DeleteFileW(IMPORT_CSV_PATH);
+	if (!Result) {
+		printf("Failed to import the records: %llu of %u imported\n", Counters.Imported, Records);
+		return 1;
+	}
+
+	double	Bytes = (double)sizeof(LogInfo) * Records;												//Size of the records of each file
+	printf("%u records imported into %u records in %.2f s: %.0f records/s, %.1f MB/s of CSV\n", Records, Records,
+		Time / 1000000, Records / (Time / 1000000), szFile.QuadPart / 1048576.0 / (Time / 1000000));
+	printf("Records: %.1f MB in the log file, %.1f MB imported\n", Bytes / 1048576, Bytes / 1048576);
+	printf("Peak memory: %.1f MB after loading, %.1f MB after importing (%.2f times the records)\n",
+		Loaded / 1048576.0, Peak / 1048576.0, Peak / (Bytes * 2));
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,145 @@
+/*
+Description:    Large log file test. Writes a log file of some gigabytes, so the offsets of its records pass 2 GB and
+                4 GB, and streams every record back. Then a sparse log file of more than 4G records is written, of which
+                only the first blocks hold data: its 64-bit count must be read as it is, and the loader must refuse it
+                instead of loading a truncated count
+Author:         Hanson
+File:           LargeFile.cpp
+*/
+
+#include "Bench.h"
+
+const wchar_t		LARGE_SPARSE_PATH[] = L"BenchSparse.dat";	//Sparse log file of more than 4G records
+const ULONGLONG		LARGE_SPARSE_RECORDS = (ULONGLONG)UINT_MAX + CHECK_BLOCK_RECORDS * 10;	//Records of the sparse log file
+const UINT			LARGE_SPARSE_BLOCKS = FILE_IO_CHUNK / CHECK_BLOCK_SIZE;	//Blocks written to the sparse log file, the rest are holes
+
+/*
+Description:    Create a sparse log file with the default password. Only the header and the first blocks are written,
+				the file is extended to the size of all its records without allocating them
+Args:			Path: Path of the log file, replaced if it exists
+				Count: No. of records in the header, see IceBenchRecord()
+				From: Enter time of the first car, see IceToEpoch()
+Return:			true if succeed, false otherwise
+*/
+static bool IceCreateSparseLog(const wstring &Path, ULONGLONG Count, LONGLONG From) {
+	IceKeySchedule	Schedule;
+	HANDLE			hFile;
+	BYTE			Header[CHECK_BLOCK_SIZE];
+	LogInfo			Records[CHECK_BLOCK_RECORDS];
+	vector<BYTE>	Buffer(CHECK_BLOCK_SIZE * LARGE_SPARSE_BLOCKS);
+	LARGE_INTEGER	szFile;
+	DWORD			Written;
+	bool			Result;
+
+	IceDeleteBenchFiles(Path);
+	if (!IceExpandKey(BENCH_PASSWORD, Schedule))
+		return false;
+	hFile = CreateFileW(Path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+	Result = DeviceIoControl(hFile, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &Written, NULL) != FALSE;	//Holes take no disk space
+	IceBuildRecordHeader(Header, BENCH_PASSWORD, Count, 10, PARKING_MAX_CAPACITY, 0, Schedule);
+	for (UINT i = 0; i < LARGE_SPARSE_BLOCKS; i++) {
+		ULONGLONG	First = (ULONGLONG)i * CHECK_BLOCK_RECORDS;
+		for (UINT j = 0; j < CHECK_BLOCK_RECORDS; j++)
+			Records[j] = IceBenchRecord(First + j, From);
+		IceEncodeBlock(Buffer.data() + CHECK_BLOCK_SIZE * i, Records, CHECK_BLOCK_RECORDS, Schedule, IceRecordOffset(LOG_VERSION, First));
+	}
+	Result = Result && WriteFile(hFile, Header, CHECK_BLOCK_SIZE, &Written, NULL) && Written == CHECK_BLOCK_SIZE &&
+		WriteFile(hFile, Buffer.data(), (DWORD)Buffer.size(), &Written, NULL) && Written == Buffer.size();
+	szFile.QuadPart = CHECK_BLOCK_SIZE * (streamoff)(1 + (Count + CHECK_BLOCK_RECORDS - 1) / CHECK_BLOCK_RECORDS);
+	Result = Result && SetFilePointerEx(hFile, szFile, NULL, FILE_BEGIN) && SetEndOfFile(hFile);
+	CloseHandle(hFile);
+	return Result;
+}
+
+/*
+Description:    Stream the records of a log file and compare them with the records written
+Args:			Path: Path of the log file
+				Count: No. of records written, see IceBenchRecord()
+				Limit: No. of records to read, the rest of the file is not read
+				From: Enter time of the first car
+				Reading: Variable to receive the time taken in microseconds, the check of the records is not timed
+Return:			No. of failures
+*/
+static UINT IceCheckStream(const wstring &Path, ULONGLONG Count, ULONGLONG Limit, LONGLONG From, double &Reading) {
+	IceRecordReader	Reader;
+	const LogInfo	*Records;
+	UINT			Chunk;
+	ULONGLONG		Read = 0, Wrong = 0;
+	double			Start = IceBenchMicroseconds();
+
+	Reading = 0;
+	if (!Reader.Open(Path, BENCH_PASSWORD)) {
+		printf("Failed to open the log file\n");
+		return 1;
+	}
+	if (Reader.ElementCount != Count) {
+		printf("%llu records are read from the header, %llu are written\n", Reader.ElementCount, Count);
+		return 1;
+	}
+	while (Read < Limit && Reader.Next(Records, Chunk)) {
+		Reading += IceBenchMicroseconds() - Start;
+		for (UINT i = 0; i < Chunk && Read + i < Limit; i++) {
+			LogInfo	Expected = IceBenchRecord(Read + i, From);
+			if (memcmp(&Records[i], &Expected, sizeof(LogInfo)) != 0)
+				Wrong++;
+		}
+		Read += Chunk;
+		Start = IceBenchMicroseconds();
+	}
+	Reading += IceBenchMicroseconds() - Start;
+	if (Read < Limit) {
+		printf("%llu of %llu records are read\n", Read, Limit);
+		return 1;
+	}
+	if (Wrong) {
+		printf("%llu records are not read as written\n", Wrong);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+Description:    Write a log file of some gigabytes and a sparse log file of more than 4G records, and read them back
+Args:			Gigabytes: Size of the log file in GB
+Return:			0 if every record is read as written and the loader refuses the sparse log file, 1 otherwise
+*/
+int IceRunLargeFile(UINT Gigabytes) {
+	ULONGLONG	Count = (ULONGLONG)Gigabytes * 1073741824 / CHECK_BLOCK_SIZE * CHECK_BLOCK_RECORDS;
+	LONGLONG	From = IceBenchNow() - (LONGLONG)Count;
+	wchar_t		Password[CIPHER_MAX_KEY];
+	double		Reading;
+	UINT		Failed = 0;
+
+	if (Count == 0 || !IceCreateLargeBenchLog(BENCH_LOG_PATH, Count, From)) {
+		printf("Failed to create the log file\n");
+		IceDeleteBenchFiles(BENCH_LOG_PATH);
+		return 1;
+	}
+	Failed += IceCheckStream(BENCH_LOG_PATH, Count, Count, From, Reading);
+	IceDeleteBenchFiles(BENCH_LOG_PATH);
+	printf("%u GB, %llu records, last record at %.2f GB: streamed in %.1f s\n", Gigabytes, Count,
+		IceRecordOffset(LOG_VERSION, Count - 1) / 1073741824.0, Reading / 1000000);
+
+	if (!IceCreateSparseLog(LARGE_SPARSE_PATH, LARGE_SPARSE_RECORDS, From)) {
+		printf("Failed to create the sparse log file\n");
+		IceDeleteBenchFiles(LARGE_SPARSE_PATH);
+		return 1;
+	}
+	Failed += IceCheckStream(LARGE_SPARSE_PATH, LARGE_SPARSE_RECORDS, (ULONGLONG)LARGE_SPARSE_BLOCKS * CHECK_BLOCK_RECORDS, From, Reading);
+	{
+		IceEncryptedFile	File(LARGE_SPARSE_PATH);
+		lstrcpyW(Password, BENCH_PASSWORD);
+		File.ArchiveHotDays = BENCH_HOT_DAYS;
+		if (File.ReadFile(Password) || File.FileContent.ElementCount != 0) {						//The store is indexed with UINT
+			printf("The loader does not refuse %llu records, %u are loaded\n", LARGE_SPARSE_RECORDS, File.FileContent.ElementCount);
+			Failed++;
+		}
+	}
+	IceDeleteBenchFiles(LARGE_SPARSE_PATH);
+	printf("Sparse log file of %llu records (%.1f GB): header and first %u blocks read, refused by the loader\n",
+		LARGE_SPARSE_RECORDS, IceRecordOffset(LOG_VERSION, LARGE_SPARSE_RECORDS) / 1073741824.0, LARGE_SPARSE_BLOCKS);
+	printf("%u failed\n", Failed);
+	return Failed ? 1 : 0;
+}
@@ -0,0 +1,84 @@
+/*
+Description:    Loader thread benchmark. Loads a large log file with 1 thread, then with 2, 4, 8 and 16 threads, and
+                reports the startup time and the speedup of each. Every load must give the records and the parking
+                cars of the load with 1 thread
+Author:         Hanson
+File:           LoadThreads.cpp
+*/
+
+#include "Bench.h"
+
+const UINT			THREAD_ROUNDS = 3;				//Loads timed per thread count, the fastest is reported
+
+/*
+Description:    Load the log file with some threads
+Args:			Threads: No. of loader threads
+				Time: Variable to receive the fastest load in microseconds
+				Hash: Variable to receive the hash of the loaded records
+				Sessions: Vector to receive the indices of the parking cars
+Return:			true if succeed, false otherwise
+*/
+static bool IceTimeLoad(UINT Threads, double &Time, DWORD &Hash, vector<UINT> &Sessions) {
+	wchar_t		Password[CIPHER_MAX_KEY];
+
+	for (UINT Round = 0; Round < THREAD_ROUNDS; Round++) {
+		IceEncryptedFile	File(BENCH_LOG_PATH);
+		lstrcpyW(Password, BENCH_PASSWORD);
+		File.ArchiveHotDays = BENCH_HOT_DAYS;
+		File.LoadThreads = Threads;
+		double	Start = IceBenchMicroseconds();
+		if (!File.ReadFile(Password))
+			return false;
+		double	Load = IceBenchMicroseconds() - Start;
+		Time = Round ? min(Time, Load) : Load;
+
+		Hash = 0;
+		for (size_t i = 0, Count; i < File.FileContent.LogData.Size(); i += Count) {
+			const LogInfo	*Run = File.FileContent.LogData.GetRun(i, Count);
+			Hash = Hash * 31 + IceCrc32c((const BYTE*)Run, sizeof(LogInfo) * Count);
+		}
+		Sessions = File.OpenSessions;
+	}
+	return true;
+}
+
+/*
+Description:    Time the load of a log file of some megabytes with 1 thread up to LOAD_MAX_THREADS threads
+Args:			Megabytes: Size of the log file in MB
+Return:			0 if every load gives the records of the load with 1 thread, 1 otherwise
+*/
+int IceRunLoadThreads(UINT Megabytes) {
+	ULONGLONG		Count = (ULONGLONG)Megabytes * 1048576 / CHECK_BLOCK_SIZE * CHECK_BLOCK_RECORDS;
+	double			Single = 0, Time = 0;
+	DWORD			SingleHash = 0, Hash = 0;
+	vector<UINT>	SingleSessions, Sessions;
+	UINT			Failed = 0;
+
+	if (Count == 0 || Count >= UINT_MAX || !IceCreateLargeBenchLog(BENCH_LOG_PATH, Count, IceBenchNow() - (LONGLONG)Count)) {
+		printf("Failed to create the log file\n");
+		IceDeleteBenchFiles(BENCH_LOG_PATH);
+		return 1;
+	}
+
+	printf("%u MB, %llu records, %u cores\n", Megabytes, Count, thread::hardware_concurrency());
+	for (UINT Threads = 1; Threads <= LOAD_MAX_THREADS; Threads *= 2) {
+		if (!IceTimeLoad(Threads, Time, Hash, Sessions)) {
+			printf("%u threads: failed to read the log file\n", Threads);
+			Failed++;
+			break;
+		}
+		if (Threads == 1) {
+			Single = Time;
+			SingleHash = Hash;
+			SingleSessions = Sessions;
+		}
+
+		bool	Same = Hash == SingleHash && Sessions == SingleSessions;
+		printf("%2u threads: %.3f s, %.0f MB/s, %.2f times 1 thread%s\n", Threads, Time / 1000000, Megabytes / (Time / 1000000),
+			Single / Time, Same ? "" : ", NOT the records of 1 thread");
+		if (!Same)
+			Failed++;
+	}
+	IceDeleteBenchFiles(BENCH_LOG_PATH);
+	return Failed ? 1 : 0;
+}
@@ -0,0 +1,105 @@
+/*
+Description:    Load benchmark. Loads a large log file as the system does at login, decrypting the mapped file straight
+                into the record store, or as it was loaded before: read into a buffer, decrypted in place and copied
+                into the records. Reports the time and the peak memory
+Author:         Hanson
+File:           LoadTime.cpp
+*/
+
+#include "Bench.h"
+
+/*
+Description:    Load a log file the way it was loaded before the file mapping: the whole file is read into a buffer,
+				decrypted in place, then the records are copied out, so two copies of the file are kept at the peak
+Args:			Path: Path of the log file
+				Records: Vector to store the records
+Return:			true if succeed, false otherwise
+*/
+static bool IceLoadBuffered(const wstring &Path, vector<LogInfo> &Records) {
+	IceKeySchedule	Schedule;
+	HANDLE			hFile;
+	LARGE_INTEGER	szFile;
+	DWORD			Read;
+	bool			Result;
+
+	if (!IceExpandKey(BENCH_PASSWORD, Schedule))
+		return false;
+	hFile = CreateFileW(Path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+	Result = GetFileSizeEx(hFile, &szFile) && szFile.QuadPart >= CHECK_BLOCK_SIZE;
+
+	vector<BYTE>	Buffer(Result ? (size_t)szFile.QuadPart : 0);
+	for (size_t Done = 0; Result && Done < Buffer.size(); Done += Read) {						//Read the whole file
+		Result = ::ReadFile(hFile, Buffer.data() + Done, (DWORD)min(Buffer.size() - Done, FILE_IO_CHUNK), &Read, NULL) && Read > 0;
+	}
+	CloseHandle(hFile);
+
+	ULONGLONG	ElementCount;
+	float		FeePerHour;
+	Result = Result && IceOpenRecordHeader(Buffer.data(), Schedule) &&
+		IceParseRecordHeader(Buffer.data(), BENCH_PASSWORD, ElementCount, FeePerHour) &&
+		IceRecordOffset(LOG_VERSION, ElementCount) <= szFile.QuadPart;
+	if (!Result)
+		return false;
+	Records.resize((size_t)ElementCount);
+	for (ULONGLONG First = 0; First < ElementCount; First += CHECK_BLOCK_RECORDS) {				//Decrypt in place, then copy the records
+		streamoff	Offset = IceRecordOffset(LOG_VERSION, First);
+		BYTE		*Block = Buffer.data() + Offset;
+		IceOpenBlock(Block, Block, CHECK_BLOCK_SIZE - IceSealSize(Schedule), Schedule, Offset);
+		memcpy(&Records[(size_t)First], Block, sizeof(LogInfo) * (size_t)min(ElementCount - First, (ULONGLONG)CHECK_BLOCK_RECORDS));
+	}
+	return true;
+}
+
+/*
+Description:    Time the load of a log file of some megabytes. The peak memory of a process never drops, so each way
+				of loading is run in a process of its own
+Args:			Megabytes: Size of the log file in MB
+				Buffered: Load the file with a buffer instead of the file mapping
+Return:			0 if every record is loaded, 1 otherwise
+*/
+int IceRunLoadTime(UINT Megabytes, bool Buffered) {
+	ULONGLONG		Count = (ULONGLONG)Megabytes * 1048576 / CHECK_BLOCK_SIZE * CHECK_BLOCK_RECORDS;
+	wchar_t			Password[CIPHER_MAX_KEY];
+	double			Start, Time;
+	size_t			Before, Peak;
+	ULONGLONG		Loaded = 0;
+
+	if (Count == 0 || Count >= UINT_MAX || !IceCreateLargeBenchLog(BENCH_LOG_PATH, Count, IceBenchNow() - (LONGLONG)Count)) {
+		printf("Failed to create the log file\n");
+		IceDeleteBenchFiles(BENCH_LOG_PATH);
+		return 1;
+	}
+	Before = IceBenchPeakMemory();
+
+	if (Buffered) {
+		vector<LogInfo>		Records;
+		Start = IceBenchMicroseconds();
+		if (IceLoadBuffered(BENCH_LOG_PATH, Records))
+			Loaded = Records.size();
+		Time = IceBenchMicroseconds() - Start;
+		Peak = IceBenchPeakMemory();
+	}
+	else {																						//As the system loads the file at login
+		IceEncryptedFile	File(BENCH_LOG_PATH);
+		lstrcpyW(Password, BENCH_PASSWORD);
+		File.ArchiveHotDays = BENCH_HOT_DAYS;
+		Start = IceBenchMicroseconds();
+		if (File.ReadFile(Password))
+			Loaded = File.FileContent.ElementCount;
+		Time = IceBenchMicroseconds() - Start;
+		Peak = IceBenchPeakMemory();
+	}
+	IceDeleteBenchFiles(BENCH_LOG_PATH);
+
+	printf("%u MB, %llu records, %s: %.2f s, %.0f MB/s\n", Megabytes, Count,
+		Buffered ? "read, decrypted and copied" : "mapped and decrypted into the store", Time / 1000000, Megabytes / (Time / 1000000));
+	printf("Peak memory %.1f MB (%.1f MB before loading, %.2f times the file)\n", Peak / 1048576.0, Before / 1048576.0,
+		Peak / 1048576.0 / Megabytes);
+	if (Loaded != Count) {
+		printf("%llu of %llu records are loaded\n", Loaded, Count);
+		return 1;
+	}
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,133 @@
+/*
+Description:    Occupancy snapshot test. Cars enter and leave at random times, sometimes at the same second, sometimes
+                after the clock is set back, while the history report jumps to random times and steps forward and
+                backward. Every lookup of the occupancy snapshots must find the cars of a scan of all records, with
+                snapshots at several spacings and with none
+Author:         Hanson
+File:           OccupancyReplay.cpp
+*/
+
+#include "Bench.h"
+
+const LONGLONG		REPLAY_SPACINGS[] = { 0, 60, OCCUPANCY_SNAPSHOT_SPACING, 4 * 3600 };	//Snapshot spacings tested, by trial
+const UINT			REPLAY_MAX_RECORDS = 2000;		//Max no. of records of the log before the history is built
+const UINT			REPLAY_EVENTS = 400;			//Cars entering or leaving, and lookups, per trial
+
+/*
+Description:    Find the cars parking at a time with a scan of all records, as the history report did before the snapshots
+Args:			LogData: The records
+				Time: The time, see IceToEpoch()
+				Sessions: Vector to receive the indices of the records of the cars, sorted
+*/
+static void IceScanParked(const IceRecordStore &LogData, LONGLONG Time, vector<UINT> &Sessions) {
+	Sessions.clear();
+	for (size_t i = 0; i < LogData.Size(); i++) {
+		if (LogData[i].EnterTime > 0 && Time >= LogData[i].EnterTime && (LogData[i].LeaveTime >= Time || LogData[i].LeaveTime == 0))
+			Sessions.push_back((UINT)i);
+	}
+}
+
+/*
+Description:    Make a record of a car entered at a time
+Args:			Index: No. of the car
+				EnterTime: Enter time of the car
+				LeaveTime: Leave time of the car, 0 if the car is still parking
+Return:			The record
+*/
+static LogInfo IceReplayRecord(UINT Index, LONGLONG EnterTime, LONGLONG LeaveTime) {
+	LogInfo		Info = {};
+	wchar_t		CarNumber[CAR_NUMBER_MAX + 1];
+
+	swprintf_s(CarNumber, L"R%07u", Index);
+	Info.CarNumber = IcePackCarNumber(CarNumber);
+	Info.EnterTime = EnterTime;
+	Info.LeaveTime = LeaveTime;
+	Info.CarPos = Index % PARKING_MAX_CAPACITY;
+	return Info;
+}
+
+/*
+Description:    Run a trial: build the history of a random log, then let cars enter and leave while looking up
+				random times
+Args:			Random: Random number generator
+				Spacing: Snapshot spacing of the history
+				Lookups: Variable to add the no. of lookups to
+Return:			No. of lookups not finding the cars of the scan
+*/
+static UINT IceReplayTrial(mt19937 &Random, LONGLONG Spacing, UINT &Lookups) {
+	IceRecordStore		LogData;
+	IceOccupancyHistory	History;
+	vector<UINT>		Found, Scanned, Parked;
+	LONGLONG			First = IceBenchNow() - 30 * SECONDS_PER_DAY, Now = First, Last = First;
+	UINT				Failed = 0;
+
+	for (UINT i = Random() % REPLAY_MAX_RECORDS; i > 0; i--) {								//The log before logging in
+		LONGLONG	LeaveTime = Random() % 5 ? Now + Random() % 7200 : 0;							//Left at the enter time at times
+		LogData.Append(IceReplayRecord((UINT)LogData.Size(), Random() % 50 ? Now : 0, LeaveTime));	//Lost in a damaged block at times
+		Now += Random() % 120;																		//Cars enter at the same second at times
+	}
+	History.SnapshotSpacing = Spacing;
+	History.Build(LogData);
+	for (size_t i = 0; i < LogData.Size(); i++) {
+		if (LogData[i].EnterTime > 0 && LogData[i].LeaveTime == 0)
+			Parked.push_back((UINT)i);
+	}
+	for (size_t i = 0; i < LogData.Size(); i++)
+		Now = max(Now, LogData[i].LeaveTime);
+
+	for (UINT i = 0; i < REPLAY_EVENTS; i++) {
+		UINT	Action = Random() % 10;
+
+		if (Action == 0 && Random() % 10 == 0)													//The clock is set back
+			Now -= Random() % 3600;
+		if (Action < 3 || (Action < 5 && Parked.empty())) {										//A car enters
+			Now += Random() % 120;
+			LogData.Append(IceReplayRecord((UINT)LogData.Size(), Now, 0));
+			Parked.push_back((UINT)LogData.Size() - 1);
+			History.Update(LogData, LogData.Size() - 1);
+		}
+		else if (Action < 5) {																	//A car leaves
+			UINT	Slot = Random() % Parked.size();
+			LogInfo	&Info = LogData[Parked[Slot]];
+			Now += Random() % 120;
+			Info.LeaveTime = max(Now, Info.EnterTime);
+			History.Update(LogData, Parked[Slot]);
+			Parked[Slot] = Parked.back();
+			Parked.pop_back();
+		}
+		else {																					//A jump to a random time, or a step of the slider
+			if (Action < 7)
+				Last = First - 60 + (LONGLONG)(Random() % (ULONGLONG)(Now - First + 120));
+			else
+				Last += Random() % 2 ? 60 : -60;
+			History.Find(Last, Found);
+			IceScanParked(LogData, Last, Scanned);
+			sort(Found.begin(), Found.end());
+			if (Found != Scanned)
+				Failed++;
+			Lookups++;
+		}
+	}
+	return Failed;
+}
+
+/*
+Description:    Run trials of random logs and lookups
+Args:			Seed: Seed of the random numbers
+				Trials: No. of trials, the snapshot spacing changes with each trial
+Return:			0 if every lookup finds the cars of the scan, 1 otherwise
+*/
+int IceRunOccupancyReplay(UINT Seed, UINT Trials) {
+	mt19937		Random(Seed);
+	UINT		Lookups = 0, Failed = 0;
+
+	for (UINT i = 0; i < Trials; i++) {
+		LONGLONG	Spacing = REPLAY_SPACINGS[i % (sizeof(REPLAY_SPACINGS) / sizeof(REPLAY_SPACINGS[0]))];
+		UINT		Wrong = IceReplayTrial(Random, Spacing, Lookups);
+		if (Wrong)
+			printf("Trial %u, snapshots every %lld s: %u lookups are wrong\n", i, Spacing, Wrong);
+		Failed += Wrong;
+	}
+	printf("%u trials, %u lookups, seed %u: %u failed\n", Trials, Lookups, Seed, Failed);
+	return Failed ? 1 : 0;
+}
@@ -0,0 +1,121 @@
+/*
+Description:    Plate lookup benchmark. Looks up the car numbers pressed at the gate among many parking cars, with the
+                plate index and with a scan of the parking cars as the gate did before. Half of the cars looked up are
+                parking, the other half are entering
+Author:         Hanson
+File:           PlateLookup.cpp
+*/
+
+#include "Bench.h"
+
+const UINT			PLATE_BATCH = 1000;				//Lookups timed together, a single one is too short for the timer
+const UINT			PLATE_BATCHES = 1000;			//Batches of index lookups, and of enters and leaves
+const UINT			PLATE_SCAN_BATCHES = 10;		//Batches of scans, each scan visits every parking car
+
+/*
+Description:    Pack the car number of a bench car
+Args:			Prefix: First letter of the car number, 'P' for the parking cars
+				No: No. of the car
+Return:			The packed car number
+*/
+static ULONGLONG IcePlateOf(wchar_t Prefix, UINT No) {
+	wchar_t	CarNumber[CAR_NUMBER_MAX + 1];
+
+	swprintf_s(CarNumber, L"%c%07u", Prefix, No);
+	return IcePackCarNumber(CarNumber);
+}
+
+/*
+Description:    Find a parking car by scanning the records of all parking cars
+Args:			LogData: The records
+				Sessions: Indices of the records of the parking cars
+				CarNumber: The packed car number
+				Index: Variable to receive the index of the record
+Return:			true if the car is parking, false otherwise
+*/
+static bool IceScanParked(const IceRecordStore &LogData, const vector<UINT> &Sessions, ULONGLONG CarNumber, UINT &Index) {
+	for (UINT i = 0; i < Sessions.size(); i++) {
+		if (LogData[Sessions[i]].CarNumber == CarNumber) {
+			Index = Sessions[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+Description:    Time the lookups of car numbers among parking cars with the plate index and with a scan, and the updates
+				of the index when cars enter and leave
+Args:			Parked: No. of parking cars
+				Seed: Seed of the cars looked up
+Return:			0 if all lookups find the right cars, 1 otherwise
+*/
+int IceRunPlateLookup(UINT Parked, UINT Seed) {
+	IceRecordStore		LogData;
+	vector<UINT>		Sessions;
+	IcePlateIndex		Plates;
+	vector<ULONGLONG>	Queries(PLATE_BATCH * 16);												//Cycled through by the batches
+	vector<double>		IndexTimes, ScanTimes, UpdateTimes;
+	mt19937				Random(Seed);
+	UINT				Index, Found = 0, Expected = 0, Wrong = 0;
+	double				Start, Build;
+
+	if (Parked == 0) {
+		printf("No parking cars\n");
+		return 1;
+	}
+	for (UINT i = 0; i < Parked; i++) {
+		LogInfo	Info = {};
+		Info.EnterTime = i;
+		Info.CarNumber = IcePlateOf(L'P', i);
+		Info.CarPos = i;
+		LogData.Append(Info);
+		Sessions.push_back(i);
+	}
+	Start = IceBenchMicroseconds();
+	Plates.Build(LogData, Sessions);
+	Build = IceBenchMicroseconds() - Start;
+
+	uniform_int_distribution<UINT>	Car(0, Parked - 1);
+	for (UINT i = 0; i < Queries.size(); i++)
+		Queries[i] = IcePlateOf(i % 2 ? L'E' : L'P', Car(Random));								//Entering cars are never found
+
+	for (UINT b = 0; b < PLATE_BATCHES; b++) {
+		const ULONGLONG	*Batch = &Queries[(b % 16) * PLATE_BATCH];
+		Start = IceBenchMicroseconds();
+		for (UINT i = 0; i < PLATE_BATCH; i++)
+			Found += Plates.Find(Batch[i], Index) && LogData[Index].CarNumber == Batch[i];
+		IndexTimes.push_back(IceBenchMicroseconds() - Start);
+		Expected += PLATE_BATCH / 2;
+	}
+	for (UINT b = 0; b < PLATE_SCAN_BATCHES; b++) {
+		const ULONGLONG	*Batch = &Queries[(b % 16) * PLATE_BATCH];
+		Start = IceBenchMicroseconds();
+		for (UINT i = 0; i < PLATE_BATCH; i++)
+			Found += IceScanParked(LogData, Sessions, Batch[i], Index);
+		ScanTimes.push_back(IceBenchMicroseconds() - Start);
+		Expected += PLATE_BATCH / 2;
+	}
+	if (Found != Expected)
+		Wrong++;
+
+	for (UINT b = 0; b < PLATE_BATCHES; b++) {													//A parking car leaves and enters again
+		Start = IceBenchMicroseconds();
+		for (UINT i = 0; i < PLATE_BATCH; i++) {
+			UINT	No = (b * PLATE_BATCH + i) % Parked;
+			Plates.Remove(LogData[No].CarNumber);
+			Plates.Insert(LogData[No].CarNumber, No);
+		}
+		UpdateTimes.push_back(IceBenchMicroseconds() - Start);
+	}
+	if (Plates.Size() != Parked)
+		Wrong++;
+
+	printf("%u parking cars, index built in %.1f ms\n", Parked, Build / 1000);
+	IcePrintPercentiles("Index lookups, 1000 per sample", IndexTimes);
+	IcePrintPercentiles("Scans, 1000 per sample", ScanTimes);
+	IcePrintPercentiles("Leaves and enters, 1000 per sample", UpdateTimes);
+	if (Wrong)
+		printf("Found %u cars, expected %u\n", Found, Expected);
+	return Wrong ? 1 : 0;
+}
\ No newline at end of file
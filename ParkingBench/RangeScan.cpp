@@ -0,0 +1,135 @@
+/*
+Description:    Range scan benchmark. Counts the cars in the car park on some days of a large log file, as the daily
+                report does: scanning the whole history with the keys computed from SYSTEMTIME on every compare as
+                before, scanning it with the epoch times of the records, and with ReadRange() as the reports do now.
+                The log file and the days are always the same, so the runs can be compared with each other
+Author:         Hanson
+File:           RangeScan.cpp
+*/
+
+#include "Bench.h"
+
+const SYSTEMTIME	RANGE_FIRST_DAY = { 2018, 11, 0, 1 };	//Enter time of the first car. The log file passes the end of a year
+const UINT			RANGE_QUERIES = 20;				//Days counted, spread evenly over the log file
+const UINT			RANGE_ROUNDS = 3;				//Passes over the days, the fastest is reported
+
+/* Description:		Times of a record as they were stored before the epoch times */
+struct LegacyTimes {
+	SYSTEMTIME		EnterTime;						//Enter time of the car
+	SYSTEMTIME		LeaveTime;						//Leave time of the car. If the car is not left, LeaveTime.wYear = 0
+};
+
+/*
+Description:    Convert a time to seconds as it was done before the epoch times, on every compare. The result is
+				not the calendar order: months are 31 days and years 365, and the seconds overflow a UINT
+Args:			st: The time
+Return:			Time value in seconds
+*/
+static inline UINT IceLegacySecond(const SYSTEMTIME &st) {
+	return (UINT)(st.wYear * 365 * 24 * 3600 + st.wMonth * 31 * 24 * 3600 + st.wDay * 24 * 3600 +
+		st.wHour * 3600 + st.wMinute * 60 + st.wSecond);
+}
+
+/*
+Description:    Time a way of counting the cars in the car park on every day of the queries
+Args:			Name: Name of the way
+				Days: Beginnings of the days
+				Count: Function counting the cars of a day, from its beginning and its end
+				Counts: Vector to store the no. of cars of each day
+*/
+template <class Counter>
+static void IceTimeQueries(const char *Name, const vector<LONGLONG> &Days, Counter Count, vector<size_t> &Counts) {
+	double	Best = 0;
+
+	Counts.resize(Days.size());
+	for (UINT Round = 0; Round < RANGE_ROUNDS; Round++) {
+		double	Start = IceBenchMicroseconds();
+		for (UINT i = 0; i < Days.size(); i++)
+			Counts[i] = Count(Days[i], Days[i] + SECONDS_PER_DAY - 1);
+		double	Time = IceBenchMicroseconds() - Start;
+		Best = Round ? min(Best, Time) : Time;
+	}
+	printf("%s: %.2f ms per day\n", Name, Best / 1000 / Days.size());
+}
+
+/*
+Description:    Time the range scans of a log file of some records
+Args:			Records: No. of records of the log file, a car enters every second
+Return:			0 if ReadRange() finds the cars of the full scan on every day, 1 otherwise
+*/
+int IceRunRangeScan(UINT Records) {
+	LONGLONG			From = IceToEpoch(RANGE_FIRST_DAY);
+	wchar_t				Password[CIPHER_MAX_KEY];
+	vector<LONGLONG>	Days;
+	vector<size_t>		Legacy, Epoch, Range;
+	vector<LogInfo>		Found;
+	UINT				Failed = 0, Different = 0;
+
+	if (Records < SECONDS_PER_DAY || !IceCreateLargeBenchLog(BENCH_LOG_PATH, Records, From)) {
+		printf("Failed to create the log file of at least one day\n");
+		IceDeleteBenchFiles(BENCH_LOG_PATH);
+		return 1;
+	}
+
+	IceEncryptedFile	File(BENCH_LOG_PATH);
+	lstrcpyW(Password, BENCH_PASSWORD);
+	File.ArchiveHotDays = BENCH_HOT_DAYS;
+	if (!File.ReadFile(Password)) {
+		printf("Failed to read the log file\n");
+		IceDeleteBenchFiles(BENCH_LOG_PATH);
+		return 1;
+	}
+	IceDeleteBenchFiles(BENCH_LOG_PATH);
+
+	const IceRecordStore	&Store = File.FileContent.LogData;
+	vector<LegacyTimes>		Times(Store.Size());
+	for (size_t i = 0; i < Store.Size(); i++) {												//The times as they were stored before
+		Times[i].EnterTime = IceFromEpoch(Store[i].EnterTime);
+		if (Store[i].LeaveTime)
+			Times[i].LeaveTime = IceFromEpoch(Store[i].LeaveTime);
+		else
+			memset(&Times[i].LeaveTime, 0, sizeof(SYSTEMTIME));
+	}
+	for (UINT i = 0; i < RANGE_QUERIES; i++)
+		Days.push_back(From + (LONGLONG)(Records - SECONDS_PER_DAY) / SECONDS_PER_DAY * i / RANGE_QUERIES * SECONDS_PER_DAY);
+
+	printf("%u records from %04u-%02u-%02u, %u days\n", Records, RANGE_FIRST_DAY.wYear, RANGE_FIRST_DAY.wMonth,
+		RANGE_FIRST_DAY.wDay, RANGE_QUERIES);
+	IceTimeQueries("Full scan, keys of SYSTEMTIME", Days, [&](LONGLONG DayStart, LONGLONG DayEnd) {
+		SYSTEMTIME	Start = IceFromEpoch(DayStart), End = IceFromEpoch(DayEnd);
+		size_t		Count = 0;
+		for (size_t i = 0; i < Times.size(); i++) {
+			if (IceLegacySecond(End) >= IceLegacySecond(Times[i].EnterTime) &&
+				(Times[i].LeaveTime.wYear == 0 || IceLegacySecond(Times[i].LeaveTime) >= IceLegacySecond(Start)))
+				Count++;
+		}
+		return Count;
+	}, Legacy);
+	IceTimeQueries("Full scan, epoch times", Days, [&](LONGLONG DayStart, LONGLONG DayEnd) {
+		size_t	Count = 0, Run;
+		for (size_t i = 0; i < Store.Size(); i += Run) {
+			const LogInfo	*First = Store.GetRun(i, Run);
+			for (size_t j = 0; j < Run; j++)
+				Count += (First[j].EnterTime <= DayEnd) & ((First[j].LeaveTime == 0) | (First[j].LeaveTime >= DayStart));
+		}
+		return Count;
+	}, Epoch);
+	IceTimeQueries("ReadRange()", Days, [&](LONGLONG DayStart, LONGLONG DayEnd) {
+		File.ReadRange(DayStart, DayEnd, Found);
+		return Found.size();
+	}, Range);
+
+	for (UINT i = 0; i < Days.size(); i++) {
+		if (Range[i] != Epoch[i]) {
+			SYSTEMTIME	Day = IceFromEpoch(Days[i]);
+			printf("%04u-%02u-%02u: %u cars found by ReadRange(), %u by the full scan\n", Day.wYear, Day.wMonth, Day.wDay,
+				(UINT)Range[i], (UINT)Epoch[i]);
+			Failed++;
+		}
+		if (Legacy[i] != Epoch[i])
+			Different++;
+	}
+	if (Different)
+		printf("The keys of SYSTEMTIME give other counts on %u of %u days\n", Different, RANGE_QUERIES);
+	return Failed ? 1 : 0;
+}
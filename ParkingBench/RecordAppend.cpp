@@ -0,0 +1,81 @@
+/*
+Description:    Record append benchmark. Appends records to the record store as cars enter, and to a vector as the log
+                file did before. The vector copies all records when it grows, which shows up in the tail of the
+                latencies, while the store only allocates a new chunk
+Author:         Hanson
+File:           RecordAppend.cpp
+*/
+
+#include "Bench.h"
+
+const UINT			APPEND_BATCH = 100;				//Appends timed together, a single one is too short for the timer
+
+/*
+Description:    Make the record of a bench car
+Args:			No: No. of the car
+Return:			The record
+*/
+static LogInfo IceAppendRecord(UINT No) {
+	LogInfo	Info = {};
+
+	Info.EnterTime = No;
+	Info.CarNumber = No + 1;
+	Info.CarPos = No % PARKING_MAX_CAPACITY;
+	return Info;
+}
+
+/*
+Description:    Time the appends of records to the record store and to a vector. The vector is timed after the store is
+				freed, so both have the same memory
+Args:			Records: No. of records
+Return:			0 if the records of the store stay at their addresses, 1 otherwise
+*/
+int IceRunRecordAppend(UINT Records) {
+	vector<double>	StoreTimes, VectorTimes;
+	UINT			Moved = 0, Reallocations = 0;
+
+	StoreTimes.reserve(Records / APPEND_BATCH + 1);
+	VectorTimes.reserve(Records / APPEND_BATCH + 1);
+	{
+		IceRecordStore	Store;
+		const LogInfo	*First = NULL;
+		for (UINT i = 0; i < Records; ) {
+			UINT	Count = min(APPEND_BATCH, Records - i);
+			double	Start = IceBenchMicroseconds();
+			for (UINT j = 0; j < Count; j++)
+				Store.Append(IceAppendRecord(i + j));
+			StoreTimes.push_back(IceBenchMicroseconds() - Start);
+			if (!First)
+				First = &Store[0];
+			i += Count;
+		}
+		for (UINT i = 0; i < Records; i++) {
+			if (Store[i].EnterTime != i)
+				Moved++;
+		}
+		if (Records && First != &Store[0])															//The first record is never copied
+			Moved++;
+	}
+	{
+		vector<LogInfo>	Vector;
+		for (UINT i = 0; i < Records; ) {
+			UINT	Count = min(APPEND_BATCH, Records - i);
+			size_t	Capacity = Vector.capacity();
+			double	Start = IceBenchMicroseconds();
+			for (UINT j = 0; j < Count; j++)
+				Vector.push_back(IceAppendRecord(i + j));
+			VectorTimes.push_back(IceBenchMicroseconds() - Start);
+			if (Vector.capacity() != Capacity)
+				Reallocations++;
+			i += Count;
+		}
+	}
+
+	printf("%u records\n", Records);
+	IcePrintPercentiles("Record store, 100 per sample", StoreTimes);
+	IcePrintPercentiles("Vector, 100 per sample", VectorTimes);
+	printf("The vector grew during %u samples\n", Reallocations);
+	if (Moved)
+		printf("%u records of the store moved or changed\n", Moved);
+	return Moved ? 1 : 0;
+}
\ No newline at end of file
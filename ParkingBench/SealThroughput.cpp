@@ -0,0 +1,116 @@
+/*
+Description:    Seal throughput benchmark. Seals and opens the blocks of a buffer with a derived key, as the log file
+                is written and read when it is encrypted with AES, and hashes the buffer with SHA-256 alone. Every
+                block is encrypted with AES-CTR and tagged with HMAC-SHA256, so the hash bounds the throughput
+                unless the SHA extensions are used
+Author:         Hanson
+File:           SealThroughput.cpp
+*/
+
+#include "Bench.h"
+
+const UINT			SEAL_ROUNDS = 3;				//Passes over the buffer, the fastest is reported
+
+/*
+Description:    Check SHA-256 with the test vectors of FIPS 180-2, so the kernel in use gives the standard digests
+Return:			true if the digests are correct, false otherwise
+*/
+static bool IceCheckSha256() {
+	const BYTE		Abc[32] = {
+		0xBA, 0x78, 0x16, 0xBF, 0x8F, 0x01, 0xCF, 0xEA, 0x41, 0x41, 0x40, 0xDE, 0x5D, 0xAE, 0x22, 0x23,
+		0xB0, 0x03, 0x61, 0xA3, 0x96, 0x17, 0x7A, 0x9C, 0xB4, 0x10, 0xFF, 0x61, 0xF2, 0x00, 0x15, 0xAD
+	};
+	const BYTE		Million[32] = {																//1,000,000 times 'a'
+		0xCD, 0xC7, 0x6E, 0x5C, 0x99, 0x14, 0xFB, 0x92, 0x81, 0xA1, 0xC7, 0xE2, 0x84, 0xD7, 0x3E, 0x67,
+		0xF1, 0x80, 0x9A, 0x48, 0xA4, 0x97, 0x20, 0x0E, 0x04, 0x6D, 0x39, 0xCC, 0xC7, 0x11, 0x2C, 0xD0
+	};
+	vector<BYTE>	Data(1000000, 'a');
+	BYTE			Digest[32];
+
+	IceSha256((const BYTE*)"abc", 3, Digest);
+	if (memcmp(Digest, Abc, sizeof(Digest)) != 0)
+		return false;
+	IceSha256(Data.data(), Data.size(), Digest);
+	return memcmp(Digest, Million, sizeof(Digest)) == 0;
+}
+
+/*
+Description:    Print the throughput of a pass over a buffer
+Args:			Name: Name of the pass
+				Bytes: Size of the buffer in bytes
+				Time: The fastest time of the pass in microseconds
+*/
+static void IcePrintThroughput(const char *Name, size_t Bytes, double Time) {
+	printf("%s: %.2f GB/s\n", Name, Bytes / Time / 1000.0);
+}
+
+/*
+Description:    Time sealing, opening and hashing a buffer
+Args:			Megabytes: Size of the buffer in MB
+Return:			0 if every block is opened as it was sealed, 1 otherwise
+*/
+int IceRunSealThroughput(UINT Megabytes) {
+	KeyFileHeader	KeyFile = { KEY_MAGIC, KDF_MIN_ITERATIONS };
+	wchar_t			Token[CIPHER_MAX_KEY];
+	IceKeySchedule	Schedule;
+	mt19937			Random(BENCH_SEED);
+	size_t			Blocks = (size_t)Megabytes * 1048576 / CHECK_BLOCK_SIZE;
+	double			SealTime = 0, OpenTime = 0, HashTime = 0;
+	UINT			Failed = 0;
+
+	for (int i = 0; i < KDF_SALT_SIZE; i++)
+		KeyFile.Salt[i] = (BYTE)Random();
+	IceDeriveKey(BENCH_PASSWORD, KeyFile, Token);
+	if (!IceExpandKey(Token, Schedule) || Blocks == 0) {
+		printf("Failed to prepare the key\n");
+		return 1;
+	}
+	if (!IceCheckSha256()) {
+		printf("SHA-256 gives wrong digests\n");
+		return 1;
+	}
+
+	int				Seal = IceSealSize(Schedule);
+	streamoff		Length = CHECK_BLOCK_SIZE - Seal;											//Payload of a block, as in the log file
+	vector<BYTE>	Plain(Blocks * CHECK_BLOCK_SIZE), Sealed(Plain.size()), Opened(Plain.size());
+	for (size_t i = 0; i < Plain.size(); i++)
+		Plain[i] = (BYTE)Random();
+
+	for (UINT Round = 0; Round < SEAL_ROUNDS; Round++) {
+		double	Start = IceBenchMicroseconds();
+		for (size_t i = 0; i < Blocks; i++)
+			IceSealBlock(Sealed.data() + i * CHECK_BLOCK_SIZE, Plain.data() + i * CHECK_BLOCK_SIZE, Length, Schedule,
+				(streamoff)i * CHECK_BLOCK_SIZE);
+		double	Sealing = IceBenchMicroseconds() - Start;
+
+		Start = IceBenchMicroseconds();
+		for (size_t i = 0; i < Blocks; i++) {
+			if (!IceOpenBlock(Opened.data() + i * CHECK_BLOCK_SIZE, Sealed.data() + i * CHECK_BLOCK_SIZE, Length, Schedule,
+				(streamoff)i * CHECK_BLOCK_SIZE))
+				Failed++;
+		}
+		double	Opening = IceBenchMicroseconds() - Start;
+
+		BYTE	Digest[32];
+		Start = IceBenchMicroseconds();
+		IceSha256(Plain.data(), Plain.size(), Digest);
+		double	Hashing = IceBenchMicroseconds() - Start;
+
+		SealTime = Round ? min(SealTime, Sealing) : Sealing;
+		OpenTime = Round ? min(OpenTime, Opening) : Opening;
+		HashTime = Round ? min(HashTime, Hashing) : Hashing;
+	}
+	for (size_t i = 0; i < Blocks; i++) {
+		if (memcmp(Opened.data() + i * CHECK_BLOCK_SIZE, Plain.data() + i * CHECK_BLOCK_SIZE, (size_t)Length) != 0)
+			Failed++;
+	}
+
+	printf("%u MB in %u blocks, AES-NI %s, SHA extensions %s\n", Megabytes, (UINT)Blocks,
+		AesHardware ? "used" : "not available", ShaHardware ? "used" : "not available");
+	IcePrintThroughput("Seal (AES-CTR + HMAC-SHA256)", Blocks * (size_t)Length, SealTime);
+	IcePrintThroughput("Open (HMAC-SHA256 + AES-CTR)", Blocks * (size_t)Length, OpenTime);
+	IcePrintThroughput("SHA-256", Plain.size(), HashTime);
+	if (Failed)
+		printf("%u blocks are not opened as they were sealed\n", Failed);
+	return Failed ? 1 : 0;
+}
\ No newline at end of file
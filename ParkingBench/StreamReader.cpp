@@ -0,0 +1,65 @@
+/*
+Description:    Streaming reader test. Writes a log file larger than the memory given to the test, reads it back
+                with IceRecordReader, and checks every record and the peak memory of the process
+Author:         Hanson
+File:           StreamReader.cpp
+*/
+
+#include "Bench.h"
+
+const size_t		STREAM_MEMORY_CAP = 64 * 1024 * 1024;	//Max peak memory of the process. The file is many times larger
+
+/*
+Description:    Write a log file of some gigabytes and stream it
+Args:			Gigabytes: Size of the log file in GB
+Return:			0 if every record is read as written and the memory stays under the cap, 1 otherwise
+*/
+int IceRunStreamReader(UINT Gigabytes) {
+	ULONGLONG		Count = (ULONGLONG)Gigabytes * 1073741824 / CHECK_BLOCK_SIZE * CHECK_BLOCK_RECORDS;
+	LONGLONG		From = IceBenchNow() - (LONGLONG)Count;
+	IceRecordReader	Reader;
+	const LogInfo	*Records;
+	UINT			Chunk;
+	ULONGLONG		Read = 0, Wrong = 0;
+	double			Start, Writing, Reading = 0;
+
+	Start = IceBenchMicroseconds();
+	if (Count == 0 || !IceCreateLargeBenchLog(BENCH_LOG_PATH, Count, From)) {
+		printf("Failed to create the log file\n");
+		IceDeleteBenchFiles(BENCH_LOG_PATH);
+		return 1;
+	}
+	Writing = IceBenchMicroseconds() - Start;
+
+	Start = IceBenchMicroseconds();
+	if (!Reader.Open(BENCH_LOG_PATH, BENCH_PASSWORD)) {
+		printf("Failed to open the log file\n");
+		IceDeleteBenchFiles(BENCH_LOG_PATH);
+		return 1;
+	}
+	while (Reader.Next(Records, Chunk)) {
+		Reading += IceBenchMicroseconds() - Start;													//The check of the records is not timed
+		for (UINT i = 0; i < Chunk; i++) {
+			LogInfo	Expected = IceBenchRecord(Read + i, From);
+			if (memcmp(&Records[i], &Expected, sizeof(LogInfo)) != 0)
+				Wrong++;
+		}
+		Read += Chunk;
+		Start = IceBenchMicroseconds();
+	}
+	Reading += IceBenchMicroseconds() - Start;
+	Reader.Close();
+	IceDeleteBenchFiles(BENCH_LOG_PATH);
+
+	size_t	Peak = IceBenchPeakMemory();
+	printf("%u GB, %llu records: written in %.1f s, streamed in %.1f s (%.2f GB/s)\n", Gigabytes, Count,
+		Writing / 1000000, Reading / 1000000, Gigabytes * 1.073741824 / (Reading / 1000000));
+	printf("Peak memory %.1f MB, cap %.1f MB\n", Peak / 1048576.0, STREAM_MEMORY_CAP / 1048576.0);
+	if (Reader.Failed || Read != Count)
+		printf("%llu of %llu records are read\n", Read, Count);
+	if (Wrong)
+		printf("%llu records are not read as written\n", Wrong);
+	if (Peak > STREAM_MEMORY_CAP)
+		printf("The memory exceeds the cap\n");
+	return Reader.Failed || Read != Count || Wrong || Peak > STREAM_MEMORY_CAP ? 1 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,129 @@
+/*
+Description:    Allocate parking positions with a hierarchical bitmap. Finding the first free position takes
+                one bit scan per level, i.e. at most 4 for 1000000 positions, however full the car park is
+Author:         Hanson
+File:           BayAllocator.cpp
+*/
+
+#include "FileManager.h"
+#include <intrin.h>
+
+/*
+Description:    Set the no. of positions and mark all of them as free
+Args:			Capacity: No. of positions, PARKING_MIN_CAPACITY ~ PARKING_MAX_CAPACITY
+*/
+void IceBayAllocator::Reset(UINT Capacity) {
+	UINT	Bits = Capacity;
+
+	this->Capacity = Capacity;
+	FreeCount = Capacity;
+	Levels.clear();
+	do {																						//Build the levels up to a single word
+		vector<DWORD>	Level((Bits + BAY_WORD_BITS - 1) / BAY_WORD_BITS, 0xFFFFFFFF);
+		if (Bits % BAY_WORD_BITS)																	//Bits after the last position are never free
+			Level.back() = (1u << (Bits % BAY_WORD_BITS)) - 1;
+		Bits = (UINT)Level.size();
+		Levels.push_back(Level);
+	} while (Bits > 1);
+	if (Capacity == 0)
+		Levels.back()[0] = 0;
+}
+
+/*
+Description:    Mark a position as free or occupied, and update the higher levels if a word becomes empty or non-empty
+Args:			Bay: The position
+				Free: If the position is free
+*/
+void IceBayAllocator::SetFree(UINT Bay, bool Free) {
+	for (UINT i = 0; i < Levels.size(); i++) {
+		DWORD	&Word = Levels[i][Bay / BAY_WORD_BITS];
+		DWORD	Bit = 1u << (Bay % BAY_WORD_BITS);
+		bool	WasEmpty = Word == 0;
+
+		if (Free)
+			Word |= Bit;
+		else
+			Word &= ~Bit;
+		if ((Word == 0) == WasEmpty)																//The level above doesn't change
+			break;
+		Bay /= BAY_WORD_BITS;
+	}
+}
+
+/*
+Description:    Allocate the free position with the smallest number
+Return:			The position, -1 if all positions are occupied
+*/
+int IceBayAllocator::Allocate() {
+	unsigned long	Bit;
+	UINT			Word = 0;
+
+	if (FreeCount == 0)
+		return -1;
+	for (size_t i = Levels.size(); i-- > 0;) {													//From the top level down
+		_BitScanForward(&Bit, Levels[i][Word]);
+		Word = Word * BAY_WORD_BITS + Bit;
+	}
+	SetFree(Word, false);
+	FreeCount--;
+	return (int)Word;
+}
+
+/*
+Description:    Mark a given position as occupied, e.g. by a car parked before the program started
+Args:			Bay: The position
+Return:			true if succeed, false if the position is occupied or doesn't exist
+*/
+bool IceBayAllocator::Claim(UINT Bay) {
+	if (Bay >= Capacity || IsOccupied(Bay))
+		return false;
+	SetFree(Bay, false);
+	FreeCount--;
+	return true;
+}
+
+/*
+Description:    Mark a position as free
+Args:			Bay: The position
+Return:			true if succeed, false if the position is free or doesn't exist
+*/
+bool IceBayAllocator::Release(UINT Bay) {
+	if (Bay >= Capacity || !IsOccupied(Bay))
+		return false;
+	SetFree(Bay, true);
+	FreeCount++;
+	return true;
+}
+
+/*
+Description:    Check if a position is occupied
+Args:			Bay: The position
+Return:			true if the position is occupied, false if it is free or doesn't exist
+*/
+bool IceBayAllocator::IsOccupied(UINT Bay) const {
+	return Bay < Capacity && !(Levels[0][Bay / BAY_WORD_BITS] & (1u << (Bay % BAY_WORD_BITS)));
+}
+
+/*
+Description:    Get the no. of positions
+Return:			The no. of positions
+*/
+UINT IceBayAllocator::GetCapacity() const {
+	return Capacity;
+}
+
+/*
+Description:    Get the no. of free positions
+Return:			The no. of free positions
+*/
+UINT IceBayAllocator::GetFreeCount() const {
+	return FreeCount;
+}
+
+/*
+Description:    Get the no. of occupied positions
+Return:			The no. of occupied positions
+*/
+UINT IceBayAllocator::GetUsedCount() const {
+	return Capacity - FreeCount;
+}
\ No newline at end of file
@@ -0,0 +1,59 @@
+/*
+Description:    CRC32C (Castagnoli) checksums of the blocks of record files. The SSE4.2 CRC32
+                instruction is used when the CPU supports it, otherwise a lookup table
+Author:         Hanson
+File:           Checksum.cpp
+*/
+
+#include "FileManager.h"
+#include <intrin.h>
+
+static DWORD	CrcTable[256];																	//Remainders of all bytes, for CPUs without SSE4.2
+
+/*
+Description:    Fill the lookup table and check if the CPU supports SSE4.2
+Return:			true if the CRC32 instruction can be used, false otherwise
+*/
+static bool DetectCrcSupport() {
+	int		CpuInfo[4];
+
+	for (DWORD i = 0; i < 256; i++) {
+		DWORD	Crc = i;
+		for (int j = 0; j < 8; j++)
+			Crc = (Crc >> 1) ^ (Crc & 1 ? 0x82F63B78 : 0);												//Reversed Castagnoli polynomial
+		CrcTable[i] = Crc;
+	}
+	__cpuid(CpuInfo, 0);
+	if (CpuInfo[0] < 1)
+		return false;
+	__cpuid(CpuInfo, 1);
+	return (CpuInfo[2] & (1 << 20)) != 0;														//SSE4.2
+}
+
+static const bool	CrcHardware = DetectCrcSupport();												//Detected once before WinMain, read by all threads
+
+/*
+Description:    Calculate the CRC32C of a piece of data
+Args:			Data: The data
+				Length: Size of the data in bytes
+Return:			The checksum
+*/
+DWORD IceCrc32c(const BYTE *Data, size_t Length) {
+	DWORD	Crc = 0xFFFFFFFF;
+	size_t	i = 0;
+
+	if (CrcHardware) {
+		for (; i + sizeof(UINT) <= Length; i += sizeof(UINT)) {											//4 bytes per step
+			UINT	Value;
+			memcpy(&Value, Data + i, sizeof(UINT));
+			Crc = _mm_crc32_u32(Crc, Value);
+		}
+		for (; i < Length; i++)
+			Crc = _mm_crc32_u8(Crc, Data[i]);
+	}
+	else {
+		for (; i < Length; i++)
+			Crc = (Crc >> 8) ^ CrcTable[(Crc ^ Data[i]) & 0xFF];
+	}
+	return ~Crc;
+}
\ No newline at end of file
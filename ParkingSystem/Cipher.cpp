@@ -0,0 +1,453 @@
+/*
+Description:    Encryption kernels of the log cipher. The key byte of every byte depends on
+                its position only, so the key is expanded into a repeating block once and
+                the data is processed 64/16 bytes at a time with AVX2/SSE2 when available.
+                Files can also be encrypted with AES-128 in counter mode (AES-NI when available). Every piece
+                of data is then sealed on its own with a new nonce and an HMAC-SHA256 tag, so no key stream is
+                used twice and damaged or forged pieces are rejected when they are opened
+Author:         Hanson
+File:           Cipher.cpp
+*/
+
+#include "FileManager.h"
+#include <intrin.h>
+
+static BYTE							SBox[256];												//AES S-box, filled at startup
+static map<wstring, IceKeySchedule>	DerivedKeys;											//Schedules of derived keys, by token
+static mutex						DerivedKeysLock;										//Protects DerivedKeys
+static ULONGLONG					NextNonce;												//Nonce of the next sealed piece of data
+static bool							NonceSeeded = false;									//If NextNonce is set to a random value
+static mutex						NonceLock;												//Protects NextNonce and NonceSeeded
+
+/*
+Description:    Get the fastest kernel supported by the CPU and the OS
+Return:			CIPHER_AVX2, CIPHER_SSE2 or CIPHER_SCALAR
+*/
+static int DetectCipherLevel() {
+	int		CpuInfo[4];
+
+	__cpuid(CpuInfo, 0);
+	int		MaxLeaf = CpuInfo[0];
+	if (MaxLeaf < 1)
+		return CIPHER_SCALAR;
+	__cpuid(CpuInfo, 1);
+	bool	SSE2 = (CpuInfo[3] & (1 << 26)) != 0;
+	bool	AVX = (CpuInfo[2] & (1 << 27)) && (CpuInfo[2] & (1 << 28)) &&						//OSXSAVE and AVX
+		(_xgetbv(0) & 6) == 6;																	//The OS saves XMM and YMM registers
+	if (AVX && MaxLeaf >= 7) {
+		__cpuidex(CpuInfo, 7, 0);
+		if (CpuInfo[1] & (1 << 5))																	//AVX2
+			return CIPHER_AVX2;
+	}
+	return SSE2 ? CIPHER_SSE2 : CIPHER_SCALAR;
+}
+
+const int	CipherLevel = DetectCipherLevel();													//Detected once before WinMain, read by all threads
+
+/*
+Description:    Fill the AES S-box and check if the CPU supports AES-NI
+Return:			true if AES-NI can be used, false otherwise
+*/
+static bool DetectAesSupport() {
+	int		CpuInfo[4];
+	BYTE	p = 1, q = 1;
+
+	do {																						//p runs through all non-zero elements of GF(2^8), q is its inverse
+		p = (BYTE)(p ^ (p << 1) ^ (p & 0x80 ? 0x1B : 0));
+		q ^= (BYTE)(q << 1);
+		q ^= (BYTE)(q << 2);
+		q ^= (BYTE)(q << 4);
+		if (q & 0x80)
+			q ^= 0x09;
+		BYTE	x = (BYTE)(q ^ (q << 1 | q >> 7) ^ (q << 2 | q >> 6) ^ (q << 3 | q >> 5) ^ (q << 4 | q >> 4));	//Affine transformation
+		SBox[p] = x ^ 0x63;
+	} while (p != 1);
+	SBox[0] = 0x63;
+
+	__cpuid(CpuInfo, 0);
+	if (CpuInfo[0] < 1)
+		return false;
+	__cpuid(CpuInfo, 1);
+	return (CpuInfo[2] & (1 << 25)) && (CpuInfo[3] & (1 << 26));									//AES-NI and SSE2
+}
+
+const bool	AesHardware = DetectAesSupport();													//Detected once before WinMain, read by all threads
+
+/*
+Description:    Multiply by x in GF(2^8)
+*/
+static inline BYTE Xtime(BYTE Value) {
+	return (BYTE)((Value << 1) ^ (Value & 0x80 ? 0x1B : 0));
+}
+
+/*
+Description:    Expand an AES-128 key into round keys
+Args:			Key: The key, 16 bytes
+				RoundKeys: Buffer to store the round keys
+*/
+static void AesExpandKey(const BYTE *Key, BYTE RoundKeys[AES_ROUNDS + 1][16]) {
+	BYTE	Rcon = 1;
+
+	memcpy(RoundKeys[0], Key, 16);
+	for (int r = 1; r <= AES_ROUNDS; r++) {
+		const BYTE	*Prev = RoundKeys[r - 1];
+		BYTE		*Next = RoundKeys[r];
+		Next[0] = Prev[0] ^ SBox[Prev[13]] ^ Rcon;													//RotWord, SubWord and Rcon of the last word
+		Next[1] = Prev[1] ^ SBox[Prev[14]];
+		Next[2] = Prev[2] ^ SBox[Prev[15]];
+		Next[3] = Prev[3] ^ SBox[Prev[12]];
+		for (int i = 4; i < 16; i++)
+			Next[i] = Prev[i] ^ Next[i - 4];
+		Rcon = Xtime(Rcon);
+	}
+}
+
+/*
+Description:    Encrypt a block with AES-128 without AES-NI
+Args:			Schedule: Key schedule of the key
+				In: The block
+				Out: Buffer to store the encrypted block
+*/
+static void AesEncryptBlock(const IceKeySchedule &Schedule, const BYTE *In, BYTE *Out) {
+	BYTE	State[16], Temp[16];
+
+	for (int i = 0; i < 16; i++)
+		State[i] = In[i] ^ Schedule.RoundKeys[0][i];
+	for (int r = 1; r <= AES_ROUNDS; r++) {
+		for (int c = 0; c < 4; c++) {																//SubBytes and ShiftRows
+			for (int Row = 0; Row < 4; Row++)
+				Temp[c * 4 + Row] = SBox[State[((c + Row) & 3) * 4 + Row]];
+		}
+		for (int c = 0; c < 4; c++) {																//MixColumns, except in the last round
+			BYTE	*Column = Temp + c * 4;
+			if (r < AES_ROUNDS) {
+				BYTE	All = Column[0] ^ Column[1] ^ Column[2] ^ Column[3];
+				State[c * 4] = Column[0] ^ All ^ Xtime(Column[0] ^ Column[1]);
+				State[c * 4 + 1] = Column[1] ^ All ^ Xtime(Column[1] ^ Column[2]);
+				State[c * 4 + 2] = Column[2] ^ All ^ Xtime(Column[2] ^ Column[3]);
+				State[c * 4 + 3] = Column[3] ^ All ^ Xtime(Column[3] ^ Column[0]);
+			}
+			else
+				memcpy(State + c * 4, Column, 4);
+		}
+		for (int i = 0; i < 16; i++)
+			State[i] ^= Schedule.RoundKeys[r][i];
+	}
+	memcpy(Out, State, 16);
+}
+
+/*
+Description:    Build a counter block
+Args:			Nonce: Nonce of the sealed piece of data, CIPHER_NONCE bytes
+				Counter: Position / 16 of the block in the piece
+				Block: Buffer to store the counter block, 16 bytes
+*/
+static inline void AesCounterBlock(const BYTE *Nonce, ULONGLONG Counter, BYTE *Block) {
+	memcpy(Block, Nonce, CIPHER_NONCE);
+	memcpy(Block + CIPHER_NONCE, &Counter, 8);
+}
+
+/*
+Description:    Generate key stream with AES-NI. The blocks are encrypted side by side to hide the latency of AESENC
+Args:			Schedule: Key schedule of the key
+				Nonce: Nonce of the sealed piece of data
+				Counter: Counter of the first block
+				Blocks: No. of blocks, at most AES_PARALLEL
+				Stream: Buffer to store the key stream
+*/
+static void AesStreamAESNI(const IceKeySchedule &Schedule, const BYTE *Nonce, ULONGLONG Counter, UINT Blocks, BYTE *Stream) {
+	__m128i	Keys[AES_ROUNDS + 1], State[AES_PARALLEL];
+	BYTE	Block[16];
+
+	for (int r = 0; r <= AES_ROUNDS; r++)
+		Keys[r] = _mm_loadu_si128((const __m128i*)Schedule.RoundKeys[r]);
+	for (UINT i = 0; i < Blocks; i++) {
+		AesCounterBlock(Nonce, Counter + i, Block);
+		State[i] = _mm_xor_si128(_mm_loadu_si128((const __m128i*)Block), Keys[0]);
+	}
+	for (int r = 1; r < AES_ROUNDS; r++) {
+		for (UINT i = 0; i < Blocks; i++)
+			State[i] = _mm_aesenc_si128(State[i], Keys[r]);
+	}
+	for (UINT i = 0; i < Blocks; i++)
+		_mm_storeu_si128((__m128i*)(Stream + i * 16), _mm_aesenclast_si128(State[i], Keys[AES_ROUNDS]));
+}
+
+/*
+Description:    Encrypt or decrypt a sealed piece of data with AES-128 in counter mode. The counter blocks are the
+				nonce of the piece followed by the position / 16 in the piece
+Args:			Dest: Buffer to store the processed data
+				Src: Data to be processed
+				Length: Size of the data in bytes
+				Schedule: Key schedule of the key
+				Nonce: Nonce of the piece, CIPHER_NONCE bytes
+*/
+static void IceCryptAES(BYTE *Dest, const BYTE *Src, streamoff Length, const IceKeySchedule &Schedule, const BYTE *Nonce) {
+	BYTE		Stream[16 * AES_PARALLEL];
+	streamoff	Done = 0;
+
+	while (Done < Length) {
+		ULONGLONG	Counter = (ULONGLONG)Done / 16;
+		UINT		Blocks = (UINT)min((Length - Done + 15) / 16, (streamoff)AES_PARALLEL);
+		int			Piece = (int)min((streamoff)(16 * Blocks), Length - Done);
+		int			i = 0;
+
+		if (AesHardware)
+			AesStreamAESNI(Schedule, Nonce, Counter, Blocks, Stream);
+		else {
+			for (UINT j = 0; j < Blocks; j++) {
+				AesCounterBlock(Nonce, Counter + j, Stream + j * 16);
+				AesEncryptBlock(Schedule, Stream + j * 16, Stream + j * 16);
+			}
+		}
+		if (CipherLevel >= CIPHER_SSE2) {
+			for (; i + 16 <= Piece; i += 16) {
+				_mm_storeu_si128((__m128i*)(Dest + Done + i), _mm_xor_si128(
+					_mm_loadu_si128((const __m128i*)(Src + Done + i)), _mm_loadu_si128((const __m128i*)(Stream + i))));
+			}
+		}
+		for (; i < Piece; i++)
+			Dest[Done + i] = Src[Done + i] ^ Stream[i];
+		Done += Piece;
+	}
+}
+
+/*
+Description:    Get a nonce which is never used again. The nonces count up from a random value chosen once, so nonces
+				of different runs of the system don't meet either
+Args:			Nonce: Buffer to store the nonce, CIPHER_NONCE bytes
+*/
+static void IceNewNonce(BYTE *Nonce) {
+	lock_guard<mutex>	Lock(NonceLock);
+
+	if (!NonceSeeded) {
+		LARGE_INTEGER	Counter;
+		QueryPerformanceCounter(&Counter);
+		if (!IceRandomBytes((BYTE*)&NextNonce, sizeof(NextNonce)))								//No random source, start at a value unlikely used before
+			NextNonce = (ULONGLONG)Counter.QuadPart * 0x9E3779B97F4A7C15ULL ^ GetCurrentProcessId();
+		NonceSeeded = true;
+	}
+	memcpy(Nonce, &NextNonce, CIPHER_NONCE);
+	NextNonce++;
+}
+
+/*
+Description:    Calculate the tag of a sealed piece of data
+Args:			Schedule: Key schedule of the key
+				Data: The encrypted piece
+				Length: Size of the piece in bytes
+				Nonce: Nonce of the piece
+				Offset: Position of the piece in the file, so a piece copied to another place is rejected
+				Tag: Buffer to store the tag, CIPHER_TAG bytes
+*/
+static void IceSealTag(const IceKeySchedule &Schedule, const BYTE *Data, streamoff Length, const BYTE *Nonce, streamoff Offset,
+	BYTE *Tag) {
+
+	BYTE	Prefix[CIPHER_NONCE + sizeof(LONGLONG)];											//Nonce + position
+	BYTE	Digest[32];
+	LONGLONG	Position = Offset;
+
+	memcpy(Prefix, Nonce, CIPHER_NONCE);
+	memcpy(Prefix + CIPHER_NONCE, &Position, sizeof(Position));
+	IceHmacSha256(Schedule.MacKey, Prefix, sizeof(Prefix), Data, (size_t)Length, Digest);
+	memcpy(Tag, Digest, CIPHER_TAG);
+}
+
+/*
+Description:    Derive an AES key from a password, and register it under a token. Passing the token to
+				IceExpandKey() gives the schedule of the derived key, so tokens are used in place of passwords
+Args:			Password: The password
+				KeyFile: Salt and no. of iterations
+				Token: Buffer to receive the token, CIPHER_MAX_KEY characters. Different keys get different tokens
+*/
+void IceDeriveKey(const wchar_t *Password, const KeyFileHeader &KeyFile, wchar_t *Token) {
+	BYTE			Derived[16 + 32];																//AES key + HMAC key
+	BYTE			Digest[32];
+	IceKeySchedule	Schedule;
+
+	IcePbkdf2((const BYTE*)Password, sizeof(wchar_t) * lstrlenW(Password), KeyFile.Salt, KDF_SALT_SIZE,
+		KeyFile.Iterations, Derived, sizeof(Derived));
+	memset(&Schedule, 0, sizeof(Schedule));
+	Schedule.Algorithm = CIPHER_AES;
+	Schedule.KeyLen = 1;
+	AesExpandKey(Derived, Schedule.RoundKeys);
+	IceHmacInit(Derived + 16, 32, Schedule.MacKey);
+
+	IceSha256(Derived, sizeof(Derived), Digest);													//The token tells nothing about the key
+	Token[0] = KEY_TOKEN_PREFIX;
+	for (int i = 0; i < 8; i++)
+		swprintf_s(Token + 1 + i * 2, CIPHER_MAX_KEY - 1 - i * 2, L"%02X", Digest[i]);
+	SecureZeroMemory(Derived, sizeof(Derived));
+
+	lock_guard<mutex>	Lock(DerivedKeysLock);
+	DerivedKeys[Token] = Schedule;
+}
+
+/*
+Description:    Expand the password into a key schedule
+Args:			Key: The password, or a token from IceDeriveKey()
+				Schedule: Variable to receive the key schedule
+Return:			true if succeed, false if the token is not registered. Tokens are never used as passwords, so data
+				sealed with a derived key can't be written or read with the token by mistake
+*/
+bool IceExpandKey(const wchar_t *Key, IceKeySchedule &Schedule) {
+	if (Key[0] == KEY_TOKEN_PREFIX) {															//Token of a derived key
+		lock_guard<mutex>	Lock(DerivedKeysLock);
+		map<wstring, IceKeySchedule>::const_iterator	it = DerivedKeys.find(Key);
+		if (it == DerivedKeys.end())
+			return false;
+		Schedule = it->second;
+		return true;
+	}
+	Schedule.Algorithm = CIPHER_XOR;
+	Schedule.KeyLen = lstrlenW(Key);
+	if (Schedule.KeyLen > CIPHER_MAX_KEY)														//Longer passwords are not accepted by the UI
+		Schedule.KeyLen = CIPHER_MAX_KEY;
+	if (Schedule.KeyLen <= 0) {																	//No password, nothing is encrypted
+		Schedule.KeyLen = 1;
+		memset(Schedule.Stream, 0, sizeof(Schedule.Stream));
+		return true;
+	}
+	for (int i = 0; i < CIPHER_MAX_KEY + CIPHER_BLOCK; i++)										//Key bytes of positions 0 ~ KeyLen + 63
+		Schedule.Stream[i] = (BYTE)(487 ^ Key[i % Schedule.KeyLen]);
+	return true;
+}
+
+/*
+Description:    AVX2 kernel, 64 bytes per step
+Args:			See IceCryptBlock()
+				Phase: Position of the first byte in the key
+Return:			No. of bytes processed
+*/
+static streamoff IceCryptAVX2(BYTE *Dest, const BYTE *Src, streamoff Length, const IceKeySchedule &Schedule, int &Phase) {
+	streamoff	i = 0;
+	int			Step = CIPHER_BLOCK % Schedule.KeyLen;
+
+	for (; i + CIPHER_BLOCK <= Length; i += CIPHER_BLOCK) {
+		__m256i	Key0 = _mm256_loadu_si256((const __m256i*)(Schedule.Stream + Phase));
+		__m256i	Key1 = _mm256_loadu_si256((const __m256i*)(Schedule.Stream + Phase + 32));
+		_mm256_storeu_si256((__m256i*)(Dest + i), _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(Src + i)), Key0));
+		_mm256_storeu_si256((__m256i*)(Dest + i + 32), _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(Src + i + 32)), Key1));
+		Phase += Step;
+		if (Phase >= Schedule.KeyLen)
+			Phase -= Schedule.KeyLen;
+	}
+	_mm256_zeroupper();																			//Avoid AVX-SSE transition penalty
+	return i;
+}
+
+/*
+Description:    SSE2 kernel, 16 bytes per step
+Args:			See IceCryptBlock()
+				Phase: Position of the first byte in the key
+Return:			No. of bytes processed
+*/
+static streamoff IceCryptSSE2(BYTE *Dest, const BYTE *Src, streamoff Length, const IceKeySchedule &Schedule, int &Phase) {
+	streamoff	i = 0;
+	int			Step = 16 % Schedule.KeyLen;
+
+	for (; i + 16 <= Length; i += 16) {
+		__m128i	Key = _mm_loadu_si128((const __m128i*)(Schedule.Stream + Phase));
+		_mm_storeu_si128((__m128i*)(Dest + i), _mm_xor_si128(_mm_loadu_si128((const __m128i*)(Src + i)), Key));
+		Phase += Step;
+		if (Phase >= Schedule.KeyLen)
+			Phase -= Schedule.KeyLen;
+	}
+	return i;
+}
+
+/*
+Description:    Encrypt or decrypt a piece of data with the password. Dest and Src can be the same buffer.
+				Data encrypted with a derived key is sealed instead, see IceSealBlock()
+Args:			Dest: Buffer to store the processed data
+				Src: Data to be processed
+				Length: Size of the data in bytes
+				Schedule: Key schedule of the password, CIPHER_XOR
+				Offset: Position of the first byte of Src in the file
+*/
+void IceCryptBlock(BYTE *Dest, const BYTE *Src, streamoff Length, const IceKeySchedule &Schedule, streamoff Offset) {
+	IceCryptKernel(Dest, Src, Length, Schedule, Offset, CipherLevel);
+}
+
+/*
+Description:    Encrypt or decrypt a piece of data with the password like IceCryptBlock(), with a given kernel.
+				Every kernel gives the same bytes, the benchmarks compare them
+Args:			See IceCryptBlock()
+				Level: CIPHER_AVX2, CIPHER_SSE2 or CIPHER_SCALAR, not above CipherLevel
+*/
+void IceCryptKernel(BYTE *Dest, const BYTE *Src, streamoff Length, const IceKeySchedule &Schedule, streamoff Offset, int Level) {
+	int			Phase = (int)(Offset % Schedule.KeyLen);
+	streamoff	Done = 0;
+
+	if (Level >= CIPHER_AVX2)
+		Done += IceCryptAVX2(Dest, Src, Length, Schedule, Phase);
+	if (Level >= CIPHER_SSE2)
+		Done += IceCryptSSE2(Dest + Done, Src + Done, Length - Done, Schedule, Phase);
+	for (; Done < Length; Done++) {																//The rest bytes
+		Dest[Done] = Src[Done] ^ Schedule.Stream[Phase];
+		if (++Phase == Schedule.KeyLen)
+			Phase = 0;
+	}
+}
+
+/*
+Description:    Get the no. of bytes following a sealed piece of data
+Args:			Schedule: Key schedule of the key
+Return:			CIPHER_SEAL for a derived key, 0 for a password
+*/
+int IceSealSize(const IceKeySchedule &Schedule) {
+	return Schedule.Algorithm == CIPHER_AES ? CIPHER_SEAL : 0;
+}
+
+/*
+Description:    Seal a piece of data: encrypt it with a new nonce, and append the nonce and the tag of the encrypted
+				piece. With a password, the piece is encrypted with its position like IceCryptBlock() and nothing is
+				appended, so files encrypted with passwords keep their layout. Dest and Src can be the same buffer
+Args:			Dest: Buffer to store the sealed piece, Length + IceSealSize() bytes
+				Src: Data to be sealed
+				Length: Size of the data in bytes
+				Schedule: Key schedule of the key
+				Offset: Position of the piece in the file
+*/
+void IceSealBlock(BYTE *Dest, const BYTE *Src, streamoff Length, const IceKeySchedule &Schedule, streamoff Offset) {
+	if (Schedule.Algorithm != CIPHER_AES) {
+		IceCryptBlock(Dest, Src, Length, Schedule, Offset);
+		return;
+	}
+
+	BYTE	*Nonce = Dest + Length;
+
+	IceNewNonce(Nonce);
+	IceCryptAES(Dest, Src, Length, Schedule, Nonce);
+	IceSealTag(Schedule, Dest, Length, Nonce, Offset, Nonce + CIPHER_NONCE);
+}
+
+/*
+Description:    Open a piece of data sealed by IceSealBlock(): check the tag, then decrypt the piece.
+				Dest and Src can be the same buffer
+Args:			Dest: Buffer to store the decrypted data, Length bytes
+				Src: The sealed piece, Length + IceSealSize() bytes
+				Length: Size of the data in bytes
+				Schedule: Key schedule of the key
+				Offset: Position of the piece in the file
+Return:			true if succeed, false if the piece is damaged, forged, moved or sealed with another key.
+				Nothing is decrypted then
+*/
+bool IceOpenBlock(BYTE *Dest, const BYTE *Src, streamoff Length, const IceKeySchedule &Schedule, streamoff Offset) {
+	if (Schedule.Algorithm != CIPHER_AES) {
+		IceCryptBlock(Dest, Src, Length, Schedule, Offset);
+		return true;
+	}
+
+	const BYTE	*Nonce = Src + Length;
+	BYTE		Tag[CIPHER_TAG];
+	BYTE		Diff = 0;
+
+	IceSealTag(Schedule, Src, Length, Nonce, Offset, Tag);
+	for (int i = 0; i < CIPHER_TAG; i++)														//Compare every byte, so the time tells nothing
+		Diff |= Tag[i] ^ Nonce[CIPHER_NONCE + i];
+	if (Diff)
+		return false;
+	IceCryptAES(Dest, Src, Length, Schedule, Nonce);
+	return true;
+}
\ No newline at end of file
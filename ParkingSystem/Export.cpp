@@ -0,0 +1,324 @@
+/*
+Description:    Export records to CSV or NDJSON files. Fields are formatted by hand instead of swprintf_s,
+                and the text is written in large pieces. Chunks of records can be formatted by several
+                threads, and are still written in order
+Author:         Hanson
+File:           Export.cpp
+*/
+
+#include "FileManager.h"
+
+static const char	DigitPairs[] =																//Two-digit numbers 00 ~ 99
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839404142434445464748495051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+/* Description:		Formatting state of a thread. The date of a record is usually the same as the last one */
+struct ExportFormatter {
+	LONGLONG		CachedDay = -1;					//Day of CachedDate, days since 1970-01-01
+	char			CachedDate[11];					//"YYYY-MM-DD "
+};
+
+/*
+Description:    Write a number of two digits
+Args:			Out: Output position
+				Value: The number, 0 ~ 99
+Return:			Position after the written text
+*/
+static inline char *IceWriteTwoDigits(char *Out, UINT Value) {
+	memcpy(Out, DigitPairs + Value * 2, 2);
+	return Out + 2;
+}
+
+/*
+Description:    Write an unsigned integer
+Args:			Out: Output position
+				Value: The number
+Return:			Position after the written text
+*/
+static char *IceWriteUInt(char *Out, UINT Value) {
+	char	Buffer[10];
+	char	*p = Buffer + sizeof(Buffer);
+
+	while (Value >= 100) {																		//Two digits at a time, from the end
+		p -= 2;
+		memcpy(p, DigitPairs + Value % 100 * 2, 2);
+		Value /= 100;
+	}
+	if (Value >= 10) {
+		p -= 2;
+		memcpy(p, DigitPairs + Value * 2, 2);
+	}
+	else
+		*--p = (char)('0' + Value);
+	memcpy(Out, p, Buffer + sizeof(Buffer) - p);
+	return Out + (Buffer + sizeof(Buffer) - p);
+}
+
+/*
+Description:    Write a time as "YYYY-MM-DD hh:mm:ss"
+Args:			Out: Output position
+				Time: The time, see IceToEpoch()
+				Formatter: Formatting state of the thread
+Return:			Position after the written text
+*/
+static char *IceWriteTime(char *Out, LONGLONG Time, ExportFormatter &Formatter) {
+	LONGLONG	Day = (Time >= 0 ? Time : Time - (SECONDS_PER_DAY - 1)) / SECONDS_PER_DAY;
+	UINT		Seconds = (UINT)(Time - Day * SECONDS_PER_DAY);
+
+	if (Day != Formatter.CachedDay) {															//Convert the date only when it changes
+		SYSTEMTIME	stDate = IceFromEpoch(Time);
+		char		*p = Formatter.CachedDate;
+		p = IceWriteTwoDigits(p, stDate.wYear / 100 % 100);
+		p = IceWriteTwoDigits(p, stDate.wYear % 100);
+		*p++ = '-';
+		p = IceWriteTwoDigits(p, stDate.wMonth);
+		*p++ = '-';
+		p = IceWriteTwoDigits(p, stDate.wDay);
+		*p = ' ';
+		Formatter.CachedDay = Day;
+	}
+	memcpy(Out, Formatter.CachedDate, sizeof(Formatter.CachedDate));
+	Out += sizeof(Formatter.CachedDate);
+	Out = IceWriteTwoDigits(Out, Seconds / 3600);
+	*Out++ = ':';
+	Out = IceWriteTwoDigits(Out, Seconds / 60 % 60);
+	*Out++ = ':';
+	return IceWriteTwoDigits(Out, Seconds % 60);
+}
+
+/*
+Description:    Write a fee as dollars, e.g. "12.50"
+Args:			Out: Output position
+				Fee: The fee, in cents
+Return:			Position after the written text
+*/
+static char *IceWriteFee(char *Out, int Fee) {
+	UINT	Cents = (UINT)Fee;
+
+	if (Fee < 0) {
+		*Out++ = '-';
+		Cents = 0u - Cents;
+	}
+	Out = IceWriteUInt(Out, Cents / 100);
+	*Out++ = '.';
+	return IceWriteTwoDigits(Out, Cents % 100);
+}
+
+/*
+Description:    Write a car number, see IceUnpackCarNumber()
+Args:			Out: Output position
+				Packed: The packed car number
+Return:			Position after the written text
+*/
+static char *IceWriteCarNumber(char *Out, ULONGLONG Packed) {
+	int		Length = 0;
+
+	while (Packed != 0 && Length < CAR_NUMBER_MAX) {
+		UINT	Digit = (UINT)(Packed % 37);
+		Out[Length++] = (char)(Digit <= 10 ? '0' + Digit - 1 : 'A' + Digit - 11);
+		Packed /= 37;
+	}
+	return Out + Length;
+}
+
+/*
+Description:    Check if a record should be exported
+Args:			Info: The record
+				Options: Export options
+Return:			true if the record should be exported, false otherwise
+*/
+static inline bool IceExportFilter(const LogInfo &Info, const ExportOptions &Options) {
+	if (Info.EnterTime < Options.From || Info.EnterTime > Options.To)
+		return false;
+	if (Options.Status == EXPORT_CLOSED)
+		return Info.LeaveTime != 0;
+	if (Options.Status == EXPORT_OPEN)
+		return Info.LeaveTime == 0;
+	return true;
+}
+
+/*
+Description:    Format records
+Args:			Records: The records
+				Count: No. of records
+				Options: Export options
+				Out: String to store the text
+				Exported: Variable to receive the no. of records formatted
+*/
+static void IceFormatRecords(const LogInfo *Records, size_t Count, const ExportOptions *Options, string *Out, size_t *Exported) {
+	ExportFormatter	Formatter;
+	char			*Begin, *p;
+
+	Out->resize(Count * EXPORT_MAX_LINE);
+	Begin = p = &(*Out)[0];
+	*Exported = 0;
+	for (size_t i = 0; i < Count; i++) {
+		const LogInfo	&Info = Records[i];
+		if (!IceExportFilter(Info, *Options))
+			continue;
+
+		if (Options->Format == EXPORT_NDJSON) {
+			memcpy(p, "{\"car_number\":\"", 15);
+			p = IceWriteCarNumber(p + 15, Info.CarNumber);
+			memcpy(p, "\",\"enter_time\":\"", 16);
+			p = IceWriteTime(p + 16, Info.EnterTime, Formatter);
+			if (Info.LeaveTime) {
+				memcpy(p, "\",\"leave_time\":\"", 16);
+				p = IceWriteTime(p + 16, Info.LeaveTime, Formatter);
+				*p++ = '"';
+			}
+			else {
+				memcpy(p, "\",\"leave_time\":null", 19);
+				p += 19;
+			}
+			memcpy(p, ",\"position\":", 12);
+			p = IceWriteUInt(p + 12, Info.CarPos + 1);
+			memcpy(p, ",\"fee\":", 7);
+			p = IceWriteFee(p + 7, Info.Fee);
+			*p++ = '}';
+		}
+		else {																						//car_number,enter_time,leave_time,position,fee
+			p = IceWriteCarNumber(p, Info.CarNumber);
+			*p++ = ',';
+			p = IceWriteTime(p, Info.EnterTime, Formatter);
+			*p++ = ',';
+			if (Info.LeaveTime)																			//Empty if the car is still parking
+				p = IceWriteTime(p, Info.LeaveTime, Formatter);
+			*p++ = ',';
+			p = IceWriteUInt(p, Info.CarPos + 1);
+			*p++ = ',';
+			p = IceWriteFee(p, Info.Fee);
+		}
+		*p++ = '\n';
+		(*Exported)++;
+	}
+	Out->resize(p - Begin);
+}
+
+/*
+Description:    Write data to the end of a file
+Args:			hFile: Handle to the file
+				Data: The data
+				Length: Size of the data in bytes
+Return:			true if succeed, false otherwise
+*/
+static bool IceWriteAll(HANDLE hFile, const char *Data, size_t Length) {
+	while (Length > 0) {
+		DWORD	Piece = (DWORD)min(Length, FILE_IO_CHUNK), Written;
+		if (!WriteFile(hFile, Data, Piece, &Written, NULL) || Written != Piece)
+			return false;
+		Data += Piece;
+		Length -= Piece;
+	}
+	return true;
+}
+
+/*
+Description:    Get the records stored one after another from a record on, the rest of a chunk of IceRecordReader
+Args:			Records: The records
+				Index: Index of the first record
+				Count: Variable to receive the no. of records. Unlimited, as the caller knows the size of the chunk
+Return:			Pointer to the first record
+*/
+static const LogInfo *IceGetRun(const LogInfo *Records, size_t Index, size_t &Count) {
+	Count = (size_t)-1;
+	return Records + Index;
+}
+
+/*
+Description:    Get the records stored one after another from a record on, up to the end of its chunk
+Args:			Records: The records
+				Index: Index of the first record
+				Count: Variable to receive the no. of records
+Return:			Pointer to the first record
+*/
+static const LogInfo *IceGetRun(const IceRecordStore &Records, size_t Index, size_t &Count) {
+	return Records.GetRun(Index, Count);
+}
+
+/*
+Description:    Format records on several threads and write them in order. A piece given to a thread never
+				crosses a chunk of an IceRecordStore
+Args:			hFile: Handle to the output file
+				Records: The records, a chunk of IceRecordReader or an IceRecordStore
+				Count: No. of records
+				Options: Export options
+				Threads: No. of threads
+				Parts: Buffers of the threads, kept between calls to save allocations
+				Exported: Variable to add the no. of exported records to
+Return:			true if succeed, false otherwise
+*/
+template <class RecordArray> static bool IceExportBatch(HANDLE hFile, const RecordArray &Records, size_t Count,
+	const ExportOptions &Options, UINT Threads, vector<string> &Parts, ULONGLONG &Exported) {
+
+	vector<size_t>	Counts(Threads);
+
+	for (size_t Done = 0; Done < Count;) {
+		vector<thread>	Workers;
+		size_t			FirstPiece;
+		const LogInfo	*First = IceGetRun(Records, Done, FirstPiece);
+		UINT			Used = 1;
+
+		FirstPiece = min(min(FirstPiece, Count - Done), EXPORT_CHUNK_RECORDS);
+		Done += FirstPiece;
+		for (; Used < Threads && Done < Count; Used++) {											//The following chunks go to worker threads
+			size_t			Piece;
+			const LogInfo	*Run = IceGetRun(Records, Done, Piece);
+			Piece = min(min(Piece, Count - Done), EXPORT_CHUNK_RECORDS);
+			Workers.push_back(thread(IceFormatRecords, Run, Piece, &Options, &Parts[Used], &Counts[Used]));
+			Done += Piece;
+		}
+		IceFormatRecords(First, FirstPiece, &Options, &Parts[0], &Counts[0]);						//The first chunk is formatted by this thread
+		for (UINT i = 0; i < Workers.size(); i++)
+			Workers[i].join();
+		for (UINT i = 0; i < Used; i++) {															//Write in order
+			if (!IceWriteAll(hFile, Parts[i].data(), Parts[i].size()))
+				return false;
+			Exported += Counts[i];
+		}
+	}
+	return true;
+}
+
+/*
+Description:    Export the records of the archived segments and the log file, in this order. The segments are streamed
+				with IceRecordReader, so a chunk of records per thread is kept in memory, however large a segment is
+Args:			Path: Path of the output file, replaced if it exists
+				Options: Export options
+				Exported: Variable to receive the no. of exported records, can be NULL
+Return:			true if succeed, false if the output file can't be written or a segment is damaged
+*/
+bool IceEncryptedFile::ExportRecords(const wstring &Path, const ExportOptions &Options, ULONGLONG *Exported) {
+	HANDLE			hFile;
+	UINT			Threads = min(Options.Threads ? Options.Threads : max(thread::hardware_concurrency(), 1u), EXPORT_MAX_THREADS);
+	vector<string>	Parts(Threads);
+	IceRecordReader	Reader(sizeof(LogInfo) * EXPORT_CHUNK_RECORDS * Threads);					//A piece for every thread
+	const LogInfo	*Chunk;
+	UINT			ChunkCount;
+	ULONGLONG		Count = 0;
+	bool			Result = true;
+
+	hFile = CreateFileW(Path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+	if (Options.Format == EXPORT_CSV) {
+		const char	Header[] = "car_number,enter_time,leave_time,position,fee\n";
+		Result = IceWriteAll(hFile, Header, sizeof(Header) - 1);
+	}
+	for (UINT i = 0; Result && i < Segments.size(); i++) {										//A segment holds the records of a month at most
+		if (Segments[i].FirstTime > Options.To || Segments[i].LastTime < Options.From)				//No car of the segment entered in the period
+			continue;
+		Result = Reader.Open(GetSegmentPath(Segments[i].Year, Segments[i].Month), CipherKey.c_str(), Options.From, Options.To);
+		while (Result && Reader.Next(Chunk, ChunkCount))
+			Result = IceExportBatch(hFile, Chunk, ChunkCount, Options, Threads, Parts, Count);
+		Result = Result && !Reader.Failed && Reader.ElementCount == Segments[i].ElementCount;	//Damaged segment
+		Reader.Close();
+	}
+	if (Result)
+		Result = IceExportBatch(hFile, FileContent.LogData, FileContent.ElementCount, Options, Threads, Parts, Count);
+	CloseHandle(hFile);
+	if (!Result)																				//Don't leave a partial export behind
+		DeleteFileW(Path.c_str());
+	if (Exported)
+		*Exported = Count;
+	return Result;
+}
\ No newline at end of file
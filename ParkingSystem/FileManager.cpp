@@ -7,182 +7,2747 @@ File:           FileManager.cpp
 
 #include "FileManager.h"
 
+/*
+Description:    Encrypt or decrypt a piece of data with the password. The key byte of every byte
+				depends on its position only, so any part of a file can be processed on its own
+Args:			Buffer: Data to be processed
+				Length: Size of the data in bytes
+				Key: The password
+				Offset: Position of the first byte of Buffer in the file
+Return:			true if succeed, false if the key is a derived key, whose data is sealed instead (see IceSeal())
+*/
+static bool IceCrypt(BYTE *Buffer, streamoff Length, const wchar_t *Key, streamoff Offset) {
+	IceKeySchedule	Schedule;
+
+	if (!IceExpandKey(Key, Schedule) || IceSealSize(Schedule))
+		return false;
+	IceCryptBlock(Buffer, Buffer, Length, Schedule, Offset);
+	return true;
+}
+
+/*
+Description:    Get the no. of bytes following a sealed piece of data, see IceSealBlock()
+Args:			Key: The password, or a token from IceDeriveKey()
+Return:			CIPHER_SEAL for a derived key, 0 for a password
+*/
+static int IceSealSize(const wchar_t *Key) {
+	return Key[0] == KEY_TOKEN_PREFIX ? CIPHER_SEAL : 0;
+}
+
+/*
+Description:    Seal a piece of data in place, see IceSealBlock()
+Args:			Buffer: Data to be sealed, followed by room for the seal
+				Length: Size of the data in bytes, the seal not included
+				Key: The password, or a token from IceDeriveKey()
+				Offset: Position of the piece in the file
+Return:			true if succeed, false if the key is not registered
+*/
+static bool IceSeal(BYTE *Buffer, streamoff Length, const wchar_t *Key, streamoff Offset) {
+	IceKeySchedule	Schedule;
+
+	if (!IceExpandKey(Key, Schedule))
+		return false;
+	IceSealBlock(Buffer, Buffer, Length, Schedule, Offset);
+	return true;
+}
+
+/*
+Description:    Open a piece of data sealed by IceSeal() in place, see IceOpenBlock()
+Args:			Buffer: The sealed piece
+				Length: Size of the data in bytes, the seal not included
+				Key: The password, or a token from IceDeriveKey()
+				Offset: Position of the piece in the file
+Return:			true if succeed, false if the key is not registered, or the piece is damaged or sealed with another key
+*/
+static bool IceOpen(BYTE *Buffer, streamoff Length, const wchar_t *Key, streamoff Offset) {
+	IceKeySchedule	Schedule;
+
+	return IceExpandKey(Key, Schedule) && IceOpenBlock(Buffer, Buffer, Length, Schedule, Offset);
+}
+
+/*
+Description:    Decrypt a part of a mapped file into a buffer. The file is mapped piece by piece,
+				so the address space used does not depend on the size of the file
+Args:			hMapping: Handle to the file mapping object
+				Offset: Position of the first byte to be decrypted in the file
+				Dest: Buffer to store the decrypted data
+				Length: Size of the data in bytes
+				Key: The password
+Return:			true if succeed, false otherwise
+*/
+static bool IceCryptMapping(HANDLE hMapping, streamoff Offset, BYTE *Dest, streamoff Length, const wchar_t *Key) {
+	IceKeySchedule	Schedule;
+
+	if (!IceExpandKey(Key, Schedule) || IceSealSize(Schedule))										//Only files of LOG_VERSION are sealed, see IceLoadBlocks()
+		return false;
+
+	while (Length > 0) {
+		streamoff	ViewBase = Offset - Offset % MAPPING_VIEW_SIZE;										//Views must start at a multiple of the allocation granularity
+		streamoff	ViewEnd = ViewBase + MAPPING_VIEW_SIZE;
+		if (ViewEnd > Offset + Length)
+			ViewEnd = Offset + Length;
+
+		BYTE	*View = (BYTE*)MapViewOfFile(hMapping, FILE_MAP_READ,
+			(DWORD)(ViewBase >> 32), (DWORD)ViewBase, (size_t)(ViewEnd - ViewBase));				//Map the current piece
+		if (!View)
+			return false;
+		IceCryptBlock(Dest, View + (Offset - ViewBase), ViewEnd - Offset, Schedule, Offset);		//Decrypt from the view into the buffer
+		Dest += ViewEnd - Offset;
+		UnmapViewOfFile(View);
+
+		Length -= ViewEnd - Offset;
+		Offset = ViewEnd;
+	}
+	return true;
+}
+
+/*
+Description:    Convert a time to seconds since 1970-01-01 00:00:00. No time zone is applied, so local times
+				stay local. Day of week and milliseconds are ignored
+Args:			Time: The time
+Return:			Seconds since 1970-01-01 00:00:00
+*/
+LONGLONG IceToEpoch(const SYSTEMTIME &Time) {
+	int			Year = Time.wYear - (Time.wMonth <= 2 ? 1 : 0);									//Years start from March, so leap days are at the end
+	int			Era = (Year >= 0 ? Year : Year - 399) / 400;									//400-year cycles
+	int			YearOfEra = Year - Era * 400;
+	int			DayOfYear = (153 * ((Time.wMonth + 9) % 12) + 2) / 5 + Time.wDay - 1;
+	int			DayOfEra = YearOfEra * 365 + YearOfEra / 4 - YearOfEra / 100 + DayOfYear;
+	LONGLONG	Days = (LONGLONG)Era * 146097 + DayOfEra - 719468;								//Days since 1970-01-01
+
+	return Days * 86400 + Time.wHour * 3600 + Time.wMinute * 60 + Time.wSecond;
+}
+
+/*
+Description:    Convert seconds since 1970-01-01 00:00:00 to a time. See IceToEpoch()
+Args:			Time: Seconds since 1970-01-01 00:00:00
+Return:			The time
+*/
+SYSTEMTIME IceFromEpoch(LONGLONG Time) {
+	SYSTEMTIME	Result = {};
+	LONGLONG	Days = (Time >= 0 ? Time : Time - 86399) / 86400;								//Round towards negative infinity
+	int			Seconds = (int)(Time - Days * 86400);
+	LONGLONG	Shifted = Days + 719468;														//Days since 0000-03-01
+	LONGLONG	Era = (Shifted >= 0 ? Shifted : Shifted - 146096) / 146097;
+	int			DayOfEra = (int)(Shifted - Era * 146097);
+	int			YearOfEra = (DayOfEra - DayOfEra / 1460 + DayOfEra / 36524 - DayOfEra / 146096) / 365;
+	int			DayOfYear = DayOfEra - (YearOfEra * 365 + YearOfEra / 4 - YearOfEra / 100);
+	int			MonthIndex = (5 * DayOfYear + 2) / 153;											//0 = March
+
+	Result.wDay = (WORD)(DayOfYear - (153 * MonthIndex + 2) / 5 + 1);
+	Result.wMonth = (WORD)(MonthIndex < 10 ? MonthIndex + 3 : MonthIndex - 9);
+	Result.wYear = (WORD)(Era * 400 + YearOfEra + (Result.wMonth <= 2 ? 1 : 0));
+	Result.wDayOfWeek = (WORD)(((Days + 4) % 7 + 7) % 7);										//1970-01-01 is Thursday
+	Result.wHour = (WORD)(Seconds / 3600);
+	Result.wMinute = (WORD)(Seconds / 60 % 60);
+	Result.wSecond = (WORD)(Seconds % 60);
+	return Result;
+}
+
+/*
+Description:    Pack a car number into an integer. Each character is a base-37 digit
+				('0' ~ '9' = 1 ~ 10, 'A' ~ 'Z' = 11 ~ 36) and the first character is the lowest digit
+Args:			CarNumber: The car number, letters and digits only
+Return:			The packed car number, 0 if the car number is empty, too long or contains other characters
+*/
+ULONGLONG IcePackCarNumber(const wchar_t *CarNumber) {
+	int			Length = lstrlenW(CarNumber);
+	ULONGLONG	Packed = 0;
+
+	if (Length > CAR_NUMBER_MAX)
+		return 0;
+	for (int i = Length - 1; i >= 0; i--) {
+		wchar_t		ch = CarNumber[i];
+		ULONGLONG	Digit;
+		if (ch >= '0' && ch <= '9')
+			Digit = ch - '0' + 1;
+		else if (ch >= 'A' && ch <= 'Z')
+			Digit = ch - 'A' + 11;
+		else if (ch >= 'a' && ch <= 'z')
+			Digit = ch - 'a' + 11;
+		else
+			return 0;
+		Packed = Packed * 37 + Digit;
+	}
+	return Packed;
+}
+
+/*
+Description:    Unpack a car number packed by IcePackCarNumber()
+Args:			Packed: The packed car number
+				CarNumber: Buffer to store the car number, CAR_NUMBER_MAX + 1 characters
+*/
+void IceUnpackCarNumber(ULONGLONG Packed, wchar_t *CarNumber) {
+	int		Length = 0;
+
+	while (Packed != 0 && Length < CAR_NUMBER_MAX) {
+		UINT	Digit = (UINT)(Packed % 37);
+		CarNumber[Length++] = (wchar_t)(Digit <= 10 ? '0' + Digit - 1 : 'A' + Digit - 11);
+		Packed /= 37;
+	}
+	CarNumber[Length] = 0;
+}
+
+/*
+Description:    Convert a record of a legacy (version 1) file
+Args:			Legacy: The legacy record
+Return:			The converted record. The car number is 0 if it can't be packed
+*/
+static LogInfo IceConvertLegacyRecord(const LegacyLogInfo &Legacy) {
+	LogInfo		Info;
+	wchar_t		CarNumber[15];
+
+	memcpy(CarNumber, Legacy.CarNumber, sizeof(CarNumber));
+	CarNumber[14] = 0;																			//Damaged records may not be terminated
+	Info.CarNumber = IcePackCarNumber(CarNumber);
+	Info.EnterTime = IceToEpoch(Legacy.EnterTime);
+	Info.LeaveTime = Legacy.LeaveTime.wYear ? IceToEpoch(Legacy.LeaveTime) : 0;
+	Info.Fee = (int)(Legacy.Fee * 100 + 0.5f);
+	Info.CarPos = (UINT)Legacy.CarPos;
+	return Info;
+}
+
+/*
+Description:    Calculate the checksum (FNV-1a) of a piece of data
+Args:			Data: The data
+				Length: Size of the data in bytes
+Return:			The checksum
+*/
+DWORD IceChecksum(const BYTE *Data, streamoff Length) {
+	DWORD	Hash = 2166136261;
+
+	for (streamoff i = 0; i < Length; i++) {
+		Hash ^= Data[i];
+		Hash *= 16777619;
+	}
+	return Hash;
+}
+
+/*
+Description:    Get the size of the header of a record file
+Args:			Version: Format version of the file
+Return:			The size in bytes, 0 if the version is not supported
+*/
+int IceRecordHeaderSize(DWORD Version) {
+	switch (Version) {
+	case LOG_VERSION:
+	case WIDE_LOG_VERSION:
+		return FILE_HEADER_SIZE;
+	case SMALL_LOG_VERSION:
+		return SMALL_HEADER_SIZE;
+	default:
+		return 0;
+	}
+}
+
+/*
+Description:    Get the no. of bytes taken by the header of a record file. The header of a checksummed file takes a
+				whole block, which is sealed as a piece if the file is encrypted with a derived key
+Args:			Version: Format version of the file
+Return:			The size in bytes, 0 if the version is not supported
+*/
+int IceRecordHeaderSpan(DWORD Version) {
+	return Version == LOG_VERSION ? CHECK_BLOCK_SIZE : IceRecordHeaderSize(Version);
+}
+
+/*
+Description:    Decrypt the header of a record file in place. Files encrypted with a derived key are always
+				checksummed, so a header of another version is rejected then
+Args:			Header: The header, magic and version included, IceRecordHeaderSpan() bytes
+				Schedule: Key schedule of the key
+Return:			true if succeed, false if the version is not supported, or the sealed header is damaged
+				or sealed with another key
+*/
+bool IceOpenRecordHeader(BYTE *Header, const IceKeySchedule &Schedule) {
+	DWORD	Version;
+	int		Span, Seal = IceSealSize(Schedule);
+
+	memcpy(&Version, Header + sizeof(DWORD), sizeof(DWORD));
+	Span = IceRecordHeaderSpan(Version);
+	if (Span == 0 || (Seal && Version != LOG_VERSION))
+		return false;
+	return IceOpenBlock(Header + FILE_PLAIN_SIZE, Header + FILE_PLAIN_SIZE, Span - FILE_PLAIN_SIZE - Seal, Schedule, FILE_PLAIN_SIZE);
+}
+
+/*
+Description:    Get the fields of a decrypted record file header. The element count of
+				SMALL_LOG_VERSION files is widened to 64 bits
+Args:			Header: The header, magic and version included
+				Password: The password
+				ElementCount: Variable to receive the number of records
+				FeePerHour: Variable to receive the fee per hour
+				Capacity: Variable to receive the no. of parking positions, can be NULL. PARKING_CAPACITY if the file
+						  doesn't store one
+Return:			true if the header is valid and the password matches, false otherwise
+*/
+bool IceParseRecordHeader(const BYTE *Header, const wchar_t *Password, ULONGLONG &ElementCount, float &FeePerHour,
+	UINT *Capacity) {
+	DWORD		Signature[2];																	//Magic + version
+	const BYTE	*Fields = Header + FILE_PLAIN_SIZE + sizeof(wchar_t) * 20;						//Fields after the password
+
+	memcpy(Signature, Header, sizeof(Signature));
+	if (Signature[0] != LOG_MAGIC || lstrcmpW((wchar_t*)(Header + FILE_PLAIN_SIZE), Password))	//Not a record file or wrong password
+		return false;
+	if (Signature[1] == LOG_VERSION || Signature[1] == WIDE_LOG_VERSION) {
+		memcpy(&ElementCount, Fields, sizeof(ULONGLONG));											//Element count
+		memcpy(&FeePerHour, Fields + sizeof(ULONGLONG), sizeof(float));								//Fee per hour
+		if (Capacity)
+			memcpy(Capacity, Fields + sizeof(ULONGLONG) + sizeof(float), sizeof(UINT));				//No. of parking positions, 0 in older files
+	}
+	else if (Signature[1] == SMALL_LOG_VERSION) {
+		UINT	Count;
+		memcpy(&Count, Fields, sizeof(UINT));														//Element count
+		memcpy(&FeePerHour, Fields + sizeof(UINT), sizeof(float));									//Fee per hour
+		ElementCount = Count;
+		if (Capacity)
+			*Capacity = 0;
+	}
+	else																						//Unknown format
+		return false;
+	if (Capacity && (*Capacity < PARKING_MIN_CAPACITY || *Capacity > PARKING_MAX_CAPACITY))
+		*Capacity = PARKING_CAPACITY;
+	return true;
+}
+
+/*
+Description:    Get the archive generation of a decrypted record file header, see IceEncryptedFile::LogGeneration
+Args:			Header: The header, magic and version included, IceRecordHeaderSpan() bytes
+Return:			The generation, 0 if the version doesn't store one
+*/
+static UINT IceRecordGeneration(const BYTE *Header) {
+	DWORD	Version;
+	UINT	Generation = 0;
+
+	memcpy(&Version, Header + sizeof(DWORD), sizeof(DWORD));
+	if (Version == LOG_VERSION)																	//Stored in the padding of the header block
+		memcpy(&Generation, Header + LOG_GENERATION_OFFSET, sizeof(UINT));
+	return Generation;
+}
+
+/*
+Description:    Read the archive generation of a record file from its header
+Args:			Path: Path of the record file
+				Password: The password
+				Generation: Variable to receive the generation
+Return:			true if succeed, false if the file can't be read, or the password doesn't match
+*/
+static bool IceReadRecordGeneration(const wstring &Path, const wchar_t *Password, UINT &Generation) {
+	BYTE			Header[CHECK_BLOCK_SIZE];
+	DWORD			Version;
+	int				Span;
+	ULONGLONG		ElementCount;
+	float			FeePerHour;
+	IceKeySchedule	Schedule;
+	ifstream		fsIn;
+
+	fsIn.open(Path.c_str(), ios::binary);
+	if (!fsIn.read((char*)Header, FILE_PLAIN_SIZE))
+		return false;
+	memcpy(&Version, Header + sizeof(DWORD), sizeof(DWORD));
+	if ((Span = IceRecordHeaderSpan(Version)) == 0 || !fsIn.read((char*)Header + FILE_PLAIN_SIZE, Span - FILE_PLAIN_SIZE))
+		return false;
+	if (!IceExpandKey(Password, Schedule) || !IceOpenRecordHeader(Header, Schedule) ||
+		!IceParseRecordHeader(Header, Password, ElementCount, FeePerHour, NULL))
+		return false;
+	Generation = IceRecordGeneration(Header);
+	return true;
+}
+
+/*
+Description:    Get the position of a record in a record file
+Args:			Version: Format version of the file
+				Index: Index of the record
+Return:			The position in bytes
+*/
+streamoff IceRecordOffset(DWORD Version, ULONGLONG Index) {
+	if (Version == LOG_VERSION)																	//Blocks follow the block of the header
+		return (streamoff)CHECK_BLOCK_SIZE * (streamoff)(1 + Index / CHECK_BLOCK_RECORDS) +
+			(streamoff)sizeof(LogInfo) * (streamoff)(Index % CHECK_BLOCK_RECORDS);
+	return IceRecordHeaderSize(Version) + (streamoff)sizeof(LogInfo) * (streamoff)Index;
+}
+
+/*
+Description:    Get the size of a record file of the current version
+Args:			ElementCount: No. of records
+Return:			The size in bytes
+*/
+static streamoff IceRecordFileSize(ULONGLONG ElementCount) {
+	return (streamoff)CHECK_BLOCK_SIZE * (streamoff)(1 + (ElementCount + CHECK_BLOCK_RECORDS - 1) / CHECK_BLOCK_RECORDS);
+}
+
+/*
+Description:    Build the encrypted content of a checksummed block. The checksum is calculated from the
+				decrypted records, so a block decrypted with a wrong key never passes the check. With a derived key,
+				the block is sealed and the seal takes the end of the padding after the checksum
+Args:			Block: Buffer to store the content, CHECK_BLOCK_SIZE bytes
+				Records: Records of the block
+				Count: No. of records, at most CHECK_BLOCK_RECORDS
+				Schedule: Key schedule of the key
+				Offset: Position of the block in the file
+*/
+void IceEncodeBlock(BYTE *Block, const LogInfo *Records, UINT Count, const IceKeySchedule &Schedule, streamoff Offset) {
+	DWORD	Checksum = IceCrc32c((const BYTE*)Records, sizeof(LogInfo) * Count);
+
+	memset(Block, 0, CHECK_BLOCK_SIZE);
+	memcpy(Block, Records, sizeof(LogInfo) * Count);
+	memcpy(Block + sizeof(LogInfo) * CHECK_BLOCK_RECORDS, &Checksum, sizeof(DWORD));			//The checksum is at the same place in every block
+	IceSealBlock(Block, Block, CHECK_BLOCK_SIZE - IceSealSize(Schedule), Schedule, Offset);
+}
+
+/*
+Description:    Build the encrypted header block of a record file of the current version
+Args:			Header: Buffer to store the header, CHECK_BLOCK_SIZE bytes
+				Password: The password
+				ElementCount: No. of records
+				FeePerHour: Fee per hour
+				Capacity: No. of parking positions
+				Generation: Archive generation, see IceEncryptedFile::LogGeneration
+				Schedule: Key schedule of the password
+*/
+void IceBuildRecordHeader(BYTE *Header, const wchar_t *Password, ULONGLONG ElementCount, float FeePerHour, UINT Capacity,
+	UINT Generation, const IceKeySchedule &Schedule) {
+	BYTE	*Secure = Header + FILE_PLAIN_SIZE;
+
+	memset(Header, 0, CHECK_BLOCK_SIZE);														//The header takes a whole block
+	memcpy(Header, &LOG_MAGIC, sizeof(DWORD));													//Magic
+	memcpy(Header + sizeof(DWORD), &LOG_VERSION, sizeof(DWORD));								//Version
+	memcpy(Secure, Password, sizeof(wchar_t) * min(lstrlenW(Password) + 1, 20));				//Password
+	memcpy(Secure + sizeof(wchar_t) * 20, &ElementCount, sizeof(ULONGLONG));					//Element count
+	memcpy(Secure + sizeof(wchar_t) * 20 + sizeof(ULONGLONG), &FeePerHour, sizeof(float));		//Fee per hour
+	memcpy(Secure + sizeof(wchar_t) * 20 + sizeof(ULONGLONG) + sizeof(float), &Capacity, sizeof(UINT));	//No. of parking positions
+	memcpy(Header + LOG_GENERATION_OFFSET, &Generation, sizeof(UINT));							//Archive generation
+	IceSealBlock(Secure, Secure, CHECK_BLOCK_SIZE - FILE_PLAIN_SIZE - IceSealSize(Schedule), Schedule, FILE_PLAIN_SIZE);	//Magic and version are not encrypted
+}
+
+/*
+Description:    Write a record file to a stream at its current position. The records are encoded into checksummed
+				blocks, which are encrypted and written FILE_IO_CHUNK bytes at a time, so no copy of the whole file is kept in memory
+Args:			fsOut: The stream
+				Password: The password
+				FeePerHour: Fee per hour
+				Capacity: No. of parking positions
+				Generation: Archive generation, see IceEncryptedFile::LogGeneration
+				Records: The records
+Return:			true if succeed, false otherwise
+*/
+static bool IceWriteRecordFile(ostream &fsOut, const wchar_t *Password, float FeePerHour, UINT Capacity, UINT Generation,
+	const IceRecordStore &Records) {
+	ULONGLONG		ElementCount = Records.Size();
+	IceKeySchedule	Schedule;
+	BYTE			Header[CHECK_BLOCK_SIZE];
+	ULONGLONG		BlockCount = (ElementCount + CHECK_BLOCK_RECORDS - 1) / CHECK_BLOCK_RECORDS;
+	const UINT		ChunkBlocks = FILE_IO_CHUNK / CHECK_BLOCK_SIZE;								//Blocks written at a time
+
+	if (!IceExpandKey(Password, Schedule))
+		return false;
+	IceBuildRecordHeader(Header, Password, ElementCount, FeePerHour, Capacity, Generation, Schedule);
+	fsOut.write((char*)Header, CHECK_BLOCK_SIZE);
+
+	vector<BYTE>	Buffer((size_t)min(BlockCount, (ULONGLONG)ChunkBlocks) * CHECK_BLOCK_SIZE);
+	for (ULONGLONG Block = 0; Block < BlockCount && !fsOut.bad(); ) {							//Encode and write the blocks piece by piece
+		UINT	Count = (UINT)min(BlockCount - Block, (ULONGLONG)ChunkBlocks);
+		for (UINT i = 0; i < Count; i++) {
+			ULONGLONG	First = (Block + i) * CHECK_BLOCK_RECORDS;
+			IceEncodeBlock(Buffer.data() + CHECK_BLOCK_SIZE * i, &Records[(size_t)First],
+				(UINT)min(ElementCount - First, (ULONGLONG)CHECK_BLOCK_RECORDS), Schedule, IceRecordOffset(LOG_VERSION, First));
+		}
+		fsOut.write((char*)Buffer.data(), (streamoff)CHECK_BLOCK_SIZE * Count);
+		Block += Count;
+	}
+	return !fsOut.flush().bad();
+}
+
+/*
+Description:    Check if a decrypted record looks valid
+Args:			Info: The record
+Return:			true if the record is valid, false otherwise
+*/
+static bool IceCheckRecord(const LogInfo &Info) {
+	return Info.CarNumber != 0 && Info.CarPos < PARKING_MAX_CAPACITY &&
+		Info.EnterTime > 0 && Info.LeaveTime >= 0;
+}
+
+/*
+Description:    Decrypt the checksummed blocks of a chunk from a mapped record file and verify them. Blocks never
+				cross a view, so every view is mapped once and all of its blocks are decrypted from it
+Args:			hMapping: Handle to the file mapping object
+				szFile: Size of the file
+				Password: The password
+				Records: The first record of the chunk in the destination
+				Chunk: The chunk, must start at the first record of a block. ValidCount is set to the number of
+					   records before the first missing block, and the blocks failing the checksum are added to
+					   DamagedBlocks. Their records are zeroed
+Return:			true if succeed, false if the file can't be mapped
+*/
+static bool IceLoadBlocks(HANDLE hMapping, streamoff szFile, const wchar_t *Password, LogInfo *Records, LoadChunk *Chunk) {
+	IceKeySchedule	Schedule;
+	BYTE			*View = NULL, Plain[CHECK_BLOCK_SIZE];
+	streamoff		ViewBase = 0, ViewEnd = 0;
+	bool			Result = true;
+	int				Seal;
+
+	if (!IceExpandKey(Password, Schedule))
+		return false;
+	Seal = IceSealSize(Schedule);
+	Chunk->ValidCount = Chunk->Count;
+	for (UINT i = 0; i < Chunk->Count; i += CHECK_BLOCK_RECORDS) {
+		UINT		Count = min(Chunk->Count - i, CHECK_BLOCK_RECORDS);
+		streamoff	Offset = IceRecordOffset(LOG_VERSION, Chunk->First + i);
+		DWORD		Checksum;
+		if (Offset + CHECK_BLOCK_SIZE > szFile) {													//Missing block (e.g. power lost while the file was saved)
+			Chunk->ValidCount = i;
+			break;
+		}
+		if (Offset + CHECK_BLOCK_SIZE > ViewEnd) {													//Map the view containing the block
+			if (View)
+				UnmapViewOfFile(View);
+			ViewBase = Offset - Offset % MAPPING_VIEW_SIZE;
+			ViewEnd = min(ViewBase + MAPPING_VIEW_SIZE, szFile);
+			View = (BYTE*)MapViewOfFile(hMapping, FILE_MAP_READ, (DWORD)(ViewBase >> 32), (DWORD)ViewBase, (size_t)(ViewEnd - ViewBase));
+			if (!View) {
+				Result = false;
+				break;
+			}
+		}
+		const BYTE	*Block = View + (Offset - ViewBase);
+		bool		Valid = true;
+		if (Seal) {																					//A sealed block is checked as a whole before it is decrypted
+			Valid = IceOpenBlock(Plain, Block, CHECK_BLOCK_SIZE - Seal, Schedule, Offset);
+			memcpy(Records + i, Plain, sizeof(LogInfo) * Count);
+			memcpy(&Checksum, Plain + sizeof(LogInfo) * CHECK_BLOCK_RECORDS, sizeof(DWORD));
+		}
+		else {
+			IceCryptBlock((BYTE*)(Records + i), Block, sizeof(LogInfo) * Count, Schedule, Offset);
+			IceCryptBlock((BYTE*)&Checksum, Block + sizeof(LogInfo) * CHECK_BLOCK_RECORDS, sizeof(DWORD), Schedule,
+				Offset + sizeof(LogInfo) * CHECK_BLOCK_RECORDS);
+		}
+		if (!Valid || IceCrc32c((BYTE*)(Records + i), sizeof(LogInfo) * Count) != Checksum) {		//Torn or corrupted block, the caller
+			memset(Records + i, 0, sizeof(LogInfo) * Count);											//decides if it is the end of the file
+			Chunk->DamagedBlocks.push_back(Chunk->First + i);
+		}
+	}
+	if (View)
+		UnmapViewOfFile(View);
+	return Result;
+}
+
+/*
+Description:    Decrypt a chunk of records from a mapped record file, then validate them and find the cars still parking.
+				This is the job of a loader thread
+Args:			hMapping: Handle to the file mapping object
+				szFile: Size of the file
+				Password: The password
+				Version: Format version of the file
+				Records: The first record of the chunk in the destination
+				Chunk: The chunk, results are stored in it
+				ScanFrom: Records before this index are decrypted only
+*/
+static void IceLoadChunk(HANDLE hMapping, streamoff szFile, const wchar_t *Password, DWORD Version, LogInfo *Records,
+	LoadChunk *Chunk, UINT ScanFrom) {
+
+	Chunk->InvalidCount = 0;
+	if (Version == LOG_VERSION)																	//Verify the blocks while decrypting them
+		Chunk->Result = IceLoadBlocks(hMapping, szFile, Password, Records, Chunk);
+	else {																						//Older files have no checksums
+		Chunk->Result = IceCryptMapping(hMapping, IceRecordOffset(Version, Chunk->First),
+			(BYTE*)Records, (streamoff)sizeof(LogInfo) * Chunk->Count, Password);
+		Chunk->ValidCount = Chunk->Count;
+	}
+	if (!Chunk->Result)
+		return;
+	size_t	d = 0;																				//Next damaged block, its records are counted by the caller
+	for (UINT i = (ScanFrom > Chunk->First ? min(ScanFrom - Chunk->First, Chunk->ValidCount) : 0); i < Chunk->ValidCount; i++) {
+		while (d < Chunk->DamagedBlocks.size() && Chunk->DamagedBlocks[d] + CHECK_BLOCK_RECORDS <= Chunk->First + i)
+			d++;
+		if (d < Chunk->DamagedBlocks.size() && Chunk->DamagedBlocks[d] <= Chunk->First + i)
+			continue;
+		if (!IceCheckRecord(Records[i]))																//Damaged records are kept, but never treated as parking cars
+			Chunk->InvalidCount++;
+		else if (Records[i].LeaveTime == 0)
+			Chunk->OpenSessions.push_back(Chunk->First + i);
+	}
+}
+
+/*
+Description:    Decrypt a run of chunks, see IceLoadChunk(). This is the job of a loader thread
+Args:			hMapping: Handle to the file mapping object
+				szFile: Size of the file
+				Password: The password
+				Version: Format version of the file
+				Records: The destination, large enough for all records of the file
+				Chunks: The first chunk of the run
+				Count: No. of chunks
+				ScanFrom: Records before this index are decrypted only
+*/
+static void IceLoadChunks(HANDLE hMapping, streamoff szFile, const wchar_t *Password, DWORD Version, IceRecordStore *Records,
+	LoadChunk *Chunks, UINT Count, UINT ScanFrom) {
+
+	for (UINT i = 0; i < Count; i++)
+		IceLoadChunk(hMapping, szFile, Password, Version, &(*Records)[Chunks[i].First], &Chunks[i], ScanFrom);
+}
+
+/*
+Description:    Map a record file into memory and decrypt its records. Large files are split into chunks, one for
+				each chunk of the record store, and runs of them are decrypted and verified by several threads.
+				The results of the chunks are merged in order. Blocks failing the checksum at the end of the file are
+				dropped with the missing blocks, since that is what a save interrupted by a power failure leaves behind.
+				A block failing the checksum before a valid block (e.g. a torn in-place update or a bad sector) only
+				loses its own records, which are zeroed, so the following records keep their indices
+Args:			Path: Path of the record file
+				Password: The password
+				Header: Buffer to store the decrypted header, IceRecordHeaderSpan() bytes, CHECK_BLOCK_SIZE at most
+				Records: Store to receive the records, its content is replaced
+				OpenSessions: Vector to store the indices (in Records) of the cars still parking, can be NULL
+				InvalidCount: Variable to receive the number of damaged records, can be NULL
+				ScanFrom: Records before this index are decrypted only, and not searched for parking cars.
+						  Set to 0 if it is beyond the end of the file. Can be NULL
+				DroppedCount: Variable to receive the number of records dropped from the end, can be NULL
+				DamagedBlocks: Vector to store the indices of the first records of the damaged blocks which are not
+							   dropped, can be NULL
+				Threads: No. of loader threads, 0 for one per core. At most LOAD_MAX_THREADS are used
+Return:			true if succeed, false otherwise
+*/
+static bool IceReadRecordFile(const wstring &Path, const wchar_t *Password, BYTE *Header, IceRecordStore &Records,
+	vector<UINT> *OpenSessions = NULL, UINT *InvalidCount = NULL, UINT *ScanFrom = NULL, UINT *DroppedCount = NULL,
+	vector<UINT> *DamagedBlocks = NULL, UINT Threads = 0) {
+
+	HANDLE			hFile, hMapping = NULL;
+	LARGE_INTEGER	szFile;																		//File size
+
+	hFile = CreateFileW(Path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+		NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)															//Failed to open the file
+		return false;
+	if (GetFileSizeEx(hFile, &szFile) && szFile.QuadPart >= FILE_PLAIN_SIZE)					//Get file size
+		hMapping = CreateFileMappingW(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(hFile);																			//The mapping object keeps the file opened
+	if (!hMapping)																				//Failed to create the mapping
+		return false;
+
+	//Decrypt the header and check if the decrypted password matches with the provided password.
+	//Magic and version are not encrypted, an empty key copies them as they are
+	bool			Result = false;
+	ULONGLONG		ElementCount, StoredCount;
+	float			FeePerHour;
+	DWORD			Signature[2] = { 0, 0 };
+	streamoff		HeaderSize = 0;
+	BYTE			Block[CHECK_BLOCK_SIZE];															//The header, or the block taken by it
+	IceKeySchedule	Schedule;
+
+	if (IceCryptMapping(hMapping, 0, Block, FILE_PLAIN_SIZE, L""))
+		memcpy(Signature, Block, sizeof(Signature));
+	if (Signature[0] == LOG_MAGIC)
+		HeaderSize = IceRecordHeaderSpan(Signature[1]);
+	if (HeaderSize > 0 && HeaderSize <= szFile.QuadPart && IceExpandKey(Password, Schedule) &&
+		IceCryptMapping(hMapping, 0, Block, HeaderSize, L"") && IceOpenRecordHeader(Block, Schedule) &&
+		IceParseRecordHeader(Block, Password, ElementCount, FeePerHour)) {
+
+		memcpy(Header, Block, (size_t)HeaderSize);
+		StoredCount = ElementCount;
+		if (Signature[1] == LOG_VERSION)																//Blocks beyond the end of the file are missing anyway,
+			ElementCount = min(ElementCount, (ULONGLONG)(max(szFile.QuadPart / CHECK_BLOCK_SIZE, 1LL) - 1) * CHECK_BLOCK_RECORDS);	//so a damaged count never sizes the store
+		if ((Signature[1] == LOG_VERSION ||																//Missing blocks of checksummed files are dropped
+			ElementCount <= (ULONGLONG)(szFile.QuadPart - HeaderSize) / sizeof(LogInfo)) &&			//Make sure all records are in the file
+			ElementCount < UINT_MAX && ElementCount <= (size_t)-1 / sizeof(LogInfo)) {				//Records are indexed with UINT in memory, larger files are read with IceRecordReader
+			UINT	ScanStart = ScanFrom ? *ScanFrom : 0;
+			if (ScanStart > ElementCount)																//Doesn't match with the file, search all records
+				ScanStart = 0;
+			if (ScanFrom)
+				*ScanFrom = ScanStart;
+
+			//Split the records into chunks of the record store. They start at the first record of a block, as a chunk of
+			//the store holds a whole number of blocks
+			UINT	ChunkCount = (UINT)((ElementCount + RECORD_CHUNK_RECORDS - 1) / RECORD_CHUNK_RECORDS);
+			UINT	ThreadCount = Threads ? Threads : thread::hardware_concurrency();
+			UINT	MaxThreads = (UINT)((streamoff)sizeof(LogInfo) * ElementCount / LOAD_CHUNK_MIN) + 1;
+			if (ThreadCount > LOAD_MAX_THREADS)
+				ThreadCount = LOAD_MAX_THREADS;
+			if (ThreadCount > MaxThreads)
+				ThreadCount = MaxThreads;
+			if (ThreadCount > ChunkCount)
+				ThreadCount = ChunkCount;
+			if (ThreadCount < 1)
+				ThreadCount = 1;
+
+			vector<LoadChunk>	Chunks(ChunkCount);
+			vector<thread>		Workers;
+			for (UINT i = 0; i < ChunkCount; i++) {
+				Chunks[i].First = (UINT)(i * RECORD_CHUNK_RECORDS);
+				Chunks[i].Count = (UINT)min(ElementCount - Chunks[i].First, (ULONGLONG)RECORD_CHUNK_RECORDS);
+			}
+
+			//Decrypt all log data from the mapping straight into the store. Each thread takes a run of chunks,
+			//the first run is done by this thread
+			Records.Resize(0);
+			Records.Resize((size_t)ElementCount);
+			for (UINT i = 1; i < ThreadCount; i++) {
+				UINT	First = ChunkCount * i / ThreadCount;
+				Workers.push_back(thread(IceLoadChunks, hMapping, (streamoff)szFile.QuadPart, Password, Signature[1],
+					&Records, Chunks.data() + First, ChunkCount * (i + 1) / ThreadCount - First, ScanStart));
+			}
+			IceLoadChunks(hMapping, szFile.QuadPart, Password, Signature[1], &Records, Chunks.data(), ChunkCount / ThreadCount, ScanStart);
+			for (UINT i = 0; i < Workers.size(); i++)
+				Workers[i].join();
+
+			//Merge the results in the order of the chunks
+			Result = true;
+			for (UINT i = 0; i < ChunkCount; i++) {
+				if (!Chunks[i].Result)
+					Result = false;
+			}
+			if (Result) {
+				UINT			ValidCount = 0;															//No. of records before the first missing block
+				vector<UINT>	Damaged;
+				for (UINT i = 0; i < ChunkCount; i++) {
+					if (OpenSessions) {
+						for (UINT j = 0; j < Chunks[i].OpenSessions.size(); j++)
+							OpenSessions->push_back(Chunks[i].OpenSessions[j]);
+					}
+					if (InvalidCount)
+						*InvalidCount += Chunks[i].InvalidCount;
+					ValidCount += Chunks[i].ValidCount;
+					Damaged.insert(Damaged.end(), Chunks[i].DamagedBlocks.begin(), Chunks[i].DamagedBlocks.end());
+					if (Chunks[i].ValidCount < Chunks[i].Count)												//The following chunks are after the missing block
+						break;
+				}
+				while (!Damaged.empty() && ValidCount - Damaged.back() <= CHECK_BLOCK_RECORDS) {		//No valid block after it, a torn tail
+					ValidCount = Damaged.back();
+					Damaged.pop_back();
+				}
+				Records.Resize(ValidCount);
+				if (DamagedBlocks)
+					DamagedBlocks->swap(Damaged);
+				if (DroppedCount)
+					*DroppedCount = (UINT)(min(StoredCount, (ULONGLONG)UINT_MAX) - ValidCount);		//Including the missing blocks
+			}
+			else																						//Failed to read the file
+				Records.Clear();
+		}
+	}
+	CloseHandle(hMapping);
+	return Result;
+}
+
+/*
+Description:    Move a file written completely over another file. The content is flushed to the disk first, otherwise
+				the rename may reach the disk before the data, and a power failure leaves a partial file in place of
+				the complete one
+Args:			Source: Path of the new file
+				Dest: Path of the file to be replaced
+Return:			true if succeed, false otherwise
+*/
+static bool IceMoveFile(const wstring &Source, const wstring &Dest) {
+	HANDLE	hFile = CreateFileW(Source.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+		NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	bool	Result;
+
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+	Result = FlushFileBuffers(hFile) != FALSE;
+	CloseHandle(hFile);
+	return Result && MoveFileExW(Source.c_str(), Dest.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != FALSE;
+}
+
+/*
+Description:    Replace the content of a file. The content is written to a temporary file first and flushed to the
+				disk before it is moved in, so the original file is still complete if anything goes wrong
+Args:			Path: Path of the file
+				Data: The new content
+				Length: Size of the content in bytes
+Return:			true if succeed, false otherwise
+*/
+static bool IceReplaceFile(const wstring &Path, const BYTE *Data, streamoff Length) {
+	wstring		TempPath = Path + L".tmp";
+	ofstream	fsOut;
+
+	fsOut.open(TempPath.c_str(), ios::binary | ios::trunc);
+	if (fsOut.fail())
+		return false;
+	fsOut.write((char*)Data, Length);
+	if (fsOut.flush().bad()) {
+		fsOut.close();
+		DeleteFileW(TempPath.c_str());
+		return false;
+	}
+	fsOut.close();
+	return IceMoveFile(TempPath, Path);
+}
+
+/*
+Description:    Replace the content of a file with data sealed as a whole, see IceReplaceFile() and IceSeal()
+Args:			Path: Path of the file
+				Data: The new content, not encrypted
+				Length: Size of the content in bytes
+				Key: The password, or a token from IceDeriveKey()
+Return:			true if succeed, false otherwise
+*/
+static bool IceSaveSealedFile(const wstring &Path, const BYTE *Data, streamoff Length, const wchar_t *Key) {
+	vector<BYTE>	Buffer((size_t)Length + IceSealSize(Key));
+
+	memcpy(Buffer.data(), Data, (size_t)Length);
+	return IceSeal(Buffer.data(), Length, Key, 0) && IceReplaceFile(Path, Buffer.data(), Buffer.size());
+}
+
+/*
+Description:    Read a file written by IceSaveSealedFile()
+Args:			Path: Path of the file
+				Key: The password, or a token from IceDeriveKey()
+				Content: Vector to store the decrypted content
+Return:			true if succeed, false if the file can't be read, or is damaged or written with another key
+*/
+static bool IceLoadSealedFile(const wstring &Path, const wchar_t *Key, vector<BYTE> &Content) {
+	ifstream	fsIn;
+	int			Seal = IceSealSize(Key);
+
+	fsIn.open(Path.c_str(), ios::binary);
+	if (fsIn.fail())
+		return false;
+	fsIn.seekg(0, ios::end);
+	streamoff	szFile = fsIn.tellg();															//Get file size
+	fsIn.seekg(0, ios::beg);
+	if (szFile < Seal)
+		return false;
+	Content.resize((size_t)szFile);
+	if (!fsIn.read((char*)Content.data(), szFile) || !IceOpen(Content.data(), szFile - Seal, Key, 0))
+		return false;
+	Content.resize((size_t)(szFile - Seal));
+	return true;
+}
+
+/*
+Description:    Read a legacy (version 1) record file and convert its records. The records are appended to Records
+Args:			Path: Path of the record file
+				Password: The password
+				FeePerHour: Variable to receive the fee per hour
+				Records: Vector to store the records
+Return:			true if succeed, false otherwise
+*/
+static bool IceReadLegacyFile(const wstring &Path, const wchar_t *Password, float &FeePerHour, vector<LogInfo> &Records) {
+	ifstream	fsIn;
+	UINT		ElementCount;
+
+	fsIn.open(Path.c_str(), ios::binary);
+	if (fsIn.fail())
+		return false;
+	fsIn.seekg(0, ios::end);
+	streamoff	szFile = fsIn.tellg();															//Get file size
+	fsIn.seekg(0, ios::beg);
+	if (szFile < LEGACY_HEADER_SIZE)
+		return false;
+	unique_ptr<BYTE[]>	Buffer(new BYTE[(size_t)szFile]);
+	if (!fsIn.read((char*)Buffer.get(), szFile))
+		return false;
+	fsIn.close();
+
+	if (!IceCrypt(Buffer.get(), szFile, Password, 0) ||										//Decrypt binary data
+		lstrcmpW((wchar_t*)Buffer.get(), Password))													//Wrong password
+		return false;
+	memcpy(&ElementCount, Buffer.get() + sizeof(wchar_t) * 20, sizeof(UINT));					//Element count
+	memcpy(&FeePerHour, Buffer.get() + sizeof(wchar_t) * 20 + sizeof(UINT), sizeof(float));		//Fee per hour
+	if (LEGACY_HEADER_SIZE + (streamoff)sizeof(LegacyLogInfo) * ElementCount > szFile)			//Make sure all records are in the file
+		return false;
+
+	const LegacyLogInfo	*Legacy = (const LegacyLogInfo*)(Buffer.get() + LEGACY_HEADER_SIZE);
+	for (UINT i = 0; i < ElementCount; i++)
+		Records.push_back(IceConvertLegacyRecord(Legacy[i]));
+	return true;
+}
+
+/*
+Description:    Copy a file FILE_IO_CHUNK bytes at a time. The destination is replaced only if the content is written completely
+Args:			Source: Path of the file to be copied
+				Dest: Path of the copy
+Return:			true if succeed, false otherwise
+*/
+static bool IceCopyFile(const wstring &Source, const wstring &Dest) {
+	wstring			TempPath = Dest + L".tmp";
+	ifstream		fsIn;
+	ofstream		fsOut;
+
+	fsIn.open(Source.c_str(), ios::binary);														//Shares the file with the opened log file, unlike CopyFileW()
+	if (fsIn.fail())
+		return false;
+	fsIn.seekg(0, ios::end);
+	streamoff	szFile = fsIn.tellg();															//Get file size
+	fsIn.seekg(0, ios::beg);
+	fsOut.open(TempPath.c_str(), ios::binary | ios::trunc);
+	if (fsOut.fail())
+		return false;
+
+	vector<BYTE>	Buffer((size_t)min(szFile, (streamoff)FILE_IO_CHUNK));
+	bool			Result = true;
+	for (streamoff Done = 0; Done < szFile && Result; ) {
+		streamoff	Piece = min(szFile - Done, (streamoff)FILE_IO_CHUNK);
+		if (!fsIn.read((char*)Buffer.data(), Piece)) {
+			Result = false;
+			break;
+		}
+		Result = !fsOut.write((char*)Buffer.data(), Piece).bad();
+		Done += Piece;
+	}
+	fsIn.close();
+	if (!Result || fsOut.flush().bad()) {
+		fsOut.close();
+		DeleteFileW(TempPath.c_str());
+		return false;
+	}
+	fsOut.close();
+	return IceMoveFile(TempPath, Dest);
+}
+
+/*
+Description:    Fill the description of a segment from its records
+Args:			Segment: The segment
+				Records: Records of the segment, not empty
+*/
+static void IceDescribeSegment(SegmentInfo &Segment, const vector<LogInfo> &Records) {
+	Segment.ElementCount = Records.size();
+	Segment.Checksum = IceChecksum((BYTE*)Records.data(), (streamoff)sizeof(LogInfo) * Records.size());
+	Segment.FirstTime = Records[0].EnterTime;
+	Segment.LastTime = Records[0].LeaveTime;
+	for (UINT i = 1; i < Records.size(); i++) {
+		if (Records[i].EnterTime < Segment.FirstTime)
+			Segment.FirstTime = Records[i].EnterTime;
+		if (Records[i].LeaveTime > Segment.LastTime)
+			Segment.LastTime = Records[i].LeaveTime;
+	}
+}
+
+/*
+Description:    Append an unsigned integer to a buffer, 7 bits per byte with the lowest bits first.
+				The highest bit of a byte is set if more bytes follow, so small values take a single byte
+Args:			Buffer: The buffer
+				Value: The integer
+*/
+static void IcePutVarint(vector<BYTE> &Buffer, ULONGLONG Value) {
+	while (Value >= 0x80) {
+		Buffer.push_back((BYTE)(Value | 0x80));
+		Value >>= 7;
+	}
+	Buffer.push_back((BYTE)Value);
+}
+
+/*
+Description:    Read an unsigned integer written by IcePutVarint()
+Args:			Data: Position of the integer, moved to the following data
+				End: End of the buffer
+				Value: Variable to receive the integer
+Return:			true if succeed, false if the data is damaged
+*/
+static bool IceGetVarint(const BYTE *&Data, const BYTE *End, ULONGLONG &Value) {
+	Value = 0;
+	for (int Shift = 0; Shift < 64 && Data < End; Shift += 7) {
+		BYTE	Byte = *Data++;
+		Value |= (ULONGLONG)(Byte & 0x7F) << Shift;
+		if (!(Byte & 0x80))
+			return true;
+	}
+	return false;
+}
+
+/*
+Description:    Map a signed integer to an unsigned one (0, -1, 1, -2, ... = 0, 1, 2, 3, ...),
+				so small negative values take few bytes as well
+Args:			Value: The signed integer
+Return:			The unsigned integer
+*/
+static ULONGLONG IceZigZag(LONGLONG Value) {
+	return ((ULONGLONG)Value << 1) ^ (ULONGLONG)(Value >> 63);
+}
+
+/*
+Description:    Undo IceZigZag()
+Args:			Value: The unsigned integer
+Return:			The signed integer
+*/
+static LONGLONG IceUnZigZag(ULONGLONG Value) {
+	return (LONGLONG)(Value >> 1) ^ -(LONGLONG)(Value & 1);
+}
+
+/*
+Description:    Compress a block of archived records. The block starts with a dictionary of the car numbers in it.
+				Each record is stored as varints: enter time (difference from the previous record), time parked
+				(instead of leave time), index of the car number, parked position (difference from the previous
+				record), fee and a reserved field (always 0). Nothing outside the block is needed to decompress it
+Args:			Records: The records, sorted by enter time for best results
+				Count: No. of records
+				Buffer: Buffer to store the compressed block
+*/
+static void IceEncodeHistoryBlock(const LogInfo *Records, UINT Count, vector<BYTE> &Buffer) {
+	map<ULONGLONG, UINT>	PlateIndex;															//Car number -> index in the dictionary
+	vector<ULONGLONG>		Plates;																//Dictionary, in the order of first appearance
+	LONGLONG				PrevEnter = 0;
+	LONGLONG				PrevPos = 0;
+
+	for (UINT i = 0; i < Count; i++) {
+		if (PlateIndex.insert(make_pair(Records[i].CarNumber, (UINT)Plates.size())).second)
+			Plates.push_back(Records[i].CarNumber);
+	}
+	Buffer.clear();
+	IcePutVarint(Buffer, Plates.size());
+	for (UINT i = 0; i < Plates.size(); i++)
+		IcePutVarint(Buffer, Plates[i]);
+	for (UINT i = 0; i < Count; i++) {
+		IcePutVarint(Buffer, IceZigZag(Records[i].EnterTime - PrevEnter));
+		IcePutVarint(Buffer, IceZigZag(Records[i].LeaveTime - Records[i].EnterTime));
+		IcePutVarint(Buffer, PlateIndex[Records[i].CarNumber]);
+		IcePutVarint(Buffer, IceZigZag((LONGLONG)Records[i].CarPos - PrevPos));
+		IcePutVarint(Buffer, IceZigZag(Records[i].Fee));
+		IcePutVarint(Buffer, 0);
+		PrevEnter = Records[i].EnterTime;
+		PrevPos = Records[i].CarPos;
+	}
+}
+
+/*
+Description:    Decompress a block of archived records. See IceEncodeHistoryBlock()
+Args:			Data: The compressed block
+				Size: Size of the compressed block in bytes
+				Count: No. of records in the block
+				Records: Buffer to store the records, Count elements
+Return:			true if succeed, false if the block is damaged
+*/
+bool IceDecodeHistoryBlock(const BYTE *Data, UINT Size, UINT Count, LogInfo *Records) {
+	const BYTE			*End = Data + Size;
+	vector<ULONGLONG>	Plates;
+	ULONGLONG			PlateCount, Enter, Dwell, Plate, Pos, Fee, Reserved;
+	LONGLONG			PrevEnter = 0;
+	LONGLONG			PrevPos = 0;
+
+	if (!IceGetVarint(Data, End, PlateCount) || PlateCount > Count)
+		return false;
+	Plates.resize((size_t)PlateCount);
+	for (UINT i = 0; i < PlateCount; i++) {
+		if (!IceGetVarint(Data, End, Plates[i]))
+			return false;
+	}
+	for (UINT i = 0; i < Count; i++) {
+		if (!IceGetVarint(Data, End, Enter) || !IceGetVarint(Data, End, Dwell) || !IceGetVarint(Data, End, Plate) ||
+			!IceGetVarint(Data, End, Pos) || !IceGetVarint(Data, End, Fee) || !IceGetVarint(Data, End, Reserved) ||
+			Plate >= PlateCount || Reserved != 0)
+			return false;
+		Records[i].EnterTime = PrevEnter + IceUnZigZag(Enter);
+		Records[i].LeaveTime = Records[i].EnterTime + IceUnZigZag(Dwell);
+		Records[i].CarNumber = Plates[(size_t)Plate];
+		Records[i].Fee = (int)IceUnZigZag(Fee);
+		Records[i].CarPos = (UINT)(PrevPos + IceUnZigZag(Pos));
+		PrevEnter = Records[i].EnterTime;
+		PrevPos = Records[i].CarPos;
+	}
+	return Data == End;
+}
+
+/*
+Description:    Write an archived segment in the compressed history format. The header is followed by the block index
+				and the compressed blocks of HISTORY_BLOCK_RECORDS records each. With a derived key, the header, the
+				index and every block are sealed on their own, each followed by its seal. The original file is replaced
+				only if the new content is written completely
+Args:			Path: Path of the segment
+				Password: The password
+				Records: The records, sorted by enter time
+Return:			true if succeed, false otherwise
+*/
+static bool IceWriteHistoryFile(const wstring &Path, const wchar_t *Password, const vector<LogInfo> &Records) {
+	UINT						ElementCount = Records.size();
+	UINT						BlockCount = (ElementCount + HISTORY_BLOCK_RECORDS - 1) / HISTORY_BLOCK_RECORDS;
+	IceKeySchedule				Schedule;
+	vector<HistoryBlockInfo>	Blocks(BlockCount);
+	vector<BYTE>				Buffer, Block;
+
+	if (!IceExpandKey(Password, Schedule))
+		return false;
+
+	int		Seal = IceSealSize(Schedule);
+	size_t	IndexOffset = HISTORY_HEADER_SIZE + Seal;												//Position of the block index
+	Buffer.resize(IndexOffset + sizeof(HistoryBlockInfo) * BlockCount + Seal);
+
+	for (UINT i = 0; i < BlockCount; i++) {														//Compress the blocks one by one
+		UINT			First = i * HISTORY_BLOCK_RECORDS;
+		UINT			Count = min(ElementCount - First, HISTORY_BLOCK_RECORDS);
+		const LogInfo	*Data = Records.data() + First;
+
+		IceEncodeHistoryBlock(Data, Count, Block);
+		Blocks[i].FirstTime = Data[0].EnterTime;
+		Blocks[i].LastTime = Data[0].LeaveTime;
+		for (UINT j = 1; j < Count; j++) {
+			if (Data[j].EnterTime < Blocks[i].FirstTime)
+				Blocks[i].FirstTime = Data[j].EnterTime;
+			if (Data[j].LeaveTime > Blocks[i].LastTime)
+				Blocks[i].LastTime = Data[j].LeaveTime;
+		}
+		Blocks[i].Offset = Buffer.size();
+		Blocks[i].Size = Block.size();
+		Blocks[i].RecordCount = Count;
+		Blocks[i].Checksum = IceChecksum((BYTE*)Data, (streamoff)sizeof(LogInfo) * Count);
+		Blocks[i].Reserved = 0;
+		Buffer.insert(Buffer.end(), Block.begin(), Block.end());
+		Buffer.resize(Buffer.size() + Seal);
+	}
+
+	BYTE	*Secure = Buffer.data() + FILE_PLAIN_SIZE;
+	memcpy(Buffer.data(), &HISTORY_MAGIC, sizeof(DWORD));										//Magic
+	memcpy(Buffer.data() + sizeof(DWORD), &HISTORY_VERSION, sizeof(DWORD));					//Version
+	memset(Secure, 0, sizeof(wchar_t) * 20);
+	memcpy(Secure, Password, sizeof(wchar_t) * min(lstrlenW(Password) + 1, 20));				//Password
+	memcpy(Secure + sizeof(wchar_t) * 20, &ElementCount, sizeof(UINT));							//Element count
+	memcpy(Secure + sizeof(wchar_t) * 20 + sizeof(UINT), &BlockCount, sizeof(UINT));			//Block count
+	for (UINT i = 0; i < BlockCount; i++)														//Blocks are sealed before the index holding their positions
+		IceSealBlock(Buffer.data() + Blocks[i].Offset, Buffer.data() + Blocks[i].Offset, Blocks[i].Size, Schedule, Blocks[i].Offset);
+	memcpy(Buffer.data() + IndexOffset, Blocks.data(), sizeof(HistoryBlockInfo) * BlockCount);	//Block index
+	IceSealBlock(Buffer.data() + IndexOffset, Buffer.data() + IndexOffset, sizeof(HistoryBlockInfo) * BlockCount, Schedule, IndexOffset);
+	IceSealBlock(Secure, Secure, HISTORY_HEADER_SIZE - FILE_PLAIN_SIZE, Schedule, FILE_PLAIN_SIZE);	//Magic and version are not encrypted
+	return IceReplaceFile(Path, Buffer.data(), Buffer.size());
+}
+
+/*
+Description:    Read the records of an archived segment which may be related to a period of time. The segment is
+				streamed with IceRecordReader, so only the blocks overlapping the period are read and decompressed,
+				and of segments written as plain record files before the history format, only the records overlapping
+				the period are kept. The records are appended to Records
+Args:			Path: Path of the segment
+				Password: The password
+				From: Beginning of the period
+				To: End of the period
+				Records: Vector to store the records
+				ElementCount: Variable to receive the number of records in the whole segment, can be NULL
+Return:			true if succeed, false otherwise
+*/
+static bool IceReadHistoryFile(const wstring &Path, const wchar_t *Password, LONGLONG From, LONGLONG To,
+	vector<LogInfo> &Records, UINT *ElementCount = NULL) {
+
+	IceRecordReader	Reader(sizeof(LogInfo) * HISTORY_BLOCK_RECORDS);							//A block at a time, the records are copied out anyway
+	const LogInfo	*Chunk;
+	UINT			ChunkCount;
+	size_t			OldCount = Records.size();
+
+	if (!Reader.Open(Path, Password, From, To))
+		return false;
+	while (Reader.Next(Chunk, ChunkCount)) {
+		for (UINT i = 0; i < ChunkCount; i++) {
+			if (Chunk[i].EnterTime <= To && Chunk[i].LeaveTime >= From)							//Keep the records overlapping the period only
+				Records.push_back(Chunk[i]);
+		}
+	}
+	if (Reader.Failed) {																		//Damaged file
+		Records.resize(OldCount);
+		return false;
+	}
+	if (ElementCount)
+		*ElementCount = (UINT)Reader.ElementCount;
+	return true;
+}
+
 /*
 Description:    Constructor of encrypted file class
 Args:			FilePath: Log file path
+				GroupCommit: If journal records are written by the writer thread in batches, otherwise each record
+							 is written when it is added
+*/
+IceEncryptedFile::IceEncryptedFile(const wchar_t *FilePath, bool GroupCommit) {
+	LogPath = FilePath;
+	this->GroupCommit = GroupCommit;															//The writer thread is started with the journal below
+
+	//Get journal and manifest file paths, which are the log file path with the extension replaced
+	BasePath = FilePath;
+	size_t	ExtPos = BasePath.find_last_of(L"."), DirPos = BasePath.find_last_of(L"\\/");
+	if (ExtPos != wstring::npos && (DirPos == wstring::npos || ExtPos > DirPos))
+		BasePath.erase(ExtPos);
+	JournalPath = BasePath + L".jnl";
+	ManifestPath = BasePath + L".mft";
+	CheckpointPath = BasePath + L".ckp";
+	KeyPath = BasePath + L".key";
+	SummaryPath = BasePath + L".sum";
+	SwapRekeyedFiles();																		//Complete or undo a password change interrupted by a crash
+
+	//Initialize group commit counters
+	LARGE_INTEGER	Frequency;
+	QueryPerformanceFrequency(&Frequency);
+	CounterFrequency = Frequency.QuadPart;
+	memset(&Stats, 0, sizeof(Stats));
+
+	//Open log file
+	lstrcpyW(FileContent.Password, L"123");													//Set the default password
+	CipherKey = FileContent.Password;
+	FileContent.FeePerHour = 10;															//Set the default fee per hour
+	FileContent.Capacity = PARKING_CAPACITY;												//Set the default no. of parking positions
+	FileContent.ElementCount = 0;															//Set the default element count
+	fsFile.open(FilePath, ios::binary | ios::in | ios::out);								//Attempt to open the file with read/write privilege
+	if (fsFile.fail()) {
+		fsFile.open(FilePath, ios::binary | ios::out);											//Create log file if it doesn't exist, open it with write privilege only
+		CreatedNewFile = true;																	//Mark as created a new file
+		if (fsFile.fail()) {																		//Path not accessible
+			fsFile.close();
+			if (MessageBox(GetMainWindowHandle(),
+				L"Failed to access log file! Continue without log file?",
+				L"Error",
+				MB_ICONERROR | MB_YESNO) == IDNO) {
+
+				DestroyWindow(GetMainWindowHandle());												//Quit the system
+				PostQuitMessage(0);
+			}
+			else																				//Continuing without log file
+				WithoutFile = true;
+			return;
+		}
+		if (!SaveFile()) {																	//Initalize the file content
+			fsFile.close();
+			if (MessageBox(GetMainWindowHandle(),
+				L"Failed to initalize the log file content! Please make sure the file is writable! Continue without log file?",
+				L"Error",
+				MB_ICONERROR | MB_YESNO) == IDNO) {												//Show a prompt if failed to initalize file content
+
+				DestroyWindow(GetMainWindowHandle());												//Quit the system
+				PostQuitMessage(0);
+			}
+			else																				//Continuing without log file
+				WithoutFile = true;
+		}
+		else {																				//Reopen the file with read/write privilege
+			fsFile.close();
+			fsFile.open(FilePath, ios::binary | ios::in | ios::out);
+		}
+	}
+
+	//Check file size
+	fsFile.seekg(0, ios::end);
+	streamoff	szFile = fsFile.tellg();														//Get file size
+	fsFile.clear();
+	fsFile.seekg(0, ios::beg);
+	if (szFile < sizeof(FileContent) - sizeof(wchar_t) * 20) {									//Invalid file size
+		if (MessageBox(GetMainWindowHandle(),
+			L"Invalid file content! Create a new file to replace current file?",
+			L"Error",
+			MB_ICONERROR | MB_YESNO) == IDNO) {
+
+			fsFile.close();																			//Don't create a new file
+			WithoutFile = true;																		//Continuing without log file
+			MessageBox(GetMainWindowHandle(),
+				L"Continuing without log file!",
+				L"Invalid File Content",
+				MB_ICONEXCLAMATION);
+			return;
+		}
+		else {																					//Create a new file
+			if (!SaveFile()) {																		//Failed to create a new file
+				fsFile.close();
+				WithoutFile = true;																		//Continuing without log file
+				MessageBox(GetMainWindowHandle(),
+					L"Failed to create a new file! Continuing without log file!",
+					L"Invalid File Content",
+					MB_ICONEXCLAMATION);
+				return;
+			}
+			CreatedNewFile = true;																	//Mark as created a new file
+		}
+	}
+
+	//Open journal file. If the log file is newly created, the previous journal is meaningless
+	if (!WithoutFile)
+		OpenJournal(CreatedNewFile);
+}
+
+/*
+Description:    Destructor of encrypted file class
+*/
+IceEncryptedFile::~IceEncryptedFile() {
+	CancelCompaction();																			//Archived again next time
+
+	//Stop the writer thread after all queued records are committed
+	if (CommitThread.joinable()) {
+		{
+			lock_guard<mutex>	Lock(CommitMutex);
+			StopCommit = true;
+		}
+		CommitQueued.notify_one();
+		CommitThread.join();
+	}
+
+	//Close log file and journal file
+	fsFile.close();
+	if (hJournal != INVALID_HANDLE_VALUE)
+		CloseHandle(hJournal);
+	if (hLogWriter != INVALID_HANDLE_VALUE)
+		CloseHandle(hLogWriter);
+}
+
+/*
+Description:    Add a new record to the file
+Args:			CarNumber: Car number
+				EnterTime: Enter time of the car, see IceToEpoch()
+				LeaveTime: Leave time of the car, 0 if the car is not left
+				CarPos: Parked position
+				Fee: Fee paid, in cents
+				Ticket: Variable to receive the ticket for WaitForCommit(), can be NULL
+Return:			true if the record is saved or queued, false otherwise. The record is added to FileContent if a file is
+				opened, even if it can't be saved
+*/
+bool IceEncryptedFile::AddLog(const wchar_t *CarNumber, LONGLONG EnterTime, LONGLONG LeaveTime, int CarPos, int Fee, ULONGLONG *Ticket) {
+	if (fsFile.fail() || WithoutFile)															//No file opened
+		return false;
+
+	LogInfo	info;																				//Set the content
+	info.CarNumber = IcePackCarNumber(CarNumber);
+	info.EnterTime = EnterTime;
+	info.LeaveTime = LeaveTime;
+	info.Fee = Fee;
+	info.CarPos = (UINT)CarPos;
+
+	FileContent.LogData.Append(info);														//Add log
+	FileContent.ElementCount++;	
+	SetSessionOpen(FileContent.ElementCount - 1, LeaveTime == 0);
+	if (!AppendJournal(JOURNAL_ENTER, FileContent.ElementCount - 1, Ticket))					//Append the new record to the journal
+		return SaveFile();																			//Journal not available, update the whole log file instead
+	return true;
+}
+
+/*
+Description:    Save the changes of an existing record (e.g. leave time and fee when the car leaves)
+Args:			Index: Index of the modified record
+				Ticket: Variable to receive the ticket for WaitForCommit(), can be NULL
+Return:			true if succeed, false otherwise
+*/
+bool IceEncryptedFile::UpdateLog(UINT Index, ULONGLONG *Ticket) {
+	if (fsFile.fail() || WithoutFile || Index >= FileContent.ElementCount)						//No file opened or invalid index
+		return false;
+
+	SetSessionOpen(Index, FileContent.LogData[Index].LeaveTime == 0);
+	if (Index < SnapshotCount && PatchRecord(Index, Ticket))									//The record is in the log file, overwrite it in place
+		return true;
+	if (!AppendJournal(JOURNAL_EXIT, Index, Ticket))											//Append the modified record to the journal
+		return SaveFile();																			//Journal not available, update the whole log file instead
+	return true;
+}
+
+/*
+Description:    Save the file content. The new snapshot is written to a temporary file which then replaces the log file,
+				as the blocks of an old snapshot overwritten halfway would still pass their checksums. The journal is
+				emptied only after the new snapshot is on the disk, see IceMoveFile()
+Return:			true if succeed, false otherwise
+*/
+bool IceEncryptedFile::SaveFile() {
+	wstring		TempPath = LogPath + L".tmp";
+	ofstream	fsOut;
+	bool		Result;
+
+	if (fsFile.fail() || WithoutFile)															//No file opened
+		return false;
+	
+	if (lstrlenW(FileContent.Password) <= 0)													//Check password length
+		return false;
+	DrainJournal();																				//Queued in-place updates must not land on the new snapshot
+	DeleteFileW(CheckpointPath.c_str());														//The checkpoint may not match with the new snapshot
+
+	fsOut.open(TempPath.c_str(), ios::binary | ios::trunc);
+	if (fsOut.fail())
+		return false;
+	Result = IceWriteRecordFile(fsOut, CipherKey.c_str(), FileContent.FeePerHour, FileContent.Capacity, LogGeneration,
+		FileContent.LogData);																	//Encrypt and write the content piece by piece
+	fsOut.close();
+	if (!Result || fsOut.fail() || !KeepDamagedFile() || !ReplaceLogFile(TempPath)) {
+		DeleteFileW(TempPath.c_str());
+		return false;
+	}
+	SnapshotCount = FileContent.ElementCount;
+	DamagedBlocks.clear();																		//The records lost are zeroed in the new snapshot
+	SaveCheckpoint();
+
+	//All journal records are included in the new snapshot now
+	if (hJournal != INVALID_HANDLE_VALUE)
+		ResetJournal();
+	return true;
+}
+
+/*
+Description:    Replace the log file with a new snapshot. An opened file can't be replaced, so the handles to the log file
+				are closed first, and opened again whether the log file is replaced or not
+Args:			Path: Path of the new snapshot
+Return:			true if succeed, false otherwise
+*/
+bool IceEncryptedFile::ReplaceLogFile(const wstring &Path) {
+	lock_guard<mutex>	Lock(CommitMutex);														//The writer thread is idle after DrainJournal(), but owns hLogWriter
+	bool				Writer = hLogWriter != INVALID_HANDLE_VALUE;
+	bool				Result;
+
+	fsFile.close();
+	if (Writer)
+		CloseHandle(hLogWriter);
+	Result = IceMoveFile(Path, LogPath);
+	fsFile.clear();
+	fsFile.open(LogPath.c_str(), ios::binary | ios::in | ios::out);
+	if (Writer)
+		hLogWriter = CreateFileW(LogPath.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+			NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);											//In-place updates are appended to the journal if this fails
+	return Result && !fsFile.fail();
+}
+
+/*
+Description:    Keep a copy of a log file with damaged blocks inside as "Log.bad" before it is replaced, so the records
+				lost can still be recovered from it by hand
+Return:			true if succeed or there is no damaged block, false otherwise
+*/
+bool IceEncryptedFile::KeepDamagedFile() {
+	return DamagedBlocks.empty() || IceCopyFile(LogPath, BasePath + L".bad");
+}
+
+/*
+Description:    Check if the password is correct. Only the password at the beginning of the file
+				is read and decrypted, so the time needed does not depend on the size of the file
+Args:			Password: The password to be checked
+Return:			true if the password is correct, false otherwise
+*/
+bool IceEncryptedFile::CheckPassword(wchar_t *Password) {
+	wstring	Key;
+
+	return ResolveKey(Password, Key) && CheckKey(Key.c_str());
+}
+
+/*
+Description:    Get the key to the files from the password. If there is a key file, the files are encrypted with AES,
+				and the key is derived from the password with the salt and iterations in the key file
+Args:			Password: The password
+				Key: Variable to receive the key, the password itself or the token of the derived key
+Return:			true if succeed, false if the key file is damaged
+*/
+bool IceEncryptedFile::ResolveKey(const wchar_t *Password, wstring &Key) {
+	KeyFileHeader	KeyFile;
+	ifstream		fsKey;
+	wchar_t			Token[CIPHER_MAX_KEY];
+
+	fsKey.open(KeyPath.c_str(), ios::binary);
+	if (fsKey.fail()) {																			//Files encrypted with the password
+		StrongCipher = false;
+		Key = Password;
+		return true;
+	}
+	if (!fsKey.read((char*)&KeyFile, sizeof(KeyFile)) ||
+		KeyFile.Magic != KEY_MAGIC || KeyFile.Iterations < KDF_MIN_ITERATIONS)						//Damaged key file
+		return false;
+	if (lstrlenW(Password) <= 0)																//Password not provided
+		return false;
+	IceDeriveKey(Password, KeyFile, Token);
+	StrongCipher = true;
+	KdfIterations = KeyFile.Iterations;															//Keep the cost chosen when the key file was written
+	Key = Token;
+	return true;
+}
+
+/*
+Description:    Write the key file for the files encrypted with a new key, see SwapRekeyedFiles()
+Args:			KeyFile: Salt and no. of iterations, NULL if the files are encrypted with the password. An empty file
+						 is written then, and the key file is deleted when the files are moved in
+Return:			true if succeed, false otherwise
+*/
+bool IceEncryptedFile::SaveKeyFile(const KeyFileHeader *KeyFile) {
+	return IceReplaceFile(KeyPath + REKEY_SUFFIX, (const BYTE*)KeyFile, KeyFile ? sizeof(KeyFileHeader) : 0);
+}
+
+/*
+Description:    Move the files encrypted with a new key by ChangePassword() in. The log file is written last, so if it
+				exists, all files are complete and they are moved in: the segments, manifest and summaries, then the key
+				file, then the log file. Otherwise the password change didn't finish, and the files are deleted. Called
+				before the files are opened as well, so a change interrupted by a crash is either completed or undone
+Return:			true if succeed, false otherwise. The files left are moved in next time
+*/
+bool IceEncryptedFile::SwapRekeyedFiles() {
+	wstring						Directory = BasePath.substr(0, BasePath.find_last_of(L"\\/") + 1);
+	wstring						StagedLog = LogPath + REKEY_SUFFIX, StagedKey = KeyPath + REKEY_SUFFIX;
+	bool						Commit = GetFileAttributesW(StagedLog.c_str()) != INVALID_FILE_ATTRIBUTES;
+	bool						Result = true;
+	WIN32_FIND_DATAW			Found;
+	WIN32_FILE_ATTRIBUTE_DATA	KeyInfo;
+	HANDLE						hFind = FindFirstFileW((BasePath + L"*" + REKEY_SUFFIX).c_str(), &Found);
+
+	if (hFind != INVALID_HANDLE_VALUE) {														//Segments, manifest and summaries
+		do {
+			wstring	Staged = Directory + Found.cFileName;
+			wstring	Path = Staged.substr(0, Staged.size() - lstrlenW(REKEY_SUFFIX));
+			if (Staged == StagedLog || Staged == StagedKey)
+				continue;
+			if (!Commit)
+				DeleteFileW(Staged.c_str());
+			else if (!IceMoveFile(Staged, Path))
+				Result = false;
+		} while (FindNextFileW(hFind, &Found));
+		FindClose(hFind);
+	}
+	if (!Commit) {
+		DeleteFileW(StagedKey.c_str());
+		return true;
+	}
+
+	if (Result && GetFileAttributesExW(StagedKey.c_str(), GetFileExInfoStandard, &KeyInfo)) {
+		if (KeyInfo.nFileSizeLow == 0 && KeyInfo.nFileSizeHigh == 0) {								//Nothing is encrypted with a derived key any more
+			DeleteFileW(KeyPath.c_str());
+			Result = GetFileAttributesW(KeyPath.c_str()) == INVALID_FILE_ATTRIBUTES && DeleteFileW(StagedKey.c_str());
+		}
+		else
+			Result = IceMoveFile(StagedKey, KeyPath);
+	}
+	if (Result) {
+		if (fsFile.is_open())
+			Result = ReplaceLogFile(StagedLog);
+		else
+			Result = IceMoveFile(StagedLog, LogPath);
+	}
+	return Result;
+}
+
+/*
+Description:    Check if the key is correct, see CheckPassword()
+Args:			Key: The key to be checked, see ResolveKey()
+Return:			true if the key is correct, false otherwise
+*/
+bool IceEncryptedFile::CheckKey(const wchar_t *Key) {
+	BYTE			Header[CHECK_BLOCK_SIZE];												//Header of the file
+	DWORD			Version;
+	int				Span;
+	IceKeySchedule	Schedule;
+
+	if (fsFile.fail() || WithoutFile)															//No file opened
+		return false;
+	if (lstrlenW(Key) <= 0)																		//Key not provided
+		return false;
+
+	Version = GetFileVersion();
+	if (Version == LEGACY_VERSION) {															//Legacy files start with the password
+		fsFile.seekg(0, ios::beg);
+		if (!fsFile.read((char*)Header, sizeof(wchar_t) * 20)) {									//Read the encrypted key only
+			fsFile.clear();
+			return false;
+		}
+		return IceCrypt(Header, sizeof(wchar_t) * 20, Key, 0) && !wcsncmp((wchar_t*)Header, Key, 20);	//Decrypt it with the provided key
+	}
+	if ((Span = IceRecordHeaderSpan(Version)) == 0)												//Unknown format
+		return false;
+	fsFile.seekg(0, ios::beg);
+	if (!fsFile.read((char*)Header, Span)) {													//Read the header only, a sealed header is checked as a whole
+		fsFile.clear();
+		return false;
+	}
+	return IceExpandKey(Key, Schedule) && IceOpenRecordHeader(Header, Schedule) &&
+		!wcsncmp((wchar_t*)(Header + FILE_PLAIN_SIZE), Key, 20);
+}
+
+/*
+Description:    Get the format version of the log file from the unencrypted part of the header
+Return:			The version, LEGACY_VERSION if the file has no magic, 0 if the file can't be read
+*/
+DWORD IceEncryptedFile::GetFileVersion() {
+	DWORD	Signature[2];																	//Magic + version
+
+	fsFile.seekg(0, ios::beg);
+	if (!fsFile.read((char*)Signature, sizeof(Signature))) {
+		fsFile.clear();
+		return 0;
+	}
+	if (Signature[0] != LOG_MAGIC)																//The first byte of a legacy file is never 'I'
+		return LEGACY_VERSION;
+	return Signature[1];
+}
+
+/*
+Description:    Read the file and decrypt the content with the password provided
+Args:			Password: The password to the file
+Return:			true if succeed, false otherwise
+*/
+bool IceEncryptedFile::ReadFile(wchar_t *Password) {
+	wstring	Key;
+
+	if (!ResolveKey(Password, Key) || !CheckKey(Key.c_str()))									//Reject wrong passwords before touching the log data
+		return false;
+	if (GetFileVersion() == LEGACY_VERSION) {													//Convert a file written by an older version
+		if (!ConvertLegacyFile(Key.c_str()))
+			return false;
+		lstrcpynW(FileContent.Password, Password, CIPHER_MAX_KEY);
+		LoadSummaries();
+		ArchiveClosedSessions();
+		return true;
+	}
+
+	//Map the log file into memory instead of reading it into a temporary buffer
+	BYTE			Header[CHECK_BLOCK_SIZE];
+	IceRecordStore	LogData;
+	vector<UINT>	Sessions, Checkpoint;
+	UINT			InvalidCount = 0, Stamp = 0, DroppedCount = 0;
+	ULONGLONG		ElementCount;
+	DWORD			Version;
+
+	//Only the records after the checkpoint are searched for parking cars
+	if (!LoadCheckpoint(Key.c_str(), Stamp, Checkpoint)) {
+		Stamp = 0;
+		Checkpoint.clear();
+	}
+	if (!IceReadRecordFile(LogPath, Key.c_str(), Header, LogData, &Sessions, &InvalidCount, &Stamp, &DroppedCount, &DamagedBlocks,
+		LoadThreads))
+		return false;
+	OpenSessions.clear();																		//Cars still parking
+	for (UINT i = 0; i < Checkpoint.size(); i++) {												//Cars in the checkpoint may have left since then
+		UINT	Index = Checkpoint[i];
+		if (Index < Stamp && Index < LogData.Size() && (i == 0 || Index > Checkpoint[i - 1]) &&
+			LogData[Index].LeaveTime == 0 && IceCheckRecord(LogData[Index]))
+			OpenSessions.push_back(Index);
+	}
+	OpenSessions.insert(OpenSessions.end(), Sessions.begin(), Sessions.end());
+	InvalidRecords = InvalidCount;
+	TruncatedRecords = DroppedCount;
+	lstrcpynW(FileContent.Password, Password, CIPHER_MAX_KEY);								//Password
+	CipherKey = Key;
+	IceParseRecordHeader(Header, Key.c_str(), ElementCount, FileContent.FeePerHour, &FileContent.Capacity);	//Fee per hour and no. of positions
+	memcpy(&Version, Header + sizeof(DWORD), sizeof(DWORD));									//Version
+	LogGeneration = IceRecordGeneration(Header);
+	FileContent.LogData.Swap(LogData);															//All log data
+	FileContent.ElementCount = (UINT)FileContent.LogData.Size();								//Element count
+	SnapshotCount = FileContent.ElementCount;
+
+	ReplayJournal();																			//Apply changes made after the snapshot, which may repair damaged blocks
+	DamagedRecords = 0;
+	for (UINT i = 0; i < DamagedBlocks.size(); i++) {											//Records lost in the damaged blocks
+		for (UINT j = DamagedBlocks[i]; j < min(DamagedBlocks[i] + CHECK_BLOCK_RECORDS, FileContent.ElementCount); j++) {
+			if (!IceCheckRecord(FileContent.LogData[j]))
+				DamagedRecords++;
+		}
+	}
+	if ((Version != LOG_VERSION || DroppedCount) && DamagedBlocks.empty())						//Rewrite older files in the current format, so in-place updates
+		SaveFile();																					//always write checksummed blocks, and cut the damaged tail off.
+	else if (Version != LOG_VERSION)															//A file with damaged blocks inside is kept as it is, and
+		SnapshotCount = 0;																			//its blocks of an older format are never overwritten
+	InstallCompaction();																		//Finish or undo a compaction interrupted by a crash
+	LoadManifest();																				//Get the list of archived segments
+	LoadSummaries();
+	StartCompaction();																			//Move the records of the cars left days ago out of the log file
+	return true;
+}
+
+/*
+Description:    Change the password. The log file, archived segments, manifest and summaries are encrypted with the new
+				key into files next to them, which are moved in only when all of them are written, see SwapRekeyedFiles().
+				A failure before leaves the files encrypted with the current key. Also called with the current password
+				to switch the encryption
+Args:			NewPassword: The new password
+				Strong: If a new key is derived from the password with a new salt and the files are encrypted with AES,
+						otherwise they are encrypted with the password itself. StrongCipher is set when the change is done
+Return:			true if succeed, false otherwise
+*/
+bool IceEncryptedFile::ChangePassword(const wchar_t *NewPassword, bool Strong) {
+	KeyFileHeader	KeyFile = { KEY_MAGIC, max(KdfIterations, KDF_MIN_ITERATIONS) };
+	wchar_t			NewKey[CIPHER_MAX_KEY];
+	wstring			TempPath = LogPath + L".tmp";
+	ofstream		fsOut;
+	bool			Result = true;
+
+	if (lstrlenW(NewPassword) <= 0)																//Password not provided
+		return false;
+	CancelCompaction();																			//The compaction thread writes segments with the old key
+	if (!InstallCompaction())																	//Staged segments are encrypted with the old key
+		return false;
+	if (Strong) {																				//Derive the new key with a new salt
+		if (!IceRandomBytes(KeyFile.Salt, KDF_SALT_SIZE))
+			return false;
+		IceDeriveKey(NewPassword, KeyFile, NewKey);
+	}
+	else
+		lstrcpynW(NewKey, NewPassword, CIPHER_MAX_KEY);
+	if (fsFile.fail() || WithoutFile) {															//No file opened, nothing to encrypt
+		lstrcpyW(FileContent.Password, NewPassword);
+		CipherKey = NewKey;
+		StrongCipher = Strong;
+		return false;
+	}
+	DrainJournal();																				//Queued records are in the new log file
+
+	//Encrypt the files with the new key. The log file is the last, as it tells that all others are complete
+	for (UINT i = 0; i < Segments.size() && Result; i++) {
+		vector<LogInfo>	Records;
+		Result = ReadSegment(i, 0, MAXLONGLONG, Records) &&
+			IceWriteHistoryFile(GetSegmentPath(Segments[i].Year, Segments[i].Month) + REKEY_SUFFIX, NewKey, Records);
+	}
+	Result = Result && SaveManifest(ManifestPath + REKEY_SUFFIX, NewKey, Segments) && SaveSummaries(SummaryPath + REKEY_SUFFIX, NewKey) &&
+		SaveKeyFile(Strong ? &KeyFile : NULL) && KeepDamagedFile();
+	if (Result) {
+		fsOut.open(TempPath.c_str(), ios::binary | ios::trunc);
+		Result = !fsOut.fail() && IceWriteRecordFile(fsOut, NewKey, FileContent.FeePerHour, FileContent.Capacity, LogGeneration,
+			FileContent.LogData);
+		fsOut.close();
+		Result = Result && !fsOut.fail() && IceMoveFile(TempPath, LogPath + REKEY_SUFFIX);
+	}
+	if (!Result) {																				//Keep the current key, and delete the new files
+		DeleteFileW(TempPath.c_str());
+		SwapRekeyedFiles();
+		return false;
+	}
+
+	//Move the files in. The change is done from here, the files left are moved in next time if this fails
+	DeleteFileW(CheckpointPath.c_str());														//Encrypted with the current key
+	Result = SwapRekeyedFiles();
+	lstrcpyW(FileContent.Password, NewPassword);												//Store the new password
+	CipherKey = NewKey;
+	StrongCipher = Strong;
+	SnapshotCount = FileContent.ElementCount;
+	DamagedBlocks.clear();
+	if (hJournal != INVALID_HANDLE_VALUE)														//All journal records are in the new log file
+		Result = ResetJournal() && Result;
+	SaveCheckpoint();
+	return Result;
+}
+
+/*
+Description:    Get the records of the archived segments overlapping a period of time
+Args:			From: Beginning of the period, see IceToEpoch()
+				To: End of the period
+				Records: Vector to store the records
+*/
+void IceEncryptedFile::ReadSegments(LONGLONG From, LONGLONG To, vector<LogInfo> &Records) {
+	Records.clear();
+	for (UINT i = 0; i < Segments.size(); i++) {
+		if (Segments[i].FirstTime > To || Segments[i].LastTime < From)							//The segment doesn't overlap the period
+			continue;
+		ReadSegment(i, From, To, Records);															//Damaged segments are ignored
+	}
+}
+
+/*
+Description:    Check if a car was in the car park during a period of time, i.e. it entered before the end of the
+				period and didn't leave before the beginning
+Args:			Info: The record
+				From: Beginning of the period, see IceToEpoch()
+				To: End of the period
+Return:			true if the car was in the car park
+*/
+static inline bool IceOverlaps(const LogInfo &Info, LONGLONG From, LONGLONG To) {
+	return (Info.EnterTime > 0) & (Info.EnterTime <= To) & ((Info.LeaveTime == 0) | (Info.LeaveTime >= From));	//Integer compares only, no short circuit
+}
+
+/*
+Description:    Get the records which may be related to a period of time: the records of archived segments overlapping
+				the period, and the records of the log file of the cars in the car park during the period. The other
+				records of the log file entered and left before the period, or entered after it, so they don't change
+				any count of the period
+Args:			From: Beginning of the period, see IceToEpoch()
+				To: End of the period
+				Records: Vector to store the records
+*/
+void IceEncryptedFile::ReadRange(LONGLONG From, LONGLONG To, vector<LogInfo> &Records) {
+	size_t	Run;
+
+	ReadSegments(From, To, Records);
+	for (size_t i = 0; i < FileContent.LogData.Size(); i += Run) {							//A run of records at a time
+		const LogInfo	*First = FileContent.LogData.GetRun(i, Run);
+		for (size_t j = 0; j < Run; j++) {
+			if (IceOverlaps(First[j], From, To))													//The records are in enter order, so the result
+				Records.push_back(First[j]);															//of the test rarely changes from one to the next
+		}
+	}
+}
+
+/*
+Description:    Read the records of an archived segment which may be related to a period of time
+Args:			Index: Index of the segment in Segments
+				From: Beginning of the period, see IceToEpoch()
+				To: End of the period
+				Records: Vector to append the records to
+Return:			true if succeed, false if the segment is damaged
+*/
+bool IceEncryptedFile::ReadSegment(UINT Index, LONGLONG From, LONGLONG To, vector<LogInfo> &Records) {
+	size_t	OldCount = Records.size();
+	UINT	ElementCount;
+
+	if (!IceReadHistoryFile(GetSegmentPath(Segments[Index].Year, Segments[Index].Month), CipherKey.c_str(),
+		From, To, Records, &ElementCount))																//Only the blocks overlapping the period are read
+		return false;
+	if (ElementCount != Segments[Index].ElementCount ||
+		(Records.size() - OldCount == ElementCount &&
+		IceChecksum((BYTE*)(Records.data() + OldCount), (streamoff)sizeof(LogInfo) * ElementCount) != Segments[Index].Checksum)) {
+		Records.resize(OldCount);																	//Damaged segment
+		return false;
+	}
+	return true;
+}
+
+/*
+Description:    Write data to a file at the specified position
+Args:			hFile: Handle to the file
+				Offset: Position to write at
+				Data: Data to be written
+				Length: Size of the data in bytes
+Return:			true if succeed, false otherwise
+*/
+static bool IceWriteAt(HANDLE hFile, streamoff Offset, const void *Data, DWORD Length) {
+	OVERLAPPED	Overlapped = {};
+	DWORD		Written;
+
+	Overlapped.Offset = (DWORD)Offset;
+	Overlapped.OffsetHigh = (DWORD)(Offset >> 32);
+	return WriteFile(hFile, Data, Length, &Written, &Overlapped) && Written == Length;
+}
+
+/*
+Description:    Read data from a file at the specified position
+Args:			hFile: Handle to the file
+				Offset: Position to read at
+				Data: Buffer to store the data
+				Length: Size of the buffer in bytes
+Return:			No. of bytes read
+*/
+static DWORD IceReadAt(HANDLE hFile, streamoff Offset, void *Data, DWORD Length) {
+	OVERLAPPED	Overlapped = {};
+	DWORD		Read;
+
+	Overlapped.Offset = (DWORD)Offset;
+	Overlapped.OffsetHigh = (DWORD)(Offset >> 32);
+	if (!::ReadFile(hFile, Data, Length, &Read, &Overlapped))									//Reading beyond the end of the file fails with ERROR_HANDLE_EOF
+		return 0;
+	return Read;
+}
+
+/*
+Description:    Open the journal file, and start the writer thread if group commit is enabled
+Args:			Truncate: Discard the content of the existing journal file
+Return:			true if succeed, false otherwise
+*/
+bool IceEncryptedFile::OpenJournal(bool Truncate) {
+	LARGE_INTEGER	szFile;
+
+	hJournal = CreateFileW(JournalPath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+		NULL, Truncate ? CREATE_ALWAYS : OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);				//Open the existing journal file, or create an empty one
+	if (hJournal == INVALID_HANDLE_VALUE)														//Path not accessible, every change rewrites the whole log file
+		return false;
+	if (Truncate || !GetFileSizeEx(hJournal, &szFile) || szFile.QuadPart == 0) {				//Write the header for an empty journal
+		if (!ResetJournal()) {
+			CloseHandle(hJournal);
+			hJournal = INVALID_HANDLE_VALUE;
+			return false;
+		}
+	}
+
+	if (GroupCommit) {
+		hLogWriter = CreateFileW(LogPath.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+			NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);											//In-place updates are appended to the journal if this fails
+		CommitThread = thread(&IceEncryptedFile::CommitThreadProc, this);
+	}
+	return true;
+}
+
+/*
+Description:    Empty the journal file and write a new header for the current snapshot
+Return:			true if succeed, false otherwise
+*/
+bool IceEncryptedFile::ResetJournal() {
+	JournalHeader	Header = { JOURNAL_MAGIC, FileContent.ElementCount, LogGeneration };
+	BYTE			Sealed[sizeof(JournalHeader) + CIPHER_SEAL];
+	int				Length = sizeof(Header) + IceSealSize(CipherKey.c_str());
+	LARGE_INTEGER	Zero = {};
+
+	DrainJournal();																				//Queued records are included in the snapshot, let the writer thread finish them first
+	lock_guard<mutex>	Lock(CommitMutex);
+	memcpy(Sealed, &Header, sizeof(Header));
+	if (!IceSeal(Sealed, sizeof(Header), CipherKey.c_str(), 0))									//Encrypt the header
+		return false;
+	if (!SetFilePointerEx(hJournal, Zero, NULL, FILE_BEGIN) || !SetEndOfFile(hJournal) ||		//Truncate the journal file
+		!IceWriteAt(hJournal, 0, Sealed, Length))
+		return false;
+	JournalSize = Length;
+	JournalCount = 0;
+	CommitFailed = false;
+	return true;
+}
+
+/*
+Description:    Append a record to the journal file. Only the affected record is written,
+				so the cost does not depend on the size of the log. If group commit is enabled,
+				the record is queued for the writer thread and this function returns immediately
+Args:			Type: JOURNAL_ENTER or JOURNAL_EXIT
+				Index: Index of the affected record
+				Ticket: Variable to receive the ticket for WaitForCommit(), can be NULL
+Return:			true if succeed, false otherwise
+*/
+bool IceEncryptedFile::AppendJournal(UINT Type, UINT Index, ULONGLONG *Ticket) {
+	PendingRecord	Pending;
+	JournalRecord	Record = { Type, Index, FileContent.LogData[Index] };
+
+	if (Ticket)																					//Nothing to wait for unless the record is queued
+		*Ticket = 0;
+	if (hJournal == INVALID_HANDLE_VALUE)														//No journal opened
+		return false;
+
+	memcpy(Pending.Record, &Record, sizeof(Record));
+	Pending.Length = sizeof(Record) + IceSealSize(CipherKey.c_str());
+	Pending.InPlace = false;
+	Pending.Offset = JournalSize;
+	if (!IceSeal(Pending.Record, sizeof(Record), CipherKey.c_str(), JournalSize))				//Encrypt the record with its position in the journal
+		return false;
+
+	if (CommitThread.joinable()) {																//Queue the record for the writer thread
+		if (!QueueRecord(Pending, Ticket))
+			return false;
+	}
+	else if (!IceWriteAt(hJournal, JournalSize, Pending.Record, Pending.Length))				//Append to the journal directly
+		return false;
+	JournalSize += Pending.Length;
+	JournalCount++;
+
+	if (JournalCount >= JOURNAL_COMPACT_LIMIT)													//Journal is too long, compact it into a new snapshot
+		SaveFile();
+	return true;
+}
+
+/*
+Description:    Overwrite a record of the log file in place. Every block is encrypted on its own (and sealed with a new
+				nonce if the key is a derived key), so the block containing the record is written alone with a new checksum, and the
+				cost does not depend on the size of the log. Blocks are aligned to CHECK_BLOCK_SIZE and written at once
+Args:			Index: Index of the record, must be less than SnapshotCount
+				Ticket: Variable to receive the ticket for WaitForCommit(), can be NULL
+Return:			true if succeed, false otherwise
+*/
+bool IceEncryptedFile::PatchRecord(UINT Index, ULONGLONG *Ticket) {
+	PendingRecord	Pending;
+	IceKeySchedule	Schedule;
+	UINT			First = Index - Index % CHECK_BLOCK_RECORDS;									//First record of the block
+
+	if (Ticket)																					//Nothing to wait for unless the record is queued
+		*Ticket = 0;
+	if (binary_search(DamagedBlocks.begin(), DamagedBlocks.end(), First))						//Keep the damaged block as it is, the record goes to the journal
+		return false;
+
+	if (!IceExpandKey(CipherKey.c_str(), Schedule))
+		return false;
+	Pending.InPlace = true;
+	Pending.Offset = IceRecordOffset(LOG_VERSION, First);
+	Pending.Block.resize(CHECK_BLOCK_SIZE);
+	IceEncodeBlock(Pending.Block.data(), &FileContent.LogData[First], min(SnapshotCount - First, CHECK_BLOCK_RECORDS),
+		Schedule, Pending.Offset);																	//Records of the block in the log file only
+
+	if (CommitThread.joinable()) {																//Queue the record for the writer thread
+		if (hLogWriter == INVALID_HANDLE_VALUE)
+			return false;
+		return QueueRecord(Pending, Ticket);
+	}
+	fsFile.seekp(Pending.Offset, ios::beg);														//Write the block directly
+	fsFile.write((char*)Pending.Block.data(), CHECK_BLOCK_SIZE);
+	if (fsFile.flush().bad()) {
+		fsFile.clear();
+		return false;
+	}
+	return true;
+}
+
+/*
+Description:    Queue an encrypted record for the writer thread
+Args:			Pending: The record, Ticket and QueuedTime are filled by this function
+				Ticket: Variable to receive the ticket for WaitForCommit(), can be NULL
+Return:			true if succeed, false if the writer thread failed previously
+*/
+bool IceEncryptedFile::QueueRecord(PendingRecord &Pending, ULONGLONG *Ticket) {
+	LARGE_INTEGER	Now;
+
+	QueryPerformanceCounter(&Now);
+	Pending.QueuedTime = Now.QuadPart;
+	{
+		lock_guard<mutex>	Lock(CommitMutex);
+		if (CommitFailed)																			//The files are not reliable now, let the caller save the whole file
+			return false;
+		Pending.Ticket = ++QueuedTicket;
+		CommitQueue.push_back(Pending);
+	}
+	CommitQueued.notify_one();
+	if (Ticket)
+		*Ticket = Pending.Ticket;
+	return true;
+}
+
+/*
+Description:    Wait until a queued journal record is written and synchronized to the disk.
+				If the writer thread failed, the whole file is saved instead
+Args:			Ticket: Ticket received from AddLog() or UpdateLog()
+Return:			true if the record is saved, false otherwise
+*/
+bool IceEncryptedFile::WaitForCommit(ULONGLONG Ticket) {
+	bool	Failed;
+
+	{
+		unique_lock<mutex>	Lock(CommitMutex);
+		CommitDone.wait(Lock, [&] { return CommittedTicket >= Ticket || CommitFailed; });
+		Failed = CommitFailed;
+	}
+	if (Failed)
+		return SaveFile();
+	return true;
+}
+
+/*
+Description:    Get the group commit counters
+Return:			A copy of the counters
+*/
+CommitStats IceEncryptedFile::GetCommitStats() {
+	lock_guard<mutex>	Lock(CommitMutex);
+
+	return Stats;
+}
+
+/*
+Description:    Add a record to or remove a record from OpenSessions
+Args:			Index: Index of the record
+				Open: If the car of the record is still parking
+*/
+void IceEncryptedFile::SetSessionOpen(UINT Index, bool Open) {
+	vector<UINT>::iterator	it = lower_bound(OpenSessions.begin(), OpenSessions.end(), Index);
+	bool					Found = it != OpenSessions.end() && *it == Index;
+
+	if (Open && !Found)
+		OpenSessions.insert(it, Index);
+	else if (!Open && Found)
+		OpenSessions.erase(it);
+}
+
+/*
+Description:    Wait until the writer thread commits all queued records
+Return:			true if all records are committed, false otherwise
 */
-IceEncryptedFile::IceEncryptedFile(const wchar_t *FilePath) {
-	//Open log file
-	lstrcpyW(FileContent.Password, L"123");													//Set the default password
-	FileContent.FeePerHour = 10;															//Set the default fee per hour
-	FileContent.ElementCount = 0;															//Set the default element count
-	fsFile.open(FilePath, ios::binary | ios::in | ios::out);								//Attempt to open the file with read/write privilege
-	if (fsFile.fail()) {
-		fsFile.open(FilePath, ios::binary | ios::out);											//Create log file if it doesn't exist, open it with write privilege only
-		CreatedNewFile = true;																	//Mark as created a new file
-		if (fsFile.fail()) {																		//Path not accessible
-			fsFile.close();
-			if (MessageBox(GetMainWindowHandle(),
-				L"Failed to access log file! Continue without log file?",
-				L"Error",
-				MB_ICONERROR | MB_YESNO) == IDNO) {
+bool IceEncryptedFile::DrainJournal() {
+	unique_lock<mutex>	Lock(CommitMutex);
 
-				DestroyWindow(GetMainWindowHandle());												//Quit the system
-				PostQuitMessage(0);
+	CommitDone.wait(Lock, [this] { return CommittedTicket >= QueuedTicket; });
+	return !CommitFailed;
+}
+
+/*
+Description:    Writer thread of group commit. Records queued within CommitWindow ms
+				(or until CommitBatchLimit records are queued) are written and synchronized at once
+*/
+void IceEncryptedFile::CommitThreadProc() {
+	vector<PendingRecord>	Batch;
+	vector<BYTE>			Buffer;
+	unique_lock<mutex>		Lock(CommitMutex);
+
+	for (;;) {
+		CommitQueued.wait(Lock, [this] { return StopCommit || !CommitQueue.empty(); });
+		if (CommitQueue.empty())																	//Stopping, and nothing left to write
+			break;
+
+		//Wait for more records until the window of the first record ends
+		while (!StopCommit && CommitQueue.size() < CommitBatchLimit) {
+			LARGE_INTEGER	Now;
+			QueryPerformanceCounter(&Now);
+			LONGLONG	Elapsed = (Now.QuadPart - CommitQueue.front().QueuedTime) * 1000 / CounterFrequency;
+			if (Elapsed >= CommitWindow)
+				break;
+			CommitQueued.wait_for(Lock, chrono::milliseconds(CommitWindow - Elapsed));
+		}
+		Batch.swap(CommitQueue);
+		Lock.unlock();
+
+		//Journal records are queued in the order of their positions, so they are written at once.
+		//In-place updates are written to the log file one by one
+		bool		Result = true, LogWritten = false;
+		streamoff	JournalOffset = -1;
+		Buffer.clear();
+		for (UINT i = 0; i < Batch.size(); i++) {
+			if (Batch[i].InPlace) {
+				Result = IceWriteAt(hLogWriter, Batch[i].Offset, Batch[i].Block.data(), CHECK_BLOCK_SIZE) && Result;
+				LogWritten = true;
+			}
+			else {
+				if (JournalOffset < 0)
+					JournalOffset = Batch[i].Offset;
+				Buffer.insert(Buffer.end(), Batch[i].Record, Batch[i].Record + Batch[i].Length);
 			}
-			else																				//Continuing without log file
-				WithoutFile = true;
-			return;
 		}
-		if (!SaveFile()) {																	//Initalize the file content
-			fsFile.close();
-			if (MessageBox(GetMainWindowHandle(),
-				L"Failed to initalize the log file content! Please make sure the file is writable! Continue without log file?",
-				L"Error",
-				MB_ICONERROR | MB_YESNO) == IDNO) {												//Show a prompt if failed to initalize file content
+		if (!Buffer.empty())
+			Result = IceWriteAt(hJournal, JournalOffset, Buffer.data(), Buffer.size()) &&
+				FlushFileBuffers(hJournal) && Result;
+		if (LogWritten)
+			Result = FlushFileBuffers(hLogWriter) && Result;
+		LARGE_INTEGER	Now;
+		QueryPerformanceCounter(&Now);
 
-				DestroyWindow(GetMainWindowHandle());												//Quit the system
-				PostQuitMessage(0);
+		Lock.lock();
+		if (Result) {																				//Update counters
+			Stats.Batches++;
+			Stats.Records += Batch.size();
+			if (Batch.size() > Stats.MaxBatchSize)
+				Stats.MaxBatchSize = Batch.size();
+			for (UINT i = 0; i < Batch.size(); i++) {
+				ULONGLONG	Latency = (Now.QuadPart - Batch[i].QueuedTime) * 1000000 / CounterFrequency;
+				Stats.TotalLatency += Latency;
+				if (Latency > Stats.MaxLatency)
+					Stats.MaxLatency = Latency;
 			}
-			else																				//Continuing without log file
-				WithoutFile = true;
 		}
-		else {																				//Reopen the file with read/write privilege
-			fsFile.close();
-			fsFile.open(FilePath, ios::binary | ios::in | ios::out);
+		else
+			CommitFailed = true;
+		CommittedTicket = Batch.back().Ticket;
+		Batch.clear();
+		CommitDone.notify_all();
+	}
+}
+
+/*
+Description:    Apply the records in the journal file to the loaded snapshot. The journal must be written for a snapshot
+				of the same archive generation with the same no. of records. Replaying the changes of existing records
+				again is harmless, so a journal left by a crash right after a save is ignored or replayed without effect.
+				A journal of another generation (e.g. left by a crash after a compaction shrank the log file) is refused,
+				as its indices point to other records
+Return:			true if succeed, false otherwise
+*/
+bool IceEncryptedFile::ReplayJournal() {
+	JournalHeader		Header;
+	LegacyJournalHeader	Previous;
+	JournalRecord		Record;
+	BYTE				Sealed[sizeof(JournalRecord) + CIPHER_SEAL];
+	int					Seal = IceSealSize(CipherKey.c_str()), HeaderSize = sizeof(Header) + Seal;
+	DWORD				Read;
+	bool				Dirty = false;															//If the journal contains anything other than the header
+
+	if (hJournal == INVALID_HANDLE_VALUE)														//No journal opened
+		return false;
+
+	if (IceReadAt(hJournal, 0, Sealed, sizeof(Header) + Seal) == sizeof(Header) + Seal &&
+		IceOpen(Sealed, sizeof(Header), CipherKey.c_str(), 0))
+		memcpy(&Header, Sealed, sizeof(Header));
+	else
+		Header.Magic = 0;
+	if (Header.Magic != JOURNAL_MAGIC) {														//Written before the generation was added to the header
+		HeaderSize = sizeof(Previous) + Seal;
+		if (IceReadAt(hJournal, 0, Sealed, HeaderSize) != (DWORD)HeaderSize || !IceOpen(Sealed, sizeof(Previous), CipherKey.c_str(), 0))
+			return ResetJournal();																		//Empty or damaged journal
+		memcpy(&Previous, Sealed, sizeof(Previous));
+		if (Previous.Magic != UNVERSIONED_JOURNAL_MAGIC)
+			return ResetJournal();
+		Header.Magic = JOURNAL_MAGIC;
+		Header.BaseCount = Previous.BaseCount;
+		Header.Generation = LogGeneration;																//Checked by the no. of records only
+	}
+	if (Header.Generation != LogGeneration || Header.BaseCount != FileContent.ElementCount)	//Written with another password or for another snapshot
+		return ResetJournal();
+
+	JournalSize = HeaderSize;
+	while ((Read = IceReadAt(hJournal, JournalSize, Sealed, sizeof(Record) + Seal)) == sizeof(Record) + Seal) {	//Replay records one by one
+		Dirty = true;
+		if (!IceOpen(Sealed, sizeof(Record), CipherKey.c_str(), JournalSize))						//Damaged record, ignore the rest of the journal
+			break;
+		memcpy(&Record, Sealed, sizeof(Record));
+		if (Record.Type == JOURNAL_ENTER && Record.Index == FileContent.LogData.Size())				//New record
+			FileContent.LogData.Append(Record.Info);
+		else if ((Record.Type == JOURNAL_ENTER || Record.Type == JOURNAL_EXIT) &&
+			Record.Index < FileContent.LogData.Size())												//Modified record
+			FileContent.LogData[Record.Index] = Record.Info;
+		else																						//Damaged record, ignore the rest of the journal
+			break;
+		SetSessionOpen(Record.Index, Record.Info.LeaveTime == 0 && IceCheckRecord(Record.Info));	//Keep the parking cars list up to date
+		JournalSize += sizeof(Record) + Seal;
+	}
+	if (Read > 0)																				//Incomplete record at the end (e.g. power lost while writing)
+		Dirty = true;
+	FileContent.ElementCount = (UINT)FileContent.LogData.Size();
+
+	if (Dirty && DamagedBlocks.empty())															//Merge the journal into a new snapshot
+		return SaveFile();
+	JournalCount = (UINT)((JournalSize - HeaderSize) / (sizeof(Record) + Seal));	//Kept until a file with damaged blocks is saved
+	return true;
+}
+
+/*
+Description:    Convert a legacy (version 1) log file, together with its journal and archived segments, to the
+				current format. A copy of the legacy log file is kept as "Log.bak". Segments are converted and
+				listed in the manifest before the log file is replaced, so an interrupted conversion can be run again
+Args:			Password: The password to the file
+Return:			true if succeed, false otherwise
+*/
+bool IceEncryptedFile::ConvertLegacyFile(const wchar_t *Password) {
+	vector<LogInfo>		LogData;
+	float				FeePerHour;
+	LegacyJournalHeader	Header;
+	LegacyJournalRecord	Record;
+
+	if (!IceReadLegacyFile(LogPath, Password, FeePerHour, LogData))
+		return false;
+
+	//Apply the legacy journal. It is replaced by an empty journal when the converted file is saved
+	if (hJournal != INVALID_HANDLE_VALUE && IceReadAt(hJournal, 0, &Header, sizeof(Header)) == sizeof(Header)) {
+		IceCrypt((BYTE*)&Header, sizeof(Header), Password, 0);
+		if (Header.Magic == LEGACY_JOURNAL_MAGIC && Header.BaseCount == LogData.size()) {
+			streamoff	Offset = sizeof(Header);
+			while (IceReadAt(hJournal, Offset, &Record, sizeof(Record)) == sizeof(Record)) {
+				IceCrypt((BYTE*)&Record, sizeof(Record), Password, Offset);
+				if (Record.Type == JOURNAL_ENTER && Record.Index == LogData.size())						//New record
+					LogData.push_back(IceConvertLegacyRecord(Record.Info));
+				else if ((Record.Type == JOURNAL_ENTER || Record.Type == JOURNAL_EXIT) &&
+					Record.Index < LogData.size())															//Modified record
+					LogData[Record.Index] = IceConvertLegacyRecord(Record.Info);
+				else																						//Damaged record, ignore the rest of the journal
+					break;
+				Offset += sizeof(Record);
+			}
 		}
 	}
 
-	//Check file size
-	fsFile.seekg(0, ios::end);
-	streamoff	szFile = fsFile.tellg();														//Get file size
-	fsFile.clear();
-	fsFile.seekg(0, ios::beg);
-	if (szFile < sizeof(FileContent) - sizeof(wchar_t) * 20) {									//Invalid file size
-		if (MessageBox(GetMainWindowHandle(),
-			L"Invalid file content! Create a new file to replace current file?",
-			L"Error",
-			MB_ICONERROR | MB_YESNO) == IDNO) {
+	//Convert the segments listed in the legacy manifest. Nothing to do if the manifest is converted already
+	lstrcpyW(FileContent.Password, Password);
+	CipherKey = Password;
+	if (!LoadManifest()) {
+		ManifestHeader				ManifestHead;
+		vector<LegacySegmentInfo>	LegacySegments;
+		ifstream					fsManifest;
 
-			fsFile.close();																			//Don't create a new file
-			WithoutFile = true;																		//Continuing without log file
-			MessageBox(GetMainWindowHandle(),
-				L"Continuing without log file!",
-				L"Invalid File Content",
-				MB_ICONEXCLAMATION);
-			return;
+		fsManifest.open(ManifestPath.c_str(), ios::binary);
+		fsManifest.seekg(0, ios::end);
+		streamoff	szFile = fsManifest.tellg();													//Get file size
+		fsManifest.seekg(0, ios::beg);
+		if (fsManifest.read((char*)&ManifestHead, sizeof(ManifestHead))) {
+			IceCrypt((BYTE*)&ManifestHead, sizeof(ManifestHead), Password, 0);
+			if (ManifestHead.Magic == LEGACY_MANIFEST_MAGIC &&
+				sizeof(ManifestHead) + (streamoff)sizeof(LegacySegmentInfo) * ManifestHead.SegmentCount <= szFile) {
+
+				LegacySegments.resize(ManifestHead.SegmentCount);
+				fsManifest.read((char*)LegacySegments.data(), sizeof(LegacySegmentInfo) * ManifestHead.SegmentCount);
+				IceCrypt((BYTE*)LegacySegments.data(), sizeof(LegacySegmentInfo) * ManifestHead.SegmentCount, Password, sizeof(ManifestHead));
+			}
 		}
-		else {																					//Create a new file
-			if (!SaveFile()) {																		//Failed to create a new file
-				fsFile.close();
-				WithoutFile = true;																		//Continuing without log file
-				MessageBox(GetMainWindowHandle(),
-					L"Failed to create a new file! Continuing without log file!",
-					L"Invalid File Content",
-					MB_ICONEXCLAMATION);
-				return;
+		fsManifest.close();
+
+		for (UINT i = 0; i < LegacySegments.size(); i++) {
+			wstring			SegmentPath = GetSegmentPath(LegacySegments[i].Year, LegacySegments[i].Month);
+			vector<LogInfo>	Records;
+			float			SegmentFee;
+
+			if (!IceReadHistoryFile(SegmentPath, Password, 0, MAXLONGLONG, Records)) {					//Not converted by an interrupted conversion
+				if (!IceReadLegacyFile(SegmentPath, Password, SegmentFee, Records) || Records.empty())
+					continue;																						//Damaged segment, leave it as it is
+				sort(Records.begin(), Records.end(), [](const LogInfo &a, const LogInfo &b) {
+					return a.EnterTime < b.EnterTime;
+				});
+				if (!IceWriteHistoryFile(SegmentPath, Password, Records))
+					return false;
 			}
+			if (Records.empty())
+				continue;
+
+			SegmentInfo	Segment = {};
+			Segment.Year = LegacySegments[i].Year;
+			Segment.Month = LegacySegments[i].Month;
+			IceDescribeSegment(Segment, Records);
+			Segments.push_back(Segment);
 		}
+		if (!SaveManifest())
+			return false;
+	}
+
+	//Keep a copy of the legacy log file, then write the converted records over it
+	if (!IceCopyFile(LogPath, BasePath + L".bak"))
+		return false;
+	FileContent.FeePerHour = FeePerHour;
+	FileContent.LogData.Assign(LogData);
+	FileContent.ElementCount = (UINT)FileContent.LogData.Size();
+	OpenSessions.clear();
+	InvalidRecords = 0;
+	for (UINT i = 0; i < FileContent.ElementCount; i++) {										//Car numbers which can't be packed are counted as damaged
+		if (!IceCheckRecord(FileContent.LogData[i]))
+			InvalidRecords++;
+		else if (FileContent.LogData[i].LeaveTime == 0)
+			OpenSessions.push_back(i);
 	}
+	return SaveFile();
 }
 
 /*
-Description:    Destructor of encrypted file class
+Description:    Get the path of an archived segment, e.g. "Log_201906.dat"
+Args:			Year: Year of the segment
+				Month: Month of the segment
+Return:			The path of the segment
 */
-IceEncryptedFile::~IceEncryptedFile() {
-	//Close log file
-	fsFile.close();
+wstring IceEncryptedFile::GetSegmentPath(WORD Year, WORD Month) {
+	wchar_t	Suffix[16];
+
+	swprintf_s(Suffix, L"_%04u%02u.dat", Year, Month);
+	return BasePath + Suffix;
 }
 
 /*
-Description:    Add a new record to the file
-Args:			CarNumber: Car number
-				EnterTime: Enter time of the car
-				LeaveTime: Leave time of the car
-				CarPos: Parked position
-				Fee: Fee paid
+Description:    Read the list of archived segments from the manifest file
 Return:			true if succeed, false otherwise
 */
-bool IceEncryptedFile::AddLog(wchar_t CarNumber[10], SYSTEMTIME EnterTime, SYSTEMTIME LeaveTime, int CarPos, float Fee) {
-	if (fsFile.fail() || WithoutFile)															//No file opened
-		return false;
+bool IceEncryptedFile::LoadManifest() {
+	Segments.clear();
+	if (GetFileAttributesW(ManifestPath.c_str()) == INVALID_FILE_ATTRIBUTES)					//Nothing archived yet
+		return true;
+	return LoadManifest(ManifestPath, Segments);
+}
 
-	LogInfo	info;																				//Set the content
-	lstrcpyW(info.CarNumber, CarNumber);
-	info.EnterTime = EnterTime;
-	info.LeaveTime = LeaveTime;
-	info.CarPos = CarPos;
-	info.Fee = Fee;
+/*
+Description:    Read a list of archived segments from a file
+Args:			Path: Path of the file
+				List: Vector to store the segments
+Return:			true if succeed, false otherwise
+*/
+bool IceEncryptedFile::LoadManifest(const wstring &Path, vector<SegmentInfo> &List) {
+	ManifestHeader	Header;
+	vector<BYTE>	Content;
 
-	FileContent.LogData.push_back(info);														//Add log
-	FileContent.ElementCount++;	
-	SaveFile();																					//Update the log file
+	List.clear();
+	if (!IceLoadSealedFile(Path, CipherKey.c_str(), Content) || Content.size() < sizeof(Header))	//Damaged manifest
+		return false;
+	memcpy(&Header, Content.data(), sizeof(Header));
+	if ((Header.Magic != MANIFEST_MAGIC && Header.Magic != UNTAGGED_MANIFEST_MAGIC) ||
+		sizeof(Header) + (streamoff)sizeof(SegmentInfo) * Header.SegmentCount > (streamoff)Content.size())	//Written with another password, or damaged
+		return false;
+
+	List.resize(Header.SegmentCount);
+	memcpy(List.data(), Content.data() + sizeof(Header), sizeof(SegmentInfo) * Header.SegmentCount);
+	for (UINT i = 0; Header.Magic == UNTAGGED_MANIFEST_MAGIC && i < List.size(); i++)			//Written before the generations were stored
+		List[i].Generation = 0;
 	return true;
 }
 
 /*
-Description:    Save the file content
+Description:    Write the list of archived segments to the manifest file
 Return:			true if succeed, false otherwise
 */
-bool IceEncryptedFile::SaveFile() {
-	if (fsFile.fail() || WithoutFile)															//No file opened
+bool IceEncryptedFile::SaveManifest() {
+	return SaveManifest(ManifestPath, CipherKey.c_str(), Segments);
+}
+
+/*
+Description:    Write a list of archived segments to a file
+Args:			Path: Path of the file
+				Key: The key
+				List: The segments
+Return:			true if succeed, false otherwise
+*/
+bool IceEncryptedFile::SaveManifest(const wstring &Path, const wchar_t *Key, const vector<SegmentInfo> &List) {
+	ManifestHeader		Header = { MANIFEST_MAGIC, (UINT)List.size() };
+	streamoff			szFile = sizeof(Header) + (streamoff)sizeof(SegmentInfo) * List.size();
+	unique_ptr<BYTE[]>	Buffer(new BYTE[(size_t)szFile]);
+
+	memcpy(Buffer.get(), &Header, sizeof(Header));
+	memcpy(Buffer.get() + sizeof(Header), List.data(), sizeof(SegmentInfo) * List.size());
+	return IceSaveSealedFile(Path, Buffer.get(), szFile, Key);								//Encrypt binary data
+}
+
+/*
+Description:    Read the checkpoint file
+Args:			Password: The password
+				Stamp: Variable to receive the number of records covered by the checkpoint
+				Sessions: Vector to store the indices of the cars still parking among the covered records
+Return:			true if succeed, false otherwise
+*/
+bool IceEncryptedFile::LoadCheckpoint(const wchar_t *Password, UINT &Stamp, vector<UINT> &Sessions) {
+	CheckpointHeader	Header;
+	vector<BYTE>		Content;
+
+	if (!IceLoadSealedFile(CheckpointPath, Password, Content) || Content.size() < sizeof(Header))	//No checkpoint
 		return false;
-	
-	int		szFile = sizeof(wchar_t) * 20 + sizeof(UINT) + sizeof(int) + sizeof(LogInfo) * FileContent.ElementCount;
-	unique_ptr<BYTE[]> Buffer(new BYTE[szFile]);												//Allocate binary content buffer
-
-	memcpy(Buffer.get(), FileContent.Password, sizeof(wchar_t) * 20);							//Password
-	memcpy(Buffer.get() + sizeof(wchar_t) * 20, &(FileContent.ElementCount), sizeof(UINT));		//Element count
-	memcpy(Buffer.get() + sizeof(wchar_t) * 20 + sizeof(UINT),
-		&(FileContent.FeePerHour), sizeof(float));												//Fee per hour
-	memcpy(Buffer.get() + sizeof(wchar_t) * 20 + sizeof(UINT) + sizeof(float),
-		FileContent.LogData.data(), sizeof(LogInfo) * FileContent.ElementCount);				//All log data
-	int KeyLen = lstrlenW(FileContent.Password);
-	if (KeyLen <= 0)																			//Check password length
-		return false;
-	for (int i = 0; i < szFile; Buffer.get()[i++] ^= (487 ^ FileContent.Password[i % KeyLen]));	//Encrypt binary data
-	fsFile.seekg(0, ios::beg);
-	fsFile.write((char*)Buffer.get(), szFile);													//Write to the file
-	return !fsFile.flush().bad();																//Update the content of the file
+	memcpy(&Header, Content.data(), sizeof(Header));
+	if (Header.Magic != CHECKPOINT_MAGIC ||
+		sizeof(Header) + (streamoff)sizeof(UINT) * Header.SessionCount != (streamoff)Content.size())	//Written with another password, or damaged
+		return false;
+
+	Sessions.resize(Header.SessionCount);
+	memcpy(Sessions.data(), Content.data() + sizeof(Header), sizeof(UINT) * Header.SessionCount);
+	if (IceChecksum((BYTE*)Sessions.data(), sizeof(UINT) * Header.SessionCount) != Header.Checksum)
+		return false;
+	Stamp = Header.RecordCount;
+	return true;
 }
 
 /*
-Description:    Read the file and decrypt the content with the password provided
-Args:			Password: The password to the file
+Description:    Write the indices of the cars still parking to the checkpoint file
 Return:			true if succeed, false otherwise
 */
-bool IceEncryptedFile::ReadFile(wchar_t *Password) {
-	if (fsFile.fail() || WithoutFile)															//No file opened
+bool IceEncryptedFile::SaveCheckpoint() {
+	CheckpointHeader	Header = { CHECKPOINT_MAGIC, FileContent.ElementCount, (UINT)OpenSessions.size(),
+		IceChecksum((BYTE*)OpenSessions.data(), sizeof(UINT) * OpenSessions.size()) };
+	streamoff			szFile = sizeof(Header) + (streamoff)sizeof(UINT) * OpenSessions.size();
+	unique_ptr<BYTE[]>	Buffer(new BYTE[(size_t)szFile]);
+
+	memcpy(Buffer.get(), &Header, sizeof(Header));
+	memcpy(Buffer.get() + sizeof(Header), OpenSessions.data(), sizeof(UINT) * OpenSessions.size());
+	return IceSaveSealedFile(CheckpointPath, Buffer.get(), szFile, CipherKey.c_str());		//Encrypt binary data
+}
+
+/*
+Description:    Summarize the days of a period
+Args:			Lists: Lists of the records of the cars parked in the period. A car must not be listed twice,
+				and records of cars not parked in the period are ignored
+				From: Beginning of the first day, see IceToEpoch()
+				To: Beginning of the day after the last day
+				Summaries: Vector to append the summaries to
+*/
+static void IceSummarizeDays(const vector<const vector<LogInfo>*> &Lists, LONGLONG From, LONGLONG To,
+	vector<DailySummary> &Summaries) {
+
+	struct ParkingEvent {
+		LONGLONG	Time;																		//Enter or leave time
+		int			Delta;																		//1 = entered, -1 = left
+		int			Fee;																		//Fee paid if the car left
+	};
+	vector<ParkingEvent>	Events;
+	int						Occupancy = 0;														//No. of cars parked
+	size_t					e = 0;
+
+	for (size_t i = 0; i < Lists.size(); i++) {
+		for (size_t j = 0; j < Lists[i]->size(); j++) {
+			const LogInfo	&Info = (*Lists[i])[j];
+			if (Info.EnterTime >= To || (Info.LeaveTime != 0 && Info.LeaveTime < From))			//Not parked in the period
+				continue;
+			ParkingEvent	Enter = { Info.EnterTime, 1, 0 };
+			Events.push_back(Enter);
+			if (Info.LeaveTime != 0) {
+				ParkingEvent	Leave = { Info.LeaveTime, -1, Info.Fee };
+				Events.push_back(Leave);
+			}
+		}
+	}
+	sort(Events.begin(), Events.end(), [](const ParkingEvent &a, const ParkingEvent &b) {
+		return a.Time != b.Time ? a.Time < b.Time : a.Delta < b.Delta;								//Leaving cars first
+	});
+
+	for (LONGLONG Day = From; Day < To; Day += SECONDS_PER_DAY) {
+		DailySummary	Summary = { Day, 0, 0, 0, 0, 0 };
+		for (; e < Events.size() && Events[e].Time < Day; e++)									//Cars entered before the day
+			Occupancy += Events[e].Delta;
+		Summary.PeakOccupancy = (UINT)max(Occupancy, 0);
+		for (; e < Events.size() && Events[e].Time < Day + SECONDS_PER_DAY; e++) {
+			Occupancy += Events[e].Delta;
+			if (Events[e].Delta > 0) {
+				Summary.Enters++;
+				Summary.PeakOccupancy = max(Summary.PeakOccupancy, (UINT)Occupancy);
+			}
+			else {
+				Summary.Exits++;
+				Summary.Income += Events[e].Fee;
+			}
+		}
+		Summary.ClosingOccupancy = (UINT)max(Occupancy, 0);
+		Summaries.push_back(Summary);
+	}
+}
+
+/*
+Description:    Archive the closed sessions and wait until the log file is shrunk, see StartCompaction()
+Return:			true if succeed, false otherwise
+*/
+bool IceEncryptedFile::ArchiveClosedSessions() {
+	CompactionFailed = false;
+	StartCompaction();
+	FinishCompaction(true);
+	return !CompactionFailed;
+}
+
+/*
+Description:    Start a compaction job. The records of the cars left more than ArchiveHotDays days ago are moved into
+				the segments of their leave months, and the days before are summarized. The records are copied here,
+				then the segments and summaries are written by the compaction thread, so cars can enter and leave
+				while it runs. FinishCompaction() shrinks the log file after the thread is finished
+Return:			true if a job is started, false if there is nothing to do, a job is running or the log file has damaged blocks
+*/
+bool IceEncryptedFile::StartCompaction() {
+	SYSTEMTIME	stNow;
+	LONGLONG	Cutoff, FirstLeave = MAXLONGLONG;
+
+	if (fsFile.fail() || WithoutFile || CompactionThread.joinable())							//No file opened, or a job is running
 		return false;
+	if (!DamagedBlocks.empty())																	//Shrinking would rewrite a log file with damaged blocks
+		return false;
+	if (!InstallCompaction())																	//The segments of the last job are not moved in yet
+		return false;
+
+	GetLocalTime(&stNow);
+	Cutoff = IceToEpoch(stNow);
+	Cutoff -= Cutoff % SECONDS_PER_DAY + (LONGLONG)ArchiveHotDays * SECONDS_PER_DAY;				//Beginning of the day ArchiveHotDays days ago
+	Compaction = CompactionJob();
+	for (UINT i = 0; i < FileContent.ElementCount; i++) {										//Sort out the records to be archived
+		const LogInfo	&Info = FileContent.LogData[i];
+		if (Info.LeaveTime != 0)
+			FirstLeave = min(FirstLeave, Info.LeaveTime);
+		if (Info.LeaveTime != 0 && Info.LeaveTime < Cutoff) {
+			SYSTEMTIME	stLeave = IceFromEpoch(Info.LeaveTime);
+			Compaction.ArchiveData[stLeave.wYear * 100 + stLeave.wMonth].push_back(Info);
+			Compaction.Archived.push_back(i);
+		}
+		else if (Info.EnterTime < Cutoff)															//May be parked on the days to be summarized
+			Compaction.HotData.push_back(Info);
+	}
 
-	int		KeyLen = lstrlenW(Password);														//Get password length
-	if (KeyLen <= 0)																			//Password not provided
+	Compaction.SummarizedTo = SummarizedTo;
+	if (Compaction.SummarizedTo == 0) {
+		//Nothing summarized yet. Older versions archived the cars left before the current month, so the days
+		//from the first leave month of the log file on can be summarized from the log file
+		if (FirstLeave == MAXLONGLONG)
+			Compaction.SummarizedTo = Cutoff;
+		else {
+			SYSTEMTIME	stFirst = IceFromEpoch(FirstLeave);
+			stFirst.wDay = 1;
+			stFirst.wHour = stFirst.wMinute = stFirst.wSecond = 0;
+			Compaction.SummarizedTo = IceToEpoch(stFirst);
+		}
+	}
+	if (Compaction.Archived.empty() && Compaction.SummarizedTo >= Cutoff) {						//Nothing to do
+		Compaction = CompactionJob();
 		return false;
+	}
 
-	//Get file size
-	fsFile.seekg(0, ios::end);
-	streamoff	szFile = fsFile.tellg();														//Get file size
-	if (szFile == -1) {																			//Failed to get file size
-		return false;
-	}
-	fsFile.seekg(0, ios::beg);																	//Change file pointer to the beginning of file
-	unique_ptr<BYTE[]> Buffer(new BYTE[(int)szFile]);											//Smart pointer to the buffer
-
-	//Read file contents
-	fsFile.read((char*)(Buffer.get()), szFile);													//Read whole file
-	for (int i = 0; i < szFile; Buffer.get()[i++] ^= (487 ^ Password[i % KeyLen]));	 			//Decrypt binary data with the provided password
-	if (!lstrcmpW((wchar_t*)Buffer.get(), Password)) {											//Check if the decrypted password matches with the provided password
-		memcpy(FileContent.Password, Buffer.get(), sizeof(wchar_t) * 20);							//Password
-		memcpy(&(FileContent.ElementCount), Buffer.get() + sizeof(wchar_t) * 20, sizeof(UINT));		//Element count
-		memcpy(&(FileContent.FeePerHour),
-			Buffer.get() + sizeof(wchar_t) * 20 + sizeof(UINT), sizeof(float));						//Fee per hour
-		FileContent.LogData.resize(FileContent.ElementCount);										//Allocate LogData elements
-		memcpy(FileContent.LogData.data(),
-			Buffer.get() + sizeof(wchar_t) * 20 + sizeof(UINT) + sizeof(float),
-			sizeof(LogInfo) * FileContent.ElementCount);											//All log data
+	Compaction.Cutoff = Cutoff;
+	Compaction.Generation = LogGeneration + 1;
+	Compaction.Segments = Segments;
+	Compaction.Summaries = Summaries;
+	Compaction.Key = CipherKey;
+	CompactionDone = false;
+	CompactionThread = thread(&IceEncryptedFile::CompactionThreadProc, this);
+	return true;
+}
+
+/*
+Description:    Compaction thread. Merges the archived records into the segments, which are written to temporary files,
+				and summarizes the days. Only the job is touched, the log file is left to the thread owning it
+*/
+void IceEncryptedFile::CompactionThreadProc() {
+	CompactionJob					&Job = Compaction;
+	vector<const vector<LogInfo>*>	Lists;														//Records used by the summaries
+	bool							Result = true;
+
+	for (map<DWORD, vector<LogInfo>>::iterator it = Job.ArchiveData.begin(); Result && it != Job.ArchiveData.end(); it++) {
+		WORD			Year = (WORD)(it->first / 100), Month = (WORD)(it->first % 100);
+		vector<LogInfo>	&Records = it->second;
+		wstring			SegmentPath = GetSegmentPath(Year, Month);
+		UINT			SegIndex;
+
+		for (SegIndex = 0; SegIndex < Job.Segments.size(); SegIndex++) {							//Find the segment of the month
+			if (Job.Segments[SegIndex].Year > Year || (Job.Segments[SegIndex].Year == Year && Job.Segments[SegIndex].Month >= Month))
+				break;
+		}
+		if (SegIndex < Job.Segments.size() && Job.Segments[SegIndex].Year == Year && Job.Segments[SegIndex].Month == Month) {
+			//Merge with the existing segment, the records archived already are removed below
+			if (!IceReadHistoryFile(SegmentPath, Job.Key.c_str(), 0, MAXLONGLONG, Records)) {
+				Result = false;																			//Don't overwrite a segment that can't be read
+				break;
+			}
+		}
+		else {																						//New segment
+			SegmentInfo	NewSegment = {};
+			NewSegment.Year = Year;
+			NewSegment.Month = Month;
+			Job.Segments.insert(Job.Segments.begin() + SegIndex, NewSegment);
+		}
+
+		//Enter times are delta-encoded, so the records are written in the order of enter time
+		sort(Records.begin(), Records.end(), [](const LogInfo &a, const LogInfo &b) {
+			if (a.EnterTime != b.EnterTime)
+				return a.EnterTime < b.EnterTime;
+			return memcmp(&a, &b, sizeof(LogInfo)) < 0;
+		});
+		Records.erase(unique(Records.begin(), Records.end(), [](const LogInfo &a, const LogInfo &b) {
+			return !memcmp(&a, &b, sizeof(LogInfo));
+		}), Records.end());
+
+		IceDescribeSegment(Job.Segments[SegIndex], Records);										//Update segment info
+		Job.Segments[SegIndex].Generation = Job.Generation;
+		if (!IceWriteHistoryFile(SegmentPath + STAGED_SUFFIX, Job.Key.c_str(), Records))			//The segment is replaced by InstallCompaction()
+			Result = false;
+		else
+			Job.Written.push_back(SegmentPath);
+		Lists.push_back(&Records);
+	}
+
+	if (Result && Job.SummarizedTo < Job.Cutoff) {												//Summarize the days before the cutoff
+		Lists.push_back(&Job.HotData);
+		IceSummarizeDays(Lists, Job.SummarizedTo, Job.Cutoff, Job.Summaries);
+		Job.SummarizedTo = Job.Cutoff;
+	}
+	Job.Result = Result;
+
+	lock_guard<mutex>	Lock(CompactionMutex);
+	CompactionDone = true;
+}
+
+/*
+Description:    Finish the compaction job: save the summaries, stage the manifest next to it, shrink the log file, then
+				move the segments and the manifest in, see InstallCompaction(). Indices of LogData change, so indices kept
+				by the caller must be taken from OpenSessions again if records are removed. Sets CompactionFailed
+Args:			Wait: If wait for the compaction thread, otherwise return immediately if it is still running
+Return:			true if records are removed from the log file, false otherwise
+*/
+bool IceEncryptedFile::FinishCompaction(bool Wait) {
+	if (!CompactionThread.joinable())															//No job
+		return false;
+	if (!Wait) {
+		lock_guard<mutex>	Lock(CompactionMutex);
+		if (!CompactionDone)
+			return false;
+	}
+	CompactionThread.join();
+
+	CompactionJob	&Job = Compaction;
+	CompactionFailed = !Job.Result;
+	if (!CompactionFailed && !Job.Archived.empty() &&
+		!SaveManifest(ManifestPath + STAGED_SUFFIX, CipherKey.c_str(), Job.Segments))			//Tells which segments are staged
+		CompactionFailed = true;
+	if (CompactionFailed) {																		//Keep the records in the log file
+		CancelCompaction();
+		return false;
+	}
+	Summaries.swap(Job.Summaries);
+	SummarizedTo = Job.SummarizedTo;
+	SaveSummaries();
+	if (Job.Archived.empty()) {																	//Only summarized
+		Compaction = CompactionJob();
+		return false;
+	}
+
+	//Shrink the log file. The records added while the thread was running are kept
+	IceRecordStore	HotData;
+	vector<UINT>	Sessions = OpenSessions;
+	UINT			Generation = LogGeneration, Stored;
+	for (UINT i = 0, a = 0; i < FileContent.ElementCount; i++) {
+		if (a < Job.Archived.size() && Job.Archived[a] == i)
+			a++;
+		else
+			HotData.Append(FileContent.LogData[i]);
+	}
+	for (UINT i = 0; i < OpenSessions.size(); i++)												//Cars still parking are never archived
+		OpenSessions[i] -= (UINT)(lower_bound(Job.Archived.begin(), Job.Archived.end(), OpenSessions[i]) - Job.Archived.begin());
+	FileContent.LogData.Swap(HotData);
+	FileContent.ElementCount = (UINT)FileContent.LogData.Size();
+	LogGeneration = Job.Generation;
+	Compaction = CompactionJob();
+
+	//The compaction is done once the log file of the new generation is in place
+	if (!SaveFile()) {
+		CompactionFailed = true;
+		if (IceReadRecordGeneration(LogPath, CipherKey.c_str(), Stored) && Stored < LogGeneration) {	//Not replaced, keep the records
+			FileContent.LogData.Swap(HotData);
+			FileContent.ElementCount = (UINT)FileContent.LogData.Size();
+			OpenSessions.swap(Sessions);
+			LogGeneration = Generation;
+		}
+	}
+	if (!InstallCompaction())																	//Moved in next time
+		CompactionFailed = true;
+	return LogGeneration != Generation;
+}
+
+/*
+Description:    Stop the compaction job without changing anything. Waits for the compaction thread
+*/
+void IceEncryptedFile::CancelCompaction() {
+	if (CompactionThread.joinable())
+		CompactionThread.join();
+	for (UINT i = 0; i < Compaction.Written.size(); i++)										//Segments not replaced
+		DeleteFileW((Compaction.Written[i] + STAGED_SUFFIX).c_str());
+	Compaction = CompactionJob();
+}
+
+/*
+Description:    Move the segments and the manifest staged by FinishCompaction() in. The staged segments are tagged with the
+				generation the log file gets when the archived records are removed from it. If the log file has it, the
+				segments and then the manifest are moved in, and the files left by an interrupted move are moved in again.
+				Otherwise the log file still holds the records, and the staged files are deleted. So a record is never in
+				both the log file and a segment. Called when the log file is read as well, so a compaction interrupted by a
+				crash is either completed or undone
+Return:			true if nothing is left staged, false otherwise
+*/
+bool IceEncryptedFile::InstallCompaction() {
+	wstring				StagedManifest = ManifestPath + STAGED_SUFFIX;
+	vector<SegmentInfo>	Staged;
+	UINT				Generation = 0, LogFileGeneration;
+	bool				Result = true;
+
+	if (GetFileAttributesW(StagedManifest.c_str()) == INVALID_FILE_ATTRIBUTES)					//Nothing staged
 		return true;
+	if (!IceReadRecordGeneration(LogPath, CipherKey.c_str(), LogFileGeneration))				//Can't tell if the log file is shrunk
+		return false;
+	if (!LoadManifest(StagedManifest, Staged))													//Damaged, nothing can be moved in
+		return DeleteFileW(StagedManifest.c_str()) != FALSE;
+	for (UINT i = 0; i < Staged.size(); i++)
+		Generation = max(Generation, Staged[i].Generation);
+
+	for (UINT i = 0; i < Staged.size(); i++) {
+		wstring	SegmentPath = GetSegmentPath(Staged[i].Year, Staged[i].Month);
+		if (Staged[i].Generation != Generation ||
+			GetFileAttributesW((SegmentPath + STAGED_SUFFIX).c_str()) == INVALID_FILE_ATTRIBUTES)	//Not written by the job, or moved in already
+			continue;
+		if (LogFileGeneration < Generation)
+			DeleteFileW((SegmentPath + STAGED_SUFFIX).c_str());
+		else if (!IceMoveFile(SegmentPath + STAGED_SUFFIX, SegmentPath))
+			Result = false;
 	}
-	else {																						//Password unmatch
+	if (LogFileGeneration < Generation)
+		return DeleteFileW(StagedManifest.c_str()) != FALSE;
+	if (!Result || !IceMoveFile(StagedManifest, ManifestPath))
+		return false;
+	Segments.swap(Staged);
+	return true;
+}
+
+/*
+Description:    Get the daily summaries of a period
+Args:			From: Beginning of the first day, see IceToEpoch()
+				To: Beginning of the day after the last day
+				Days: Vector to store the summaries
+Return:			true if every day of the period is summarized, false otherwise
+*/
+bool IceEncryptedFile::ReadSummaries(LONGLONG From, LONGLONG To, vector<DailySummary> &Days) {
+	Days.clear();
+	if (Summaries.empty() || From < Summaries.front().Day || To > SummarizedTo)
+		return false;
+
+	vector<DailySummary>::const_iterator	it = lower_bound(Summaries.begin(), Summaries.end(), From,
+		[](const DailySummary &Summary, LONGLONG Day) {
+		return Summary.Day < Day;
+	});
+	for (; it != Summaries.end() && it->Day < To; it++)
+		Days.push_back(*it);
+	return Days.size() == (size_t)((To - From) / SECONDS_PER_DAY);
+}
+
+/*
+Description:    Read the daily summaries from the summary file
+Return:			true if succeed, false otherwise
+*/
+bool IceEncryptedFile::LoadSummaries() {
+	SummaryHeader	Header;
+	vector<BYTE>	Content;
+
+	Summaries.clear();
+	SummarizedTo = 0;
+	if (GetFileAttributesW(SummaryPath.c_str()) == INVALID_FILE_ATTRIBUTES)					//Nothing summarized yet
+		return true;
+	if (!IceLoadSealedFile(SummaryPath, CipherKey.c_str(), Content) || Content.size() < sizeof(Header))
+		return false;
+	memcpy(&Header, Content.data(), sizeof(Header));
+	if (Header.Magic != SUMMARY_MAGIC ||
+		sizeof(Header) + (streamoff)sizeof(DailySummary) * Header.DayCount != (streamoff)Content.size())	//Written with another password, or damaged
+		return false;
+
+	Summaries.resize(Header.DayCount);
+	memcpy(Summaries.data(), Content.data() + sizeof(Header), sizeof(DailySummary) * Header.DayCount);
+	if (IceChecksum((BYTE*)Summaries.data(), sizeof(DailySummary) * Header.DayCount) != Header.Checksum) {
+		Summaries.clear();																			//Summarized again from the log file
 		return false;
 	}
+	SummarizedTo = Header.SummarizedTo;
+	return true;
+}
+
+/*
+Description:    Write the daily summaries to the summary file
+Return:			true if succeed, false otherwise
+*/
+bool IceEncryptedFile::SaveSummaries() {
+	return SaveSummaries(SummaryPath, CipherKey.c_str());
+}
+
+/*
+Description:    Write the daily summaries to a file
+Args:			Path: Path of the file
+				Key: The key
+Return:			true if succeed, false otherwise
+*/
+bool IceEncryptedFile::SaveSummaries(const wstring &Path, const wchar_t *Key) {
+	SummaryHeader		Header = { SUMMARY_MAGIC, (UINT)Summaries.size(), SummarizedTo,
+		IceChecksum((BYTE*)Summaries.data(), sizeof(DailySummary) * Summaries.size()), 0 };
+	streamoff			szFile = sizeof(Header) + (streamoff)sizeof(DailySummary) * Summaries.size();
+	unique_ptr<BYTE[]>	Buffer(new BYTE[(size_t)szFile]);
+
+	memcpy(Buffer.get(), &Header, sizeof(Header));
+	memcpy(Buffer.get() + sizeof(Header), Summaries.data(), sizeof(DailySummary) * Summaries.size());
+	return IceSaveSealedFile(Path, Buffer.get(), szFile, Key);								//Encrypt binary data
 }
\ No newline at end of file
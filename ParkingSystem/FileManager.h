@@ -6,11 +6,170 @@ File:           FileManager.h
 */
 
 #include "MessageHandler.h"
+#include <string>
+#include <map>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 
 using namespace std;
 
-/* Description:		Log record structure */
+/* File layout constants */
+const DWORD			LOG_MAGIC = 0x474F4C49;			//"ILOG", stored unencrypted at the beginning of record files
+const DWORD			LOG_VERSION = 4;				//Record file format version, records stored in checksummed blocks
+const DWORD			WIDE_LOG_VERSION = 3;			//Version of the files with a 64-bit element count and no checksums, upgraded when loaded
+const DWORD			SMALL_LOG_VERSION = 2;			//Version of the files with a 32-bit element count, upgraded when loaded
+const DWORD			LEGACY_VERSION = 1;				//Version of the files without LOG_MAGIC (LegacyLogInfo records)
+const int			FILE_PLAIN_SIZE = sizeof(DWORD) * 2;	//Magic + version, not encrypted
+const int			FILE_HEADER_SIZE = FILE_PLAIN_SIZE + sizeof(wchar_t) * 20 + sizeof(ULONGLONG) + sizeof(float) + sizeof(DWORD);	//Magic + version + password + element count + fee per hour + reserved
+const int			LOG_GENERATION_OFFSET = FILE_HEADER_SIZE;	//Position of the archive generation in the header block of LOG_VERSION files, 0 in older files
+const int			SMALL_HEADER_SIZE = FILE_PLAIN_SIZE + sizeof(wchar_t) * 20 + sizeof(UINT) + sizeof(float);	//Header of SMALL_LOG_VERSION files
+const int			CHECK_BLOCK_SIZE = 4096;		//Size of a checksummed block. The header takes the first block, so every block is written at once
+const UINT			CHECK_BLOCK_RECORDS = (CHECK_BLOCK_SIZE - sizeof(DWORD)) / 32;	//127 records (32 bytes each) per block, followed by their CRC32C
+const int			LEGACY_HEADER_SIZE = sizeof(wchar_t) * 20 + sizeof(UINT) + sizeof(float);	//Password + element count + fee per hour
+const int			CAR_NUMBER_MAX = 12;			//Max length of a packed car number
+const streamoff		MAPPING_VIEW_SIZE = 16 * 1024 * 1024;	//Size of each view when the log file is mapped into memory. Every loader thread maps its own views
+const streamoff		LOAD_CHUNK_MIN = 1024 * 1024;	//Min size of the records decrypted by a loader thread
+const UINT			LOAD_MAX_THREADS = 16;			//Max number of loader threads
+const UINT			PARKING_CAPACITY = 100;			//Default number of parking positions, used if the log file doesn't store one
+const UINT			PARKING_MIN_CAPACITY = 100;		//Range of the number of parking positions
+const UINT			PARKING_MAX_CAPACITY = 1000000;
+const size_t		READER_BUFFER_SIZE = 4 * 1024 * 1024;	//Default size of the chunk buffer of IceRecordReader
+const size_t		FILE_IO_CHUNK = 4 * 1024 * 1024;	//Size of the pieces large files are encrypted, written and copied in
+
+/* Cipher constants */
+const int			CIPHER_MAX_KEY = 20;			//Max length of the password
+const int			CIPHER_BLOCK = 64;				//Bytes processed per step by the widest kernel
+const int			CIPHER_SCALAR = 0;				//Kernel levels, see CipherLevel
+const int			CIPHER_SSE2 = 1;
+const int			CIPHER_AVX2 = 2;
+const int			CIPHER_XOR = 0;					//Algorithms of key schedules: position-keyed XOR with the password
+const int			CIPHER_AES = 1;					//AES-128 in counter mode with a key derived from the password, see IceDeriveKey()
+const int			AES_ROUNDS = 10;				//No. of rounds of AES-128
+const int			AES_PARALLEL = 8;				//Counter blocks encrypted per step
+const int			CIPHER_NONCE = 8;				//Size of the nonce of a sealed piece of data, see IceSealBlock()
+const int			CIPHER_TAG = 16;				//Size of the tag of a sealed piece of data, HMAC-SHA256 cut to 128 bits
+const int			CIPHER_SEAL = CIPHER_NONCE + CIPHER_TAG;	//Bytes following a sealed piece of data
+
+/* Key derivation constants */
+const DWORD			KEY_MAGIC = 0x59454B49;			//"IKEY", stored at the beginning of the key file
+const UINT			KDF_DEFAULT_ITERATIONS = 100000;	//Default no. of PBKDF2 iterations. More iterations make guessing passwords slower, and logging in too
+const UINT			KDF_MIN_ITERATIONS = 1000;		//Key files with fewer iterations are rejected
+const int			KDF_SALT_SIZE = 16;				//Size of the random salt
+const wchar_t		KEY_TOKEN_PREFIX = 1;			//First character of key tokens, which can't be typed into a password box
+const wchar_t		REKEY_SUFFIX[] = L".rekey";		//Suffix of the files encrypted with a new key by ChangePassword(), moved in once all are written
+
+/* Journal constants */
+const DWORD			JOURNAL_MAGIC = 0x334E4A49;		//"IJN3", used to check if the journal is decrypted correctly
+const DWORD			UNVERSIONED_JOURNAL_MAGIC = 0x324E4A49;	//"IJN2", journal written before the generation was added to the header
+const DWORD			LEGACY_JOURNAL_MAGIC = 0x4C4E4A49;	//"IJNL", journal of a legacy log file
+const UINT			JOURNAL_ENTER = 1;				//Journal record type: a car entered (a new element is appended)
+const UINT			JOURNAL_EXIT = 2;				//Journal record type: a car left (an existing element is modified)
+const UINT			JOURNAL_COMPACT_LIMIT = 4096;	//Number of journal records that triggers a compaction
+
+/* Checkpoint constants */
+const DWORD			CHECKPOINT_MAGIC = 0x504B4349;	//"ICKP", used to check if the checkpoint is decrypted correctly
+
+/* Group commit constants */
+const DWORD			GROUP_COMMIT_WINDOW = 5;		//Default time (ms) the writer thread waits for more records before a commit
+const UINT			GROUP_COMMIT_BATCH = 64;		//Default number of records that triggers a commit immediately
+
+/* Segment constants */
+const DWORD			MANIFEST_MAGIC = 0x33464D49;	//"IMF3", used to check if the manifest is decrypted correctly
+const DWORD			UNTAGGED_MANIFEST_MAGIC = 0x32464D49;	//"IMF2", manifest without the generations of the segments
+const DWORD			LEGACY_MANIFEST_MAGIC = 0x54464D49;	//"IMFT", manifest of legacy segments
+
+/* Compaction constants */
+const UINT			ARCHIVE_HOT_DAYS = 3;			//Default no. of days closed sessions stay in the log file before they are archived
+const DWORD			COMPACTION_INTERVAL = 60000;	//Time (ms) between checks if a compaction should be started
+const DWORD			SUMMARY_MAGIC = 0x4D555349;		//"ISUM", used to check if the summary file is decrypted correctly
+const LONGLONG		SECONDS_PER_DAY = 24 * 3600;
+const wchar_t		STAGED_SUFFIX[] = L".new";		//Suffix of the segments and manifest written by a compaction job, moved in once the log file is shrunk
+
+/* Export constants */
+const int			EXPORT_CSV = 0;					//Export formats: comma-separated values with a header line
+const int			EXPORT_NDJSON = 1;				//One JSON object per line
+const int			EXPORT_ALL = 0;					//Exported records: all records
+const int			EXPORT_CLOSED = 1;				//Cars left only
+const int			EXPORT_OPEN = 2;				//Cars still parking only
+const size_t		EXPORT_CHUNK_RECORDS = 65536;	//Records formatted at once by a thread, then written in one piece
+const size_t		EXPORT_MAX_LINE = 192;			//Max length of a formatted record
+const UINT			EXPORT_MAX_THREADS = 16;		//Max number of threads formatting the records, each keeps a chunk in memory
+
+/* Import constants */
+const size_t		IMPORT_READ_SIZE = 32 * 1024 * 1024;	//Bytes of the input file read at once, then split among the parser threads
+const size_t		IMPORT_PIECE_MIN = 1024 * 1024;	//Min size of the text parsed by a parser thread
+const size_t		IMPORT_LINE_GUESS = 48;			//Typical length of a line, used to reserve memory for the records
+
+/* Record store constants */
+const size_t		RECORD_CHUNK_RECORDS = CHECK_BLOCK_RECORDS * 512;	//Records per chunk of IceRecordStore (about 2MB). A whole number of
+																	//checksummed blocks, so the records of a block are never split
+
+/* Bay allocator constants */
+const UINT			BAY_WORD_BITS = 32;				//Bits per word of the bitmaps of IceBayAllocator
+const UINT			NO_SESSION = 0xFFFFFFFF;			//Record index of a free position, see IceParkedCars
+
+/* Plate index constants */
+const size_t		PLATE_INDEX_MIN = 16;			//Min no. of slots of IcePlateIndex, always a power of 2
+
+/* Interval index constants */
+const size_t		INTERVAL_BLOCK_RECORDS = 64;	//Records per leaf of IceIntervalIndex, checked one by one. Divides RECORD_CHUNK_RECORDS
+
+/* Occupancy history constants */
+const LONGLONG		OCCUPANCY_SNAPSHOT_SPACING = 15 * 60;	//Default time (s) between snapshots of IceOccupancyHistory
+
+/* History constants */
+const DWORD			HISTORY_MAGIC = 0x54534849;		//"IHST", stored unencrypted at the beginning of archived segments
+const DWORD			HISTORY_VERSION = 1;			//Archived segment format version
+const int			HISTORY_HEADER_SIZE = FILE_PLAIN_SIZE + sizeof(wchar_t) * 20 + sizeof(UINT) * 2;	//Magic + version + password + element count + block count
+const UINT			HISTORY_BLOCK_RECORDS = 1024;	//Max number of records per block
+
+/* Description:		Running state of SHA-256 */
+struct Sha256State {
+	DWORD			Hash[8];						//Intermediate hash value
+	BYTE			Block[64];						//Data not processed yet
+	size_t			BlockLength;					//No. of bytes in Block
+	ULONGLONG		TotalLength;					//No. of bytes hashed
+};
+
+/* Description:		HMAC-SHA256 key, the states after hashing the inner and outer padded key. See IceHmacInit() */
+struct HmacKey {
+	Sha256State		Inner;
+	Sha256State		Outer;
+};
+
+/* Description:		Key schedule of the log cipher. Stream[i] is the key byte of position i (mod KeyLen),
+					repeated long enough to cover a whole block starting at any position of the key */
+struct IceKeySchedule {
+	int				Algorithm;						//CIPHER_XOR or CIPHER_AES
+	int				KeyLen;							//Length of the password
+	BYTE			Stream[CIPHER_MAX_KEY + CIPHER_BLOCK];	//Expanded key bytes
+	BYTE			RoundKeys[AES_ROUNDS + 1][16];	//AES round keys
+	HmacKey			MacKey;							//Key of the tags of sealed data, see IceSealBlock()
+};
+
+/* Description:		Key file structure. The key file is not encrypted, and only exists if the files are encrypted with AES */
+struct KeyFileHeader {
+	DWORD			Magic;							//Always KEY_MAGIC
+	UINT			Iterations;						//No. of PBKDF2 iterations
+	BYTE			Salt[KDF_SALT_SIZE];			//Random salt, replaced whenever the password changes
+};
+
+/* Description:		Log record structure, 32 bytes. Times are seconds since 1970-01-01 00:00:00 (local time),
+					see IceToEpoch() */
 struct LogInfo {
+	LONGLONG		EnterTime;						//Enter time of the car
+	LONGLONG		LeaveTime;						//Leave time of the car. If the car is not left, LeaveTime = 0
+	ULONGLONG		CarNumber;						//Car number packed by IcePackCarNumber()
+	int				Fee;							//Fee paid, in cents
+	UINT			CarPos;							//Parked position, from 0. Older versions stored a 16-bit position followed by
+													//a reserved word which is always 0, so their records read the same
+};
+
+/* Description:		Log record structure of legacy (version 1) files */
+struct LegacyLogInfo {
 	wchar_t			CarNumber[15];					//Car number
 	SYSTEMTIME		EnterTime;						//Enter time of the car
 	SYSTEMTIME		LeaveTime;						//Leave time of the car. If the car is not left, LeaveTime.wYear = 0
@@ -18,25 +177,528 @@ struct LogInfo {
 	float			Fee;							//Fee paid
 };
 
+/* Description:		Part of a record file decrypted by a loader thread */
+struct LoadChunk {
+	UINT			First;							//Index of the first record of the chunk
+	UINT			Count;							//No. of records of the chunk
+	bool			Result;							//If the chunk is decrypted successfully
+	UINT			ValidCount;						//No. of records before the first missing block
+	UINT			InvalidCount;					//No. of damaged records of the chunk
+	vector<UINT>	OpenSessions;					//Indices of the cars still parking
+	vector<UINT>	DamagedBlocks;					//Indices of the first records of the blocks failing the checksum, their records are zeroed
+};
+
+/* Description:		Records kept in fixed-size chunks, see RecordStore.cpp. Appending a record never moves the records
+					stored before, so references to them stay valid and no append copies the whole log */
+class IceRecordStore {
+public:
+	LogInfo &operator[](size_t Index);
+	const LogInfo &operator[](size_t Index) const;
+	size_t Size() const;
+	void Append(const LogInfo &Info);
+	void Resize(size_t Count);
+	void Assign(const vector<LogInfo> &Records);
+	const LogInfo *GetRun(size_t Index, size_t &Count) const;
+	void Clear();
+	void Swap(IceRecordStore &Other);
+	void ReleaseBefore(size_t Index);
+
+private:
+	vector<unique_ptr<LogInfo[]>>	Chunks;			//Chunks of RECORD_CHUNK_RECORDS records, the last one may be partly used
+	size_t			Count = 0;						//No. of records
+};
+
 /* Description:		Encrypted file structure */
 struct RecordFile {
 	wchar_t			Password[20];					//User password
 	UINT			ElementCount;					//No. of elements of LogData
 	float			FeePerHour;						//Fee per hour
-	vector<LogInfo>	LogData;						//File content
+	UINT			Capacity;						//No. of parking positions, stored in the reserved field of the header
+	IceRecordStore	LogData;						//File content
+};
+
+/* Description:		Journal file header structure */
+struct JournalHeader {
+	DWORD			Magic;							//Always JOURNAL_MAGIC
+	UINT			BaseCount;						//ElementCount of the snapshot this journal applies to
+	UINT			Generation;						//LogGeneration of the snapshot this journal applies to
+};
+
+/* Description:		Journal file header structure of legacy (version 1) files, and of journals written before the
+					generation was added ("IJN2") */
+struct LegacyJournalHeader {
+	DWORD			Magic;							//LEGACY_JOURNAL_MAGIC or UNVERSIONED_JOURNAL_MAGIC
+	UINT			BaseCount;						//ElementCount of the snapshot this journal applies to
+};
+
+/* Description:		Journal record structure. One record is appended per gate event */
+struct JournalRecord {
+	UINT			Type;							//JOURNAL_ENTER or JOURNAL_EXIT
+	UINT			Index;							//Index of the affected element of LogData
+	LogInfo			Info;							//Content of the element after the event
+};
+
+/* Description:		Journal record structure of legacy (version 1) files */
+struct LegacyJournalRecord {
+	UINT			Type;							//JOURNAL_ENTER or JOURNAL_EXIT
+	UINT			Index;							//Index of the affected element of LogData
+	LegacyLogInfo	Info;							//Content of the element after the event
+};
+
+/* Description:		Journal record waiting for the writer thread */
+struct PendingRecord {
+	BYTE			Record[sizeof(JournalRecord) + CIPHER_SEAL];	//Encrypted journal record, followed by its seal if the key is a derived key
+	UINT			Length;							//Size of Record in bytes, the seal included
+	bool			InPlace;						//If Block overwrites a block of the log file instead of Record being appended to the journal
+	vector<BYTE>	Block;							//Encrypted block of the log file containing the modified record
+	streamoff		Offset;							//Position of the record in the journal file or the log file
+	ULONGLONG		Ticket;							//Sequence number of the record
+	LONGLONG		QueuedTime;						//Performance counter value when the record is queued
+};
+
+/* Description:		Group commit counters */
+struct CommitStats {
+	ULONGLONG		Batches;						//No. of write-and-sync operations
+	ULONGLONG		Records;						//No. of records committed
+	UINT			MaxBatchSize;					//Largest number of records committed at once
+	ULONGLONG		TotalLatency;					//Sum of the time (us) from queuing to commit of all records
+	ULONGLONG		MaxLatency;						//Longest time (us) from queuing to commit of a record
+};
+
+/* Description:		Checkpoint file header structure. The header is followed by SessionCount indices of LogData */
+struct CheckpointHeader {
+	DWORD			Magic;							//Always CHECKPOINT_MAGIC
+	UINT			RecordCount;					//No. of records covered by the checkpoint, the following records must be searched
+	UINT			SessionCount;					//No. of cars still parking among the covered records
+	DWORD			Checksum;						//Checksum of the indices
+};
+
+/* Description:		Manifest file header structure */
+struct ManifestHeader {
+	DWORD			Magic;							//Always MANIFEST_MAGIC
+	UINT			SegmentCount;					//No. of segments listed in the manifest
+};
+
+/* Description:		Archived segment structure. Each segment holds the records of the cars left in one month */
+struct SegmentInfo {
+	WORD			Year;							//Year of the segment
+	WORD			Month;							//Month of the segment
+	UINT			ElementCount;					//No. of records in the segment
+	DWORD			Checksum;						//Checksum of the decrypted records
+	UINT			Generation;						//Archive generation of the log file the segment was last written for, see IceEncryptedFile::LogGeneration
+	LONGLONG		FirstTime;						//Earliest enter time of the records
+	LONGLONG		LastTime;						//Latest leave time of the records
+};
+
+/* Description:		Summary file header structure. The header is followed by DayCount daily summaries */
+struct SummaryHeader {
+	DWORD			Magic;							//Always SUMMARY_MAGIC
+	UINT			DayCount;						//No. of days summarized
+	LONGLONG		SummarizedTo;					//The days before this time are summarized, see IceToEpoch()
+	DWORD			Checksum;						//Checksum of the summaries
+	DWORD			Reserved;
+};
+
+/* Description:		Pre-aggregated statistics of a day. Days are summarized when their records are archived,
+					so reports of archived days don't read the segments */
+struct DailySummary {
+	LONGLONG		Day;							//Beginning of the day, see IceToEpoch()
+	UINT			Enters;							//No. of cars entered on the day
+	UINT			Exits;							//No. of cars left on the day
+	LONGLONG		Income;							//Sum of the fees of the cars left on the day, in cents
+	UINT			PeakOccupancy;					//Max no. of cars parked at the same time
+	UINT			ClosingOccupancy;				//No. of cars parked at the end of the day
+};
+
+/* Description:		Compaction job. The records to be archived are copied out of the log file when the job starts,
+					then the segments and summaries are written by the compaction thread, and the log file is shrunk
+					by the thread owning the log file after the job is finished, see StartCompaction() */
+struct CompactionJob {
+	LONGLONG				Cutoff;					//Closed sessions left before this time are archived, the beginning of a day
+	vector<UINT>			Archived;				//Indices of the archived records in LogData, in ascending order
+	map<DWORD, vector<LogInfo>>	ArchiveData;		//Records to be archived, key = year * 100 + month
+	vector<LogInfo>			HotData;				//Records staying in the log file entered before Cutoff
+	vector<SegmentInfo>		Segments;				//Segment list, updated by the compaction thread
+	vector<DailySummary>	Summaries;				//Daily summaries, updated by the compaction thread
+	LONGLONG				SummarizedTo;			//See SummaryHeader
+	vector<wstring>			Written;				//Segments written by the compaction thread, each to Path + STAGED_SUFFIX
+	UINT					Generation;				//Archive generation the log file gets when it is shrunk
+	wstring					Key;					//Key to the files, see IceEncryptedFile::CipherKey
+	bool					Result;					//If the compaction thread succeeded
+};
+
+/* Description:		Options of IceEncryptedFile::ExportRecords() */
+struct ExportOptions {
+	int				Format;							//EXPORT_CSV or EXPORT_NDJSON
+	LONGLONG		From;							//Only the cars entered in [From, To] are exported, see IceToEpoch()
+	LONGLONG		To;
+	int				Status;							//EXPORT_ALL, EXPORT_CLOSED or EXPORT_OPEN
+	UINT			Threads;						//No. of threads formatting the records, 0 = one per processor. At most EXPORT_MAX_THREADS are used
+};
+
+/* Description:		Result of IceEncryptedFile::ImportRecords() */
+struct ImportResult {
+	ULONGLONG		Lines;							//No. of lines read, including the header line
+	ULONGLONG		Imported;						//No. of records added to the log file
+	ULONGLONG		Rejected;						//No. of lines which are not valid records
+	ULONGLONG		FirstRejected;					//Line no. of the first rejected line, 0 if none
+	ULONGLONG		Conflicts;						//No. of cars still parking dropped because their position is taken, or the car is parking already
+};
+
+/* Description:		Part of an import file parsed by a parser thread */
+struct ImportPiece {
+	const char		*Begin;							//First character of the piece, the beginning of a line
+	const char		*End;							//End of the piece, after a line break or at the end of the file
+	UINT			Capacity;						//No. of parking positions of the log file
+	vector<LogInfo>	Records;						//Parsed records, sorted by enter time
+	ULONGLONG		Lines;							//No. of lines of the piece
+	ULONGLONG		Rejected;						//No. of rejected lines of the piece
+	ULONGLONG		FirstRejected;					//Line no. in the piece (from 1) of the first rejected line, 0 if none
+};
+
+/* Description:		Block index entry of an archived segment. Each block is compressed on its own, so blocks
+					outside the period being read are skipped without being read from the disk */
+struct HistoryBlockInfo {
+	LONGLONG		FirstTime;						//Earliest enter time of the records
+	LONGLONG		LastTime;						//Latest leave time of the records
+	LONGLONG		Offset;							//Position of the block in the file
+	UINT			Size;							//Size of the compressed block in bytes
+	UINT			RecordCount;					//No. of records in the block
+	DWORD			Checksum;						//Checksum of the decompressed records
+	DWORD			Reserved;						//Always 0
+};
+
+/* Description:		Archived segment structure of legacy (version 1) manifests */
+struct LegacySegmentInfo {
+	WORD			Year;							//Year of the segment
+	WORD			Month;							//Month of the segment
+	UINT			ElementCount;					//No. of records in the segment
+	DWORD			Checksum;						//Checksum of the decrypted records
+	SYSTEMTIME		FirstTime;						//Earliest enter time of the records
+	SYSTEMTIME		LastTime;						//Latest leave time of the records
+};
+
+/* Checksum functions, see Checksum.cpp */
+DWORD IceCrc32c(const BYTE *Data, size_t Length);
+
+/* Cipher functions, see Cipher.cpp */
+extern const int	CipherLevel;					//Kernel used by IceCryptBlock(), detected at startup
+extern const bool	AesHardware;					//If AES-NI is used by IceCryptBlock(), detected at startup
+bool IceExpandKey(const wchar_t *Key, IceKeySchedule &Schedule);
+void IceCryptBlock(BYTE *Dest, const BYTE *Src, streamoff Length, const IceKeySchedule &Schedule, streamoff Offset);
+void IceCryptKernel(BYTE *Dest, const BYTE *Src, streamoff Length, const IceKeySchedule &Schedule, streamoff Offset, int Level);
+int IceSealSize(const IceKeySchedule &Schedule);
+void IceSealBlock(BYTE *Dest, const BYTE *Src, streamoff Length, const IceKeySchedule &Schedule, streamoff Offset);
+bool IceOpenBlock(BYTE *Dest, const BYTE *Src, streamoff Length, const IceKeySchedule &Schedule, streamoff Offset);
+void IceDeriveKey(const wchar_t *Password, const KeyFileHeader &KeyFile, wchar_t *Token);
+
+/* Key derivation functions, see KeyDerivation.cpp */
+extern const bool	ShaHardware;					//If the SHA extensions are used by IceSha256() and the tags, detected at startup
+void IceSha256(const BYTE *Data, size_t Length, BYTE *Digest);
+void IceHmacInit(const BYTE *Key, size_t KeyLength, HmacKey &Mac);
+void IceHmacSha256(const HmacKey &Mac, const BYTE *Prefix, size_t PrefixLength, const BYTE *Data, size_t Length, BYTE *Digest);
+void IcePbkdf2(const BYTE *Password, size_t PasswordLength, const BYTE *Salt, size_t SaltLength, UINT Iterations,
+	BYTE *Output, size_t OutputLength);
+bool IceRandomBytes(BYTE *Buffer, DWORD Length);
+
+/* Record field conversion functions */
+LONGLONG IceToEpoch(const SYSTEMTIME &Time);
+SYSTEMTIME IceFromEpoch(LONGLONG Time);
+ULONGLONG IcePackCarNumber(const wchar_t *CarNumber);
+void IceUnpackCarNumber(ULONGLONG Packed, wchar_t *CarNumber);
+
+/* Record file header functions */
+int IceRecordHeaderSize(DWORD Version);
+int IceRecordHeaderSpan(DWORD Version);
+bool IceOpenRecordHeader(BYTE *Header, const IceKeySchedule &Schedule);
+streamoff IceRecordOffset(DWORD Version, ULONGLONG Index);
+bool IceParseRecordHeader(const BYTE *Header, const wchar_t *Password, ULONGLONG &ElementCount, float &FeePerHour,
+	UINT *Capacity = NULL);
+void IceBuildRecordHeader(BYTE *Header, const wchar_t *Password, ULONGLONG ElementCount, float FeePerHour, UINT Capacity,
+	UINT Generation, const IceKeySchedule &Schedule);
+void IceEncodeBlock(BYTE *Block, const LogInfo *Records, UINT Count, const IceKeySchedule &Schedule, streamoff Offset);
+
+/* Archived segment functions */
+DWORD IceChecksum(const BYTE *Data, streamoff Length);
+bool IceDecodeHistoryBlock(const BYTE *Data, UINT Size, UINT Count, LogInfo *Records);
+
+/* Description:		Streaming reader of record files and archived segments, see RecordReader.cpp. Records are read and
+					decrypted chunk by chunk into a buffer of fixed size, so files of any size are processed with the
+					same amount of memory */
+class IceRecordReader {
+public:
+	ULONGLONG		ElementCount = 0;				//No. of records in the file
+	float			FeePerHour = 0;					//Fee per hour stored in the file
+	ULONGLONG		Position = 0;					//Index of the first record of the next chunk
+	bool			Failed = false;					//If a chunk couldn't be read. Next() returns false then
+
+	IceRecordReader(size_t BufferSize = READER_BUFFER_SIZE);
+	~IceRecordReader();
+	bool Open(const wstring &Path, const wchar_t *Password, LONGLONG From = 0, LONGLONG To = MAXLONGLONG);
+	bool Next(const LogInfo *&Records, UINT &Count);
+	void Close();
+
+private:
+	HANDLE			hFile = INVALID_HANDLE_VALUE;	//Record file handle
+	IceKeySchedule	Schedule;						//Key schedule of the password
+	DWORD			Version = LOG_VERSION;			//Format version of the file
+	vector<LogInfo>	Buffer;							//Chunk buffer
+	bool			History = false;				//If the file is an archived segment in the history format
+	vector<HistoryBlockInfo>	Blocks;				//Block index of the archived segment
+	UINT			NextBlock = 0;					//Index of the next block to be read
+	LONGLONG		PeriodStart = 0;				//Period of time, blocks of the archived segment outside it are skipped
+	LONGLONG		PeriodEnd = MAXLONGLONG;
+	LONGLONG		FileSize = 0;					//Size of the file in bytes
+	vector<BYTE>	Block;							//Compressed block being decoded
+
+	bool OpenHistory(const DWORD *Signature, const wchar_t *Password);
+	bool NextHistory(const LogInfo *&Records, UINT &Count);
+};
+
+/* Description:		Allocator of parking positions, see BayAllocator.cpp. Level 0 of the bitmap has a bit per position
+					(1 = free), and a bit of each higher level tells if a word of the level below has a free position,
+					so the first free position is found with one bit scan per level */
+class IceBayAllocator {
+public:
+	void Reset(UINT Capacity);
+	int Allocate();
+	bool Claim(UINT Bay);
+	bool Release(UINT Bay);
+	bool IsOccupied(UINT Bay) const;
+	UINT GetCapacity() const;
+	UINT GetFreeCount() const;
+	UINT GetUsedCount() const;
+
+private:
+	vector<vector<DWORD>>	Levels;					//Bitmaps, from one bit per position up to a single word
+	UINT			Capacity = 0;					//No. of positions
+	UINT			FreeCount = 0;					//No. of free positions
+
+	void SetFree(UINT Bay, bool Free);
+};
+
+/* Description:		Parking cars by position, see ParkedCars.cpp. Each position has the record of its car and where the car
+					is in the list of parking cars, so a car is found, added or removed in constant time. The position of
+					a record is its CarPos */
+class IceParkedCars {
+public:
+	void Build(const IceRecordStore &LogData, const vector<UINT> &Sessions, UINT Capacity);
+	bool Add(UINT Bay, UINT Session);
+	bool Remove(UINT Bay, UINT Session);
+	int Find(UINT Bay) const;
+	const vector<UINT> &GetSessions() const;
+	size_t Size() const;
+
+private:
+	vector<UINT>	BaySessions;					//Index of the record of the car at each position, NO_SESSION if free
+	vector<UINT>	BaySlots;						//Index of the car at each position in Sessions
+	vector<UINT>	Sessions;						//Indices of the records of the parking cars, in no particular order
+	vector<UINT>	SessionBays;					//Position of each car of Sessions
+};
+
+/* Description:		Slot of IcePlateIndex */
+struct PlateSlot {
+	ULONGLONG		CarNumber;						//Car number packed by IcePackCarNumber(), 0 if the slot is empty
+	UINT			Index;							//Index of the record of the parking car
+};
+
+/* Description:		Hash index from car numbers to the records of the parking cars, see PlateIndex.cpp. Open addressing
+					with linear probing; removed slots are refilled by shifting the following slots back, so lookups
+					never walk over deleted entries */
+class IcePlateIndex {
+public:
+	void Build(const IceRecordStore &LogData, const vector<UINT> &Sessions);
+	bool Find(ULONGLONG CarNumber, UINT &Index) const;
+	void Insert(ULONGLONG CarNumber, UINT Index);
+	bool Remove(ULONGLONG CarNumber);
+	void Clear();
+	size_t Size() const;
+
+private:
+	vector<PlateSlot>	Slots;						//Slots, a power of 2 of them
+	size_t			Count = 0;						//No. of used slots
+	int				Shift = 64;						//64 - log2(no. of slots), the hash is the top bits of the product
+
+	size_t Home(ULONGLONG CarNumber) const;
+	void Resize(size_t SlotCount);
+};
+
+/* Description:		Node of IceIntervalIndex, the period covered by the records below it */
+struct IntervalNode {
+	LONGLONG		FirstEnter;						//Earliest enter time, MAXLONGLONG if there are no records
+	LONGLONG		LastLeave;						//Latest leave time, MAXLONGLONG if a car is still parking
+};
+
+/* Description:		Index of the parking periods of the records, see IntervalIndex.cpp. A binary tree over blocks of
+					INTERVAL_BLOCK_RECORDS records, each node holding the earliest enter time and the latest leave time
+					below it, so a search for the cars parking at a time only visits the blocks having one */
+class IceIntervalIndex {
+public:
+	void Build(const IceRecordStore &LogData);
+	void Update(const IceRecordStore &LogData, size_t Index);
+	void Find(const IceRecordStore &LogData, LONGLONG Time, vector<UINT> &Sessions) const;
+	void Clear();
+
+private:
+	vector<IntervalNode>	Nodes;					//Node 1 is the root, the children of node i are 2i and 2i + 1
+	size_t			Leaves = 0;						//No. of leaves, a power of 2. Node Leaves + i covers block i
+
+	void SetLeaf(const IceRecordStore &LogData, size_t Block);
+	void SetParent(size_t Node);
+	void Grow(size_t Blocks);
+	void Collect(const IceRecordStore &LogData, size_t Node, LONGLONG Time, vector<UINT> &Sessions) const;
+};
+
+/* Description:		Car entering or leaving, see IceOccupancyHistory */
+struct OccupancyEvent {
+	LONGLONG		Time;							//Enter time or leave time of the car
+	UINT			Session;						//Index of the record of the car
+	bool			Leave;							//If the car left
+};
+
+/* Description:		Cars parking after some events, see IceOccupancyHistory */
+struct OccupancySnapshot {
+	size_t			Event;							//No. of events applied
+	size_t			First;							//Index of the first car in SnapshotSessions
+	size_t			Count;							//No. of cars
+};
+
+/* Description:		Cars parking at any time, see OccupancyHistory.cpp. The enter and leave events are kept in time order,
+					with a snapshot of the parking cars at the beginning of every SnapshotSpacing seconds having events.
+					The cars at a time are restored from the nearest snapshot, or stepped to from the previous time,
+					replaying only the events in between */
+class IceOccupancyHistory {
+public:
+	LONGLONG		SnapshotSpacing = OCCUPANCY_SNAPSHOT_SPACING;	//Time (s) between snapshots. Shorter spacing replays less
+													//events per lookup but keeps more snapshots, 0 for none
+
+	void Build(const IceRecordStore &LogData);
+	void Update(const IceRecordStore &LogData, size_t Index);
+	void Find(LONGLONG Time, vector<UINT> &Sessions);
+	size_t GetMemorySize() const;
+	void Clear();
+
+private:
+	vector<OccupancyEvent>		Events;				//Events in time order, entering cars first at the same time
+	vector<OccupancySnapshot>	Snapshots;			//Snapshots in time order, the first one is before all events
+	vector<UINT>	SnapshotSessions;				//Cars of all snapshots
+	LONGLONG		NextSnapshot = MAXLONGLONG;		//Time of the snapshot taken before the next event at or after it
+	vector<UINT>	Active;							//Cars parking after Applied events, in no particular order
+	vector<UINT>	ActiveSlots;					//Index of each record in Active, NO_SESSION if the car isn't parking
+	size_t			Applied = 0;					//No. of events applied to Active
+
+	void Append(const OccupancyEvent &Event);
+	void TakeSnapshot();
+	void Restore(size_t Snapshot);
+	void Seek(size_t Event);
+	void Insert(UINT Session);
+	void Remove(UINT Session);
 };
 
 /* Description:		Record file class */
 class IceEncryptedFile {
 public:
 	fstream			fsFile;							//File input/output stream
+	wstring			LogPath;						//Log file path
+	wstring			BasePath;						//Log file path without the extension, other files are named after it
+	HANDLE			hJournal = INVALID_HANDLE_VALUE;	//Journal file handle
+	HANDLE			hLogWriter = INVALID_HANDLE_VALUE;	//Log file handle used by the writer thread for in-place updates
+	UINT			SnapshotCount = 0;				//No. of records in the log file, the following records are in the journal only
+	wstring			JournalPath;					//Journal file path
+	wstring			ManifestPath;					//Manifest file path
+	wstring			CheckpointPath;					//Checkpoint file path
+	wstring			KeyPath;						//Key file path
+	wstring			CipherKey;						//Key passed to the cipher: the password, or the token of the key derived from it
+	bool			StrongCipher = false;			//If the files are encrypted with AES and a key derived from the password
+	UINT			KdfIterations = KDF_DEFAULT_ITERATIONS;	//PBKDF2 iterations used when a new key is derived
+	wstring			SummaryPath;					//Summary file path
+	vector<DailySummary>	Summaries;					//Daily summaries of archived days, sorted by day
+	LONGLONG		SummarizedTo = 0;				//See SummaryHeader
+	UINT			ArchiveHotDays = ARCHIVE_HOT_DAYS;	//No. of days closed sessions stay in the log file
+	UINT			LoadThreads = 0;				//No. of threads loading the log file, 0 for one per core up to LOAD_MAX_THREADS
+	bool			CompactionFailed = false;		//If the last compaction failed
+	vector<SegmentInfo>	Segments;					//Archived segments, sorted by month
+	UINT			LogGeneration = 0;				//Archive generation of the log file, increased each time archived records are removed from it
+	streamoff		JournalSize = 0;				//Size of valid content of the journal file
+	UINT			JournalCount = 0;				//No. of records in the journal file
+	bool			GroupCommit = true;				//If journal records are written by the writer thread in batches, set by the constructor
+	DWORD			CommitWindow = GROUP_COMMIT_WINDOW;	//Time (ms) the writer thread waits for more records before a commit
+	UINT			CommitBatchLimit = GROUP_COMMIT_BATCH;	//Number of records that triggers a commit immediately
 	RecordFile		FileContent;					//Record file content
+	vector<UINT>	OpenSessions;					//Indices of the cars still parking, in ascending order
+	UINT			InvalidRecords = 0;				//No. of damaged records found when the log file is read
+	UINT			TruncatedRecords = 0;			//No. of records dropped from the end of the log file because their block failed the checksum
+	UINT			DamagedRecords = 0;				//No. of records lost in blocks failing the checksum before the end of the log file
 	bool			WithoutFile = false;			//If the user selected continue without log file
 	bool			CreatedNewFile = false;			//If the program created a new file (If so, the user should modify the default password)
 
-	IceEncryptedFile(const wchar_t *FilePath);
+	IceEncryptedFile(const wchar_t *FilePath, bool GroupCommit = true);
 	~IceEncryptedFile();
-	bool AddLog(wchar_t *CarNumber, SYSTEMTIME EnterTime, SYSTEMTIME LeaveTime, int CarPos, float Fee);
+	bool AddLog(const wchar_t *CarNumber, LONGLONG EnterTime, LONGLONG LeaveTime, int CarPos, int Fee, ULONGLONG *Ticket = NULL);
+	bool UpdateLog(UINT Index, ULONGLONG *Ticket = NULL);
+	bool WaitForCommit(ULONGLONG Ticket);
+	CommitStats GetCommitStats();
 	bool SaveFile();
+	bool CheckPassword(wchar_t *Password);
 	bool ReadFile(wchar_t *Password);
+	bool ChangePassword(const wchar_t *NewPassword, bool Strong);
+	void ReadSegments(LONGLONG From, LONGLONG To, vector<LogInfo> &Records);
+	void ReadRange(LONGLONG From, LONGLONG To, vector<LogInfo> &Records);
+	bool ReadSegment(UINT Index, LONGLONG From, LONGLONG To, vector<LogInfo> &Records);
+	bool ReadSummaries(LONGLONG From, LONGLONG To, vector<DailySummary> &Days);
+	bool ExportRecords(const wstring &Path, const ExportOptions &Options, ULONGLONG *Exported = NULL);
+	bool ImportRecords(const wstring &Path, UINT Threads, ImportResult *Result = NULL);
+	bool StartCompaction();
+	bool FinishCompaction(bool Wait);
+	void CancelCompaction();
+
+private:
+	thread				CommitThread;					//Writer thread of group commit
+	mutex				CommitMutex;					//Protects the members below
+	condition_variable	CommitQueued;					//Signaled when a record is queued or the writer thread should stop
+	condition_variable	CommitDone;						//Signaled when a batch is committed
+	vector<PendingRecord>	CommitQueue;				//Records waiting for the writer thread
+	ULONGLONG			QueuedTicket = 0;				//Ticket of the last queued record
+	ULONGLONG			CommittedTicket = 0;			//Ticket of the last committed record
+	bool				CommitFailed = false;			//If the writer thread failed to write a batch
+	bool				StopCommit = false;				//If the writer thread should stop
+	CommitStats			Stats;							//Group commit counters
+	LONGLONG			CounterFrequency;				//Performance counter frequency
+	thread				CompactionThread;				//Thread writing the segments and summaries of a compaction job
+	mutex				CompactionMutex;				//Protects CompactionDone
+	bool				CompactionDone = false;			//If the compaction thread finished the job
+	vector<UINT>		DamagedBlocks;					//Indices of the first records of the blocks failing the checksum before the end of
+														//the log file, in ascending order. The file is kept as it is until they are saved
+	CompactionJob		Compaction;						//Current compaction job, owned by the compaction thread while it runs
+
+	DWORD GetFileVersion();
+	bool ResolveKey(const wchar_t *Password, wstring &Key);
+	bool CheckKey(const wchar_t *Key);
+	bool SaveKeyFile(const KeyFileHeader *KeyFile);
+	bool SwapRekeyedFiles();
+	bool InstallCompaction();
+	bool ConvertLegacyFile(const wchar_t *Password);
+	bool ReplaceLogFile(const wstring &Path);
+	bool KeepDamagedFile();
+	bool OpenJournal(bool Truncate);
+	bool ResetJournal();
+	bool AppendJournal(UINT Type, UINT Index, ULONGLONG *Ticket);
+	bool PatchRecord(UINT Index, ULONGLONG *Ticket);
+	bool QueueRecord(PendingRecord &Pending, ULONGLONG *Ticket);
+	bool ReplayJournal();
+	bool DrainJournal();
+	void SetSessionOpen(UINT Index, bool Open);
+	void CommitThreadProc();
+	wstring GetSegmentPath(WORD Year, WORD Month);
+	bool LoadManifest();
+	bool LoadManifest(const wstring &Path, vector<SegmentInfo> &List);
+	bool SaveManifest();
+	bool SaveManifest(const wstring &Path, const wchar_t *Key, const vector<SegmentInfo> &List);
+	bool LoadCheckpoint(const wchar_t *Password, UINT &Stamp, vector<UINT> &Sessions);
+	bool SaveCheckpoint();
+	bool ArchiveClosedSessions();
+	void CompactionThreadProc();
+	bool LoadSummaries();
+	bool SaveSummaries();
+	bool SaveSummaries(const wstring &Path, const wchar_t *Key);
 };
\ No newline at end of file
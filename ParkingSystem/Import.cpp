@@ -0,0 +1,509 @@
+/*
+Description:    Import records from CSV files in bulk, e.g. the history of a site moved from another system.
+                The text is parsed by several threads, and the records are added to the log file at once,
+                so the log file is written only once however many records are imported
+Author:         Hanson
+File:           Import.cpp
+*/
+
+#include "FileManager.h"
+
+static const BYTE	DaysOfMonth[] = { 0, 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };	//Days of each month in a leap year
+
+/* Description:		Parsing state of a thread. The date of a record is usually the same as the last one */
+struct ImportParser {
+	char			CachedDate[10];					//"YYYY-MM-DD" of CachedDay
+	LONGLONG		CachedDay = -1;					//Beginning of the day of CachedDate, see IceToEpoch(). -1 if none
+	UINT			Capacity;						//No. of parking positions, lines with other positions are rejected
+};
+
+/*
+Description:    Compare records by enter time. Records entered at the same time are ordered by their content,
+				so the result doesn't depend on the no. of parser threads
+Args:			a, b: The records
+Return:			true if a comes first, false otherwise
+*/
+static inline bool IceEnterTimeLess(const LogInfo &a, const LogInfo &b) {
+	if (a.EnterTime != b.EnterTime)
+		return a.EnterTime < b.EnterTime;
+	return memcmp(&a, &b, sizeof(LogInfo)) < 0;
+}
+
+/*
+Description:    Remove spaces and quotation marks around a field
+Args:			Begin: First character of the field
+				End: End of the field
+*/
+static inline void IceTrimField(const char *&Begin, const char *&End) {
+	while (Begin < End && (*Begin == ' ' || *Begin == '\t'))
+		Begin++;
+	while (End > Begin && (End[-1] == ' ' || End[-1] == '\t'))
+		End--;
+	if (End - Begin >= 2 && *Begin == '"' && End[-1] == '"') {
+		Begin++;
+		End--;
+	}
+}
+
+/*
+Description:    Parse a number of fixed length
+Args:			p: First digit
+				Digits: No. of digits
+				Value: Variable to receive the number
+Return:			true if succeed, false if a character is not a digit
+*/
+static inline bool IceParseDigits(const char *p, int Digits, UINT &Value) {
+	Value = 0;
+	for (int i = 0; i < Digits; i++) {
+		UINT	Digit = (UINT)(p[i] - '0');
+		if (Digit > 9)
+			return false;
+		Value = Value * 10 + Digit;
+	}
+	return true;
+}
+
+/*
+Description:    Parse a time written as "YYYY-MM-DD hh:mm:ss" (or with a 'T' between the date and the time)
+Args:			Begin: First character of the field
+				End: End of the field
+				Parser: Parsing state of the thread
+				Time: Variable to receive the time, see IceToEpoch()
+Return:			true if succeed, false if the time is not valid
+*/
+static bool IceParseTime(const char *Begin, const char *End, ImportParser &Parser, LONGLONG &Time) {
+	UINT	Hour, Minute, Second;
+
+	if (End - Begin != 19 || Begin[4] != '-' || Begin[7] != '-' || (Begin[10] != ' ' && Begin[10] != 'T') ||
+		Begin[13] != ':' || Begin[16] != ':')
+		return false;
+	if (!IceParseDigits(Begin + 11, 2, Hour) || !IceParseDigits(Begin + 14, 2, Minute) || !IceParseDigits(Begin + 17, 2, Second) ||
+		Hour > 23 || Minute > 59 || Second > 59)
+		return false;
+
+	if (Parser.CachedDay < 0 || memcmp(Begin, Parser.CachedDate, sizeof(Parser.CachedDate))) {	//Convert the date only when it changes
+		SYSTEMTIME	stDate = {};
+		UINT		Year, Month, Day;
+		if (!IceParseDigits(Begin, 4, Year) || !IceParseDigits(Begin + 5, 2, Month) || !IceParseDigits(Begin + 8, 2, Day) ||
+			Year < 1970 || Month < 1 || Month > 12 || Day < 1 || Day > DaysOfMonth[Month])
+			return false;
+		if (Month == 2 && Day == 29 && (Year % 4 != 0 || (Year % 100 == 0 && Year % 400 != 0)))	//Not a leap year
+			return false;
+		stDate.wYear = (WORD)Year;
+		stDate.wMonth = (WORD)Month;
+		stDate.wDay = (WORD)Day;
+		memcpy(Parser.CachedDate, Begin, sizeof(Parser.CachedDate));
+		Parser.CachedDay = IceToEpoch(stDate);
+	}
+	Time = Parser.CachedDay + Hour * 3600 + Minute * 60 + Second;
+	return Time > 0;
+}
+
+/*
+Description:    Parse a car number, see IcePackCarNumber()
+Args:			Begin: First character of the field
+				End: End of the field
+Return:			The packed car number, 0 if the car number is not valid
+*/
+static ULONGLONG IceParseCarNumber(const char *Begin, const char *End) {
+	ULONGLONG	Packed = 0;
+
+	if (End - Begin > CAR_NUMBER_MAX)
+		return 0;
+	while (End > Begin) {																		//The first character is the lowest digit
+		char	ch = *--End;
+		if (ch >= '0' && ch <= '9')
+			Packed = Packed * 37 + (ch - '0' + 1);
+		else if (ch >= 'A' && ch <= 'Z')
+			Packed = Packed * 37 + (ch - 'A' + 11);
+		else if (ch >= 'a' && ch <= 'z')
+			Packed = Packed * 37 + (ch - 'a' + 11);
+		else
+			return 0;
+	}
+	return Packed;
+}
+
+/*
+Description:    Parse a fee written in dollars, e.g. "12.50", "12.5" or "12"
+Args:			Begin: First character of the field
+				End: End of the field
+				Fee: Variable to receive the fee, in cents
+Return:			true if succeed, false if the fee is not valid
+*/
+static bool IceParseFee(const char *Begin, const char *End, int &Fee) {
+	const char	*Point = Begin;
+	UINT		Dollars, Cents = 0;
+
+	while (Point < End && *Point != '.')
+		Point++;
+	if (Point == Begin || Point - Begin > 7 || !IceParseDigits(Begin, (int)(Point - Begin), Dollars))
+		return false;
+	if (Point < End) {																			//Cents
+		int	Digits = (int)(End - Point - 1);
+		if (Digits < 1 || Digits > 2 || !IceParseDigits(Point + 1, Digits, Cents))
+			return false;
+		if (Digits == 1)
+			Cents *= 10;
+	}
+	Fee = (int)(Dollars * 100 + Cents);
+	return true;
+}
+
+/*
+Description:    Parse a line: car_number,enter_time,leave_time,position,fee. The leave time is empty if the car
+				is still parking, the position starts from 1, the same as IceEncryptedFile::ExportRecords() writes
+Args:			Begin: First character of the line
+				End: End of the line, without the line break
+				Parser: Parsing state of the thread
+				Info: Variable to receive the record
+Return:			true if succeed, false if the line is not a valid record
+*/
+static bool IceParseLine(const char *Begin, const char *End, ImportParser &Parser, LogInfo &Info) {
+	const char	*Fields[6];
+	UINT		Count = 0, Position;
+
+	Fields[Count++] = Begin;
+	for (const char *p = Begin; p < End; p++) {													//Find the commas
+		if (*p == ',') {
+			if (Count == 5)
+				return false;
+			Fields[Count++] = p + 1;
+		}
+	}
+	if (Count != 5)
+		return false;
+	Fields[5] = End + 1;
+
+	const char	*First[5], *Last[5];
+	for (UINT i = 0; i < 5; i++) {
+		First[i] = Fields[i];
+		Last[i] = Fields[i + 1] - 1;
+		IceTrimField(First[i], Last[i]);
+	}
+
+	Info.CarNumber = IceParseCarNumber(First[0], Last[0]);
+	Info.LeaveTime = 0;
+	if (Info.CarNumber == 0 || !IceParseTime(First[1], Last[1], Parser, Info.EnterTime))
+		return false;
+	if (First[2] != Last[2] && (!IceParseTime(First[2], Last[2], Parser, Info.LeaveTime) || Info.LeaveTime < Info.EnterTime))
+		return false;
+	if (Last[3] - First[3] < 1 || Last[3] - First[3] > 7 || !IceParseDigits(First[3], (int)(Last[3] - First[3]), Position) ||
+		Position < 1 || Position > Parser.Capacity)
+		return false;
+	Info.CarPos = Position - 1;
+	return IceParseFee(First[4], Last[4], Info.Fee);
+}
+
+/*
+Description:    Parser thread. Parses the lines of a piece and sorts the records by enter time
+Args:			Piece: The piece
+*/
+static void IceParsePiece(ImportPiece *Piece) {
+	ImportParser	Parser;
+	const char		*p = Piece->Begin;
+
+	Parser.Capacity = Piece->Capacity;
+	Piece->Records.clear();
+	Piece->Records.reserve((Piece->End - Piece->Begin) / IMPORT_LINE_GUESS + 1);
+	Piece->Lines = Piece->Rejected = Piece->FirstRejected = 0;
+	while (p < Piece->End) {
+		const char	*LineEnd = (const char*)memchr(p, '\n', Piece->End - p);
+		const char	*Next = LineEnd ? LineEnd + 1 : Piece->End;
+		LogInfo		Info;
+
+		if (!LineEnd)																			//Last line of the file without a line break
+			LineEnd = Piece->End;
+		if (LineEnd > p && LineEnd[-1] == '\r')
+			LineEnd--;
+		Piece->Lines++;
+		if (LineEnd > p) {																		//Empty lines are skipped
+			if (IceParseLine(p, LineEnd, Parser, Info))
+				Piece->Records.push_back(Info);
+			else if (Piece->Rejected++ == 0)
+				Piece->FirstRejected = Piece->Lines;
+		}
+		p = Next;
+	}
+	sort(Piece->Records.begin(), Piece->Records.end(), IceEnterTimeLess);
+}
+
+/*
+Description:    Read from a file until the buffer is full or the end of the file is reached
+Args:			hFile: Handle to the file
+				Buffer: The buffer
+				Length: Size of the buffer in bytes
+				Read: Variable to receive the no. of bytes read
+Return:			true if succeed, false otherwise
+*/
+static bool IceReadFully(HANDLE hFile, char *Buffer, size_t Length, size_t &Read) {
+	Read = 0;
+	while (Read < Length) {
+		DWORD	Piece = (DWORD)min(Length - Read, FILE_IO_CHUNK), Done;
+		if (!ReadFile(hFile, Buffer + Read, Piece, &Done, NULL))
+			return false;
+		if (Done == 0)																			//End of the file
+			break;
+		Read += Done;
+	}
+	return true;
+}
+
+/*
+Description:    Merge sorted runs of records into one, merging pairs of neighbouring runs on several threads
+Args:			Records: The records
+				Runs: Beginning of each run, followed by the end of the last run
+				Threads: No. of threads
+*/
+static void IceMergeRuns(vector<LogInfo> &Records, vector<size_t> &Runs, UINT Threads) {
+	while (Runs.size() > 2) {
+		vector<size_t>	Merged;
+		vector<thread>	Workers;
+
+		for (size_t i = 0; i + 1 < Runs.size(); i += 2) {
+			Merged.push_back(Runs[i]);
+			if (i + 2 >= Runs.size())																//No pair
+				continue;
+			vector<LogInfo>::iterator	First = Records.begin() + Runs[i], Middle = Records.begin() + Runs[i + 1],
+										Last = Records.begin() + Runs[i + 2];
+			if (Workers.size() + 1 >= Threads) {													//Merge on this thread if enough threads are working
+				inplace_merge(First, Middle, Last, IceEnterTimeLess);
+				continue;
+			}
+			Workers.push_back(thread([First, Middle, Last]() {
+				inplace_merge(First, Middle, Last, IceEnterTimeLess);
+			}));
+		}
+		Merged.push_back(Runs.back());
+		for (UINT i = 0; i < Workers.size(); i++)
+			Workers[i].join();
+		Runs.swap(Merged);
+	}
+}
+
+/*
+Description:    Merge sorted vectors of records into a record store. A vector is freed as soon as all its records are
+				moved, so if the vectors hold records of different periods, e.g. the reads of a file in the order of
+				time, little more than the records is kept in memory
+Args:			Runs: The vectors, each sorted by enter time. All are empty when this function returns
+				Sorted: Store to append the records to
+*/
+static void IceMergeSortedRuns(vector<vector<LogInfo>> &Runs, IceRecordStore &Sorted) {
+	vector<size_t>	Next(Runs.size());															//Index of the next record of each vector
+	vector<UINT>	Heap;																		//Vectors not moved yet, the one with the first next record on top
+	auto			Later = [&Runs, &Next](UINT a, UINT b) {
+		return IceEnterTimeLess(Runs[b][Next[b]], Runs[a][Next[a]]);
+	};
+
+	for (UINT i = 0; i < Runs.size(); i++) {
+		if (!Runs[i].empty())
+			Heap.push_back(i);
+	}
+	make_heap(Heap.begin(), Heap.end(), Later);
+	while (!Heap.empty()) {
+		pop_heap(Heap.begin(), Heap.end(), Later);
+		UINT				Run = Heap.back();
+		vector<LogInfo>		&Records = Runs[Run];
+		do {																						//Records up to the next record of another vector
+			Sorted.Append(Records[Next[Run]++]);
+		} while (Next[Run] < Records.size() &&
+			(Heap.size() == 1 || !IceEnterTimeLess(Runs[Heap[0]][Next[Heap[0]]], Records[Next[Run]])));
+		if (Next[Run] == Records.size()) {															//All records moved
+			vector<LogInfo>().swap(Records);
+			Heap.pop_back();
+		}
+		else
+			push_heap(Heap.begin(), Heap.end(), Later);
+	}
+}
+
+/*
+Description:    Import the records of a CSV file (see IceParseLine(), a header line is skipped) into the log file.
+				Lines which are not valid records are skipped. The records are merged into the log file in the order
+				of enter time, and the log file is written once. The records of each read are sorted on their own, then
+				all are merged into a record store, and then into the log file, freeing the records already moved, so
+				about one copy of the log file and the imported records is kept in memory. Indices of LogData change,
+				so indices kept by the caller must be taken from OpenSessions again
+Args:			Path: Path of the CSV file
+				Threads: No. of parser threads, 0 = one per processor
+				Result: Variable to receive the counters, can be NULL
+Return:			true if succeed, false if the file can't be read or the log file can't be saved
+*/
+bool IceEncryptedFile::ImportRecords(const wstring &Path, UINT Threads, ImportResult *Result) {
+	HANDLE					hFile;
+	vector<char>			Buffer(IMPORT_READ_SIZE);
+	vector<ImportPiece>		Pieces;
+	vector<vector<LogInfo>>	Reads;															//Records of each read, sorted by enter time
+	IceRecordStore			Imported;														//All records, sorted by enter time
+	size_t					Total = 0;														//No. of records of Reads
+	ImportResult			Counters = {};
+	size_t					Carry = 0;														//Characters of an incomplete line kept from the last read
+	bool					Eof = false, FirstRead = true, Succeeded = true;
+
+	if (fsFile.fail() || WithoutFile)															//No file opened
+		return false;
+	if (Threads == 0)
+		Threads = max(thread::hardware_concurrency(), 1u);
+	hFile = CreateFileW(Path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	while (Succeeded && !Eof) {
+		size_t		Read;
+		const char	*Begin = Buffer.data(), *End;
+
+		if (!IceReadFully(hFile, Buffer.data() + Carry, Buffer.size() - Carry, Read)) {
+			Succeeded = false;
+			break;
+		}
+		Eof = Carry + Read < Buffer.size();
+		End = Begin + Carry + Read;
+		if (!Eof) {																				//Keep the incomplete last line for the next read
+			while (End > Begin && End[-1] != '\n')
+				End--;
+			if (End == Begin) {																		//A line longer than the buffer
+				Succeeded = false;
+				break;
+			}
+		}
+		if (FirstRead) {
+			if (End - Begin >= 3 && !memcmp(Begin, "\xEF\xBB\xBF", 3))								//UTF-8 byte order mark
+				Begin += 3;
+			if (End - Begin >= 10 && !_strnicmp(Begin, "car_number", 10)) {						//Header line
+				const char	*LineEnd = (const char*)memchr(Begin, '\n', End - Begin);
+				Begin = LineEnd ? LineEnd + 1 : End;
+				Counters.Lines++;
+			}
+			FirstRead = false;
+		}
+
+		//Split the text into pieces at line breaks
+		size_t	PieceCount = (size_t)min((size_t)Threads, max((size_t)(End - Begin) / IMPORT_PIECE_MIN, (size_t)1));
+		Pieces.resize(PieceCount);
+		for (size_t i = 0; i < PieceCount; i++) {
+			const char	*PieceEnd = i + 1 == PieceCount ? End : Begin + (End - Begin) * (i + 1) / PieceCount;
+			if (i > 0)
+				Pieces[i].Begin = Pieces[i - 1].End;
+			else
+				Pieces[i].Begin = Begin;
+			PieceEnd = max(PieceEnd, Pieces[i].Begin);
+			while (PieceEnd < End && PieceEnd > Pieces[i].Begin && PieceEnd[-1] != '\n')
+				PieceEnd++;
+			Pieces[i].End = PieceEnd;
+			Pieces[i].Capacity = FileContent.Capacity;
+		}
+
+		vector<thread>	Workers;
+		for (size_t i = 1; i < PieceCount; i++)
+			Workers.push_back(thread(IceParsePiece, &Pieces[i]));
+		IceParsePiece(&Pieces[0]);																	//The first piece is parsed by this thread
+		for (UINT i = 0; i < Workers.size(); i++)
+			Workers[i].join();
+
+		vector<LogInfo>	Records;
+		vector<size_t>	Runs;																		//Sorted runs of Records, one per piece
+		size_t			Count = 0;
+		for (size_t i = 0; i < PieceCount; i++)
+			Count += Pieces[i].Records.size();
+		Records.reserve(Count);
+		for (size_t i = 0; i < PieceCount; i++) {													//Collect the records in the order of the file
+			if (Pieces[i].FirstRejected && !Counters.FirstRejected)
+				Counters.FirstRejected = Counters.Lines + Pieces[i].FirstRejected;
+			Counters.Lines += Pieces[i].Lines;
+			Counters.Rejected += Pieces[i].Rejected;
+			if (Pieces[i].Records.empty())
+				continue;
+			Runs.push_back(Records.size());
+			Records.insert(Records.end(), Pieces[i].Records.begin(), Pieces[i].Records.end());
+		}
+		if (!Records.empty()) {																		//Sort the records of the read by enter time
+			Runs.push_back(Records.size());
+			IceMergeRuns(Records, Runs, Threads);
+			Total += Records.size();
+			Reads.push_back(move(Records));
+		}
+
+		Carry = Buffer.data() + Carry + Read - End;
+		memmove(Buffer.data(), End, Carry);
+	}
+	CloseHandle(hFile);
+	vector<char>().swap(Buffer);
+	vector<ImportPiece>().swap(Pieces);
+	if (!Succeeded || (ULONGLONG)FileContent.ElementCount + Total > UINT_MAX) {
+		if (Result)
+			*Result = Counters;
+		return false;
+	}
+
+	//Sort all records by enter time
+	IceMergeSortedRuns(Reads, Imported);
+
+	//A position holds one parking car, and a car parks at one position. Cars already parking keep their positions,
+	//otherwise the car entered last is kept
+	vector<bool>	Occupied(FileContent.Capacity);
+	IcePlateIndex	Parked;
+	size_t			First = 0;																	//Index of the first record kept
+	for (UINT i = 0; i < OpenSessions.size(); i++) {
+		if (FileContent.LogData[OpenSessions[i]].CarPos < FileContent.Capacity)
+			Occupied[FileContent.LogData[OpenSessions[i]].CarPos] = true;
+	}
+	Parked.Build(FileContent.LogData, OpenSessions);
+	for (size_t i = Imported.Size(); i-- > 0;) {
+		UINT	Index;
+		if (Imported[i].LeaveTime != 0)
+			continue;
+		if (Occupied[Imported[i].CarPos] || Parked.Find(Imported[i].CarNumber, Index)) {		//Position taken, or the car is parking already
+			Imported[i].CarNumber = 0;																	//Skipped below
+			Counters.Conflicts++;
+			continue;
+		}
+		Occupied[Imported[i].CarPos] = true;
+		Parked.Insert(Imported[i].CarNumber, (UINT)i);
+	}
+	Counters.Imported = Imported.Size() - Counters.Conflicts;
+	if (Result)
+		*Result = Counters;
+	if (Counters.Imported == 0)
+		return true;
+	while (Imported[First].CarNumber == 0)
+		First++;
+
+	//The daily summaries from the day the first imported car entered on are out of date. Reports of these days are made
+	//from the records again, as ReadSummaries() fails for the periods with missing days
+	CancelCompaction();																			//The job holds indices of LogData and a copy of the summaries
+	LONGLONG	FirstDay = Imported[First].EnterTime - Imported[First].EnterTime % SECONDS_PER_DAY;
+	if (FirstDay < SummarizedTo) {
+		Summaries.erase(lower_bound(Summaries.begin(), Summaries.end(), FirstDay, [](const DailySummary &Summary, LONGLONG Day) {
+			return Summary.Day < Day;
+		}), Summaries.end());
+		SaveSummaries();
+	}
+
+	//Merge the records into the log file, the records of the log file go first among cars entered at the same time.
+	//The chunks of both are freed once moved
+	IceRecordStore	Merged;
+	size_t			OldCount = FileContent.LogData.Size(), NewCount = Imported.Size();
+	for (size_t a = 0, b = 0; a < OldCount || b < NewCount;) {
+		if (b == NewCount || (a < OldCount && Imported[b].EnterTime >= FileContent.LogData[a].EnterTime)) {
+			Merged.Append(FileContent.LogData[a++]);
+			if (a % RECORD_CHUNK_RECORDS == 0)															//A whole chunk is moved
+				FileContent.LogData.ReleaseBefore(a);
+		}
+		else {
+			if (Imported[b].CarNumber != 0)																//Records dropped above are skipped
+				Merged.Append(Imported[b]);
+			if (++b % RECORD_CHUNK_RECORDS == 0)
+				Imported.ReleaseBefore(b);
+		}
+	}
+	Imported.Clear();
+	FileContent.LogData.Swap(Merged);
+	FileContent.ElementCount = (UINT)FileContent.LogData.Size();
+
+	OpenSessions.clear();
+	for (UINT i = 0; i < FileContent.ElementCount; i++) {
+		if (FileContent.LogData[i].LeaveTime == 0)
+			OpenSessions.push_back(i);
+	}
+	return SaveFile();																			//Write the log file in one pass
+}
\ No newline at end of file
@@ -0,0 +1,140 @@
+/*
+Description:    Index of the parking periods of the records. The history report looks up the cars parking at
+                a time on every move of the slider, which only visits the blocks of records having one
+Author:         Hanson
+File:           IntervalIndex.cpp
+*/
+
+#include "FileManager.h"
+
+/*
+Description:    Rebuild the index from all records, e.g. after logging in
+Args:			LogData: The records
+*/
+void IceIntervalIndex::Build(const IceRecordStore &LogData) {
+	size_t	Blocks = (LogData.Size() + INTERVAL_BLOCK_RECORDS - 1) / INTERVAL_BLOCK_RECORDS;
+
+	Nodes.clear();
+	Leaves = 0;
+	Grow(Blocks);
+	for (size_t i = 0; i < Blocks; i++)
+		SetLeaf(LogData, i);
+	for (size_t i = Leaves - 1; i > 0; i--)
+		SetParent(i);
+}
+
+/*
+Description:    Update the index after a record is added or changed, e.g. a car entered or left
+Args:			LogData: The records
+				Index: Index of the record
+*/
+void IceIntervalIndex::Update(const IceRecordStore &LogData, size_t Index) {
+	size_t	Block = Index / INTERVAL_BLOCK_RECORDS;
+
+	Grow(Block + 1);
+	SetLeaf(LogData, Block);
+	for (size_t i = (Leaves + Block) / 2; i > 0; i /= 2)										//Up to the root
+		SetParent(i);
+}
+
+/*
+Description:    Find the cars parking at a time, i.e. entered before it and not left before it
+Args:			LogData: The records
+				Time: The time, see IceToEpoch()
+				Sessions: Vector to receive the indices of the records of the cars
+*/
+void IceIntervalIndex::Find(const IceRecordStore &LogData, LONGLONG Time, vector<UINT> &Sessions) const {
+	Sessions.clear();
+	if (Leaves)
+		Collect(LogData, 1, Time, Sessions);
+}
+
+/*
+Description:    Remove all blocks
+*/
+void IceIntervalIndex::Clear() {
+	Nodes.clear();
+	Leaves = 0;
+}
+
+/*
+Description:    Calculate the period covered by the records of a block
+Args:			LogData: The records
+				Block: Index of the block
+*/
+void IceIntervalIndex::SetLeaf(const IceRecordStore &LogData, size_t Block) {
+	IntervalNode	&Leaf = Nodes[Leaves + Block];
+	size_t			First = Block * INTERVAL_BLOCK_RECORDS, Count;
+	const LogInfo	*Records = LogData.GetRun(First, Count);									//A block is never split among chunks
+
+	Leaf.FirstEnter = MAXLONGLONG;
+	Leaf.LastLeave = 0;
+	Count = min(Count, INTERVAL_BLOCK_RECORDS);
+	for (size_t i = 0; i < Count; i++) {
+		if (Records[i].EnterTime <= 0)													//Lost in a damaged block of the log file
+			continue;
+		Leaf.FirstEnter = min(Leaf.FirstEnter, Records[i].EnterTime);
+		Leaf.LastLeave = max(Leaf.LastLeave, Records[i].LeaveTime ? Records[i].LeaveTime : MAXLONGLONG);
+	}
+}
+
+/*
+Description:    Calculate the period covered by a node from its children
+Args:			Node: Index of the node, less than Leaves
+*/
+void IceIntervalIndex::SetParent(size_t Node) {
+	const IntervalNode	&Left = Nodes[Node * 2], &Right = Nodes[Node * 2 + 1];
+
+	Nodes[Node].FirstEnter = min(Left.FirstEnter, Right.FirstEnter);
+	Nodes[Node].LastLeave = max(Left.LastLeave, Right.LastLeave);
+}
+
+/*
+Description:    Double the no. of leaves until there are enough for a no. of blocks. The leaves are kept and the
+				other nodes are recalculated, so growing as the records are added takes constant time on average
+Args:			Blocks: The no. of blocks
+*/
+void IceIntervalIndex::Grow(size_t Blocks) {
+	size_t	NewLeaves = max(Leaves, (size_t)1);
+
+	while (NewLeaves < Blocks)
+		NewLeaves *= 2;
+	if (NewLeaves == Leaves)
+		return;
+
+	IntervalNode			Empty = { MAXLONGLONG, 0 };
+	vector<IntervalNode>	NewNodes(NewLeaves * 2, Empty);
+
+	if (Leaves)
+		copy(Nodes.begin() + Leaves, Nodes.end(), NewNodes.begin() + NewLeaves);
+	Nodes.swap(NewNodes);
+	Leaves = NewLeaves;
+	for (size_t i = Leaves - 1; i > 0; i--)
+		SetParent(i);
+}
+
+/*
+Description:    Find the cars parking at a time among the records below a node
+Args:			LogData: The records
+				Node: Index of the node
+				Time: The time
+				Sessions: Vector to add the indices of the records of the cars to
+*/
+void IceIntervalIndex::Collect(const IceRecordStore &LogData, size_t Node, LONGLONG Time, vector<UINT> &Sessions) const {
+	if (Nodes[Node].FirstEnter > Time || Nodes[Node].LastLeave < Time)						//No car below the node parked at the time
+		return;
+	if (Node < Leaves) {
+		Collect(LogData, Node * 2, Time, Sessions);
+		Collect(LogData, Node * 2 + 1, Time, Sessions);
+		return;
+	}
+
+	size_t			First = (Node - Leaves) * INTERVAL_BLOCK_RECORDS, Count;
+	const LogInfo	*Records = LogData.GetRun(First, Count);
+
+	Count = min(Count, INTERVAL_BLOCK_RECORDS);
+	for (size_t i = 0; i < Count; i++) {
+		if (Records[i].EnterTime > 0 && Records[i].EnterTime <= Time && (Records[i].LeaveTime == 0 || Records[i].LeaveTime >= Time))
+			Sessions.push_back((UINT)(First + i));
+	}
+}
\ No newline at end of file
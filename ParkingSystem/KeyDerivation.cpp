@@ -0,0 +1,300 @@
+/*
+Description:    Key derivation for AES encrypted files: SHA-256, HMAC-SHA256 and PBKDF2.
+                Deriving a key takes a tunable number of iterations, so guessing passwords is slow.
+                SHA-256 uses the SHA extensions when available, as it tags every sealed block
+Author:         Hanson
+File:           KeyDerivation.cpp
+*/
+
+#include "FileManager.h"
+#include <wincrypt.h>
+#include <intrin.h>
+
+static const DWORD	Sha256K[64] = {														//Round constants
+	0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+	0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+	0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+	0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+	0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+	0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+	0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+	0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+#define ROTR(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+/*
+Description:    Check if the CPU supports the SHA extensions
+Return:			true if the SHA extensions can be used, false otherwise
+*/
+static bool DetectShaSupport() {
+	int		CpuInfo[4];
+
+	__cpuid(CpuInfo, 0);
+	if (CpuInfo[0] < 7)
+		return false;
+	__cpuid(CpuInfo, 1);
+	if (!(CpuInfo[2] & (1 << 9)) || !(CpuInfo[2] & (1 << 19)))									//SSSE3 and SSE4.1
+		return false;
+	__cpuidex(CpuInfo, 7, 0);
+	return (CpuInfo[1] & (1 << 29)) != 0;														//SHA
+}
+
+const bool	ShaHardware = DetectShaSupport();													//Detected once before WinMain, read by all threads
+
+/*
+Description:    Process a 64-byte block
+Args:			State: The state
+				Block: The block
+*/
+static void Sha256Transform(Sha256State &State, const BYTE *Block) {
+	DWORD	W[64], a, b, c, d, e, f, g, h;
+
+	for (int i = 0; i < 16; i++)																//Big endian words
+		W[i] = (DWORD)Block[i * 4] << 24 | (DWORD)Block[i * 4 + 1] << 16 | (DWORD)Block[i * 4 + 2] << 8 | Block[i * 4 + 3];
+	for (int i = 16; i < 64; i++) {
+		DWORD	s0 = ROTR(W[i - 15], 7) ^ ROTR(W[i - 15], 18) ^ (W[i - 15] >> 3);
+		DWORD	s1 = ROTR(W[i - 2], 17) ^ ROTR(W[i - 2], 19) ^ (W[i - 2] >> 10);
+		W[i] = W[i - 16] + s0 + W[i - 7] + s1;
+	}
+	a = State.Hash[0]; b = State.Hash[1]; c = State.Hash[2]; d = State.Hash[3];
+	e = State.Hash[4]; f = State.Hash[5]; g = State.Hash[6]; h = State.Hash[7];
+	for (int i = 0; i < 64; i++) {
+		DWORD	t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + Sha256K[i] + W[i];
+		DWORD	t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+	State.Hash[0] += a; State.Hash[1] += b; State.Hash[2] += c; State.Hash[3] += d;
+	State.Hash[4] += e; State.Hash[5] += f; State.Hash[6] += g; State.Hash[7] += h;
+}
+
+/*
+Description:    Process 64-byte blocks with the SHA extensions. The state is kept in two registers as ABEF and CDGH,
+				and each group of 4 rounds takes the next 4 words of the message schedule
+Args:			State: The state
+				Data: The blocks
+				Blocks: No. of blocks
+*/
+static void Sha256TransformSHA(Sha256State &State, const BYTE *Data, size_t Blocks) {
+	const __m128i	Mask = _mm_set_epi64x(0x0C0D0E0F08090A0BLL, 0x0405060700010203LL);		//Big endian words
+	__m128i			State0, State1, Message[4];
+	__m128i			Cdab = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)State.Hash), 0xB1);
+	__m128i			Efgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(State.Hash + 4)), 0x1B);
+
+	State0 = _mm_alignr_epi8(Cdab, Efgh, 8);													//ABEF
+	State1 = _mm_blend_epi16(Efgh, Cdab, 0xF0);													//CDGH
+	for (; Blocks > 0; Blocks--, Data += 64) {
+		__m128i	Abef = State0, Cdgh = State1;
+
+		for (int i = 0; i < 4; i++)
+			Message[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(Data + i * 16)), Mask);
+		for (int i = 0; i < 16; i++) {															//4 rounds at a time
+			__m128i	Words = _mm_add_epi32(Message[i & 3], _mm_loadu_si128((const __m128i*)(Sha256K + i * 4)));
+			State1 = _mm_sha256rnds2_epu32(State1, State0, Words);
+			State0 = _mm_sha256rnds2_epu32(State0, State1, _mm_shuffle_epi32(Words, 0x0E));
+			if (i < 12) {																				//Words of the group 4 groups later
+				__m128i	Next = _mm_sha256msg1_epu32(Message[i & 3], Message[(i + 1) & 3]);
+				Next = _mm_add_epi32(Next, _mm_alignr_epi8(Message[(i + 3) & 3], Message[(i + 2) & 3], 4));
+				Message[i & 3] = _mm_sha256msg2_epu32(Next, Message[(i + 3) & 3]);
+			}
+		}
+		State0 = _mm_add_epi32(State0, Abef);
+		State1 = _mm_add_epi32(State1, Cdgh);
+	}
+
+	__m128i	Feba = _mm_shuffle_epi32(State0, 0x1B);
+	__m128i	Dchg = _mm_shuffle_epi32(State1, 0xB1);
+	_mm_storeu_si128((__m128i*)State.Hash, _mm_blend_epi16(Feba, Dchg, 0xF0));					//ABCD
+	_mm_storeu_si128((__m128i*)(State.Hash + 4), _mm_alignr_epi8(Dchg, Feba, 8));				//EFGH
+}
+
+/*
+Description:    Process 64-byte blocks with the fastest kernel
+Args:			State: The state
+				Data: The blocks
+				Blocks: No. of blocks
+*/
+static void Sha256Blocks(Sha256State &State, const BYTE *Data, size_t Blocks) {
+	if (ShaHardware) {
+		Sha256TransformSHA(State, Data, Blocks);
+		return;
+	}
+	for (size_t i = 0; i < Blocks; i++)
+		Sha256Transform(State, Data + i * 64);
+}
+
+/*
+Description:    Start hashing
+Args:			State: The state
+*/
+static void Sha256Init(Sha256State &State) {
+	static const DWORD	Initial[8] = {
+		0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+	};
+
+	memcpy(State.Hash, Initial, sizeof(Initial));
+	State.BlockLength = 0;
+	State.TotalLength = 0;
+}
+
+/*
+Description:    Hash a piece of data
+Args:			State: The state
+				Data: The data
+				Length: Size of the data in bytes
+*/
+static void Sha256Update(Sha256State &State, const BYTE *Data, size_t Length) {
+	State.TotalLength += Length;
+	if (State.BlockLength > 0) {																//Fill the block started before
+		size_t	Piece = min(Length, 64 - State.BlockLength);
+		memcpy(State.Block + State.BlockLength, Data, Piece);
+		State.BlockLength += Piece;
+		Data += Piece;
+		Length -= Piece;
+		if (State.BlockLength < 64)
+			return;
+		Sha256Blocks(State, State.Block, 1);
+		State.BlockLength = 0;
+	}
+	Sha256Blocks(State, Data, Length / 64);														//Whole blocks are hashed in place
+	memcpy(State.Block, Data + Length / 64 * 64, Length % 64);
+	State.BlockLength = Length % 64;
+}
+
+/*
+Description:    Finish hashing
+Args:			State: The state
+				Digest: Buffer to store the hash value, 32 bytes
+*/
+static void Sha256Final(Sha256State &State, BYTE *Digest) {
+	ULONGLONG	Bits = State.TotalLength * 8;
+	BYTE		Padding[72] = { 0x80 };
+	size_t		PaddingLength = (State.BlockLength < 56 ? 56 : 120) - State.BlockLength;
+
+	for (int i = 0; i < 8; i++)																	//Length in bits, big endian
+		Padding[PaddingLength + i] = (BYTE)(Bits >> (56 - i * 8));
+	Sha256Update(State, Padding, PaddingLength + 8);
+	for (int i = 0; i < 8; i++) {
+		Digest[i * 4] = (BYTE)(State.Hash[i] >> 24);
+		Digest[i * 4 + 1] = (BYTE)(State.Hash[i] >> 16);
+		Digest[i * 4 + 2] = (BYTE)(State.Hash[i] >> 8);
+		Digest[i * 4 + 3] = (BYTE)State.Hash[i];
+	}
+}
+
+/*
+Description:    Calculate the SHA-256 hash value of a piece of data
+Args:			Data: The data
+				Length: Size of the data in bytes
+				Digest: Buffer to store the hash value, 32 bytes
+*/
+void IceSha256(const BYTE *Data, size_t Length, BYTE *Digest) {
+	Sha256State	State;
+
+	Sha256Init(State);
+	Sha256Update(State, Data, Length);
+	Sha256Final(State, Digest);
+}
+
+/*
+Description:    Prepare the inner and outer states of HMAC-SHA256 for a key. The states are reused for every
+				message, which halves the work of each PBKDF2 iteration and of each tag of sealed data
+Args:			Key: The key
+				KeyLength: Size of the key in bytes
+				Mac: Variable to receive the states
+*/
+void IceHmacInit(const BYTE *Key, size_t KeyLength, HmacKey &Mac) {
+	BYTE	Pad[64] = {};
+
+	if (KeyLength > 64)																			//Long keys are hashed first
+		IceSha256(Key, KeyLength, Pad);
+	else
+		memcpy(Pad, Key, KeyLength);
+	for (int i = 0; i < 64; i++)
+		Pad[i] ^= 0x36;
+	Sha256Init(Mac.Inner);
+	Sha256Update(Mac.Inner, Pad, 64);
+	for (int i = 0; i < 64; i++)
+		Pad[i] ^= 0x36 ^ 0x5C;
+	Sha256Init(Mac.Outer);
+	Sha256Update(Mac.Outer, Pad, 64);
+	SecureZeroMemory(Pad, sizeof(Pad));
+}
+
+/*
+Description:    Calculate the HMAC-SHA256 of a message from the prepared states. The message is passed in two
+				pieces, so a short prefix (e.g. a nonce) needs no copy of the data following it
+Args:			Mac: States prepared by IceHmacInit()
+				Prefix: First piece of the message, can be NULL if PrefixLength is 0
+				PrefixLength: Size of the first piece in bytes
+				Data: Second piece of the message
+				Length: Size of the second piece in bytes
+				Digest: Buffer to store the result, 32 bytes
+*/
+void IceHmacSha256(const HmacKey &Mac, const BYTE *Prefix, size_t PrefixLength, const BYTE *Data, size_t Length, BYTE *Digest) {
+	Sha256State	State = Mac.Inner;
+	BYTE		Inner[32];
+
+	Sha256Update(State, Prefix, PrefixLength);
+	Sha256Update(State, Data, Length);
+	Sha256Final(State, Inner);
+	State = Mac.Outer;
+	Sha256Update(State, Inner, sizeof(Inner));
+	Sha256Final(State, Digest);
+}
+
+/*
+Description:    Derive a key from a password with PBKDF2-HMAC-SHA256
+Args:			Password: The password
+				PasswordLength: Size of the password in bytes
+				Salt: The salt
+				SaltLength: Size of the salt in bytes, at most 60
+				Iterations: No. of iterations
+				Output: Buffer to store the key
+				OutputLength: Size of the key in bytes
+*/
+void IcePbkdf2(const BYTE *Password, size_t PasswordLength, const BYTE *Salt, size_t SaltLength, UINT Iterations,
+	BYTE *Output, size_t OutputLength) {
+
+	HmacKey		Mac;
+	BYTE		Message[64];																	//Salt + block index
+	BYTE		U[32], T[32];
+
+	IceHmacInit(Password, PasswordLength, Mac);
+	memcpy(Message, Salt, SaltLength);
+	for (DWORD Block = 1; OutputLength > 0; Block++) {
+		Message[SaltLength] = (BYTE)(Block >> 24);													//Block index, big endian
+		Message[SaltLength + 1] = (BYTE)(Block >> 16);
+		Message[SaltLength + 2] = (BYTE)(Block >> 8);
+		Message[SaltLength + 3] = (BYTE)Block;
+		IceHmacSha256(Mac, NULL, 0, Message, SaltLength + 4, U);
+		memcpy(T, U, sizeof(T));
+		for (UINT i = 1; i < Iterations; i++) {
+			IceHmacSha256(Mac, NULL, 0, U, sizeof(U), U);
+			for (int j = 0; j < 32; j++)
+				T[j] ^= U[j];
+		}
+		size_t	Piece = min(OutputLength, sizeof(T));
+		memcpy(Output, T, Piece);
+		Output += Piece;
+		OutputLength -= Piece;
+	}
+}
+
+/*
+Description:    Fill a buffer with cryptographically random bytes
+Args:			Buffer: The buffer
+				Length: Size of the buffer in bytes
+Return:			true if succeed, false otherwise
+*/
+bool IceRandomBytes(BYTE *Buffer, DWORD Length) {
+	HCRYPTPROV	hProvider;
+	bool		Result;
+
+	if (!CryptAcquireContextW(&hProvider, NULL, NULL, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT | CRYPT_SILENT))
+		return false;
+	Result = CryptGenRandom(hProvider, Length, Buffer) != FALSE;
+	CryptReleaseContext(hProvider, 0);
+	return Result;
+}
\ No newline at end of file
@@ -17,6 +17,7 @@ void RecordProgramInstance(HINSTANCE hInstance);															//This copys hIns
 HINSTANCE GetProgramInstance();																				//This retrieves hInstance from ProgramInstance
 HWND GetMainWindowHandle();																					//This retrieves main window handle
 void* GetLogFilePtr();																						//This retrieves a pointer to the LogFile
+bool SetParkingCapacity(UINT Capacity);																		//This changes the no. of parking positions
 INT_PTR CALLBACK MainWindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam);						//Main window procedure
 INT_PTR CALLBACK SettingsWindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam);					//Settings window procedure
 LRESULT CALLBACK ButtonProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam);							//Button control procedure
@@ -0,0 +1,211 @@
+/*
+Description:    Cars parking at any time, for the history report. Moving the slider replays the cars entered
+                and left since the previous time, and a jump to another date starts from the nearest snapshot
+Author:         Hanson
+File:           OccupancyHistory.cpp
+*/
+
+#include "FileManager.h"
+
+/*
+Description:    Compare the order of two events
+Args:			A, B: The events
+Return:			true if A is before B
+*/
+static bool IceEventBefore(const OccupancyEvent &A, const OccupancyEvent &B) {
+	if (A.Time != B.Time)
+		return A.Time < B.Time;
+	return A.Leave < B.Leave;																	//Entering cars first, so a car left at its enter time is added first
+}
+
+/*
+Description:    Rebuild the events and the snapshots from all records, e.g. after logging in
+Args:			LogData: The records
+*/
+void IceOccupancyHistory::Build(const IceRecordStore &LogData) {
+	vector<OccupancyEvent>	Sorted;
+
+	Clear();
+	Sorted.reserve(LogData.Size() * 2);
+	for (size_t i = 0; i < LogData.Size(); i++) {
+		const LogInfo	&Info = LogData[i];
+		OccupancyEvent	Enter = { Info.EnterTime, (UINT)i, false };
+		OccupancyEvent	Leave = { Info.LeaveTime, (UINT)i, true };
+
+		if (Info.EnterTime <= 0 || (Info.LeaveTime && Info.LeaveTime < Info.EnterTime))		//Damaged or lost, the car was never parking
+			continue;
+		Sorted.push_back(Enter);
+		if (Info.LeaveTime)
+			Sorted.push_back(Leave);
+	}
+	sort(Sorted.begin(), Sorted.end(), IceEventBefore);
+
+	ActiveSlots.assign(LogData.Size(), NO_SESSION);
+	TakeSnapshot();																				//Nothing parking before the first event
+	Events.reserve(Sorted.size());
+	for (size_t i = 0; i < Sorted.size(); i++)
+		Append(Sorted[i]);
+}
+
+/*
+Description:    Add the event of a record which is added or changed, i.e. a car entered or left
+Args:			LogData: The records
+				Index: Index of the record
+*/
+void IceOccupancyHistory::Update(const IceRecordStore &LogData, size_t Index) {
+	const LogInfo	&Info = LogData[Index];
+	OccupancyEvent	Event = { Info.LeaveTime ? Info.LeaveTime : Info.EnterTime, (UINT)Index, Info.LeaveTime != 0 };
+
+	if (!Snapshots.size() || (!Events.empty() && Event.Time < Events.back().Time)) {		//Not built, or the clock is set back
+		Build(LogData);
+		return;
+	}
+	if (Index >= ActiveSlots.size())
+		ActiveSlots.resize(LogData.Size(), NO_SESSION);
+	Append(Event);
+}
+
+/*
+Description:    Find the cars parking at a time, i.e. entered before it and not left before it. The cars are
+				stepped to from the previous time, or restored from a snapshot if it's nearer
+Args:			Time: The time, see IceToEpoch()
+				Sessions: Vector to receive the indices of the records of the cars
+*/
+void IceOccupancyHistory::Find(LONGLONG Time, vector<UINT> &Sessions) {
+	OccupancyEvent	Key = { Time, 0, true };
+	size_t			Target = upper_bound(Events.begin(), Events.end(), Key, IceEventBefore) - Events.begin();
+
+	Sessions.clear();
+	if (!Snapshots.size())																		//Not built
+		return;
+	Seek(Target);
+	for (size_t i = Target; i > 0 && Events[i - 1].Time == Time; i--) {						//Cars left at the time were still there
+		if (Events[i - 1].Leave)
+			Sessions.push_back(Events[i - 1].Session);
+	}
+	Sessions.insert(Sessions.end(), Active.begin(), Active.end());
+}
+
+/*
+Description:    Get the memory taken by the events and the snapshots, which grows as SnapshotSpacing shrinks
+Return:			Size in bytes
+*/
+size_t IceOccupancyHistory::GetMemorySize() const {
+	return sizeof(OccupancyEvent) * Events.capacity() + sizeof(OccupancySnapshot) * Snapshots.capacity() +
+		sizeof(UINT) * (SnapshotSessions.capacity() + Active.capacity() + ActiveSlots.capacity());
+}
+
+/*
+Description:    Remove all events and snapshots
+*/
+void IceOccupancyHistory::Clear() {
+	Events.clear();
+	Snapshots.clear();
+	SnapshotSessions.clear();
+	NextSnapshot = MAXLONGLONG;
+	Active.clear();
+	ActiveSlots.clear();
+	Applied = 0;
+}
+
+/*
+Description:    Add an event after all events. A snapshot is taken first if the event is in a later period of
+				SnapshotSpacing seconds than the previous one
+Args:			Event: The event
+*/
+void IceOccupancyHistory::Append(const OccupancyEvent &Event) {
+	if (SnapshotSpacing > 0 && (Events.empty() || Event.Time >= NextSnapshot)) {
+		if (!Events.empty()) {
+			Seek(Events.size());
+			TakeSnapshot();
+		}
+		NextSnapshot = Event.Time - Event.Time % SnapshotSpacing + SnapshotSpacing;			//Beginning of the next period
+	}
+	Events.push_back(Event);
+}
+
+/*
+Description:    Take a snapshot of the parking cars
+*/
+void IceOccupancyHistory::TakeSnapshot() {
+	OccupancySnapshot	Snapshot = { Applied, SnapshotSessions.size(), Active.size() };
+
+	SnapshotSessions.insert(SnapshotSessions.end(), Active.begin(), Active.end());
+	Snapshots.push_back(Snapshot);
+}
+
+/*
+Description:    Restore the parking cars of a snapshot
+Args:			Snapshot: Index of the snapshot
+*/
+void IceOccupancyHistory::Restore(size_t Snapshot) {
+	const OccupancySnapshot	&Restored = Snapshots[Snapshot];
+
+	for (size_t i = 0; i < Active.size(); i++)
+		ActiveSlots[Active[i]] = NO_SESSION;
+	Active.clear();
+	for (size_t i = 0; i < Restored.Count; i++)
+		Insert(SnapshotSessions[Restored.First + i]);
+	Applied = Restored.Event;
+}
+
+/*
+Description:    Move to the parking cars after a no. of events, from the current cars or the snapshot before or
+				after it, whichever replays the least events
+Args:			Event: The no. of events
+*/
+void IceOccupancyHistory::Seek(size_t Event) {
+	OccupancySnapshot	Key = { Event, 0, 0 };
+	size_t	Next = upper_bound(Snapshots.begin(), Snapshots.end(), Key,
+		[](const OccupancySnapshot &A, const OccupancySnapshot &B) { return A.Event < B.Event; }) - Snapshots.begin();
+	size_t	Cost = Applied > Event ? Applied - Event : Event - Applied;							//Stepping from the current cars
+	size_t	From = Snapshots.size();															//Snapshot to restore, none by default
+
+	if (Active.size() + Snapshots[Next - 1].Count + Event - Snapshots[Next - 1].Event < Cost) {	//Restoring costs a step per car
+		Cost = Active.size() + Snapshots[Next - 1].Count + Event - Snapshots[Next - 1].Event;
+		From = Next - 1;
+	}
+	if (Next < Snapshots.size() && Active.size() + Snapshots[Next].Count + Snapshots[Next].Event - Event < Cost)
+		From = Next;
+	if (From < Snapshots.size())
+		Restore(From);
+
+	for (; Applied < Event; Applied++) {														//Replay forward
+		if (Events[Applied].Leave)
+			Remove(Events[Applied].Session);
+		else
+			Insert(Events[Applied].Session);
+	}
+	for (; Applied > Event; Applied--) {														//Replay backward
+		if (Events[Applied - 1].Leave)
+			Insert(Events[Applied - 1].Session);
+		else
+			Remove(Events[Applied - 1].Session);
+	}
+}
+
+/*
+Description:    Add a parking car
+Args:			Session: Index of the record of the car
+*/
+void IceOccupancyHistory::Insert(UINT Session) {
+	if (ActiveSlots[Session] != NO_SESSION)
+		return;
+	ActiveSlots[Session] = (UINT)Active.size();
+	Active.push_back(Session);
+}
+
+/*
+Description:    Remove a parking car. The last car of the list takes its place
+Args:			Session: Index of the record of the car
+*/
+void IceOccupancyHistory::Remove(UINT Session) {
+	UINT	Slot = ActiveSlots[Session];
+
+	if (Slot == NO_SESSION)
+		return;
+	Active[Slot] = Active.back();
+	ActiveSlots[Active[Slot]] = Slot;
+	Active.pop_back();
+	ActiveSlots[Session] = NO_SESSION;
+}
\ No newline at end of file
@@ -0,0 +1,87 @@
+/*
+Description:    Index of the parking cars by position. The reports look up the car at a position on every
+                mouse move, and the gate adds and removes a car on every button press, all in constant time
+Author:         Hanson
+File:           ParkedCars.cpp
+*/
+
+#include "FileManager.h"
+
+/*
+Description:    Rebuild the index from the records of the parking cars, e.g. after logging in
+Args:			LogData: The records
+				Sessions: Indices of the records of the parking cars, see IceEncryptedFile::OpenSessions.
+				Can't be the vector returned by GetSessions()
+				Capacity: No. of positions. Cars at positions after it are not indexed
+*/
+void IceParkedCars::Build(const IceRecordStore &LogData, const vector<UINT> &Sessions, UINT Capacity) {
+	BaySessions.assign(Capacity, NO_SESSION);
+	BaySlots.assign(Capacity, 0);
+	this->Sessions.clear();
+	SessionBays.clear();
+	for (UINT i = 0; i < Sessions.size(); i++)
+		Add(LogData[Sessions[i]].CarPos, Sessions[i]);
+}
+
+/*
+Description:    Add a car which entered
+Args:			Bay: Position of the car
+				Session: Index of the record of the car
+Return:			true if succeed, false if the position is occupied or doesn't exist
+*/
+bool IceParkedCars::Add(UINT Bay, UINT Session) {
+	if (Bay >= BaySessions.size() || BaySessions[Bay] != NO_SESSION)
+		return false;
+	BaySessions[Bay] = Session;
+	BaySlots[Bay] = (UINT)Sessions.size();
+	Sessions.push_back(Session);
+	SessionBays.push_back(Bay);
+	return true;
+}
+
+/*
+Description:    Remove a car which left. The last car of the list takes its place
+Args:			Bay: Position of the car
+				Session: Index of the record of the car
+Return:			true if succeed, false if the car isn't at the position
+*/
+bool IceParkedCars::Remove(UINT Bay, UINT Session) {
+	if (Bay >= BaySessions.size() || BaySessions[Bay] != Session)
+		return false;
+
+	UINT	Slot = BaySlots[Bay];
+	Sessions[Slot] = Sessions.back();														//Move the last car to the slot
+	SessionBays[Slot] = SessionBays.back();
+	BaySlots[SessionBays[Slot]] = Slot;
+	Sessions.pop_back();
+	SessionBays.pop_back();
+	BaySessions[Bay] = NO_SESSION;
+	return true;
+}
+
+/*
+Description:    Find the car at a position
+Args:			Bay: The position
+Return:			Index of the record of the car, -1 if the position is free or doesn't exist
+*/
+int IceParkedCars::Find(UINT Bay) const {
+	if (Bay >= BaySessions.size() || BaySessions[Bay] == NO_SESSION)
+		return -1;
+	return (int)BaySessions[Bay];
+}
+
+/*
+Description:    Get the parking cars
+Return:			Indices of the records of the parking cars, in no particular order
+*/
+const vector<UINT> &IceParkedCars::GetSessions() const {
+	return Sessions;
+}
+
+/*
+Description:    Get the no. of parking cars
+Return:			The no. of cars
+*/
+size_t IceParkedCars::Size() const {
+	return Sessions.size();
+}
\ No newline at end of file
@@ -6,10 +6,13 @@ File:           ParkingSystem.cpp
 */
 
 #include "FileManager.h"
+#include <shellapi.h>
 
 /* Define constants */
 const int						GRAPH_MARGIN = 70;							//Graph margin size
 const int						GRAPH_ARROW_SIZE = 8;						//Axis arrow size
+const int						POSITION_BOX_MIN = 3;						//Min size of a position box of the position and history reports
+const int						POSITION_BOX_DETAIL = 16;					//Position boxes larger than this show crosses and numbers
 
 /* ListView sorting info to be passed to ListViewCompareFunction */
 struct lvSortInfo {
@@ -34,26 +37,6 @@ struct MonthlyDataPoint {
 	float						DailyFee;									//Total fee earned of a day
 };
 
-/*
-Description:	Convert the time stored in SYSTEMTIME to seconds
-Args:			st: A SYSTEMTIME variable
-Return:			Time value in seconds
-*/
-inline UINT ToSecond(SYSTEMTIME st) {
-	return (UINT)(st.wYear * 365 * 24 * 3600 + st.wMonth * 31 * 24 * 3600 + st.wDay * 24 * 3600 + \
-		st.wHour * 3600 + st.wMinute * 60 + st.wSecond);
-}
-
-/* Overload >= and > operator for comparing date easier */
-/* I don't need other comparison operators so I don't overload them (#^.^#) */
-inline bool operator>=(SYSTEMTIME st1, SYSTEMTIME st2) {
-	return ToSecond(st1) >= ToSecond(st2);
-}
-
-inline bool operator>(SYSTEMTIME st1, SYSTEMTIME st2) {
-	return ToSecond(st1) > ToSecond(st2);
-}
-
 /* Control bindings */
 shared_ptr<IceEncryptedFile>	LogFile;
 shared_ptr<IceToolTip>			ToolTip;
@@ -69,20 +52,25 @@ shared_ptr<IceDateTimePicker>	dtpHistoryDate, dtpHistoryTime, dtpDailyDate, dtpM
 shared_ptr<IceSlider>			sliHistoryTime;
 shared_ptr<IceTimer>			tmrRefreshTime;								//The timer refreshs system time of payment mode
 shared_ptr<IceTimer>			tmrRestoreWelcomeText;						//The timer resets welcome text of payment mode after certain seconds
+shared_ptr<IceTimer>			tmrCompaction;								//The timer finishes and starts compaction jobs of the log file
 HWND							fraPasswordFrame;							//Password frame control handle
 
 /* Position info */
-vector<UINT>					CurrParkedCars;								//Cars currently parked, index of LogFile->FileContent.LogData
-bool							ParkingPos[100] = { 0 };					//Available parking positions (true = occupied)
+IceParkedCars					ParkedCars;									//Cars currently parked by position, index of LogFile->FileContent.LogData
+IcePlateIndex					ParkedPlates;								//Car numbers of ParkedCars, rebuilt whenever ParkedCars is
+IceBayAllocator					Bays;										//Parking positions, see IceBayAllocator
+IceIntervalIndex				ParkingPeriods;								//Parking periods of the records of LogFile->FileContent.LogData, kept if Occupancy has no snapshots
+IceOccupancyHistory				Occupancy;									//Parking cars over time of the same records, for the history report, see ResetHistoryIndex()
 int								CurrSelectedPositionIndex;					//Index of log data of the selected parking position in position report
 
 /* History report related */
-LogInfo							HistoryParkedCars[100] = { 0 };				//Parked cars record for history report
+vector<LogInfo>					HistoryParkedCars;							//Parked cars record for history report, one per parking position
 int								HistoryParkedCarsCount = 0;					//Number of parked cars for history report
 int								CurrSelectedHistoryIndex;					//Index of the selected parking position in history report
 
 /* Daily report related */
 vector<DailyDataPoint>			DailyGraphDataPoints;						//Daily report graph data point info
+vector<LogInfo>					DailyReportLogs;							//Logs related to the selected date, pointed by DailyGraphDataPoints
 int								DailyEnter, DailyExit;						//Number of enter/exit cars for daily report
 int								ParkedCarsCount;							//Number of parked cars before the selected day
 float							DailyIncome;								//Income of a day for daily report
@@ -261,6 +249,43 @@ void MainWindow_Resize(int Width, int Height) {
 	}
 }
 
+/*
+Description:	Rebuild the indices of the parking cars, e.g. after logging in or changing the no. of positions
+Args:			Sessions: Indices of the records of the parking cars
+*/
+void ResetParkedCars(const vector<UINT> &Sessions) {
+	const IceRecordStore	&LogData = LogFile->FileContent.LogData;
+
+	ParkedCars.Build(LogData, Sessions, LogFile->FileContent.Capacity);
+	ParkedPlates.Build(LogData, Sessions);
+	Bays.Reset(LogFile->FileContent.Capacity);
+	for (UINT i = 0; i < Sessions.size(); i++)
+		Bays.Claim(LogData[Sessions[i]].CarPos);								//Mark the parking position as occupied
+	labPositionLeft->SetText(L"Position Left: %u", Bays.GetFreeCount());
+}
+
+/*
+Description:	Rebuild the index of the history report from all records. Only one of the snapshots and the interval
+				index is kept, the one used by dtpHistoryDate_DateTimeChanged()
+*/
+void ResetHistoryIndex() {
+	if (Occupancy.SnapshotSpacing)
+		Occupancy.Build(LogFile->FileContent.LogData);
+	else
+		ParkingPeriods.Build(LogFile->FileContent.LogData);
+}
+
+/*
+Description:	Update the index of the history report after a record is added or changed
+Args:			Index: Index of the record
+*/
+void UpdateHistoryIndex(UINT Index) {
+	if (Occupancy.SnapshotSpacing)
+		Occupancy.Update(LogFile->FileContent.LogData, Index);
+	else
+		ParkingPeriods.Update(LogFile->FileContent.LogData, Index);
+}
+
 /*
 Description:	To handle login button event
 */
@@ -281,14 +306,26 @@ void btnLogin_Click() {
 			//Redraw the window to apply new style
 			InvalidateRect(GetMainWindowHandle(), NULL, TRUE);
 
-			//Add parking cars to the list
-			for (UINT i = 0; i < LogFile->FileContent.ElementCount; i++) {
-				if (LogFile->FileContent.LogData[i].LeaveTime.wYear == 0) {			//If the car hasn't left
-					CurrParkedCars.push_back(i);										//Add it to the parked list
-					ParkingPos[LogFile->FileContent.LogData[i].CarPos] = true;			//Mark the parking position as occupied
-				}
+			//Add parking cars to the list. They are found while the log file is decrypted
+			ResetParkedCars(LogFile->OpenSessions);
+			ResetHistoryIndex();
+			tmrCompaction->SetEnabled(!LogFile->WithoutFile);						//A compaction is started by ReadFile()
+			if (LogFile->InvalidRecords) {
+				MessageBox(GetMainWindowHandle(), L"Some records of the log file are damaged and ignored.",
+					L"Warning", MB_ICONEXCLAMATION);
+			}
+			if (LogFile->TruncatedRecords) {
+				wchar_t	Message[128];
+				swprintf_s(Message, L"The end of the log file was damaged (e.g. by a power failure). %u records are removed.",
+					LogFile->TruncatedRecords);
+				MessageBox(GetMainWindowHandle(), Message, L"Warning", MB_ICONEXCLAMATION);
+			}
+			if (LogFile->DamagedRecords) {
+				wchar_t	Message[256];
+				swprintf_s(Message, L"Some blocks of the log file are damaged. %u records are skipped. "
+					L"A copy of the log file is kept as \"Log.bad\" when it is saved.", LogFile->DamagedRecords);
+				MessageBox(GetMainWindowHandle(), Message, L"Warning", MB_ICONEXCLAMATION);
 			}
-			labPositionLeft->SetText(L"Position Left: %i", 100 - CurrParkedCars.size());
 
 			//Update program status
 			CurrStatus = -1;
@@ -372,48 +409,24 @@ void btnCancelLogin_Click() {
 
 /*
 Description:	To calculate required fee with specified time info
-Args:           EnterTime: Enter time of the car
+Args:           EnterTime: Enter time of the car, see IceToEpoch()
 				LeaveTime: Leave time of the car
 				OutHourDifference: Return value of HourDifference. Default = NULL (means the value won't be returned)
-Return:			Required fee
+Return:			Required fee, in cents
 */
-float CalcFee(SYSTEMTIME *EnterTime, SYSTEMTIME *LeaveTime, int *OutHourDifference = NULL) {
+int CalcFee(LONGLONG EnterTime, LONGLONG LeaveTime, int *OutHourDifference = NULL) {
 	int			HourDifference;												//No. of hours between EnterTime and CurrTime
 
-	if (LeaveTime->wDay < EnterTime->wDay) {
-		if (LeaveTime->wMonth == 2) {											//February
-			if ((LeaveTime->wYear % 4 == 0 && LeaveTime->wYear % 100 != 0) ||
-				(LeaveTime->wYear % 400 == 0))										//For leap years, 29 days in Feb
-
-				LeaveTime->wDay += 29;
-			else																	//For normal years, 28 days in Feb
-				LeaveTime->wDay += 28;
-		}
-		else if (LeaveTime->wMonth == 5 || LeaveTime->wMonth == 7 || LeaveTime->wMonth == 10 || LeaveTime->wMonth == 12)
-			LeaveTime->wDay += 30;													//30-days months
-		else
-			LeaveTime->wDay += 31;													//31-days months
-		LeaveTime->wMonth--;													//Month reduced by 1 cuz we just added the days to wDay
-	}
-
-	if (LeaveTime->wMonth < EnterTime->wMonth) {							//Not a full year
-		LeaveTime->wMonth += 12;
-		LeaveTime->wYear--;
-	}
-
-	HourDifference = (LeaveTime->wYear - EnterTime->wYear +
-		LeaveTime->wMonth - EnterTime->wMonth +
-		LeaveTime->wDay - EnterTime->wDay) * 24 +
-		LeaveTime->wHour - EnterTime->wHour;								//Calculate date difference in hours
-	if (LeaveTime->wMinute > 0)													//Less than 1 hour = 1 hour
+	HourDifference = (int)(LeaveTime / 3600 - EnterTime / 3600);			//Calculate date difference in hours
+	if (LeaveTime % 3600 >= 60)													//Less than 1 hour = 1 hour
 		HourDifference++;
 
 	if (OutHourDifference)													//If the user wants HourDifference to be returned
 		*OutHourDifference = HourDifference;
 	if (HourDifference > 5)														//20% off for >5hrs parking
-		return (float)HourDifference * LogFile->FileContent.FeePerHour * 0.8;
+		return (int)(HourDifference * LogFile->FileContent.FeePerHour * 80 + 0.5);
 	else
-		return (float)HourDifference * LogFile->FileContent.FeePerHour;
+		return (int)(HourDifference * LogFile->FileContent.FeePerHour * 100 + 0.5);
 }
 
 /*
@@ -421,10 +434,16 @@ Description:	To handle enter & exit button event
 */
 void btnEnterOrExit_Click() {
 	wchar_t		CarNumber[20];												//Car number buffer
-	SYSTEMTIME	CurrTime = { 0 };											//Current time
-
-	GetLocalTime(&CurrTime);												//Get current system time
+	SYSTEMTIME	stCurrTime = { 0 };											//Current time
+	LONGLONG	CurrTime;
+	ULONGLONG	PackedNumber;												//Car number packed the same way as the log records
+	ULONGLONG	Ticket = 0;													//Ticket of the queued log record, 0 if nothing to wait for
+	bool		Saved;														//If the log record is on the disk
+
+	GetLocalTime(&stCurrTime);												//Get current system time
+	CurrTime = IceToEpoch(stCurrTime);
 	edCarNumber->GetText(CarNumber);
+	PackedNumber = IcePackCarNumber(CarNumber);
 
 	//Detect empty text
 	if (lstrlenW(CarNumber) == 0) {
@@ -435,50 +454,54 @@ void btnEnterOrExit_Click() {
 	}
 
 	//Determine whether the car is entering or leaving
-	for (UINT i = 0; i < CurrParkedCars.size(); i++) {						//Search for the car number in the parked cars list
-		//Matched, means the car is leaving
-		if (!lstrcmpW(CarNumber, LogFile->FileContent.LogData[CurrParkedCars[i]].CarNumber)) {
-			LogFile->FileContent.LogData[CurrParkedCars[i]].LeaveTime = CurrTime;		//Record leave time of the car
-			ParkingPos[LogFile->FileContent.LogData[CurrParkedCars[i]].CarPos] = false;	//Mark the parking position as unoccupied
-			
-			//Calculate fee when the car is leaving
-			int	HourDifference;
-			LogFile->FileContent.LogData[CurrParkedCars[i]].Fee = CalcFee(
-				&(LogFile->FileContent.LogData[CurrParkedCars[i]].EnterTime), &CurrTime, &HourDifference);
-
-			//Display parking hours and fee
-			labWelcome->SetText(L"Hours Parked: %ihr, Fee: $%.2f",
-				HourDifference, LogFile->FileContent.LogData[CurrParkedCars[i]].Fee);
-
-			CurrParkedCars.erase(CurrParkedCars.begin() + i);							//Remove the car from the parked cars list
-			LogFile->SaveFile();
-			labPositionLeft->SetText(L"Position Left: %i", 100 - CurrParkedCars.size());
-
-			//Clean the window
-			edCarNumber->SetText(L"");
-			SetFocus(edCarNumber->hWnd);
-			tmrRestoreWelcomeText->SetEnabled(true);									//Restore welcome text after few seconds
+	UINT	LogIndex;
+	if (ParkedPlates.Find(PackedNumber, LogIndex)) {						//Found in the parked cars, means the car is leaving
+		LogInfo	&Info = LogFile->FileContent.LogData[LogIndex];
+		Info.LeaveTime = CurrTime;												//Record leave time of the car
+		Bays.Release(Info.CarPos);												//Mark the parking position as unoccupied
+
+		//Calculate fee when the car is leaving
+		int	HourDifference;
+		Info.Fee = CalcFee(Info.EnterTime, CurrTime, &HourDifference);
+
+		Saved = LogFile->UpdateLog(LogIndex, &Ticket);							//Save the leave time and fee
+		ParkedPlates.Remove(PackedNumber);										//Remove the car from the parked cars list
+		ParkedCars.Remove(Info.CarPos, LogIndex);
+		UpdateHistoryIndex(LogIndex);
+		labPositionLeft->SetText(L"Position Left: %u", Bays.GetFreeCount());
+		Saved = LogFile->WaitForCommit(Ticket) && Saved;						//Open the gate after the log is saved
+
+		//Display parking hours and fee
+		if (Saved || LogFile->WithoutFile)
+			labWelcome->SetText(L"Hours Parked: %ihr, Fee: $%.2f", HourDifference, Info.Fee / 100.0);
+		else
+			labWelcome->SetText(L"Failed To Save The Log, Please Contact The Staff");
 
-			return;
-		}
+		//Clean the window
+		edCarNumber->SetText(L"");
+		SetFocus(edCarNumber->hWnd);
+		tmrRestoreWelcomeText->SetEnabled(true);								//Restore welcome text after few seconds
+
+		return;
 	}
 
 	//No matched result, means the car is entering
 	//Allocate a car position
-	bool PositionAllocated = false;											//If a position is allocated
-	for (int i = 0; i < 100; i++) {											//Find an unoccupied position
-		if (!ParkingPos[i]) {
-			ParkingPos[i] = true;												//Mark the position as occupied
-			labWelcome->SetText(L"Welcome! Your Car Position: %i", i + 1);		//Show the position for the user
-			LogFile->AddLog(CarNumber, CurrTime, { 0 }, i, 0);					//Add car enter log
-			CurrParkedCars.push_back(LogFile->FileContent.ElementCount - 1);	//Add the log index to the parked cars list
-			labPositionLeft->SetText(L"Position Left: %i", 100 - CurrParkedCars.size());
-			PositionAllocated = true;											//Mark that a position is allocated
-
-			break;
-		}
+	int Bay = Bays.Allocate();												//The free position with the smallest number
+	if (Bay != -1) {
+		Saved = LogFile->AddLog(CarNumber, CurrTime, 0, Bay, 0, &Ticket);		//Add car enter log
+		ParkedCars.Add(Bay, LogFile->FileContent.ElementCount - 1);			//Add the log index to the parked cars list
+		ParkedPlates.Insert(PackedNumber, LogFile->FileContent.ElementCount - 1);
+		UpdateHistoryIndex(LogFile->FileContent.ElementCount - 1);
+		labPositionLeft->SetText(L"Position Left: %u", Bays.GetFreeCount());
+		Saved = LogFile->WaitForCommit(Ticket) && Saved;						//Open the gate after the log is saved
+
+		if (Saved || LogFile->WithoutFile)
+			labWelcome->SetText(L"Welcome! Your Car Position: %i", Bay + 1);	//Show the position for the user
+		else
+			labWelcome->SetText(L"Failed To Save The Log, Please Contact The Staff");
 	}
-	if (!PositionAllocated)													//No position allocated (Park fulled)
+	else																	//No position allocated (Park fulled)
 		labWelcome->SetText(L"Sorry, No Position Left.");
 
 	//Clean the window
@@ -498,6 +521,20 @@ void tmrRefreshTime_Timer() {
 		st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond);
 }
 
+/*
+Description:	Finish the compaction job of the log file if it is done, and start a new one if it is due. Only done in
+				payment mode or when nothing is shown, since the log view and the reports refer to records by index
+*/
+void tmrCompaction_Timer() {
+	if (CurrStatus != 1 && CurrStatus != -1)
+		return;
+	if (LogFile->FinishCompaction(false)) {									//Records are moved out of the log file
+		ResetParkedCars(LogFile->OpenSessions);
+		ResetHistoryIndex();
+	}
+	LogFile->StartCompaction();
+}
+
 /*
 Description:	Restore welome text few seconds after a car leaves
 */
@@ -506,42 +543,64 @@ void tmrRestoreWelcomeText_Timer() {
 	tmrRestoreWelcomeText->SetEnabled(false);								//Disable the timer
 }
 
+/*
+Description:	Calculate the layout of the position boxes of the position and history reports.
+				The positions are arranged in a square grid, e.g. 10 x 10 for 100 positions
+Args:			Canvas: The report canvas
+				Columns: Variable to receive the no. of columns
+				BoxW, BoxH: Variables to receive the size of each position box
+Return:			true if the boxes are large enough to be drawn, false otherwise
+*/
+bool GetPositionGrid(const shared_ptr<IceCanvas> &Canvas, int &Columns, int &BoxW, int &BoxH) {
+	UINT	Capacity = max(Bays.GetCapacity(), 1u);
+	int		Rows;
+
+	for (Columns = 1; (UINT)Columns * Columns < Capacity; Columns++);		//Smallest square which holds all positions
+	Rows = (int)((Capacity + Columns - 1) / Columns);
+	BoxW = (Canvas->bi.bmiHeader.biWidth - 60) / 3 * 2 / Columns;
+	BoxH = (Canvas->bi.bmiHeader.biHeight - 60) / Rows;
+	return BoxW >= POSITION_BOX_MIN && BoxH >= POSITION_BOX_MIN;
+}
+
 /*
 Description:	To handle paint event of position report canvas
 */
 void PositionReportCanvas_Paint() {
-	//Calculate width and height of each position box
-	int		BoxW = (PositionReportCanvas->bi.bmiHeader.biWidth - 60) / 3 * 2 / 10,
-			BoxH = (PositionReportCanvas->bi.bmiHeader.biHeight - 60) / 10;
+	//Calculate the layout of the position boxes
+	int		Columns, BoxW, BoxH;
+	bool	Drawable = GetPositionGrid(PositionReportCanvas, Columns, BoxW, BoxH);
+	bool	Detailed = BoxW > POSITION_BOX_DETAIL && BoxH > POSITION_BOX_DETAIL;	//If the boxes are large enough for crosses and numbers
 	HBRUSH	OccupiedColor = CreateSolidBrush(RGB(240, 110, 40)),
 			UnoccupiedColor = CreateSolidBrush(RGB(225, 255, 225));
 
 	//Paint
 	RECT	BoxPos;
 	PositionReportCanvas->Cls();
-	if (BoxW > 16 && BoxH > 16) {												//Make sure the window is large enough to draw everything
-		for (int i = 0; i < 10; i++) {											//Rows
-			for (int j = 0; j < 10; j++) {											//Columns
-				BoxPos.top = 30 + i * BoxH;												//Calculate the position of box
-				BoxPos.left = 30 + j * BoxW;
-				BoxPos.right = BoxPos.left + BoxW;
-				BoxPos.bottom = BoxPos.top + BoxH;
-				
-				//Fill color for the position
-				FillRect(PositionReportCanvas->hDC, &BoxPos, UnoccupiedColor);
-
-				if (ParkingPos[i * 10 + j])	{											//Position occupied
-					//Draw occupied background with a cross
-					FillRect(PositionReportCanvas->hDC, &BoxPos, OccupiedColor);
+	if (Drawable) {																//Make sure the window is large enough to draw everything
+		for (UINT Bay = 0; Bay < Bays.GetCapacity(); Bay++) {
+			BoxPos.top = 30 + Bay / Columns * BoxH;									//Calculate the position of box
+			BoxPos.left = 30 + Bay % Columns * BoxW;
+			BoxPos.right = BoxPos.left + BoxW;
+			BoxPos.bottom = BoxPos.top + BoxH;
+
+			//Fill color for the position
+			FillRect(PositionReportCanvas->hDC, &BoxPos, UnoccupiedColor);
+
+			if (Bays.IsOccupied(Bay)) {												//Position occupied
+				//Draw occupied background with a cross
+				FillRect(PositionReportCanvas->hDC, &BoxPos, OccupiedColor);
+				if (Detailed) {
 					PositionReportCanvas->DrawLine(BoxPos.left, BoxPos.top, BoxPos.right, BoxPos.bottom);
 					PositionReportCanvas->DrawLine(BoxPos.right, BoxPos.top, BoxPos.left, BoxPos.bottom);
 				}
+			}
 
+			if (Detailed) {
 				//Draw border
 				PositionReportCanvas->DrawRect(BoxPos.left, BoxPos.top, BoxPos.right, BoxPos.bottom);
 
 				//Print number of position
-				PositionReportCanvas->Print(BoxPos.left, BoxPos.top, L"%i", i * 10 + j + 1);
+				PositionReportCanvas->Print(BoxPos.left, BoxPos.top, L"%u", Bay + 1);
 			}
 		}
 	}
@@ -556,12 +615,11 @@ Description:	To handle mouse move event of position report canvas
 Args:			X, Y: Position of cursor
 */
 void PositionReportCanvas_MouseMove(int X, int Y) {
-	//Calculate width and height of each position box
+	//Calculate the layout of the position boxes
 	int PositionAreaWidth = (PositionReportCanvas->bi.bmiHeader.biWidth - 60) / 3 * 2;
-	int BoxW = PositionAreaWidth / 10,
-		BoxH = (PositionReportCanvas->bi.bmiHeader.biHeight - 60) / 10;
+	int Columns, BoxW, BoxH;
 
-	if (BoxW <= 16 || BoxH <= 16)											//The region is too small
+	if (!GetPositionGrid(PositionReportCanvas, Columns, BoxW, BoxH))		//The region is too small
 		return;
 
 	//Calculate the car position under the cursor
@@ -569,39 +627,37 @@ void PositionReportCanvas_MouseMove(int X, int Y) {
 	int SelPosY = (Y - 30) / BoxH;
 	static int PrevPos = -1;												//Remember the previous selected car position to reduce CPU usage
 
-	if (SelPosX > 9 || SelPosY > 9 || X < 30 || Y < 30) {					//If cursor moved out of the position area
+	if (SelPosX >= Columns || X < 30 || Y < 30 ||
+		(UINT)(SelPosX + SelPosY * Columns) >= Bays.GetCapacity()) {		//If cursor moved out of the position area
 		if (PrevPos != -1) {													//If the cursor is in the position area previously
 			ToolTip->SetToolTip(PositionReportCanvas->hWnd, L"");					//Update tooltip
 			PrevPos = -1;
 			PositionReportCanvas->Print(PositionAreaWidth + 45, 30,
-				L"Occupied Positions: %i/100", CurrParkedCars.size());				//Show number of occupied positions
+				L"Occupied Positions: %u/%u", Bays.GetUsedCount(), Bays.GetCapacity());	//Show number of occupied positions
 			InvalidateRect(PositionReportCanvas->hWnd, NULL, TRUE);					//Refresh canvas
 		}
 		return;
 	}
 
-	if (SelPosX + SelPosY * 10 != PrevPos) {								//If cursor moved from one position to another
-		PrevPos = SelPosX + SelPosY * 10;										//Remember the current position
-		if (ParkingPos[PrevPos]) {												//Position occupied
+	if (SelPosX + SelPosY * Columns != PrevPos) {							//If cursor moved from one position to another
+		PrevPos = SelPosX + SelPosY * Columns;									//Remember the current position
+		CurrSelectedPositionIndex = ParkedCars.Find(PrevPos);						//Store the corresponding index of log data
+		if (CurrSelectedPositionIndex != -1) {									//Position occupied
 			ToolTip->SetToolTip(PositionReportCanvas->hWnd,
 				L"Double click to view car info");									//Update tooltip
 			PositionReportCanvas->Print(PositionAreaWidth + 45, 30,
 				L"Parking Position #%i:", PrevPos + 1);
 			PositionReportCanvas->Print(PositionAreaWidth + 45, 50,
 				L"Status: Occupied");
-			
-			//Find out the number of occupied position, which is the index of CurrParkedCars
-			int nOccupiedPos = 0;
-			for (int i = PrevPos - 1; i >= 0; i--) {
-				if (ParkingPos[i])
-					nOccupiedPos++;
-			}
-			CurrSelectedPositionIndex = CurrParkedCars[nOccupiedPos];				//Store the corresponding index of log data
+
+			wchar_t CarNumber[CAR_NUMBER_MAX + 1];
+			IceUnpackCarNumber(LogFile->FileContent.LogData[CurrSelectedPositionIndex].CarNumber, CarNumber);
 			PositionReportCanvas->Print(PositionAreaWidth + 45, 70,
-				L"Car Number: %s", LogFile->FileContent.LogData[CurrParkedCars[nOccupiedPos]].CarNumber);
-			
+				L"Car Number: %s", CarNumber);
+
 			//Show enter time & est. fee info
-			SYSTEMTIME stEnter = LogFile->FileContent.LogData[CurrParkedCars[nOccupiedPos]].EnterTime;
+			LONGLONG EnterTime = LogFile->FileContent.LogData[CurrSelectedPositionIndex].EnterTime;
+			SYSTEMTIME stEnter = IceFromEpoch(EnterTime);
 			SYSTEMTIME stNow;
 			int HourDifference;
 
@@ -610,7 +666,7 @@ void PositionReportCanvas_MouseMove(int X, int Y) {
 				stEnter.wYear, stEnter.wMonth, stEnter.wDay, stEnter.wHour, stEnter.wMinute, stEnter.wSecond);
 			GetLocalTime(&stNow);
 			PositionReportCanvas->Print(PositionAreaWidth + 45, 130,
-				L"Estimated Fee (Until Now): $%.2f", CalcFee(&stEnter, &stNow, &HourDifference));
+				L"Estimated Fee (Until Now): $%.2f", CalcFee(EnterTime, IceToEpoch(stNow), &HourDifference) / 100.0);
 			PositionReportCanvas->Print(PositionAreaWidth + 45, 110,
 				L"Hours Parked (Until Now): %i", HourDifference);
 		}
@@ -630,39 +686,41 @@ void PositionReportCanvas_MouseMove(int X, int Y) {
 Description:	To handle paint event of history report canvas
 */
 void HistoryReportCanvas_Paint() {
-	//Calculate width and height of each position box
-	int		BoxW = (HistoryReportCanvas->bi.bmiHeader.biWidth - 60) / 3 * 2 / 10,
-			BoxH = (HistoryReportCanvas->bi.bmiHeader.biHeight - 60) / 10;
+	//Calculate the layout of the position boxes
+	int		Columns, BoxW, BoxH;
+	bool	Drawable = GetPositionGrid(HistoryReportCanvas, Columns, BoxW, BoxH);
+	bool	Detailed = BoxW > POSITION_BOX_DETAIL && BoxH > POSITION_BOX_DETAIL;	//If the boxes are large enough for crosses and numbers
 	HBRUSH	OccupiedColor = CreateSolidBrush(RGB(240, 110, 40)),
 			UnoccupiedColor = CreateSolidBrush(RGB(225, 255, 225));
 
 	//Paint
 	RECT	BoxPos;
 	HistoryReportCanvas->Cls();
-	
-	if (BoxW > 16 && BoxH > 16) {												//Make sure the window is large enough to draw everything
-		for (int i = 0; i < 10; i++) {											//Rows
-			for (int j = 0; j < 10; j++) {											//Columns
-				BoxPos.top = 30 + i * BoxH;												//Calculate the position of box
-				BoxPos.left = 30 + j * BoxW;
-				BoxPos.right = BoxPos.left + BoxW;
-				BoxPos.bottom = BoxPos.top + BoxH;
-
-				//Fill color for the position
-				FillRect(HistoryReportCanvas->hDC, &BoxPos, UnoccupiedColor);
-
-				if (HistoryParkedCars[i * 10 + j].EnterTime.wYear) {					//Position occupied
-					//Draw occupied background with a cross
-					FillRect(HistoryReportCanvas->hDC, &BoxPos, OccupiedColor);
+	if (Drawable) {																//Make sure the window is large enough to draw everything
+		for (UINT Bay = 0; Bay < HistoryParkedCars.size(); Bay++) {
+			BoxPos.top = 30 + Bay / Columns * BoxH;									//Calculate the position of box
+			BoxPos.left = 30 + Bay % Columns * BoxW;
+			BoxPos.right = BoxPos.left + BoxW;
+			BoxPos.bottom = BoxPos.top + BoxH;
+
+			//Fill color for the position
+			FillRect(HistoryReportCanvas->hDC, &BoxPos, UnoccupiedColor);
+
+			if (HistoryParkedCars[Bay].EnterTime) {								//Position occupied
+				//Draw occupied background with a cross
+				FillRect(HistoryReportCanvas->hDC, &BoxPos, OccupiedColor);
+				if (Detailed) {
 					HistoryReportCanvas->DrawLine(BoxPos.left, BoxPos.top, BoxPos.right, BoxPos.bottom);
 					HistoryReportCanvas->DrawLine(BoxPos.right, BoxPos.top, BoxPos.left, BoxPos.bottom);
 				}
+			}
 
+			if (Detailed) {
 				//Draw border
 				HistoryReportCanvas->DrawRect(BoxPos.left, BoxPos.top, BoxPos.right, BoxPos.bottom);
 
 				//Print number of position
-				HistoryReportCanvas->Print(BoxPos.left, BoxPos.top, L"%i", i * 10 + j + 1);
+				HistoryReportCanvas->Print(BoxPos.left, BoxPos.top, L"%u", Bay + 1);
 			}
 		}
 	}
@@ -678,7 +736,10 @@ Description:	To handle time changed event of date/time picker of history report
 void dtpHistoryDate_DateTimeChanged() {
 	SYSTEMTIME	stSelectedTime;													//The time user selected
 	SYSTEMTIME	stTmp;															//The time of the control
+	LONGLONG	SelectedTime;
 	LogInfo		CarInfo;														//Info of current car
+	vector<LogInfo>	Logs;														//Archived logs related to the selected time
+	vector<UINT>	Sessions;													//Cars of the log file parking at the selected time
 
 	dtpHistoryDate->GetTime(&stTmp);											//Get selected date from date picker
 	stSelectedTime.wYear = stTmp.wYear;
@@ -689,16 +750,25 @@ void dtpHistoryDate_DateTimeChanged() {
 	stSelectedTime.wMinute = stTmp.wMinute;
 	stSelectedTime.wSecond = stTmp.wSecond;
 	sliHistoryTime->SetPos(stSelectedTime.wHour * 60 + stSelectedTime.wMinute);	//Set slider value
+	SelectedTime = IceToEpoch(stSelectedTime);
 
-	memset(HistoryParkedCars, 0, sizeof(LogInfo) * 100);						//Initialize history parked cars array
+	HistoryParkedCars.assign(Bays.GetCapacity(), LogInfo());					//Initialize history parked cars, one per parking position
 	HistoryParkedCarsCount = 0;													//Reset number of parked cars
-	for (UINT i = 0; i < LogFile->FileContent.ElementCount; i++) {				//Find all cars match the specified time
-		CarInfo = LogFile->FileContent.LogData[i];									//Get info of current car
+	LogFile->ReadSegments(SelectedTime, SelectedTime, Logs);					//Only archived segments overlapping the selected time are read
+	if (Occupancy.SnapshotSpacing)												//Replayed from the previous time or the nearest snapshot
+		Occupancy.Find(SelectedTime, Sessions);
+	else																		//No snapshots, looked up in the index
+		ParkingPeriods.Find(LogFile->FileContent.LogData, SelectedTime, Sessions);
+	for (UINT i = 0; i < Sessions.size(); i++)
+		Logs.push_back(LogFile->FileContent.LogData[Sessions[i]]);
+	for (UINT i = 0; i < Logs.size(); i++) {									//Find all cars match the specified time
+		CarInfo = Logs[i];															//Get info of current car
 		
 		//If Enter Time <= Selected Time <= Leave Time,
 		//the car is in the park at the specified time
-		//Note that (wYear == 0) means the car is still parking
-		if (stSelectedTime >= CarInfo.EnterTime && ((CarInfo.LeaveTime >= stSelectedTime) || (CarInfo.LeaveTime.wYear == 0))) {
+		//Note that (LeaveTime == 0) means the car is still parking
+		if (SelectedTime >= CarInfo.EnterTime && ((CarInfo.LeaveTime >= SelectedTime) || (CarInfo.LeaveTime == 0)) &&
+			CarInfo.CarPos < HistoryParkedCars.size()) {								//Positions removed since then are not shown
 			HistoryParkedCars[CarInfo.CarPos] = CarInfo;								//Record car info
 			HistoryParkedCarsCount++;													//Number of parked cars + 1
 		}
@@ -729,12 +799,11 @@ Description:	To handle mouse move event of history report canvas
 Args:			X, Y: Position of cursor
 */
 void HistoryReportCanvas_MouseMove(int X, int Y) {
-	//Calculate width and height of each position box
+	//Calculate the layout of the position boxes
 	int HistoryAreaWidth = (HistoryReportCanvas->bi.bmiHeader.biWidth - 60) / 3 * 2;
-	int BoxW = HistoryAreaWidth / 10,
-		BoxH = (HistoryReportCanvas->bi.bmiHeader.biHeight - 60) / 10;
+	int Columns, BoxW, BoxH;
 
-	if (BoxW <= 16 || BoxH <= 16)											//The region is too small
+	if (!GetPositionGrid(HistoryReportCanvas, Columns, BoxW, BoxH))			//The region is too small
 		return;
 
 	//Calculate the car position under the cursor
@@ -742,54 +811,51 @@ void HistoryReportCanvas_MouseMove(int X, int Y) {
 	int SelPosY = (Y - 30) / BoxH;
 	static int PrevPos = -2;												//Remember the previous selected car position to reduce CPU usage
 
-	if (SelPosX > 9 || SelPosY > 9 || X < 30 || Y < 30) {					//If cursor moved out of the position area
+	if (SelPosX >= Columns || X < 30 || Y < 30 ||
+		(UINT)(SelPosX + SelPosY * Columns) >= HistoryParkedCars.size()) {	//If cursor moved out of the position area
 		if (PrevPos != -1) {													//If the cursor is in the position area previously
 			ToolTip->SetToolTip(HistoryReportCanvas->hWnd, L"");					//Update tooltip
 			PrevPos = -1;
 			HistoryReportCanvas->Print(HistoryAreaWidth + 45, 120,
-				L"Occupied Positions: %i/100", HistoryParkedCarsCount);				//Show number of occupied positions
+				L"Occupied Positions: %i/%u", HistoryParkedCarsCount, Bays.GetCapacity());	//Show number of occupied positions
 			InvalidateRect(HistoryReportCanvas->hWnd, NULL, TRUE);					//Refresh canvas
 			InvalidateRect(FindWindowEx(dtpHistoryTime->hWnd, NULL, L"msctls_updown32", NULL), NULL, TRUE);
 		}
 		return;
 	}
 
-	if (SelPosX + SelPosY * 10 != PrevPos) {								//If cursor moved from one position to another
-		PrevPos = SelPosX + SelPosY * 10;										//Remember the current position
+	if (SelPosX + SelPosY * Columns != PrevPos) {							//If cursor moved from one position to another
+		PrevPos = SelPosX + SelPosY * Columns;									//Remember the current position
 		CurrSelectedHistoryIndex = PrevPos;										//Store the current selected position
-		if (HistoryParkedCars[PrevPos].EnterTime.wYear) {						//Position occupied
+		if (HistoryParkedCars[PrevPos].EnterTime) {								//Position occupied
 			ToolTip->SetToolTip(HistoryReportCanvas->hWnd,
 				L"Double click to view car info");									//Update tooltip
 			HistoryReportCanvas->Print(HistoryAreaWidth + 45, 120,
 				L"Parking Position #%i:", PrevPos + 1);
 			HistoryReportCanvas->Print(HistoryAreaWidth + 45, 140,
 				L"Status: Occupied");
-
-			//Find out the number of occupied position, which is the index of CurrParkedCars
-			int nOccupiedPos = 0;
-			for (int i = PrevPos - 1; i >= 0; i--) {
-				if (ParkingPos[i])
-					nOccupiedPos++;
-			}
+			wchar_t CarNumber[CAR_NUMBER_MAX + 1];
+			IceUnpackCarNumber(HistoryParkedCars[PrevPos].CarNumber, CarNumber);
 			HistoryReportCanvas->Print(HistoryAreaWidth + 45, 160,
-				L"Car Number: %s", HistoryParkedCars[PrevPos].CarNumber);
+				L"Car Number: %s", CarNumber);
 
 			//Show enter time
-			SYSTEMTIME stEnter = HistoryParkedCars[PrevPos].EnterTime;
+			SYSTEMTIME stEnter = IceFromEpoch(HistoryParkedCars[PrevPos].EnterTime);
 			HistoryReportCanvas->Print(HistoryAreaWidth + 45, 180,
 				L"Enter Time: %04u-%02u-%02u %02u:%02u:%02u",
 				stEnter.wYear, stEnter.wMonth, stEnter.wDay, stEnter.wHour, stEnter.wMinute, stEnter.wSecond);
 
 			//Show leave date and fee if the car has left
-			if (HistoryParkedCars[PrevPos].LeaveTime.wYear) {						//The car has left
-				SYSTEMTIME	stLeave = HistoryParkedCars[PrevPos].LeaveTime;
+			if (HistoryParkedCars[PrevPos].LeaveTime) {								//The car has left
+				SYSTEMTIME	stLeave = IceFromEpoch(HistoryParkedCars[PrevPos].LeaveTime);
 				int			HoursParked;
 
 				HistoryReportCanvas->Print(HistoryAreaWidth + 45, 200,
 					L"Leave Time: %04u-%02u-%02u %02u:%02u:%02u",
 					stLeave.wYear, stLeave.wMonth, stLeave.wDay, stLeave.wHour, stLeave.wMinute, stLeave.wSecond);
 				HistoryReportCanvas->Print(HistoryAreaWidth + 45, 240,
-					L"Fee Paid: $%.2f", CalcFee(&stEnter, &stLeave, &HoursParked));
+					L"Fee Paid: $%.2f", CalcFee(HistoryParkedCars[PrevPos].EnterTime,
+					HistoryParkedCars[PrevPos].LeaveTime, &HoursParked) / 100.0);
 				HistoryReportCanvas->Print(HistoryAreaWidth + 45, 220,
 					L"Hours Parked: %i", HoursParked);
 			}
@@ -887,6 +953,7 @@ Description:	To handle date changed event of date picker of daily report
 */
 void dtpDailyDate_DateTimeChanged() {
 	SYSTEMTIME		stSelectedTime;												//The time user selected
+	LONGLONG		DayStart, DayEnd;											//Beginning of the selected date and the next date
 	LogInfo			*lpCurrLog;													//Pointer to current log
 	DailyDataPoint	DataPointInfo;												//Data point info of a specific event (enter/exit)
 	int				CurrParkedCarsCount;										//Number of parked cars at a certain data point
@@ -899,47 +966,40 @@ void dtpDailyDate_DateTimeChanged() {
 	dtpDailyDate->GetTime(&stSelectedTime);										//Get selected date from date picker
 
 	stSelectedTime.wHour = stSelectedTime.wSecond = stSelectedTime.wMinute = 0;	//Before the selected date
-	for (i = 0; i < LogFile->FileContent.ElementCount; i++) {					//Calculate parked cars before the selected date
-		lpCurrLog = &(LogFile->FileContent.LogData[i]);								//Get a pointer to current log info
-		if (stSelectedTime > lpCurrLog->EnterTime)									//Count number of parked cars before the seleced date
+	DayStart = IceToEpoch(stSelectedTime);
+	DayEnd = DayStart + 24 * 3600;
+	LogFile->ReadRange(DayStart, DayEnd - 1, DailyReportLogs);					//Only archived segments overlapping the selected date are read
+	for (i = 0; i < DailyReportLogs.size(); i++) {								//Calculate parked cars before the selected date
+		lpCurrLog = &DailyReportLogs[i];											//Get a pointer to current log info
+		if (DayStart > lpCurrLog->EnterTime)										//Count number of parked cars before the seleced date
 			ParkedCarsCount++;
-		if (stSelectedTime > lpCurrLog->LeaveTime) {
-			if (lpCurrLog->LeaveTime.wYear != 0)
-				ParkedCarsCount--;
-		}
+		if (DayStart > lpCurrLog->LeaveTime && lpCurrLog->LeaveTime != 0)
+			ParkedCarsCount--;
 	}
 	CurrParkedCarsCount = ParkedCarsCount;
 
-	stSelectedTime.wHour = 23;													//Before the next day
-	stSelectedTime.wSecond = stSelectedTime.wMinute = 59;
-	for (i = 0; i < LogFile->FileContent.ElementCount; i++) {
-		lpCurrLog = &(LogFile->FileContent.LogData[i]);								//Get a pointer to current log info
+	for (i = 0; i < DailyReportLogs.size(); i++) {
+		lpCurrLog = &DailyReportLogs[i];											//Get a pointer to current log info
 		DataPointInfo.lpLogInfo = lpCurrLog;										//Set log info pointer of data point info
 		
-		if (lpCurrLog->EnterTime.wYear == stSelectedTime.wYear &&
-			lpCurrLog->EnterTime.wMonth == stSelectedTime.wMonth &&
-			lpCurrLog->EnterTime.wDay == stSelectedTime.wDay) {						//The car entered in the specified date
-
+		if (lpCurrLog->EnterTime >= DayStart && lpCurrLog->EnterTime < DayEnd) {	//The car entered in the specified date
 			DailyEnter++;
 			CurrParkedCarsCount++;
 
 			//Add data point
-			DataPointInfo.Hour = lpCurrLog->EnterTime.wHour + (float)lpCurrLog->EnterTime.wMinute / 60;
+			DataPointInfo.Hour = (float)((lpCurrLog->EnterTime - DayStart) / 60) / 60;
 			DataPointInfo.Enter = true;
 			DataPointInfo.Value = CurrParkedCarsCount;									//Record number of cars
 			DailyGraphDataPoints.push_back(DataPointInfo);
 		}
-		if (lpCurrLog->LeaveTime.wYear == stSelectedTime.wYear &&
-			lpCurrLog->LeaveTime.wMonth == stSelectedTime.wMonth &&
-			lpCurrLog->LeaveTime.wDay == stSelectedTime.wDay) {						//The car left in the specified date
-
+		if (lpCurrLog->LeaveTime >= DayStart && lpCurrLog->LeaveTime < DayEnd) {	//The car left in the specified date
 			DailyExit++;
 			CurrParkedCarsCount--;
 			DataPointInfo.Value = CurrParkedCarsCount;									//Record number of cars
-			DailyIncome += lpCurrLog->Fee;
+			DailyIncome += lpCurrLog->Fee / 100.0f;
 
 			//Add data point
-			DataPointInfo.Hour = lpCurrLog->LeaveTime.wHour + (float)lpCurrLog->LeaveTime.wMinute / 60;
+			DataPointInfo.Hour = (float)((lpCurrLog->LeaveTime - DayStart) / 60) / 60;
 			DataPointInfo.Enter = false;
 			DailyGraphDataPoints.push_back(DataPointInfo);
 		}
@@ -1014,26 +1074,29 @@ void DailyReportCanvas_MouseMove(int X, int Y) {
 		DailyReportCanvas->Print(GRAPH_MARGIN, GraphH + GRAPH_MARGIN + 70, L"Cars Left Today: %i", DailyExit);
 		DailyReportCanvas->Print(GRAPH_MARGIN, GraphH + GRAPH_MARGIN + 90, L"Daily Income: $%.2f", DailyIncome);
 		DailyReportCanvas->Print(GRAPH_MARGIN, GraphH + GRAPH_MARGIN + 110, L"No. of Cars in the park: %i", DailyGraphDataPoints[MinSpaceIndex].Value);
+		SYSTEMTIME	stEnter = IceFromEpoch(lpLogInfo->EnterTime), stLeave = IceFromEpoch(lpLogInfo->LeaveTime);
+		wchar_t		CarNumber[CAR_NUMBER_MAX + 1];
 		if (DailyGraphDataPoints[MinSpaceIndex].Enter) {							//If the record is 'Enter'
 			DailyReportCanvas->Print(GRAPH_MARGIN + 200, GraphH + GRAPH_MARGIN + 50, L"Event: %s", L"Car Entered");
 			DailyReportCanvas->Print(GRAPH_MARGIN, GraphH + GRAPH_MARGIN + 130, L"Time: %02u:%02u:%02u",
-				lpLogInfo->EnterTime.wHour, lpLogInfo->EnterTime.wMinute, lpLogInfo->EnterTime.wSecond);
+				stEnter.wHour, stEnter.wMinute, stEnter.wSecond);
 		}
 		else {																		//If the record is 'Leave'
 			DailyReportCanvas->Print(GRAPH_MARGIN + 200, GraphH + GRAPH_MARGIN + 50, L"Event: %s", L"Car Left");
 			DailyReportCanvas->Print(GRAPH_MARGIN, GraphH + GRAPH_MARGIN + 130, L"Time: %02u:%02u:%02u",
-				lpLogInfo->LeaveTime.wHour, lpLogInfo->LeaveTime.wMinute, lpLogInfo->LeaveTime.wSecond);
+				stLeave.wHour, stLeave.wMinute, stLeave.wSecond);
 		}
-		DailyReportCanvas->Print(GRAPH_MARGIN + 200, GraphH + GRAPH_MARGIN + 70, L"Car Number: %s", lpLogInfo->CarNumber);
-		if (lpLogInfo->LeaveTime.wYear) {											//If the car has left
+		IceUnpackCarNumber(lpLogInfo->CarNumber, CarNumber);
+		DailyReportCanvas->Print(GRAPH_MARGIN + 200, GraphH + GRAPH_MARGIN + 70, L"Car Number: %s", CarNumber);
+		if (lpLogInfo->LeaveTime) {													//If the car has left
 			int	HoursParked;
 
 			DailyReportCanvas->Print(GRAPH_MARGIN + 200, GraphH + GRAPH_MARGIN + 90,
 				L"Car Leave Time: %04u-%02u-%02u %02u:%02u:%02u",
-				lpLogInfo->LeaveTime.wYear, lpLogInfo->LeaveTime.wMonth, lpLogInfo->LeaveTime.wDay,
-				lpLogInfo->LeaveTime.wHour, lpLogInfo->LeaveTime.wMinute, lpLogInfo->LeaveTime.wSecond);
+				stLeave.wYear, stLeave.wMonth, stLeave.wDay,
+				stLeave.wHour, stLeave.wMinute, stLeave.wSecond);
 			DailyReportCanvas->Print(GRAPH_MARGIN + 200, GraphH + GRAPH_MARGIN + 130,
-				L"Fee Paid: $%.2f", CalcFee(&(lpLogInfo->EnterTime), &(lpLogInfo->LeaveTime), &HoursParked));
+				L"Fee Paid: $%.2f", CalcFee(lpLogInfo->EnterTime, lpLogInfo->LeaveTime, &HoursParked) / 100.0);
 			DailyReportCanvas->Print(GRAPH_MARGIN + 200, GraphH + GRAPH_MARGIN + 110,
 				L"Hours Parked: %i", HoursParked);
 		}
@@ -1107,6 +1170,9 @@ Description:	To handle date changed event of date picker of monthly report
 */
 void dtpMonthlyDate_DateTimeChanged() {
 	SYSTEMTIME			stSelectedTime;											//The time user selected
+	LONGLONG			MonthStart, MonthEnd;									//Beginning of the selected month and the next month
+	vector<LogInfo>		Logs;													//Logs related to the selected month
+	vector<DailySummary>	Summaries;											//Daily summaries of the selected month
 	int					MonthDays;												//Number of days in the specific month
 	LogInfo				*lpCurrLog;												//Pointer to current log
 	int					i;														//For-control
@@ -1140,34 +1206,39 @@ void dtpMonthlyDate_DateTimeChanged() {
 
 	stSelectedTime.wDay = 1;
 	stSelectedTime.wHour = stSelectedTime.wSecond = stSelectedTime.wMinute = 0;	//Before the selected date
-	for (i = 0; i < LogFile->FileContent.ElementCount; i++) {					//Calculate parked cars before the selected date
-		lpCurrLog = &(LogFile->FileContent.LogData[i]);								//Get a pointer to current log info
-		if (stSelectedTime > lpCurrLog->EnterTime)									//Count number of parked cars before the seleced date
-			CurrParkedCarsCount++;
-		if (stSelectedTime > lpCurrLog->LeaveTime) {
-			if (lpCurrLog->LeaveTime.wYear != 0)
-				CurrParkedCarsCount--;
+	MonthStart = IceToEpoch(stSelectedTime);
+	MonthEnd = MonthStart + MonthDays * 24 * 3600;
+	if (LogFile->ReadSummaries(MonthStart, MonthEnd, Summaries)) {				//Archived month, the segments are not read
+		CurrParkedCarsCount = Summaries[0].ClosingOccupancy - Summaries[0].Enters + Summaries[0].Exits;
+		for (i = 0; i < MonthDays; i++) {
+			MonthlyEnter += Summaries[i].Enters;
+			MonthlyExit += Summaries[i].Exits;
+			MonthlyGraphDataPoints[i].DailyEnter = Summaries[i].Enters;
+			MonthlyGraphDataPoints[i].DailyExit = Summaries[i].Exits;
+			MonthlyGraphDataPoints[i].DailyFee = Summaries[i].Income / 100.0f;
 		}
 	}
+	else
+		LogFile->ReadRange(MonthStart, MonthEnd - 1, Logs);						//Only archived segments overlapping the selected month are read
+	for (i = 0; i < Logs.size(); i++) {											//Calculate parked cars before the selected date
+		lpCurrLog = &Logs[i];														//Get a pointer to current log info
+		if (MonthStart > lpCurrLog->EnterTime)										//Count number of parked cars before the seleced date
+			CurrParkedCarsCount++;
+		if (MonthStart > lpCurrLog->LeaveTime && lpCurrLog->LeaveTime != 0)
+			CurrParkedCarsCount--;
+	}
 
-	stSelectedTime.wDay = MonthDays;											//Before next month
-	stSelectedTime.wHour = 23;
-	stSelectedTime.wSecond = stSelectedTime.wMinute = 59;
-	for (i = 0; i < LogFile->FileContent.ElementCount; i++) {
-		lpCurrLog = &(LogFile->FileContent.LogData[i]);								//Get a pointer to current log info
-
-		if (lpCurrLog->EnterTime.wYear == stSelectedTime.wYear &&
-			lpCurrLog->EnterTime.wMonth == stSelectedTime.wMonth) {					//The car entered in the specified month
+	for (i = 0; i < Logs.size(); i++) {
+		lpCurrLog = &Logs[i];														//Get a pointer to current log info
 
+		if (lpCurrLog->EnterTime >= MonthStart && lpCurrLog->EnterTime < MonthEnd) {	//The car entered in the specified month
 			MonthlyEnter++;
-			MonthlyGraphDataPoints[lpCurrLog->EnterTime.wDay - 1].DailyEnter++;
+			MonthlyGraphDataPoints[(lpCurrLog->EnterTime - MonthStart) / (24 * 3600)].DailyEnter++;
 		}
-		if (lpCurrLog->LeaveTime.wYear == stSelectedTime.wYear &&
-			lpCurrLog->LeaveTime.wMonth == stSelectedTime.wMonth) {					//The car left in the specified month
-
+		if (lpCurrLog->LeaveTime >= MonthStart && lpCurrLog->LeaveTime < MonthEnd) {	//The car left in the specified month
 			MonthlyExit++;
-			MonthlyGraphDataPoints[lpCurrLog->EnterTime.wDay - 1].DailyExit++;
-			MonthlyGraphDataPoints[lpCurrLog->EnterTime.wDay - 1].DailyFee += lpCurrLog->Fee;
+			MonthlyGraphDataPoints[(lpCurrLog->LeaveTime - MonthStart) / (24 * 3600)].DailyExit++;
+			MonthlyGraphDataPoints[(lpCurrLog->LeaveTime - MonthStart) / (24 * 3600)].DailyFee += lpCurrLog->Fee / 100.0f;
 		}
 	}
 
@@ -1337,7 +1408,7 @@ void tabReport_TabSelected() {
 		dtpHistoryDate_DateTimeChanged();
 		HistoryReportCanvas_Paint();											//Invoke canvas redraw
 		HistoryReportCanvas->Print((HistoryReportCanvas->bi.bmiHeader.biWidth - 60) / 3 * 2 + 45, 120,
-			L"Occupied Positions: %i/100", HistoryParkedCarsCount);				//Show number of occupied positions
+			L"Occupied Positions: %i/%u", HistoryParkedCarsCount, Bays.GetCapacity());				//Show number of occupied positions
 		InvalidateRect(HistoryReportCanvas->hWnd, NULL, TRUE);					//Refresh canvas
 		InvalidateRect(FindWindowEx(dtpHistoryTime->hWnd, NULL, L"msctls_updown32", NULL), NULL, TRUE);
 		break;
@@ -1421,7 +1492,8 @@ void PositionReportCanvas_DoubleClick() {
 Description:	To handle double click event of history report canvas
 */
 void HistoryReportCanvas_DoubleClick() {
-	if (HistoryParkedCars[CurrSelectedHistoryIndex].EnterTime.wYear) {		//If the position is occupied
+	if ((UINT)CurrSelectedHistoryIndex < HistoryParkedCars.size() &&
+		HistoryParkedCars[CurrSelectedHistoryIndex].EnterTime) {					//If the position is occupied
 		for (int i = 0; i < LogFile->FileContent.ElementCount; i++) {			//Search for the corresponding record
 			//The memory matches means two records are corresponding
 			if (!memcmp(&(LogFile->FileContent.LogData[i]), &HistoryParkedCars[CurrSelectedHistoryIndex], sizeof(LogInfo))) {
@@ -1453,6 +1525,7 @@ void btnSearch_Click() {
 	int			SearchParkHours;													//Park hours to compare with
 	char		ParkHourCmpMode = comSearchCompare->GetSelItem();					//Get parking hours comparison mode
 	SYSTEMTIME	stSearchDateAfter, stSearchDateBefore, stCurrDate;					//Dates to compare with
+	LONGLONG	DateAfter = 0, DateBefore = 0, CurrDate;
 	bool		Matched;															//If the current log matches search criteria
 
 	//Check for incomplete/invalid info
@@ -1478,29 +1551,43 @@ void btnSearch_Click() {
 		if (lstrlenW(SearchString) <= 0) {												//Check if a car number is given
 			edSearchCarNumber->SetText(L"*");
 		}
+		CharUpperW(SearchString);														//Packed car numbers are unpacked in upper case
 	}
-	if (SearchDateBefore)
+	if (SearchDateBefore) {
 		dtpSearchBeforeDate->GetTime(&stSearchDateBefore);
-	if (SearchDateAfter)
+		DateBefore = IceToEpoch(stSearchDateBefore);
+	}
+	if (SearchDateAfter) {
 		dtpSearchAfterDate->GetTime(&stSearchDateAfter);
+		DateAfter = IceToEpoch(stSearchDateAfter);
+	}
 	
 	//Search for items that matches all criteria
 	LogInfo		*lpLogInfo;
 	int			ParkedHours, ItemIndex = 0;
+	wchar_t		CarNumber[CAR_NUMBER_MAX + 1];										//Unpacked car number of current log
+	LONGLONG	RangeFrom = 0, RangeTo = MAXLONGLONG;								//Period of the records to search in, all records by default
+	vector<LogInfo>	Logs;															//Records to search in
 
 	lvSearch->DeleteAllItems();														//Delete all items in the listview
 	GetLocalTime(&stCurrDate);														//Get current system date
-	for (UINT i = 0; i < LogFile->FileContent.ElementCount; i++) {
-		lpLogInfo = &(LogFile->FileContent.LogData[i]);									//Get a pointer to current log info
+	CurrDate = IceToEpoch(stCurrDate);
+	if (SearchDateBefore)																//Cars entered before the date can't be in a segment that begins after it
+		RangeTo = DateBefore;
+	if (SearchDateAfter)																//Cars entered after the date can't be in a segment that ends before it
+		RangeFrom = DateAfter;
+	LogFile->ReadRange(RangeFrom, RangeTo, Logs);
+	for (UINT i = 0; i < Logs.size(); i++) {
+		lpLogInfo = &Logs[i];															//Get a pointer to current log info
 		Matched = true;
 		if (SearchHour) {																//Searching by parking hours
 			//If the car has left, parked hours = LeaveTime - EnterTime;
 			//If the car is still parking, parked hours = CurrentTime - EnterTime
-			//Note that (LeaveTime.wYear == 0) means the car is still parking
-			if (lpLogInfo->LeaveTime.wYear)
-				CalcFee(&lpLogInfo->EnterTime, &lpLogInfo->LeaveTime, &ParkedHours);
+			//Note that (LeaveTime == 0) means the car is still parking
+			if (lpLogInfo->LeaveTime)
+				CalcFee(lpLogInfo->EnterTime, lpLogInfo->LeaveTime, &ParkedHours);
 			else
-				CalcFee(&lpLogInfo->EnterTime, &stCurrDate, &ParkedHours);
+				CalcFee(lpLogInfo->EnterTime, CurrDate, &ParkedHours);
 
 			switch (ParkHourCmpMode) {														//Check comparison mode
 			case 0:																			//>
@@ -1520,11 +1607,11 @@ void btnSearch_Click() {
 			}
 		}
 		if (SearchDateBefore) {															//Search for date before the specified date
-			if (!(stSearchDateBefore > lpLogInfo->EnterTime))
+			if (!(DateBefore > lpLogInfo->EnterTime))
 				Matched = false;
 		}
 		if (SearchDateAfter) {															//Search for date after the specified date
-			if (!(lpLogInfo->EnterTime > stSearchDateAfter))
+			if (!(lpLogInfo->EnterTime > DateAfter))
 				Matched = false;
 		}
 		if (SearchCarNumber) {															//Searching by car numbers
@@ -1535,10 +1622,11 @@ void btnSearch_Click() {
 				* : Anything of any length
 			*/
 			int	CompPos = 0;																//Comparison position of car number string
+			IceUnpackCarNumber(lpLogInfo->CarNumber, CarNumber);
 			for (int j = 0; j < lstrlenW(SearchString); j++, CompPos++) {
 				if (!Matched)
 					break;
-				if (CompPos > lstrlenW(lpLogInfo->CarNumber)) {
+				if (CompPos > lstrlenW(CarNumber)) {
 					Matched = false;
 					break;
 				}
@@ -1547,12 +1635,12 @@ void btnSearch_Click() {
 					break;
 
 				case '#':																		//Check if the character is a number
-					if (lpLogInfo->CarNumber[CompPos] < '0' || '9' < lpLogInfo->CarNumber[CompPos])
+					if (CarNumber[CompPos] < '0' || '9' < CarNumber[CompPos])
 						Matched = false;
 					break;
 
 				case '@':																		//Check if the character is a letter
-					if (lpLogInfo->CarNumber[CompPos] < 'A' || 'Z' < lpLogInfo->CarNumber[CompPos])
+					if (CarNumber[CompPos] < 'A' || 'Z' < CarNumber[CompPos])
 						Matched = false;
 					break;
 
@@ -1561,7 +1649,7 @@ void btnSearch_Click() {
 						int		k;
 						bool	NextCharacterMatched = false;
 
-						for (k = CompPos + 1; k < lstrlenW(lpLogInfo->CarNumber); k++) {				//Match for next character
+						for (k = CompPos + 1; k < lstrlenW(CarNumber); k++) {				//Match for next character
 							//CompPos = k : Change CompPos to the matched position of the next character
 							//j++ : Move to the next searching character
 							if (NextCharacterMatched)														//Character matched, exit the loop to match next character
@@ -1575,7 +1663,7 @@ void btnSearch_Click() {
 								break;
 
 							case '#':
-								if (lpLogInfo->CarNumber[k] >= '0' && '9' >= lpLogInfo->CarNumber[k]) {
+								if (CarNumber[k] >= '0' && '9' >= CarNumber[k]) {
 									CompPos = k;
 									j++;
 									NextCharacterMatched = true;
@@ -1583,7 +1671,7 @@ void btnSearch_Click() {
 								break;
 
 							case '@':
-								if (lpLogInfo->CarNumber[k] >= 'A' && 'Z' >= lpLogInfo->CarNumber[k]) {
+								if (CarNumber[k] >= 'A' && 'Z' >= CarNumber[k]) {
 									CompPos = k;
 									j++;
 									NextCharacterMatched = true;
@@ -1591,7 +1679,7 @@ void btnSearch_Click() {
 								break;
 
 							default:
-								if (lpLogInfo->CarNumber[k] == SearchString[j + 1]) {
+								if (CarNumber[k] == SearchString[j + 1]) {
 									CompPos = k;
 									j++;
 									NextCharacterMatched = true;
@@ -1599,13 +1687,13 @@ void btnSearch_Click() {
 								break;
 							}
 						}
-						if (k > lstrlenW(lpLogInfo->CarNumber))											//Failed to match next character
+						if (k > lstrlenW(CarNumber))											//Failed to match next character
 							Matched = false;
 					}
 					break;
 
 				default:																		//Check if the character is the same
-					if (lpLogInfo->CarNumber[CompPos] != SearchString[j])
+					if (CarNumber[CompPos] != SearchString[j])
 						Matched = false;
 					break;
 				}
@@ -1618,21 +1706,24 @@ void btnSearch_Click() {
 			lvSearch->AddItem(L"%i", -1, ItemIndex + 1);
 
 			//Car number
-			lvSearch->SetItemText(ItemIndex, lpLogInfo->CarNumber, 1);
+			IceUnpackCarNumber(lpLogInfo->CarNumber, CarNumber);
+			lvSearch->SetItemText(ItemIndex, CarNumber, 1);
 
 			//Enter time
+			SYSTEMTIME	stEnter = IceFromEpoch(lpLogInfo->EnterTime);
 			lvSearch->SetItemText(ItemIndex, L"%04u-%02u-%02u %02u:%02u:%02u", 2,
-				lpLogInfo->EnterTime.wYear, lpLogInfo->EnterTime.wMonth, lpLogInfo->EnterTime.wDay,
-				lpLogInfo->EnterTime.wHour, lpLogInfo->EnterTime.wMinute, lpLogInfo->EnterTime.wSecond);
+				stEnter.wYear, stEnter.wMonth, stEnter.wDay,
+				stEnter.wHour, stEnter.wMinute, stEnter.wSecond);
 
-			if (lpLogInfo->LeaveTime.wYear) {												//The car has left
+			if (lpLogInfo->LeaveTime) {														//The car has left
 				//Leave time
+				SYSTEMTIME	stLeave = IceFromEpoch(lpLogInfo->LeaveTime);
 				lvSearch->SetItemText(ItemIndex, L"%04u-%02u-%02u %02u:%02u:%02u", 3,
-					lpLogInfo->LeaveTime.wYear, lpLogInfo->LeaveTime.wMonth, lpLogInfo->LeaveTime.wDay,
-					lpLogInfo->LeaveTime.wHour, lpLogInfo->LeaveTime.wMinute, lpLogInfo->LeaveTime.wSecond);
+					stLeave.wYear, stLeave.wMonth, stLeave.wDay,
+					stLeave.wHour, stLeave.wMinute, stLeave.wSecond);
 
 				//Fee
-				lvSearch->SetItemText(ItemIndex, L"$%.2f", 5, lpLogInfo->Fee);
+				lvSearch->SetItemText(ItemIndex, L"$%.2f", 5, lpLogInfo->Fee / 100.0);
 			}
 			else																			//The car is still parking
 				lvSearch->SetItemText(ItemIndex, L"Still Parking", 3);
@@ -1738,6 +1829,7 @@ void MainWindow_Create(HWND hWnd) {
 	btnEnterOrExit = make_shared<IceButton>(hWnd, IDC_ENTEROREXITBUTTON, btnEnterOrExit_Click);
 	tmrRefreshTime = make_shared<IceTimer>(1000, tmrRefreshTime_Timer, true);
 	tmrRestoreWelcomeText = make_shared<IceTimer>(5000, tmrRestoreWelcomeText_Timer, false);
+	tmrCompaction = make_shared<IceTimer>(COMPACTION_INTERVAL, tmrCompaction_Timer, false);
 	dtpHistoryDate = make_shared<IceDateTimePicker>(hWnd, IDC_HISTORYDATEPICKER, dtpHistoryDate_DateTimeChanged);
 	dtpHistoryTime = make_shared<IceDateTimePicker>(hWnd, IDC_HISTORYTIMEPICKER, dtpHistoryDate_DateTimeChanged);
 	dtpDailyDate = make_shared<IceDateTimePicker>(hWnd, IDC_DAILYDATEPICKER, dtpDailyDate_DateTimeChanged);
@@ -1914,35 +2006,33 @@ void mnuEnterPaymentMode_Click() {
 Description:	To handle show Log menu event
 */
 void mnuLog_Click() {
+	wchar_t		CarNumber[CAR_NUMBER_MAX + 1];								//Unpacked car number
+	SYSTEMTIME	stEnter, stLeave;
+
 	lvLog->DeleteAllItems();												//Clear log listview
 	for (UINT i = 0; i < LogFile->FileContent.ElementCount; i++) {			//Add all log info to the listview
 		//Index
 		lvLog->AddItem(L"%i", -1, i + 1);
 
 		//Car number
-		lvLog->SetItemText(i, LogFile->FileContent.LogData[i].CarNumber, 1);
+		IceUnpackCarNumber(LogFile->FileContent.LogData[i].CarNumber, CarNumber);
+		lvLog->SetItemText(i, CarNumber, 1);
 
 		//Enter time
+		stEnter = IceFromEpoch(LogFile->FileContent.LogData[i].EnterTime);
 		lvLog->SetItemText(i, L"%04u-%02u-%02u %02u:%02u:%02u", 2,
-			LogFile->FileContent.LogData[i].EnterTime.wYear,
-			LogFile->FileContent.LogData[i].EnterTime.wMonth,
-			LogFile->FileContent.LogData[i].EnterTime.wDay,
-			LogFile->FileContent.LogData[i].EnterTime.wHour,
-			LogFile->FileContent.LogData[i].EnterTime.wMinute,
-			LogFile->FileContent.LogData[i].EnterTime.wSecond);
-
-		if (LogFile->FileContent.LogData[i].LeaveTime.wYear) {					//The car has left
+			stEnter.wYear, stEnter.wMonth, stEnter.wDay,
+			stEnter.wHour, stEnter.wMinute, stEnter.wSecond);
+
+		if (LogFile->FileContent.LogData[i].LeaveTime) {						//The car has left
 			//Leave time
+			stLeave = IceFromEpoch(LogFile->FileContent.LogData[i].LeaveTime);
 			lvLog->SetItemText(i, L"%04u-%02u-%02u %02u:%02u:%02u", 3,
-				LogFile->FileContent.LogData[i].LeaveTime.wYear,
-				LogFile->FileContent.LogData[i].LeaveTime.wMonth,
-				LogFile->FileContent.LogData[i].LeaveTime.wDay,
-				LogFile->FileContent.LogData[i].LeaveTime.wHour,
-				LogFile->FileContent.LogData[i].LeaveTime.wMinute,
-				LogFile->FileContent.LogData[i].LeaveTime.wSecond);
+				stLeave.wYear, stLeave.wMonth, stLeave.wDay,
+				stLeave.wHour, stLeave.wMinute, stLeave.wSecond);
 
 			//Fee
-			lvLog->SetItemText(i, L"$%.2f", 5, LogFile->FileContent.LogData[i].Fee);
+			lvLog->SetItemText(i, L"$%.2f", 5, LogFile->FileContent.LogData[i].Fee / 100.0);
 		}
 		else																	//The car is still parking
 			lvLog->SetItemText(i, L"Still Parking", 3);
@@ -2036,6 +2126,23 @@ void mnuHowToUse_Click() {
 	MessageBox(GetMainWindowHandle(), L"Use with your brain and hands.", L"How to Use", MB_ICONINFORMATION);
 }
 
+/*
+Description:	Change the no. of parking positions
+Args:			Capacity: The new no. of positions, PARKING_MIN_CAPACITY ~ PARKING_MAX_CAPACITY
+Return:			true if succeed, false if a car is parking at a position which would be removed
+*/
+bool SetParkingCapacity(UINT Capacity) {
+	vector<UINT>	Sessions(ParkedCars.GetSessions());
+
+	for (UINT i = 0; i < Sessions.size(); i++) {
+		if (LogFile->FileContent.LogData[Sessions[i]].CarPos >= Capacity)
+			return false;
+	}
+	LogFile->FileContent.Capacity = Capacity;
+	ResetParkedCars(Sessions);
+	return true;
+}
+
 /*
 Description:	Returns pointer of LogFile
 */
@@ -2043,15 +2150,140 @@ void* GetLogFilePtr() {
 	return LogFile.get();
 }
 
+/*
+Description:	Archive the closed sessions of the log file without showing the main window
+Args:			Password: The password to the log file
+				HotDays: No. of days closed sessions stay in the log file
+Return:			0 if succeed, 1 if the log file can't be opened, 2 if the compaction failed
+*/
+int CompactLogFile(wchar_t *Password, int HotDays) {
+	IceEncryptedFile	File(L"Log.dat");
+
+	File.ArchiveHotDays = (UINT)max(HotDays, 0);
+	if (File.WithoutFile || File.CreatedNewFile || !File.ReadFile(Password))
+		return 1;
+	File.FinishCompaction(true);											//Started by ReadFile()
+	return File.CompactionFailed ? 2 : 0;
+}
+
+/*
+Description:	Parse a date option such as "/from:2017-03-01"
+Args:			Text: Text after the colon
+				Time: Variable to receive the beginning of the day, see IceToEpoch()
+Return:			true if succeed, false otherwise
+*/
+bool ParseDateOption(const wchar_t *Text, LONGLONG &Time) {
+	SYSTEMTIME	stDate = {};
+
+	if (swscanf_s(Text, L"%hu-%hu-%hu", &stDate.wYear, &stDate.wMonth, &stDate.wDay) != 3 ||
+		stDate.wMonth < 1 || stDate.wMonth > 12 || stDate.wDay < 1 || stDate.wDay > 31)
+		return false;
+	Time = IceToEpoch(stDate);
+	return true;
+}
+
+/*
+Description:	Export the records of the log file without showing the main window
+Args:			Password: The password to the log file
+				Path: Path of the output file
+				Argc: No. of options
+				Argv: Options: /csv, /ndjson, /open, /closed, /from:YYYY-MM-DD, /to:YYYY-MM-DD, /threads:N
+Return:			0 if succeed, 1 if the log file can't be opened, 2 if the export failed, 3 if an option is invalid
+*/
+int ExportLogFile(wchar_t *Password, wchar_t *Path, int Argc, LPWSTR *Argv) {
+	ExportOptions	Options = { EXPORT_CSV, 0, MAXLONGLONG, EXPORT_ALL, 1 };
+
+	for (int i = 0; i < Argc; i++) {
+		if (!lstrcmpiW(Argv[i], L"/csv"))
+			Options.Format = EXPORT_CSV;
+		else if (!lstrcmpiW(Argv[i], L"/ndjson"))
+			Options.Format = EXPORT_NDJSON;
+		else if (!lstrcmpiW(Argv[i], L"/open"))
+			Options.Status = EXPORT_OPEN;
+		else if (!lstrcmpiW(Argv[i], L"/closed"))
+			Options.Status = EXPORT_CLOSED;
+		else if (!_wcsnicmp(Argv[i], L"/from:", 6)) {
+			if (!ParseDateOption(Argv[i] + 6, Options.From))
+				return 3;
+		}
+		else if (!_wcsnicmp(Argv[i], L"/to:", 4)) {
+			if (!ParseDateOption(Argv[i] + 4, Options.To))
+				return 3;
+			Options.To += SECONDS_PER_DAY - 1;										//The whole day is included
+		}
+		else if (!_wcsnicmp(Argv[i], L"/threads:", 9))
+			Options.Threads = (UINT)max(_wtoi(Argv[i] + 9), 0);					//0 = one per processor
+		else
+			return 3;
+	}
+
+	IceEncryptedFile	File(L"Log.dat");
+	if (File.WithoutFile || File.CreatedNewFile || !File.ReadFile(Password))
+		return 1;
+	return File.ExportRecords(Path, Options) ? 0 : 2;
+}
+
+/*
+Description:	Import the records of a CSV file into the log file without showing the main window
+Args:			Password: The password to the log file
+				Path: Path of the CSV file, see IceEncryptedFile::ImportRecords()
+				Argc: No. of options
+				Argv: Options: /threads:N
+Return:			0 if succeed, 1 if the log file can't be opened, 2 if the import failed, 3 if an option is invalid,
+				4 if some lines are rejected (the valid records are imported)
+*/
+int ImportLogFile(wchar_t *Password, wchar_t *Path, int Argc, LPWSTR *Argv) {
+	UINT			Threads = 0;													//One per processor
+	ImportResult	Result;
+
+	for (int i = 0; i < Argc; i++) {
+		if (!_wcsnicmp(Argv[i], L"/threads:", 9))
+			Threads = (UINT)max(_wtoi(Argv[i] + 9), 0);
+		else
+			return 3;
+	}
+
+	IceEncryptedFile	File(L"Log.dat");
+	if (File.WithoutFile || File.CreatedNewFile || !File.ReadFile(Password))
+		return 1;
+	if (!File.ImportRecords(Path, Threads, &Result))
+		return 2;
+	return Result.Rejected ? 4 : 0;
+}
+
 /*
 Description:    The entry point of the program
 Args:           All parameters are unused
 Return:         Result of DialogBox
 */
 int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow) {
+	int		Argc;
+	LPWSTR	*Argv = CommandLineToArgvW(GetCommandLineW(), &Argc);
+
 	//Record program instance
 	RecordProgramInstance(hInstance);
 
+	//"ParkingSystem.exe /compact <password> [days]" archives the log file and exits, e.g. from a scheduled task
+	if (Argv && Argc >= 3 && !lstrcmpiW(Argv[1], L"/compact")) {
+		int	Result = CompactLogFile(Argv[2], Argc >= 4 ? _wtoi(Argv[3]) : ARCHIVE_HOT_DAYS);
+		LocalFree(Argv);
+		return Result;
+	}
+	//"ParkingSystem.exe /export <password> <file> [options]" exports the records and exits, see ExportLogFile()
+	if (Argv && Argc >= 4 && !lstrcmpiW(Argv[1], L"/export")) {
+		int	Result = ExportLogFile(Argv[2], Argv[3], Argc - 4, Argv + 4);
+		LocalFree(Argv);
+		return Result;
+	}
+	//"ParkingSystem.exe /import <password> <file> [/threads:N]" imports the records of a CSV file and exits
+	if (Argv && Argc >= 4 && !lstrcmpiW(Argv[1], L"/import")) {
+		int	Result = ImportLogFile(Argv[2], Argv[3], Argc - 4, Argv + 4);
+		LocalFree(Argv);
+		return Result;
+	}
+	if (Argv)
+		LocalFree(Argv);
+
 	//Create the main window and pass MainWindow_Create() to the lParam of its WM_INITDIALOG message
 	return DialogBoxParam(hInstance, MAKEINTRESOURCE(IDD_MAINWINDOW), NULL,
 		MainWindowProc, (LPARAM)MainWindow_Create);
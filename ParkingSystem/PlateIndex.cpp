@@ -0,0 +1,139 @@
+/*
+Description:    Hash index from car numbers to the records of the parking cars. The gate looks a car
+                number up once per button press, which takes the same time however many cars are parking
+Author:         Hanson
+File:           PlateIndex.cpp
+*/
+
+#include "FileManager.h"
+
+/*
+Description:    Get the first slot to probe for a car number (Fibonacci hashing)
+Args:			CarNumber: The packed car number
+Return:			Index of the slot
+*/
+size_t IcePlateIndex::Home(ULONGLONG CarNumber) const {
+	return (size_t)((CarNumber * 0x9E3779B97F4A7C15ull) >> Shift);
+}
+
+/*
+Description:    Rebuild the index from the records of the parking cars, e.g. after logging in
+Args:			LogData: The records
+				Sessions: Indices of the records of the parking cars, see IceEncryptedFile::OpenSessions
+*/
+void IcePlateIndex::Build(const IceRecordStore &LogData, const vector<UINT> &Sessions) {
+	size_t	SlotCount = PLATE_INDEX_MIN;
+
+	while (SlotCount < Sessions.size() * 2)														//At most half of the slots are used
+		SlotCount *= 2;
+	Slots.clear();
+	Count = 0;
+	Resize(SlotCount);
+	for (UINT i = 0; i < Sessions.size(); i++)
+		Insert(LogData[Sessions[i]].CarNumber, Sessions[i]);
+}
+
+/*
+Description:    Find the record of a parking car
+Args:			CarNumber: The packed car number
+				Index: Variable to receive the index of the record
+Return:			true if the car is parking, false otherwise
+*/
+bool IcePlateIndex::Find(ULONGLONG CarNumber, UINT &Index) const {
+	if (Slots.empty() || CarNumber == 0)
+		return false;
+
+	size_t	Mask = Slots.size() - 1;
+	for (size_t i = Home(CarNumber); Slots[i].CarNumber; i = (i + 1) & Mask) {				//An empty slot ends the probe sequence
+		if (Slots[i].CarNumber == CarNumber) {
+			Index = Slots[i].Index;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+Description:    Add a parking car, or replace the record of a car in the index
+Args:			CarNumber: The packed car number. Car numbers which can't be packed (0) are not indexed
+				Index: Index of the record
+*/
+void IcePlateIndex::Insert(ULONGLONG CarNumber, UINT Index) {
+	if (CarNumber == 0)
+		return;
+	if ((Count + 1) * 2 > Slots.size())
+		Resize(max(Slots.size() * 2, PLATE_INDEX_MIN));
+
+	size_t	Mask = Slots.size() - 1, i = Home(CarNumber);
+	for (; Slots[i].CarNumber; i = (i + 1) & Mask) {
+		if (Slots[i].CarNumber == CarNumber) {
+			Slots[i].Index = Index;
+			return;
+		}
+	}
+	Slots[i].CarNumber = CarNumber;
+	Slots[i].Index = Index;
+	Count++;
+}
+
+/*
+Description:    Remove a car which left
+Args:			CarNumber: The packed car number
+Return:			true if the car was in the index, false otherwise
+*/
+bool IcePlateIndex::Remove(ULONGLONG CarNumber) {
+	if (Slots.empty() || CarNumber == 0)
+		return false;
+
+	size_t	Mask = Slots.size() - 1, i = Home(CarNumber);
+	for (; Slots[i].CarNumber != CarNumber; i = (i + 1) & Mask) {
+		if (!Slots[i].CarNumber)																	//Not found
+			return false;
+	}
+
+	//Shift the following slots of the probe sequence back, unless it would move them before their home slots
+	for (size_t j = (i + 1) & Mask; Slots[j].CarNumber; j = (j + 1) & Mask) {
+		size_t	Distance = (j - Home(Slots[j].CarNumber)) & Mask;									//Distance of slot j from its home
+		if (Distance >= ((j - i) & Mask)) {
+			Slots[i] = Slots[j];
+			i = j;
+		}
+	}
+	Slots[i].CarNumber = 0;
+	Count--;
+	return true;
+}
+
+/*
+Description:    Remove all cars
+*/
+void IcePlateIndex::Clear() {
+	Slots.clear();
+	Count = 0;
+	Shift = 64;
+}
+
+/*
+Description:    Get the no. of cars in the index
+Return:			The no. of cars
+*/
+size_t IcePlateIndex::Size() const {
+	return Count;
+}
+
+/*
+Description:    Change the no. of slots and insert the cars again
+Args:			SlotCount: New no. of slots, a power of 2
+*/
+void IcePlateIndex::Resize(size_t SlotCount) {
+	vector<PlateSlot>	Old(SlotCount);
+
+	Old.swap(Slots);
+	for (Shift = 64; SlotCount > 1; SlotCount /= 2)
+		Shift--;
+	Count = 0;
+	for (size_t i = 0; i < Old.size(); i++) {
+		if (Old[i].CarNumber)
+			Insert(Old[i].CarNumber, Old[i].Index);
+	}
+}
\ No newline at end of file
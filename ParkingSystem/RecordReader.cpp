@@ -0,0 +1,251 @@
+/*
+Description:    Streaming reader of record files and archived segments. Only one chunk of records is kept in
+                memory at a time, so exporters, reports and tools can process logs of any size with a fixed memory budget
+Author:         Hanson
+File:           RecordReader.cpp
+*/
+
+#include "FileManager.h"
+
+/*
+Description:    Constructor of record reader class
+Args:			BufferSize: Size of the chunk buffer in bytes, which is the memory used for the records
+*/
+IceRecordReader::IceRecordReader(size_t BufferSize) {
+	Buffer.resize(max(BufferSize / sizeof(LogInfo), (size_t)1));
+}
+
+/*
+Description:    Destructor of record reader class
+*/
+IceRecordReader::~IceRecordReader() {
+	Close();
+}
+
+/*
+Description:    Open a record file or an archived segment and check the password. Nothing but the header (and the
+				block index of a segment) is read
+Args:			Path: Path of the file
+				Password: The password
+				From: Beginning of the period of time. Blocks of a segment outside the period are skipped, the
+					  records of other files are all read
+				To: End of the period
+Return:			true if succeed, false otherwise
+*/
+bool IceRecordReader::Open(const wstring &Path, const wchar_t *Password, LONGLONG From, LONGLONG To) {
+	BYTE			Header[CHECK_BLOCK_SIZE];													//The header, or the block taken by it
+	DWORD			Signature[2];															//Magic + version
+	DWORD			Read;
+	LARGE_INTEGER	szFile;																	//File size
+	int				HeaderSize;
+
+	Close();
+	hFile = CreateFileW(Path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+		NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)															//Failed to open the file
+		return false;
+	if (!GetFileSizeEx(hFile, &szFile) ||
+		!::ReadFile(hFile, Signature, sizeof(Signature), &Read, NULL) || Read != sizeof(Signature)) {
+		Close();
+		return false;
+	}
+	PeriodStart = From;
+	PeriodEnd = To;
+	FileSize = szFile.QuadPart;
+	Position = 0;
+	Failed = false;
+	History = Signature[0] == HISTORY_MAGIC;
+	if (History) {																				//Archived segment, read block by block
+		if (!IceExpandKey(Password, Schedule) || !OpenHistory(Signature, Password)) {
+			Close();
+			return false;
+		}
+		return true;
+	}
+	if ((HeaderSize = IceRecordHeaderSpan(Signature[1])) == 0) {								//Unknown format
+		Close();
+		return false;
+	}
+	Version = Signature[1];
+	memcpy(Header, Signature, sizeof(Signature));
+	if (!::ReadFile(hFile, Header + FILE_PLAIN_SIZE, HeaderSize - FILE_PLAIN_SIZE, &Read, NULL) ||
+		Read != HeaderSize - FILE_PLAIN_SIZE) {
+		Close();
+		return false;
+	}
+
+	//Decrypt the header and check if the decrypted password matches with the provided password
+	if (!IceExpandKey(Password, Schedule) || !IceOpenRecordHeader(Header, Schedule) ||
+		!IceParseRecordHeader(Header, Password, ElementCount, FeePerHour) ||
+		IceRecordOffset(Version, ElementCount) > szFile.QuadPart) {									//Wrong password or damaged file
+		Close();
+		return false;
+	}
+	if (Version == LOG_VERSION) {																//Records start at the block after the header
+		LARGE_INTEGER	Offset;
+		Offset.QuadPart = CHECK_BLOCK_SIZE;
+		if (!SetFilePointerEx(hFile, Offset, NULL, FILE_BEGIN)) {
+			Close();
+			return false;
+		}
+		if (Buffer.size() < CHECK_BLOCK_SIZE / sizeof(LogInfo))										//Room for a whole block at least
+			Buffer.resize(CHECK_BLOCK_SIZE / sizeof(LogInfo));
+	}
+	return true;
+}
+
+/*
+Description:    Read the header and the block index of an archived segment, see IceWriteHistoryFile()
+Args:			Signature: Magic and version read from the file
+				Password: The password
+Return:			true if succeed, false if the format is unknown, the password is wrong or the file is damaged
+*/
+bool IceRecordReader::OpenHistory(const DWORD *Signature, const wchar_t *Password) {
+	BYTE			Header[HISTORY_HEADER_SIZE + CIPHER_SEAL];
+	vector<BYTE>	Index;
+	DWORD			Read;
+	UINT			Count, BlockCount;
+	int				Seal = IceSealSize(Schedule);
+	LONGLONG		IndexOffset = HISTORY_HEADER_SIZE + Seal;									//Position of the block index
+
+	if (Signature[1] != HISTORY_VERSION)
+		return false;
+	memcpy(Header, Signature, FILE_PLAIN_SIZE);
+	if (!::ReadFile(hFile, Header + FILE_PLAIN_SIZE, (DWORD)(IndexOffset - FILE_PLAIN_SIZE), &Read, NULL) ||
+		Read != (DWORD)(IndexOffset - FILE_PLAIN_SIZE) ||
+		!IceOpenBlock(Header + FILE_PLAIN_SIZE, Header + FILE_PLAIN_SIZE, HISTORY_HEADER_SIZE - FILE_PLAIN_SIZE, Schedule, FILE_PLAIN_SIZE))
+		return false;
+	if (lstrcmpW((wchar_t*)(Header + FILE_PLAIN_SIZE), Password))								//Wrong password
+		return false;
+	memcpy(&Count, Header + FILE_PLAIN_SIZE + sizeof(wchar_t) * 20, sizeof(UINT));				//Element count
+	memcpy(&BlockCount, Header + FILE_PLAIN_SIZE + sizeof(wchar_t) * 20 + sizeof(UINT), sizeof(UINT));	//Block count
+	if (FileSize < IndexOffset + Seal ||
+		BlockCount > (ULONGLONG)(FileSize - IndexOffset - Seal) / sizeof(HistoryBlockInfo))		//Damaged file. Checked before the size of the index
+		return false;																				//is calculated, which may overflow
+	Index.resize(sizeof(HistoryBlockInfo) * BlockCount + Seal);
+	if (!::ReadFile(hFile, Index.data(), (DWORD)Index.size(), &Read, NULL) || Read != Index.size() ||
+		!IceOpenBlock(Index.data(), Index.data(), sizeof(HistoryBlockInfo) * BlockCount, Schedule, IndexOffset))
+		return false;
+	Blocks.resize(BlockCount);
+	memcpy(Blocks.data(), Index.data(), sizeof(HistoryBlockInfo) * BlockCount);
+	ElementCount = Count;
+	FeePerHour = 0;
+	NextBlock = 0;
+	if (Buffer.size() < HISTORY_BLOCK_RECORDS)													//Room for a whole block at least
+		Buffer.resize(HISTORY_BLOCK_RECORDS);
+	return true;
+}
+
+/*
+Description:    Read and decrypt the next chunk of records. The records stay valid until the next call.
+				Blocks of checksummed files are verified, and a block failing the checksum stops the reader
+Args:			Records: Variable to receive the first record of the chunk
+				Count: Variable to receive the number of records of the chunk
+Return:			true if a chunk is read, false if all records are read or an error occurred (see Failed)
+*/
+bool IceRecordReader::Next(const LogInfo *&Records, UINT &Count) {
+	DWORD	Read, Length;
+	UINT	Blocks = 0;
+
+	Count = 0;
+	if (hFile == INVALID_HANDLE_VALUE || Failed)
+		return false;
+	if (History)
+		return NextHistory(Records, Count);
+	if (Position >= ElementCount)																//Nothing left
+		return false;
+
+	if (Version == LOG_VERSION) {																//Whole blocks, each takes the space of 128 records
+		Blocks = (UINT)min((ElementCount - Position + CHECK_BLOCK_RECORDS - 1) / CHECK_BLOCK_RECORDS,
+			(ULONGLONG)(Buffer.size() * sizeof(LogInfo) / CHECK_BLOCK_SIZE));
+		Length = CHECK_BLOCK_SIZE * Blocks;
+	}
+	else {
+		Count = (UINT)min(ElementCount - Position, (ULONGLONG)Buffer.size());
+		Length = (DWORD)(sizeof(LogInfo) * Count);
+	}
+	if (!::ReadFile(hFile, Buffer.data(), Length, &Read, NULL) || Read != Length) {			//File truncated while reading
+		Count = 0;
+		Failed = true;
+		return false;
+	}
+	if (Version != LOG_VERSION)
+		IceCryptBlock((BYTE*)Buffer.data(), (BYTE*)Buffer.data(), Length, Schedule,
+			IceRecordOffset(Version, Position));													//Decrypt the chunk with its position in the file
+
+	//Decrypt and verify the blocks, and move their records together
+	for (UINT i = 0; i < Blocks; i++) {
+		BYTE		*Block = (BYTE*)Buffer.data() + CHECK_BLOCK_SIZE * i;
+		UINT		BlockCount = (UINT)min(ElementCount - Position - Count, (ULONGLONG)CHECK_BLOCK_RECORDS);
+		DWORD		Checksum;
+		bool		Opened = IceOpenBlock(Block, Block, CHECK_BLOCK_SIZE - IceSealSize(Schedule), Schedule,
+			IceRecordOffset(Version, Position) + CHECK_BLOCK_SIZE * i);								//A sealed block is checked as a whole
+		memcpy(&Checksum, Block + sizeof(LogInfo) * CHECK_BLOCK_RECORDS, sizeof(DWORD));
+		if (!Opened || IceCrc32c(Block, sizeof(LogInfo) * BlockCount) != Checksum) {				//Torn or corrupted block
+			Count = 0;
+			Failed = true;
+			return false;
+		}
+		memmove(Buffer.data() + Count, Block, sizeof(LogInfo) * BlockCount);
+		Count += BlockCount;
+	}
+	Records = Buffer.data();
+	Position += Count;
+	return true;
+}
+
+/*
+Description:    Read and decompress the next blocks of an archived segment which overlap the period, as many as the
+				buffer holds. Every block is checked with its checksum, and a damaged block stops the reader
+Args:			Records: Variable to receive the first record of the chunk
+				Count: Variable to receive the number of records of the chunk
+Return:			true if a chunk is read, false if all blocks are read or an error occurred (see Failed)
+*/
+bool IceRecordReader::NextHistory(const LogInfo *&Records, UINT &Count) {
+	int			Seal = IceSealSize(Schedule);
+	LONGLONG	IndexOffset = HISTORY_HEADER_SIZE + Seal;
+
+	for (; NextBlock < Blocks.size(); NextBlock++) {
+		const HistoryBlockInfo	&Info = Blocks[NextBlock];
+		LARGE_INTEGER			Offset;
+		DWORD					Read;
+
+		if (Info.FirstTime > PeriodEnd || Info.LastTime < PeriodStart || Info.RecordCount == 0) {				//Skip the block
+			Position += Info.RecordCount;
+			continue;
+		}
+		if (Count + Info.RecordCount > Buffer.size())												//The buffer is full
+			break;
+
+		bool	Result = Info.Offset >= IndexOffset && Info.Offset + Info.Size + Seal <= FileSize &&
+			Info.RecordCount <= HISTORY_BLOCK_RECORDS;
+		if (Result) {
+			Block.resize(Info.Size + Seal);
+			Offset.QuadPart = Info.Offset;
+			Result = SetFilePointerEx(hFile, Offset, NULL, FILE_BEGIN) &&
+				::ReadFile(hFile, Block.data(), (DWORD)Block.size(), &Read, NULL) && Read == Block.size() &&
+				IceOpenBlock(Block.data(), Block.data(), Info.Size, Schedule, Info.Offset) &&
+				IceDecodeHistoryBlock(Block.data(), Info.Size, Info.RecordCount, Buffer.data() + Count) &&
+				IceChecksum((BYTE*)(Buffer.data() + Count), (streamoff)sizeof(LogInfo) * Info.RecordCount) == Info.Checksum;
+		}
+		if (!Result) {																				//Damaged block
+			Count = 0;
+			Failed = true;
+			return false;
+		}
+		Count += Info.RecordCount;
+		Position += Info.RecordCount;
+	}
+	Records = Buffer.data();
+	return Count > 0;
+}
+
+/*
+Description:    Close the file
+*/
+void IceRecordReader::Close() {
+	if (hFile != INVALID_HANDLE_VALUE) {
+		CloseHandle(hFile);
+		hFile = INVALID_HANDLE_VALUE;
+	}
+}
\ No newline at end of file
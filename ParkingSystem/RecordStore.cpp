@@ -0,0 +1,109 @@
+/*
+Description:    Store the records of the log file in fixed-size chunks. A new chunk is allocated when the
+                last one is full, and the records already stored are never copied or moved
+Author:         Hanson
+File:           RecordStore.cpp
+*/
+
+#include "FileManager.h"
+
+/*
+Description:    Access a record
+Args:			Index: Index of the record, less than Size()
+Return:			The record
+*/
+LogInfo &IceRecordStore::operator[](size_t Index) {
+	return Chunks[Index / RECORD_CHUNK_RECORDS][Index % RECORD_CHUNK_RECORDS];
+}
+
+/*
+Description:    Access a record
+Args:			Index: Index of the record, less than Size()
+Return:			The record
+*/
+const LogInfo &IceRecordStore::operator[](size_t Index) const {
+	return Chunks[Index / RECORD_CHUNK_RECORDS][Index % RECORD_CHUNK_RECORDS];
+}
+
+/*
+Description:    Get the no. of records
+Return:			The no. of records
+*/
+size_t IceRecordStore::Size() const {
+	return Count;
+}
+
+/*
+Description:    Add a record to the end
+Args:			Info: The record
+*/
+void IceRecordStore::Append(const LogInfo &Info) {
+	if (Count == Chunks.size() * RECORD_CHUNK_RECORDS)											//The last chunk is full
+		Chunks.push_back(unique_ptr<LogInfo[]>(new LogInfo[RECORD_CHUNK_RECORDS]));
+	Chunks[Count / RECORD_CHUNK_RECORDS][Count % RECORD_CHUNK_RECORDS] = Info;
+	Count++;
+}
+
+/*
+Description:    Change the no. of records. Added records are zeroed, and chunks no longer used are freed
+Args:			Count: The new no. of records
+*/
+void IceRecordStore::Resize(size_t Count) {
+	size_t	ChunkCount = (Count + RECORD_CHUNK_RECORDS - 1) / RECORD_CHUNK_RECORDS;
+
+	for (size_t i = this->Count; i < Count && i < Chunks.size() * RECORD_CHUNK_RECORDS; i++)	//Zero the unused records of the last chunk
+		(*this)[i] = LogInfo();
+	while (Chunks.size() < ChunkCount)
+		Chunks.push_back(unique_ptr<LogInfo[]>(new LogInfo[RECORD_CHUNK_RECORDS]()));
+	Chunks.resize(ChunkCount);
+	this->Count = Count;
+}
+
+/*
+Description:    Replace the records with copies of the records of a vector
+Args:			Records: The records
+*/
+void IceRecordStore::Assign(const vector<LogInfo> &Records) {
+	Resize(0);
+	Resize(Records.size());
+	for (size_t i = 0; i < Records.size(); i += RECORD_CHUNK_RECORDS)							//A chunk at a time
+		memcpy(Chunks[i / RECORD_CHUNK_RECORDS].get(), Records.data() + i, sizeof(LogInfo) * min(Records.size() - i, RECORD_CHUNK_RECORDS));
+}
+
+/*
+Description:    Get the records stored one after another from a record on, up to the end of its chunk
+Args:			Index: Index of the first record, less than Size()
+				Count: Variable to receive the no. of records
+Return:			Pointer to the first record
+*/
+const LogInfo *IceRecordStore::GetRun(size_t Index, size_t &Count) const {
+	Count = min(this->Count - Index, RECORD_CHUNK_RECORDS - Index % RECORD_CHUNK_RECORDS);
+	return &(*this)[Index];
+}
+
+/*
+Description:    Remove all records and free the chunks
+*/
+void IceRecordStore::Clear() {
+	Chunks.clear();
+	Count = 0;
+}
+
+/*
+Description:    Exchange the records with another store
+Args:			Other: The other store
+*/
+void IceRecordStore::Swap(IceRecordStore &Other) {
+	Chunks.swap(Other.Chunks);
+	swap(Count, Other.Count);
+}
+
+/*
+Description:    Free the chunks holding only records before a record, when the records are being moved to another
+				store. The records of the freed chunks can't be accessed any more, and the no. of records doesn't change
+Args:			Index: Index of the record
+*/
+void IceRecordStore::ReleaseBefore(size_t Index) {
+	for (size_t i = 0; i < Index / RECORD_CHUNK_RECORDS && i < Chunks.size(); i++)
+		Chunks[i].reset();
+}
\ No newline at end of file
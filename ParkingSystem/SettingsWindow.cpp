@@ -11,6 +11,8 @@ shared_ptr<IceEdit>				edCurrPassword;
 shared_ptr<IceEdit>				edNewPassword;
 shared_ptr<IceEdit>				edConfirmPassword;
 shared_ptr<IceEdit>				edFeePerHour;
+shared_ptr<IceEdit>				edCapacity;
+shared_ptr<IceCheckBox>			chkStrongCipher;
 shared_ptr<IceButton>			cmdOK;
 shared_ptr<IceButton>			cmdCancel;
 IceEncryptedFile				*LogFile;
@@ -24,6 +26,13 @@ void cmdCancel_Click() {
 	DestroyWindow(SettingsWindowHandle);											//Close the window
 }
 
+/*
+Description:	To handle strong cipher checkbox clicked event
+*/
+void chkStrongCipher_Click() {
+	SetFocus(edCurrPassword->hWnd);													//The current password is needed to change the encryption
+}
+
 /*
 Description:	To handle OK button clicked event
 */
@@ -31,13 +40,28 @@ void cmdOK_Click() {
 	wchar_t	PasswordBuffer[20];														//Buffer to store new password and current password
 	wchar_t ConfirmPasswordBuffer[20];												//Buffer to store confirm password
 	wchar_t	FeeBuffer[10];															//Buffer to store fee string
+	wchar_t	CapacityBuffer[10];														//Buffer to store no. of parking positions
 	float	NewFee;																	//New fee
+	UINT	NewCapacity;															//New no. of parking positions
+	bool	PasswordChanged = false;												//If the user wants to change the password
+	bool	StrongCipher = chkStrongCipher->GetChecked();							//If the user wants the files encrypted with AES
 
 	edCurrPassword->GetText(PasswordBuffer);										//Get entered current password
+	if (StrongCipher != LogFile->StrongCipher && lstrlenW(PasswordBuffer) == 0) {	//Changing the encryption needs the current password too
+		MessageBox(SettingsWindowHandle, L"You must enter the current password to change the encryption!",
+			L"Failed to Change Encryption", MB_ICONEXCLAMATION);
+		SetFocus(edCurrPassword->hWnd);
+		return;
+	}
 	if (lstrlenW(PasswordBuffer) != 0) {											//If user entered current password, it means the user wants to change the password
 		if (!lstrcmpW(PasswordBuffer, LogFile->FileContent.Password)) {					//Password match
 			edNewPassword->GetText(PasswordBuffer);
 			edConfirmPassword->GetText(ConfirmPasswordBuffer);
+			if (lstrlenW(PasswordBuffer) <= 0 && lstrlenW(ConfirmPasswordBuffer) <= 0 &&
+				StrongCipher != LogFile->StrongCipher) {									//Only the encryption is changed, keep the current password
+				edCurrPassword->GetText(PasswordBuffer);
+				lstrcpyW(ConfirmPasswordBuffer, PasswordBuffer);
+			}
 			if (lstrlenW(PasswordBuffer) <= 0) {											//The user didn't enter a new password
 				MessageBox(SettingsWindowHandle, L"You must enter a new password!",
 					L"Failed to Change Password", MB_ICONEXCLAMATION);
@@ -45,7 +69,7 @@ void cmdOK_Click() {
 				return;
 			}
 			if (!lstrcmpW(PasswordBuffer, ConfirmPasswordBuffer)) {							//New password equals confirm password
-				lstrcpyW(LogFile->FileContent.Password, PasswordBuffer);						//Store the new password
+				PasswordChanged = true;															//Store the new password after all settings are checked
 			}
 			else {
 				MessageBox(SettingsWindowHandle, L"New password and confirm password are not the same!",
@@ -75,7 +99,23 @@ void cmdOK_Click() {
 		SetFocus(edFeePerHour->hWnd);
 		return;
 	}
-	if (!LogFile->SaveFile()) {														//Save data file
+	edCapacity->GetText(CapacityBuffer);											//Get entered no. of parking positions
+	NewCapacity = wcstoul(CapacityBuffer, NULL, 10);
+	if (NewCapacity < PARKING_MIN_CAPACITY || NewCapacity > PARKING_MAX_CAPACITY) {	//Check if the value is valid
+		MessageBox(SettingsWindowHandle, L"Invalid no. of parking positions! Please enter again.",
+			L"Failed to Change Parking Positions", MB_ICONEXCLAMATION);
+		SendMessage(edCapacity->hWnd, EM_SETSEL, 0, -1);								//Select all text in the textbox
+		SetFocus(edCapacity->hWnd);
+		return;
+	}
+	if (!SetParkingCapacity(NewCapacity)) {											//Positions with parking cars can't be removed
+		MessageBox(SettingsWindowHandle, L"Some cars are parking at the positions to be removed! Please enter again.",
+			L"Failed to Change Parking Positions", MB_ICONEXCLAMATION);
+		SendMessage(edCapacity->hWnd, EM_SETSEL, 0, -1);								//Select all text in the textbox
+		SetFocus(edCapacity->hWnd);
+		return;
+	}
+	if (!(PasswordChanged ? LogFile->ChangePassword(PasswordBuffer, StrongCipher) : LogFile->SaveFile())) {	//Save data file (and archived segments if the password is changed)
 		MessageBox(SettingsWindowHandle, L"Settings applied, but failed saving settings to \"Log.dat\"! Please check if the file can be accessed.",
 			L"Failed to Save Settings", MB_ICONERROR);
 	}
@@ -107,6 +147,11 @@ bool Editbox_KeyPressed(int Key, int hMenu) {
 			break;
 
 		case IDC_FEEPERHOUREDIT:													//Fee per hour edit
+			SendMessage(edCapacity->hWnd, EM_SETSEL, 0, -1);
+			SetFocus(edCapacity->hWnd);
+			break;
+
+		case IDC_CAPACITYEDIT:														//Parking positions edit
 			cmdOK_Click();
 			break;
 		}
@@ -141,13 +186,17 @@ void SettingsWindow_Create(HWND hWnd) {
 	edNewPassword = make_shared<IceEdit>(hWnd, IDC_NEWPASSWORDEDIT, SettingsWindowEditBoxWndProc);
 	edConfirmPassword = make_shared<IceEdit>(hWnd, IDC_CONFIRMPASSWORDEDIT, SettingsWindowEditBoxWndProc);
 	edFeePerHour = make_shared<IceEdit>(hWnd, IDC_FEEPERHOUREDIT, SettingsWindowEditBoxWndProc);
+	edCapacity = make_shared<IceEdit>(hWnd, IDC_CAPACITYEDIT, SettingsWindowEditBoxWndProc);
+	chkStrongCipher = make_shared<IceCheckBox>(hWnd, IDC_STRONGCIPHERCHECKBOX, chkStrongCipher_Click);
 	cmdOK = make_shared<IceButton>(hWnd, IDC_OKBUTTON, cmdOK_Click);
 	cmdCancel = make_shared<IceButton>(hWnd, IDC_CANCELBUTTON, cmdCancel_Click);
 
 	//Set control properties
 	wchar_t	FeeStr[10];														//Buffer to store converted fee value
+	wchar_t	CapacityStr[10];												//Buffer to store converted no. of parking positions
 	
 	SendMessage(edFeePerHour->hWnd, EM_SETLIMITTEXT, 8, 0);					//Max length of fee per hour editbox
+	SendMessage(edCapacity->hWnd, EM_SETLIMITTEXT, 7, 0);					//Max length of parking positions editbox
 	SendMessage(edCurrPassword->hWnd, EM_SETLIMITTEXT, 20, 0);				//Max length of password editboxes
 	SendMessage(edNewPassword->hWnd, EM_SETLIMITTEXT, 20, 0);
 	SendMessage(edConfirmPassword->hWnd, EM_SETLIMITTEXT, 20, 0);
@@ -155,4 +204,7 @@ void SettingsWindow_Create(HWND hWnd) {
 	LogFile = (IceEncryptedFile*)GetLogFilePtr();							//Get a pointer to LogFile
 	swprintf_s(FeeStr, L"%.2f", LogFile->FileContent.FeePerHour);			//Get fee per hour
 	edFeePerHour->SetText(FeeStr);
+	swprintf_s(CapacityStr, L"%u", LogFile->FileContent.Capacity);			//Get no. of parking positions
+	edCapacity->SetText(CapacityStr);
+	SendMessage(chkStrongCipher->hWnd, BM_SETCHECK, LogFile->StrongCipher ? BST_CHECKED : BST_UNCHECKED, 0);
 }
\ No newline at end of file